@@ -0,0 +1,114 @@
+// Walks the event id allocator through a few plugin loads and unloads and
+// checks that ranges given back by unloaded plugins are merged with their
+// free neighbours and handed out again before new ids are taken.
+//
+//   event_id_ranges
+//
+// Instead of loading real plugins, the reservations are attributed to made
+// up plugin handles, the same way fake_unity_load_native_plugin does it
+// while UnityPluginLoad runs. Uses the null renderer, so it runs without a
+// gpu or a vulkan loader.
+
+#include "IUnityProfiler.h" // includes IUnityInterface.h
+#include "IUnityGraphics.h"
+#define VK_NO_PROTOTYPES
+#include "IUnityGraphicsVulkan.h" // includes vulkan/vulkan.h
+
+#define FAKE_UNITY_IMPLEMENTATION
+#include "fake_unity.h"
+
+static int32_t error_count;
+
+static void
+check_value(const char *what, int64_t value, int64_t expected)
+{
+    if (value != expected)
+    {
+        fprintf(stderr, "%s is %lld, expected %lld.\n", what, (long long) value, (long long) expected);
+        error_count += 1;
+    }
+}
+
+static int
+reserve(IUnityGraphics *graphics, uint32_t plugin_handle, int count)
+{
+    __fake_unity_loading_plugin = plugin_handle;
+    int first = graphics->ReserveEventIDRange(count);
+    __fake_unity_loading_plugin = 0;
+
+    return first;
+}
+
+static void
+check_free_ranges(FakeUnityPluginEvents *events, const char *what, uint32_t first, uint32_t count)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "free range count %s", what);
+    check_value(name, events->free_ranges.count, 1);
+
+    if (events->free_ranges.count == 1)
+    {
+        snprintf(name, sizeof(name), "free range first %s", what);
+        check_value(name, events->free_ranges.items[0].first, first);
+        snprintf(name, sizeof(name), "free range size %s", what);
+        check_value(name, events->free_ranges.items[0].count, count);
+    }
+}
+
+int main(void)
+{
+    if (!fake_unity_initialize(8, 8) || !fake_unity_create_null_renderer())
+    {
+        return 1;
+    }
+
+    FakeUnityState *state = __fake_unity_get_state();
+    IUnityGraphics *graphics = &state->unity_graphics;
+    FakeUnityPluginEvents *events = &state->plugin_events;
+
+    const int first_id = FAKE_UNITY_FIRST_RESERVED_EVENT_ID;
+
+    // Three plugins get their ranges one after the other.
+    check_value("first id of plugin 1", reserve(graphics, 1, 16), first_id);
+    check_value("first id of plugin 2", reserve(graphics, 2, 16), first_id + 16);
+    check_value("first id of plugin 3", reserve(graphics, 3, 16), first_id + 32);
+    check_value("owner of an id of plugin 2", fake_unity_plugin_event_get_owner(first_id + 20), 2);
+
+    // The ranges of the first two plugins end up as a single free range.
+    __fake_unity_plugin_events_release(events, 1);
+    __fake_unity_plugin_events_release(events, 2);
+
+    check_free_ranges(events, "after unloading plugin 1 and 2", first_id, 32);
+    check_value("owner of an id of plugin 2 after unloading it", fake_unity_plugin_event_get_owner(first_id + 20), 0);
+
+    // Which is large enough for a range that neither of them would fit in.
+    check_value("first id of plugin 4", reserve(graphics, 4, 24), first_id);
+    check_value("owner of an id of plugin 4", fake_unity_plugin_event_get_owner(first_id + 20), 4);
+    check_free_ranges(events, "after loading plugin 4", first_id + 24, 8);
+
+    // Ranges that don't fit into a free range get new ids.
+    check_value("first id of plugin 5", reserve(graphics, 5, 16), first_id + 48);
+
+    // Ranges are merged with the free ranges on both sides.
+    __fake_unity_plugin_events_release(events, 3);
+    __fake_unity_plugin_events_release(events, 4);
+
+    check_free_ranges(events, "after unloading plugin 3 and 4", first_id, 48);
+
+    // A free range that fits exactly is used up.
+    check_value("first id of plugin 6", reserve(graphics, 6, 48), first_id);
+    check_value("free range count after loading plugin 6", events->free_ranges.count, 0);
+
+    // A reloaded plugin gets the range it had before.
+    __fake_unity_plugin_events_release(events, 5);
+
+    check_value("first id of plugin 5 after reloading it", reserve(graphics, 5, 16), first_id + 48);
+    check_value("free range count after reloading plugin 5", events->free_ranges.count, 0);
+
+    fake_unity_shutdown();
+
+    printf("event id ranges checked, %d errors\n", error_count);
+
+    return (error_count == 0) ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// Creates a texture with a full mip chain for formats of every block shape
+// and checks that every mip level takes exactly the number of bytes its
+// pixels or compressed blocks need, as in Texture2D.SetPixelData.
+//
+//   format_sizes
+//
+// The expected sizes are computed from a table in this file instead of the
+// one in fake_unity.h. Uses the null renderer, so it runs without a gpu or a
+// vulkan loader.
+
+#include "IUnityProfiler.h" // includes IUnityInterface.h
+#include "IUnityGraphics.h"
+#define VK_NO_PROTOTYPES
+#include "IUnityGraphicsVulkan.h" // includes vulkan/vulkan.h
+
+#define FAKE_UNITY_IMPLEMENTATION
+#include "fake_unity.h"
+
+// Not a power of two, so the block counts get rounded up in both directions.
+#define TEXTURE_WIDTH  100
+#define TEXTURE_HEIGHT 60
+
+typedef struct ExpectedFormat
+{
+    const char *name;
+    FakeUnity_TextureFormat format;
+    uint32_t block_width;
+    uint32_t block_height;
+    uint32_t block_size;
+} ExpectedFormat;
+
+static const ExpectedFormat expected_formats[] =
+{
+    { "Alpha8",       FakeUnity_TextureFormat_Alpha8,        1,  1,  1 },
+    { "RGB24",        FakeUnity_TextureFormat_RGB24,         1,  1,  3 },
+    { "RGBA32",       FakeUnity_TextureFormat_RGBA32,        1,  1,  4 },
+    { "RGB565",       FakeUnity_TextureFormat_RGB565,        1,  1,  2 },
+    { "RGB48",        FakeUnity_TextureFormat_RGB48,         1,  1,  6 },
+    { "RGBAHalf",     FakeUnity_TextureFormat_RGBAHalf,      1,  1,  8 },
+    { "RGBAFloat",    FakeUnity_TextureFormat_RGBAFloat,     1,  1, 16 },
+    { "YUY2",         FakeUnity_TextureFormat_YUY2,          2,  1,  4 },
+    { "DXT1",         FakeUnity_TextureFormat_DXT1,          4,  4,  8 },
+    { "DXT5",         FakeUnity_TextureFormat_DXT5,          4,  4, 16 },
+    { "BC4",          FakeUnity_TextureFormat_BC4,           4,  4,  8 },
+    { "BC7",          FakeUnity_TextureFormat_BC7,           4,  4, 16 },
+    { "PVRTC_RGBA2",  FakeUnity_TextureFormat_PVRTC_RGBA2,   8,  4,  8 },
+    { "PVRTC_RGBA4",  FakeUnity_TextureFormat_PVRTC_RGBA4,   4,  4,  8 },
+    { "ETC2_RGB",     FakeUnity_TextureFormat_ETC2_RGB,      4,  4,  8 },
+    { "ETC2_RGBA8",   FakeUnity_TextureFormat_ETC2_RGBA8,    4,  4, 16 },
+    { "EAC_RG",       FakeUnity_TextureFormat_EAC_RG,        4,  4, 16 },
+    { "ASTC_5x5",     FakeUnity_TextureFormat_ASTC_5x5,      5,  5, 16 },
+    { "ASTC_6x6",     FakeUnity_TextureFormat_ASTC_6x6,      6,  6, 16 },
+    { "ASTC_12x12",   FakeUnity_TextureFormat_ASTC_12x12,   12, 12, 16 },
+    { "ASTC_HDR_8x8", FakeUnity_TextureFormat_ASTC_HDR_8x8,  8,  8, 16 },
+};
+
+static int32_t error_count;
+
+static uint64_t
+get_mip_size(const ExpectedFormat *expected, uint32_t mip_level)
+{
+    uint32_t width = TEXTURE_WIDTH >> mip_level;
+    uint32_t height = TEXTURE_HEIGHT >> mip_level;
+
+    width = (width > 0) ? width : 1;
+    height = (height > 0) ? height : 1;
+
+    uint64_t block_count_x = (width + expected->block_width - 1) / expected->block_width;
+    uint64_t block_count_y = (height + expected->block_height - 1) / expected->block_height;
+
+    return block_count_x * block_count_y * expected->block_size;
+}
+
+static void
+check_format(const ExpectedFormat *expected, uint8_t *pixels, uint8_t *data)
+{
+    // 100x60 down to 1x1 are 7 mip levels.
+    const uint32_t mip_count = 7;
+
+    FakeUnity_Texture2D texture = fake_unity_Texture2D_CreateExternalTexture(TEXTURE_WIDTH, TEXTURE_HEIGHT, expected->format, true, false, pixels);
+
+    if (!texture)
+    {
+        fprintf(stderr, "%s: the texture could not be created.\n", expected->name);
+        error_count += 1;
+        return;
+    }
+
+    uint64_t total_size = 0;
+
+    for (uint32_t mip_level = 0; mip_level < mip_count; mip_level += 1)
+    {
+        uint64_t size = get_mip_size(expected, mip_level);
+
+        if (!fake_unity_Texture2D_SetPixelData(texture, mip_level, data, (size_t) size))
+        {
+            fprintf(stderr, "%s: mip level %u doesn't take %llu bytes.\n", expected->name, mip_level, (unsigned long long) size);
+            error_count += 1;
+        }
+
+        total_size += size;
+    }
+
+    printf("%-14s %2ux%-2u blocks of %2u bytes, %6llu bytes in %u mip levels\n", expected->name, expected->block_width,
+           expected->block_height, expected->block_size, (unsigned long long) total_size, mip_count);
+
+    fake_unity_Texture2D_Destroy(texture);
+}
+
+int main(void)
+{
+    if (!fake_unity_initialize(8, 8) || !fake_unity_create_null_renderer())
+    {
+        return 1;
+    }
+
+    // Large enough for the mip chain of every format above.
+    const size_t max_size = (size_t) TEXTURE_WIDTH * TEXTURE_HEIGHT * 16 * 2;
+
+    uint8_t *pixels = (uint8_t *) calloc(1, max_size);
+    uint8_t *data = (uint8_t *) calloc(1, max_size);
+
+    for (size_t i = 0; i < sizeof(expected_formats) / sizeof(expected_formats[0]); i += 1)
+    {
+        check_format(expected_formats + i, pixels, data);
+    }
+
+    // Sizes that don't match the mip level, here 25x15 blocks of 8 bytes,
+    // and mip levels past the end of the chain are rejected.
+    FakeUnity_Texture2D texture = fake_unity_Texture2D_CreateExternalTexture(TEXTURE_WIDTH, TEXTURE_HEIGHT, FakeUnity_TextureFormat_DXT1, true, false, pixels);
+
+    if (fake_unity_Texture2D_SetPixelData(texture, 0, data, 3001) ||
+        fake_unity_Texture2D_SetPixelData(texture, 7, data, 8))
+    {
+        fprintf(stderr, "a transfer with the wrong size was accepted.\n");
+        error_count += 1;
+    }
+
+    fake_unity_Texture2D_Destroy(texture);
+
+    fake_unity_shutdown();
+
+    free(pixels);
+    free(data);
+
+    printf("%d errors\n", error_count);
+
+    return (error_count == 0) ? 0 : 1;
+}
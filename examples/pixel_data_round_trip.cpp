@@ -0,0 +1,177 @@
+// Uploads pixels to every mip level of a texture and reads them back, once
+// with the blocking calls and once with async requests issued inside frames
+// on the render thread, and checks that the same bytes come back.
+//
+//   pixel_data_round_trip [frame_count]
+//
+// Uses the null renderer, so it runs without a gpu or a vulkan loader.
+
+#include "IUnityProfiler.h" // includes IUnityInterface.h
+#include "IUnityGraphics.h"
+#define VK_NO_PROTOTYPES
+#include "IUnityGraphicsVulkan.h" // includes vulkan/vulkan.h
+
+#define FAKE_UNITY_IMPLEMENTATION
+#include "fake_unity.h"
+
+#define TEXTURE_WIDTH  256
+#define TEXTURE_HEIGHT 128
+
+// 256x128 down to 1x1 are 9 mip levels.
+#define MIP_COUNT 9
+
+static int32_t error_count;
+
+static size_t
+get_mip_size(uint32_t mip_level)
+{
+    size_t width = TEXTURE_WIDTH >> mip_level;
+    size_t height = TEXTURE_HEIGHT >> mip_level;
+
+    return ((width > 0) ? width : 1) * ((height > 0) ? height : 1) * 4;
+}
+
+// Every mip level of every round gets different bytes, so data that is
+// left over from an earlier transfer doesn't go unnoticed.
+static void
+fill_pixels(uint8_t *data, size_t size, uint32_t seed)
+{
+    uint32_t value = seed * 2654435761u + 1;
+
+    for (size_t i = 0; i < size; i += 1)
+    {
+        value = value * 1664525u + 1013904223u;
+        data[i] = (uint8_t) (value >> 24);
+    }
+}
+
+static void
+check_pixels(const char *what, uint32_t mip_level, const uint8_t *expected, const uint8_t *data, size_t size)
+{
+    if (memcmp(expected, data, size))
+    {
+        fprintf(stderr, "%s: mip level %u came back different.\n", what, mip_level);
+        error_count += 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int32_t frame_count = (argc > 1) ? atoi(argv[1]) : 16;
+
+    if (!fake_unity_initialize(8, 8) || !fake_unity_create_null_renderer())
+    {
+        return 1;
+    }
+
+    size_t total_size = 0;
+
+    for (uint32_t mip_level = 0; mip_level < MIP_COUNT; mip_level += 1)
+    {
+        total_size += get_mip_size(mip_level);
+    }
+
+    uint8_t *pixels = (uint8_t *) calloc(1, total_size);
+    uint8_t *uploads = (uint8_t *) malloc(total_size);
+    uint8_t *readbacks = (uint8_t *) malloc(total_size);
+
+    FakeUnity_Texture2D texture = fake_unity_Texture2D_CreateExternalTexture(TEXTURE_WIDTH, TEXTURE_HEIGHT, FakeUnity_TextureFormat_RGBA32,
+                                                                             true, false, pixels);
+
+    if (!texture)
+    {
+        return 1;
+    }
+
+    // Without a render thread the transfers are executed right away.
+    size_t offset = 0;
+
+    for (uint32_t mip_level = 0; mip_level < MIP_COUNT; mip_level += 1)
+    {
+        size_t size = get_mip_size(mip_level);
+
+        fill_pixels(uploads + offset, size, mip_level);
+        memset(readbacks + offset, 0, size);
+
+        if (!fake_unity_Texture2D_SetPixelData(texture, mip_level, uploads + offset, size) ||
+            !fake_unity_Texture2D_GetPixelData(texture, mip_level, readbacks + offset, size))
+        {
+            fprintf(stderr, "blocking: mip level %u failed.\n", mip_level);
+            error_count += 1;
+        }
+
+        check_pixels("blocking", mip_level, uploads + offset, readbacks + offset, size);
+
+        offset += size;
+    }
+
+    // On the render thread they are recorded into the current frame, in
+    // order, so a readback issued after an upload sees its pixels.
+    fake_unity_render_thread_start();
+
+    FakeUnity_AsyncGPURequest requests[MIP_COUNT * 2];
+
+    for (int32_t frame = 0; frame < frame_count; frame += 1)
+    {
+        fake_unity_begin_frame();
+
+        offset = 0;
+
+        for (uint32_t mip_level = 0; mip_level < MIP_COUNT; mip_level += 1)
+        {
+            size_t size = get_mip_size(mip_level);
+
+            fill_pixels(uploads + offset, size, ((uint32_t) frame + 1) * MIP_COUNT + mip_level);
+            memset(readbacks + offset, 0, size);
+
+            requests[mip_level * 2 + 0] = fake_unity_Texture2D_SetPixelDataAsync(texture, mip_level, uploads + offset, size);
+            requests[mip_level * 2 + 1] = fake_unity_AsyncGPUReadback_Request(texture, mip_level, readbacks + offset, size);
+
+            offset += size;
+        }
+
+        fake_unity_end_frame();
+
+        offset = 0;
+
+        for (uint32_t mip_level = 0; mip_level < MIP_COUNT; mip_level += 1)
+        {
+            for (uint32_t i = 0; i < 2; i += 1)
+            {
+                FakeUnity_AsyncGPURequest request = requests[mip_level * 2 + i];
+
+                if (!request)
+                {
+                    error_count += 1;
+                    continue;
+                }
+
+                fake_unity_AsyncGPURequest_WaitForCompletion(request);
+
+                if (fake_unity_AsyncGPURequest_HasError(request))
+                {
+                    fprintf(stderr, "async: a transfer of mip level %u failed.\n", mip_level);
+                    error_count += 1;
+                }
+
+                fake_unity_AsyncGPURequest_Release(request);
+            }
+
+            check_pixels("async", mip_level, uploads + offset, readbacks + offset, get_mip_size(mip_level));
+
+            offset += get_mip_size(mip_level);
+        }
+    }
+
+    fake_unity_Texture2D_Destroy(texture);
+
+    fake_unity_shutdown();
+
+    printf("%d frames of %llu bytes each way, %d errors\n", frame_count, (unsigned long long) total_size, error_count);
+
+    free(pixels);
+    free(uploads);
+    free(readbacks);
+
+    return (error_count == 0) ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// Emits begin/end pairs with known durations for a profiler marker and checks
+// the statistics that are aggregated for it: the sample count, the exact
+// minimum and maximum, and the percentiles read from the histogram.
+//
+//   profiler_stats
+//
+// Uses the null renderer, so it runs without a gpu or a vulkan loader.
+
+#include "IUnityProfiler.h" // includes IUnityInterface.h
+#include "IUnityGraphics.h"
+#define VK_NO_PROTOTYPES
+#include "IUnityGraphicsVulkan.h" // includes vulkan/vulkan.h
+
+#define FAKE_UNITY_IMPLEMENTATION
+#include "fake_unity.h"
+
+// The histogram keeps the error of the percentiles below 6.25%, and a
+// percentile is never reported below the actual value.
+#define PERCENTILE_ERROR 0.0625
+
+static int32_t error_count;
+
+static void
+check_value(const char *what, uint64_t value, uint64_t expected)
+{
+    if (value != expected)
+    {
+        fprintf(stderr, "%s is %llu, expected %llu.\n", what, (unsigned long long) value, (unsigned long long) expected);
+        error_count += 1;
+    }
+}
+
+static void
+check_percentile(const char *what, uint64_t value, uint64_t expected)
+{
+    if ((value < expected) || ((double) value > ((double) expected * (1.0 + PERCENTILE_ERROR))))
+    {
+        fprintf(stderr, "%s is %llu, expected %llu (+%.2f%%).\n", what, (unsigned long long) value,
+                (unsigned long long) expected, PERCENTILE_ERROR * 100.0);
+        error_count += 1;
+    }
+}
+
+int main(void)
+{
+    if (!fake_unity_initialize(8, 8) || !fake_unity_create_null_renderer())
+    {
+        return 1;
+    }
+
+    FakeUnityState *state = __fake_unity_get_state();
+    IUnityProfiler *profiler = &state->unity_profiler;
+
+    const UnityProfilerMarkerDesc *marker;
+    profiler->CreateMarker(&marker, "Known Durations", kUnityProfilerCategoryRender, kUnityProfilerMarkerFlagDefault, 0);
+
+    fake_unity_profiler_set_mode(FakeUnityProfilerMode_Statistics);
+    fake_unity_profiler_set_enabled(true);
+
+    // EmitEvent takes its timestamps from the clock, so the events are
+    // emitted on the current profiler thread with made up timestamps instead.
+    // The durations are 1us to 1000us, every one of them exactly once.
+    FakeUnityProfilerThread *thread = __fake_unity_profiler_get_current_thread(&state->profiler);
+
+    const uint64_t sample_count = 1000;
+    uint64_t timestamp = 0;
+
+    for (uint64_t i = 1; i <= sample_count; i += 1)
+    {
+        __fake_unity_profiler_emit_event(&state->profiler, thread, marker, kUnityProfilerMarkerEventTypeBegin, timestamp, 0, 0);
+        timestamp += i * 1000;
+        __fake_unity_profiler_emit_event(&state->profiler, thread, marker, kUnityProfilerMarkerEventTypeEnd, timestamp, 0, 0);
+        timestamp += 500;
+    }
+
+    FakeUnityProfilerMarkerStats stats;
+
+    if (!fake_unity_profiler_get_marker_stats("Known Durations", &stats))
+    {
+        fprintf(stderr, "the marker has no statistics.\n");
+        fake_unity_shutdown();
+        return 1;
+    }
+
+    check_value("count", stats.count, sample_count);
+    check_value("total", stats.total_time, (sample_count * (sample_count + 1) / 2) * 1000);
+    check_value("min", stats.min_time, 1000);
+    check_value("max", stats.max_time, sample_count * 1000);
+    check_percentile("p50", stats.p50_time, 500 * 1000);
+    check_percentile("p90", stats.p90_time, 900 * 1000);
+    check_percentile("p99", stats.p99_time, 990 * 1000);
+    check_percentile("p99.9", stats.p999_time, 999 * 1000);
+    check_percentile("p25", fake_unity_profiler_get_marker_percentile("Known Durations", 0.25), 250 * 1000);
+    check_value("p100", fake_unity_profiler_get_marker_percentile("Known Durations", 1.0), stats.max_time);
+
+    // After a reset the marker starts over.
+    fake_unity_profiler_reset_marker_stats();
+    fake_unity_profiler_get_marker_stats("Known Durations", &stats);
+
+    check_value("count after reset", stats.count, 0);
+    check_value("p50 after reset", stats.p50_time, 0);
+
+    fake_unity_shutdown();
+
+    printf("count, min, max and percentiles checked, %d errors\n", error_count);
+
+    return (error_count == 0) ? 0 : 1;
+}
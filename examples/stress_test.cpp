@@ -0,0 +1,209 @@
+// Hammers the texture and plugin handle pools from several threads at once.
+// Every thread keeps a set of textures alive, creates and destroys them in a
+// loop and checks that its own handles stay valid and are never handed out
+// twice. If a plugin is given on the command line, every thread also loads
+// and unloads it in between.
+//
+//   stress_test [thread_count] [iteration_count] [./libNativePlugin.so]
+//
+// Uses the null renderer, so it runs without a gpu or a vulkan loader.
+
+#include "IUnityProfiler.h" // includes IUnityInterface.h
+#include "IUnityGraphics.h"
+#define VK_NO_PROTOTYPES
+#include "IUnityGraphicsVulkan.h" // includes vulkan/vulkan.h
+
+#define FAKE_UNITY_IMPLEMENTATION
+#include "fake_unity.h"
+
+#define MAX_THREAD_COUNT     64
+#define LIVE_TEXTURE_COUNT   32
+#define TEXTURE_SIZE         16
+
+typedef struct StressThread
+{
+    int32_t index;
+    int32_t iteration_count;
+    const char *plugin_filename;
+
+    int32_t error_count;
+    FakeUnity_Texture2D textures[LIVE_TEXTURE_COUNT];
+    uint32_t pixel_values[LIVE_TEXTURE_COUNT];
+} StressThread;
+
+// Every texture is filled with a value that is unique for the thread and the
+// slot, so a handle that is given out twice shows up as wrong pixels.
+static bool
+check_texture(FakeUnity_Texture2D texture, uint32_t value)
+{
+    uint32_t *pixels = (uint32_t *) fake_unity_Texture2D_GetNativeTexturePtr(texture);
+
+    if (!pixels)
+    {
+        return false;
+    }
+
+    for (int32_t i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; i += 1)
+    {
+        if (pixels[i] != value)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+stress_thread_run(StressThread *thread)
+{
+    uint32_t pixels[TEXTURE_SIZE * TEXTURE_SIZE];
+
+    for (int32_t iteration = 0; iteration < thread->iteration_count; iteration += 1)
+    {
+        int32_t slot = iteration % LIVE_TEXTURE_COUNT;
+
+        if (thread->textures[slot])
+        {
+            if (!check_texture(thread->textures[slot], thread->pixel_values[slot]))
+            {
+                thread->error_count += 1;
+            }
+
+            FakeUnity_Texture2D texture = thread->textures[slot];
+            fake_unity_Texture2D_Destroy(texture);
+            thread->textures[slot] = 0;
+
+            // The handle is stale right away, even though the pixels are
+            // only freed later on the render thread.
+            if (fake_unity_Texture2D_GetNativeTexturePtr(texture))
+            {
+                thread->error_count += 1;
+            }
+        }
+
+        FakeUnity_Texture2D texture = fake_unity_create_texture(TEXTURE_SIZE, TEXTURE_SIZE, FakeUnity_TextureFormat_RGBA32);
+
+        if (!texture)
+        {
+            thread->error_count += 1;
+            continue;
+        }
+
+        uint32_t value = ((uint32_t) thread->index << 24) | (uint32_t) iteration;
+
+        for (int32_t i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; i += 1)
+        {
+            pixels[i] = value;
+        }
+
+        memcpy(fake_unity_Texture2D_GetNativeTexturePtr(texture), pixels, sizeof(pixels));
+
+        thread->textures[slot] = texture;
+        thread->pixel_values[slot] = value;
+
+        if (thread->plugin_filename && ((iteration % 64) == 0))
+        {
+            uint32_t plugin = fake_unity_load_native_plugin(thread->plugin_filename);
+
+            if (!plugin)
+            {
+                thread->error_count += 1;
+            }
+
+            fake_unity_unload_native_plugin(plugin);
+        }
+    }
+
+    for (int32_t slot = 0; slot < LIVE_TEXTURE_COUNT; slot += 1)
+    {
+        if (thread->textures[slot])
+        {
+            if (!check_texture(thread->textures[slot], thread->pixel_values[slot]))
+            {
+                thread->error_count += 1;
+            }
+
+            fake_unity_Texture2D_Destroy(thread->textures[slot]);
+        }
+    }
+}
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+static DWORD WINAPI
+stress_thread_main(LPVOID parameter)
+{
+    stress_thread_run((StressThread *) parameter);
+    return 0;
+}
+#else
+static void *
+stress_thread_main(void *parameter)
+{
+    stress_thread_run((StressThread *) parameter);
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int32_t thread_count = (argc > 1) ? atoi(argv[1]) : 8;
+    int32_t iteration_count = (argc > 2) ? atoi(argv[2]) : 100000;
+    const char *plugin_filename = (argc > 3) ? argv[3] : NULL;
+
+    if ((thread_count < 1) || (thread_count > MAX_THREAD_COUNT))
+    {
+        fprintf(stderr, "thread_count has to be between 1 and %d.\n", MAX_THREAD_COUNT);
+        return 1;
+    }
+
+    if (!fake_unity_initialize(8, LIVE_TEXTURE_COUNT) || !fake_unity_create_null_renderer())
+    {
+        return 1;
+    }
+
+    // Textures are destroyed on the render thread, so this runs concurrently
+    // with the threads that create them.
+    fake_unity_render_thread_start();
+
+    static StressThread threads[MAX_THREAD_COUNT];
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    HANDLE handles[MAX_THREAD_COUNT];
+#else
+    pthread_t handles[MAX_THREAD_COUNT];
+#endif
+
+    for (int32_t i = 0; i < thread_count; i += 1)
+    {
+        threads[i].index           = i;
+        threads[i].iteration_count = iteration_count;
+        threads[i].plugin_filename = plugin_filename;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        handles[i] = CreateThread(0, 0, stress_thread_main, threads + i, 0, 0);
+#else
+        pthread_create(handles + i, 0, stress_thread_main, threads + i);
+#endif
+    }
+
+    int32_t error_count = 0;
+
+    for (int32_t i = 0; i < thread_count; i += 1)
+    {
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], 0);
+#endif
+
+        error_count += threads[i].error_count;
+    }
+
+    fake_unity_shutdown();
+
+    printf("%d threads, %d iterations each, %d errors\n", thread_count, iteration_count, error_count);
+
+    return (error_count == 0) ? 0 : 1;
+}
@@ -81,27 +81,46 @@
 #if FAKE_UNITY_PLATFORM_WINDOWS
 #  define WIN32_LEAN_AND_MEAN
 #  include <windows.h>
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+#  include <pthread.h>
 #endif
 
 typedef void (*PFN_UnityPluginLoad)(IUnityInterfaces *);
 typedef void (*PFN_UnityPluginUnload)();
 
+// A slot is published by setting used after the other members were written.
+// Slots are never removed, so lookups don't need to take a lock.
 typedef struct FakeUnityInterface
 {
+    volatile uint32_t used;
     unsigned long long guid_high;
     unsigned long long guid_low;
-    IUnityInterface *ptr;
+    IUnityInterface *volatile ptr;
 } FakeUnityInterface;
 
-typedef struct FakeUnityInterfaces
+// Open addressing hash table with linear probing. It is replaced by one
+// with twice the capacity once it is half full. Replaced tables are kept
+// alive, because lookups on other threads may still be probing them.
+typedef struct FakeUnityInterfaceTable
 {
-    int32_t count;
-    int32_t allocated;
+    struct FakeUnityInterfaceTable *retired;
+
+    uint32_t count;
+    uint32_t capacity;
     FakeUnityInterface *items;
+} FakeUnityInterfaceTable;
+
+typedef struct FakeUnityInterfaces
+{
+    volatile uint32_t lock;
+    FakeUnityInterfaceTable *volatile table;
 } FakeUnityInterfaces;
 
 typedef struct FakeUnityNativePlugin
 {
+    // The handle that currently owns this slot.
+    uint32_t plugin_handle;
+
     PFN_UnityPluginLoad UnityPluginLoad;
     PFN_UnityPluginUnload UnityPluginUnload;
 
@@ -110,15 +129,178 @@ typedef struct FakeUnityNativePlugin
 #elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
     void *handle;
 #endif
+
+    // Base address of the library, NULL if it is not known. Vulkan calls
+    // made from code at this base count for the plugin while tracing.
+    const void *module_base;
+
+    // Only set for hot reloadable plugins. The library is loaded from
+    // shadow_path, a copy of path, so path can be rebuilt while loaded.
+    char *path;
+    char *shadow_path;
+    bool changed;
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+    int watch_descriptor;
+#else
+    int64_t modification_time;
+#endif
 } FakeUnityNativePlugin;
 
+typedef struct FakeUnityGraphicsDeviceEventCallback
+{
+    IUnityGraphicsDeviceEventCallback callback;
+    // The plugin that registered the callback, zero if it wasn't registered
+    // from plugin code that the harness called.
+    uint32_t plugin_handle;
+} FakeUnityGraphicsDeviceEventCallback;
+
 typedef struct FakeUnityGraphicsDeviceEventCallbacks
 {
+    volatile uint32_t lock;
     int32_t count;
     int32_t allocated;
-    IUnityGraphicsDeviceEventCallback *items;
+    FakeUnityGraphicsDeviceEventCallback *items;
 } FakeUnityGraphicsDeviceEventCallbacks;
 
+// Number of profiler events each thread can buffer before events get dropped.
+// Has to be a power of two. Buffered events are released by calling
+// fake_unity_profiler_consume_events.
+#ifndef FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE
+#  define FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE 16384
+#endif
+
+// Maximum nesting depth of begin/end pairs per thread that is tracked for
+// the marker statistics.
+#ifndef FAKE_UNITY_PROFILER_MAX_STACK_DEPTH
+#  define FAKE_UNITY_PROFILER_MAX_STACK_DEPTH 64
+#endif
+
+#define FAKE_UNITY_PROFILER_MAX_EVENT_DATA     4
+#define FAKE_UNITY_PROFILER_EVENT_PAYLOAD_SIZE 40
+
+// Durations are sorted into a log-linear histogram with 16 buckets per power
+// of two, which keeps the error of the percentiles below 6.25%.
+#define FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS 4
+#define FAKE_UNITY_PROFILER_HISTOGRAM_BUCKET_COUNT    976
+
+typedef enum FakeUnityProfilerMode
+{
+    // Events are captured into the thread buffers, see fake_unity_profiler_consume_events.
+    FakeUnityProfilerMode_Events     = (1 << 0),
+    // Begin/end pairs are aggregated into per marker statistics, see fake_unity_profiler_get_marker_stats.
+    FakeUnityProfilerMode_Statistics = (1 << 1),
+} FakeUnityProfilerMode;
+
+typedef struct FakeUnityProfilerMarkerMetadata
+{
+    char *name;
+    UnityProfilerMarkerDataType type;
+    UnityProfilerMarkerDataUnit unit;
+} FakeUnityProfilerMarkerMetadata;
+
+typedef struct FakeUnityProfilerMarker
+{
+    // This has to be the first member. Plugins only ever see a pointer to it.
+    UnityProfilerMarkerDesc desc;
+
+    struct FakeUnityProfilerMarker *next;
+
+    char *name;
+
+    int32_t metadata_count;
+    FakeUnityProfilerMarkerMetadata *metadata;
+
+    // All times are in nanoseconds.
+    volatile uint64_t sample_count;
+    volatile uint64_t total_time;
+    volatile uint64_t min_time;
+    volatile uint64_t max_time;
+    volatile uint64_t histogram[FAKE_UNITY_PROFILER_HISTOGRAM_BUCKET_COUNT];
+} FakeUnityProfilerMarker;
+
+// The event data passed to EmitEvent is packed into payload. Every item
+// starts at an 8 byte aligned offset, so the data can be read in place as
+// any of the marker data types. Items that don't fit anymore are truncated,
+// truncated strings stay null terminated.
+typedef struct FakeUnityProfilerEvent
+{
+    uint64_t timestamp;
+    const FakeUnityProfilerMarker *marker;
+    UnityProfilerMarkerEventType type;
+    uint16_t data_count;
+    UnityProfilerMarkerDataType data_types[FAKE_UNITY_PROFILER_MAX_EVENT_DATA];
+    uint8_t data_sizes[FAKE_UNITY_PROFILER_MAX_EVENT_DATA];
+    uint64_t payload[FAKE_UNITY_PROFILER_EVENT_PAYLOAD_SIZE / 8];
+} FakeUnityProfilerEvent;
+
+// Every thread that emits events gets its own single producer single consumer
+// ring buffer. write_index is only written by the owning thread, read_index
+// is only written by the consumer.
+typedef struct FakeUnityProfilerThread
+{
+    struct FakeUnityProfilerThread *next;
+
+    // Identifies the os thread that owns this buffer.
+    const void *key;
+
+    uint64_t id;
+    char name[64];
+    char group_name[64];
+
+    volatile uint32_t write_index;
+    volatile uint32_t read_index;
+    volatile uint32_t dropped_count;
+
+    // Set by UnregisterThread. The owning thread doesn't write to this buffer
+    // anymore and the events are freed once the consumer has drained them.
+    volatile uint32_t retired;
+
+    FakeUnityProfilerEvent *events;
+
+    // Only accessed by the owning thread.
+    uint32_t stack_depth;
+    const FakeUnityProfilerMarker *stack_markers[FAKE_UNITY_PROFILER_MAX_STACK_DEPTH];
+    uint64_t stack_timestamps[FAKE_UNITY_PROFILER_MAX_STACK_DEPTH];
+} FakeUnityProfilerThread;
+
+typedef struct FakeUnityProfiler
+{
+    uint64_t id;
+
+    volatile uint32_t enabled;
+    volatile uint32_t mode;
+
+    volatile uint32_t marker_lock;
+    volatile uint32_t consumer_lock;
+
+    FakeUnityProfilerMarker *volatile markers;
+    int32_t marker_count;
+
+    FakeUnityProfilerThread *volatile threads;
+    volatile uint64_t thread_count;
+
+    // The thread that gpu timings are emitted on. Only accessed by the
+    // thread that executes the render commands.
+    FakeUnityProfilerThread *gpu_thread;
+
+    struct FakeUnityProfilerTrace *trace;
+} FakeUnityProfiler;
+
+typedef struct FakeUnityProfilerMarkerStats
+{
+    // Number of begin/end pairs. All times are in nanoseconds.
+    uint64_t count;
+    uint64_t total_time;
+    uint64_t min_time;
+    uint64_t max_time;
+    uint64_t p50_time;
+    uint64_t p90_time;
+    uint64_t p99_time;
+    uint64_t p999_time;
+} FakeUnityProfilerMarkerStats;
+
+typedef void (*FakeUnityProfilerEventCallback)(const FakeUnityProfilerThread *thread, const FakeUnityProfilerEvent *event, void *userdata);
+
 #define __FAKE_UNITY_VULKAN_GLOBAL_FUNCTIONS(__name__) \
     __name__(vkEnumerateInstanceVersion); \
     __name__(vkCreateInstance)
@@ -127,12 +309,476 @@ typedef struct FakeUnityGraphicsDeviceEventCallbacks
     __name__(vkGetDeviceProcAddr); \
     __name__(vkEnumeratePhysicalDevices); \
     __name__(vkGetPhysicalDeviceProperties); \
-    __name__(vkCreateDevice)
+    __name__(vkGetPhysicalDeviceQueueFamilyProperties); \
+    __name__(vkGetPhysicalDeviceMemoryProperties); \
+    __name__(vkCreateDevice); \
+    __name__(vkDestroyInstance)
 
 #define __FAKE_UNITY_VULKAN_DEVICE_FUNCTIONS(__name__) \
+    __name__(vkDestroyDevice); \
+    __name__(vkDeviceWaitIdle); \
+    __name__(vkGetDeviceQueue); \
+    __name__(vkQueueSubmit); \
+    __name__(vkCreatePipelineCache); \
+    __name__(vkDestroyPipelineCache); \
+    __name__(vkGetPipelineCacheData); \
+    __name__(vkCreateImageView); \
+    __name__(vkDestroyImageView); \
+    __name__(vkCreateCommandPool); \
+    __name__(vkDestroyCommandPool); \
+    __name__(vkResetCommandPool); \
+    __name__(vkAllocateCommandBuffers); \
+    __name__(vkBeginCommandBuffer); \
+    __name__(vkEndCommandBuffer); \
+    __name__(vkCmdPipelineBarrier); \
+    __name__(vkCmdCopyBufferToImage); \
+    __name__(vkCmdCopyImageToBuffer); \
+    __name__(vkCreateBuffer); \
+    __name__(vkGetBufferMemoryRequirements); \
+    __name__(vkAllocateMemory); \
+    __name__(vkBindBufferMemory); \
+    __name__(vkMapMemory); \
+    __name__(vkDestroyBuffer); \
+    __name__(vkFreeMemory); \
+    __name__(vkCreateImage); \
+    __name__(vkDestroyImage); \
+    __name__(vkGetImageMemoryRequirements); \
+    __name__(vkBindImageMemory); \
+    __name__(vkCreateFence); \
+    __name__(vkDestroyFence); \
+    __name__(vkResetFences); \
+    __name__(vkGetFenceStatus); \
+    __name__(vkWaitForFences); \
+    __name__(vkCreateQueryPool); \
+    __name__(vkDestroyQueryPool); \
+    __name__(vkGetQueryPoolResults); \
+    __name__(vkCmdResetQueryPool); \
+    __name__(vkCmdWriteTimestamp)
+
+// Every device level function of the core vulkan versions the headers know
+// about, for FakeUnityVulkanDeviceTable.
+#define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_0(__name__) \
+    __name__(vkDestroyDevice); \
     __name__(vkGetDeviceQueue); \
+    __name__(vkQueueSubmit); \
+    __name__(vkQueueWaitIdle); \
+    __name__(vkDeviceWaitIdle); \
+    __name__(vkAllocateMemory); \
+    __name__(vkFreeMemory); \
+    __name__(vkMapMemory); \
+    __name__(vkUnmapMemory); \
+    __name__(vkFlushMappedMemoryRanges); \
+    __name__(vkInvalidateMappedMemoryRanges); \
+    __name__(vkGetDeviceMemoryCommitment); \
+    __name__(vkBindBufferMemory); \
+    __name__(vkBindImageMemory); \
+    __name__(vkGetBufferMemoryRequirements); \
+    __name__(vkGetImageMemoryRequirements); \
+    __name__(vkGetImageSparseMemoryRequirements); \
+    __name__(vkQueueBindSparse); \
+    __name__(vkCreateFence); \
+    __name__(vkDestroyFence); \
+    __name__(vkResetFences); \
+    __name__(vkGetFenceStatus); \
+    __name__(vkWaitForFences); \
+    __name__(vkCreateSemaphore); \
+    __name__(vkDestroySemaphore); \
+    __name__(vkCreateEvent); \
+    __name__(vkDestroyEvent); \
+    __name__(vkGetEventStatus); \
+    __name__(vkSetEvent); \
+    __name__(vkResetEvent); \
+    __name__(vkCreateQueryPool); \
+    __name__(vkDestroyQueryPool); \
+    __name__(vkGetQueryPoolResults); \
+    __name__(vkCreateBuffer); \
+    __name__(vkDestroyBuffer); \
+    __name__(vkCreateBufferView); \
+    __name__(vkDestroyBufferView); \
+    __name__(vkCreateImage); \
+    __name__(vkDestroyImage); \
+    __name__(vkGetImageSubresourceLayout); \
     __name__(vkCreateImageView); \
-    __name__(vkDestroyImageView)
+    __name__(vkDestroyImageView); \
+    __name__(vkCreateShaderModule); \
+    __name__(vkDestroyShaderModule); \
+    __name__(vkCreatePipelineCache); \
+    __name__(vkDestroyPipelineCache); \
+    __name__(vkGetPipelineCacheData); \
+    __name__(vkMergePipelineCaches); \
+    __name__(vkCreateGraphicsPipelines); \
+    __name__(vkCreateComputePipelines); \
+    __name__(vkDestroyPipeline); \
+    __name__(vkCreatePipelineLayout); \
+    __name__(vkDestroyPipelineLayout); \
+    __name__(vkCreateSampler); \
+    __name__(vkDestroySampler); \
+    __name__(vkCreateDescriptorSetLayout); \
+    __name__(vkDestroyDescriptorSetLayout); \
+    __name__(vkCreateDescriptorPool); \
+    __name__(vkDestroyDescriptorPool); \
+    __name__(vkResetDescriptorPool); \
+    __name__(vkAllocateDescriptorSets); \
+    __name__(vkFreeDescriptorSets); \
+    __name__(vkUpdateDescriptorSets); \
+    __name__(vkCreateFramebuffer); \
+    __name__(vkDestroyFramebuffer); \
+    __name__(vkCreateRenderPass); \
+    __name__(vkDestroyRenderPass); \
+    __name__(vkGetRenderAreaGranularity); \
+    __name__(vkCreateCommandPool); \
+    __name__(vkDestroyCommandPool); \
+    __name__(vkResetCommandPool); \
+    __name__(vkAllocateCommandBuffers); \
+    __name__(vkFreeCommandBuffers); \
+    __name__(vkBeginCommandBuffer); \
+    __name__(vkEndCommandBuffer); \
+    __name__(vkResetCommandBuffer); \
+    __name__(vkCmdBindPipeline); \
+    __name__(vkCmdSetViewport); \
+    __name__(vkCmdSetScissor); \
+    __name__(vkCmdSetLineWidth); \
+    __name__(vkCmdSetDepthBias); \
+    __name__(vkCmdSetBlendConstants); \
+    __name__(vkCmdSetDepthBounds); \
+    __name__(vkCmdSetStencilCompareMask); \
+    __name__(vkCmdSetStencilWriteMask); \
+    __name__(vkCmdSetStencilReference); \
+    __name__(vkCmdBindDescriptorSets); \
+    __name__(vkCmdBindIndexBuffer); \
+    __name__(vkCmdBindVertexBuffers); \
+    __name__(vkCmdDraw); \
+    __name__(vkCmdDrawIndexed); \
+    __name__(vkCmdDrawIndirect); \
+    __name__(vkCmdDrawIndexedIndirect); \
+    __name__(vkCmdDispatch); \
+    __name__(vkCmdDispatchIndirect); \
+    __name__(vkCmdCopyBuffer); \
+    __name__(vkCmdCopyImage); \
+    __name__(vkCmdBlitImage); \
+    __name__(vkCmdCopyBufferToImage); \
+    __name__(vkCmdCopyImageToBuffer); \
+    __name__(vkCmdUpdateBuffer); \
+    __name__(vkCmdFillBuffer); \
+    __name__(vkCmdClearColorImage); \
+    __name__(vkCmdClearDepthStencilImage); \
+    __name__(vkCmdClearAttachments); \
+    __name__(vkCmdResolveImage); \
+    __name__(vkCmdSetEvent); \
+    __name__(vkCmdResetEvent); \
+    __name__(vkCmdWaitEvents); \
+    __name__(vkCmdPipelineBarrier); \
+    __name__(vkCmdBeginQuery); \
+    __name__(vkCmdEndQuery); \
+    __name__(vkCmdResetQueryPool); \
+    __name__(vkCmdWriteTimestamp); \
+    __name__(vkCmdCopyQueryPoolResults); \
+    __name__(vkCmdPushConstants); \
+    __name__(vkCmdBeginRenderPass); \
+    __name__(vkCmdNextSubpass); \
+    __name__(vkCmdEndRenderPass); \
+    __name__(vkCmdExecuteCommands);
+
+#if defined(VK_VERSION_1_1)
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_1(__name__) \
+    __name__(vkBindBufferMemory2); \
+    __name__(vkBindImageMemory2); \
+    __name__(vkGetDeviceGroupPeerMemoryFeatures); \
+    __name__(vkCmdSetDeviceMask); \
+    __name__(vkCmdDispatchBase); \
+    __name__(vkGetImageMemoryRequirements2); \
+    __name__(vkGetBufferMemoryRequirements2); \
+    __name__(vkGetImageSparseMemoryRequirements2); \
+    __name__(vkTrimCommandPool); \
+    __name__(vkGetDeviceQueue2); \
+    __name__(vkCreateSamplerYcbcrConversion); \
+    __name__(vkDestroySamplerYcbcrConversion); \
+    __name__(vkCreateDescriptorUpdateTemplate); \
+    __name__(vkDestroyDescriptorUpdateTemplate); \
+    __name__(vkUpdateDescriptorSetWithTemplate); \
+    __name__(vkGetDescriptorSetLayoutSupport);
+#else
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_1(__name__)
+#endif
+
+#if defined(VK_VERSION_1_2)
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_2(__name__) \
+    __name__(vkCmdDrawIndirectCount); \
+    __name__(vkCmdDrawIndexedIndirectCount); \
+    __name__(vkCreateRenderPass2); \
+    __name__(vkCmdBeginRenderPass2); \
+    __name__(vkCmdNextSubpass2); \
+    __name__(vkCmdEndRenderPass2); \
+    __name__(vkResetQueryPool); \
+    __name__(vkGetSemaphoreCounterValue); \
+    __name__(vkWaitSemaphores); \
+    __name__(vkSignalSemaphore); \
+    __name__(vkGetBufferDeviceAddress); \
+    __name__(vkGetBufferOpaqueCaptureAddress); \
+    __name__(vkGetDeviceMemoryOpaqueCaptureAddress);
+#else
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_2(__name__)
+#endif
+
+#if defined(VK_VERSION_1_3)
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_3(__name__) \
+    __name__(vkCreatePrivateDataSlot); \
+    __name__(vkDestroyPrivateDataSlot); \
+    __name__(vkSetPrivateData); \
+    __name__(vkGetPrivateData); \
+    __name__(vkCmdSetEvent2); \
+    __name__(vkCmdResetEvent2); \
+    __name__(vkCmdWaitEvents2); \
+    __name__(vkCmdPipelineBarrier2); \
+    __name__(vkCmdWriteTimestamp2); \
+    __name__(vkQueueSubmit2); \
+    __name__(vkCmdCopyBuffer2); \
+    __name__(vkCmdCopyImage2); \
+    __name__(vkCmdCopyBufferToImage2); \
+    __name__(vkCmdCopyImageToBuffer2); \
+    __name__(vkCmdBlitImage2); \
+    __name__(vkCmdResolveImage2); \
+    __name__(vkCmdBeginRendering); \
+    __name__(vkCmdEndRendering); \
+    __name__(vkCmdSetCullMode); \
+    __name__(vkCmdSetFrontFace); \
+    __name__(vkCmdSetPrimitiveTopology); \
+    __name__(vkCmdSetViewportWithCount); \
+    __name__(vkCmdSetScissorWithCount); \
+    __name__(vkCmdBindVertexBuffers2); \
+    __name__(vkCmdSetDepthTestEnable); \
+    __name__(vkCmdSetDepthWriteEnable); \
+    __name__(vkCmdSetDepthCompareOp); \
+    __name__(vkCmdSetDepthBoundsTestEnable); \
+    __name__(vkCmdSetStencilTestEnable); \
+    __name__(vkCmdSetStencilOp); \
+    __name__(vkCmdSetRasterizerDiscardEnable); \
+    __name__(vkCmdSetDepthBiasEnable); \
+    __name__(vkCmdSetPrimitiveRestartEnable); \
+    __name__(vkGetDeviceBufferMemoryRequirements); \
+    __name__(vkGetDeviceImageMemoryRequirements); \
+    __name__(vkGetDeviceImageSparseMemoryRequirements);
+#else
+#  define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_3(__name__)
+#endif
+
+// Unlike the lists above, every item ends with a semicolon, because the
+// lists of newer versions are empty with older headers.
+#define __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS(__name__) \
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_0(__name__) \
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_1(__name__) \
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_2(__name__) \
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS_1_3(__name__)
+
+#define declare_function(name) PFN_##name name
+
+// The device level functions of the vulkan device, resolved once with
+// vkGetDeviceProcAddr when the renderer is created. Functions the device
+// does not provide are NULL.
+typedef struct FakeUnityVulkanDeviceTable
+{
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS(declare_function)
+} FakeUnityVulkanDeviceTable;
+
+#undef declare_function
+
+// Number of frames the cpu can record ahead of the gpu.
+#ifndef FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT
+#  define FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT 3
+#endif
+
+typedef struct FakeUnityVulkanCommandBuffers
+{
+    int32_t count;
+    int32_t allocated;
+    VkCommandBuffer *items;
+} FakeUnityVulkanCommandBuffers;
+
+// Number of timestamp queries of every frame. The frame itself and every
+// plugin event executed in it take two. Events beyond that are not timed.
+#ifndef FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES
+#  define FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES 1024
+#endif
+
+// A plugin event bracketed by the timestamp queries query and query + 1.
+typedef struct FakeUnityVulkanTimestampScope
+{
+    int event_id;
+    uint32_t query;
+} FakeUnityVulkanTimestampScope;
+
+typedef struct FakeUnityVulkanTimestampScopes
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanTimestampScope *items;
+} FakeUnityVulkanTimestampScopes;
+
+// Every frame records into command buffers from its own pool. A frame
+// usually needs a single command buffer, more are allocated when the
+// recording is flushed in the middle of a frame. The fence is signaled
+// once the last submission of the frame is done.
+typedef struct FakeUnityVulkanFrame
+{
+    // The number of the frame that used this slot last, zero if unused.
+    uint64_t frame_number;
+
+    VkCommandPool command_pool;
+    VkFence fence;
+
+    // Cleared if neither the frame nor an empty batch in its place could be
+    // submitted with the fence, which is then never signaled.
+    bool submitted;
+
+    int32_t command_buffer_index;
+    FakeUnityVulkanCommandBuffers command_buffers;
+
+    // Queries 0 and 1 bracket the whole frame, query_count is zero if the
+    // frame is not timed. submit_timestamp is the cpu time of the first
+    // submission of the frame.
+    VkQueryPool query_pool;
+    uint32_t query_count;
+    uint64_t submit_timestamp;
+    FakeUnityVulkanTimestampScopes timestamp_scopes;
+} FakeUnityVulkanFrame;
+
+// A destroyed texture whose slot and view are kept alive until the gpu
+// finished frame_number.
+typedef struct FakeUnityVulkanDeferredTexture
+{
+    uint64_t frame_number;
+    uint32_t index;
+} FakeUnityVulkanDeferredTexture;
+
+typedef struct FakeUnityVulkanDeferredTextures
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanDeferredTexture *items;
+} FakeUnityVulkanDeferredTextures;
+
+typedef struct FakeUnityVulkanImageBarriers
+{
+    int32_t count;
+    int32_t allocated;
+    VkImageMemoryBarrier *items;
+} FakeUnityVulkanImageBarriers;
+
+typedef struct FakeUnityVulkanBufferBarriers
+{
+    int32_t count;
+    int32_t allocated;
+    VkBufferMemoryBarrier *items;
+} FakeUnityVulkanBufferBarriers;
+
+// Size of the persistently mapped buffer that pixel uploads and readbacks
+// are staged in. Larger transfers are split into pieces.
+#ifndef FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE
+#  define FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE (64 * 1024 * 1024)
+#endif
+
+// A piece of staging memory that is in use until the gpu finished
+// frame_number. Readbacks copy it to destination then, and the last piece
+// of a readback completes its request.
+typedef struct FakeUnityVulkanTransfer
+{
+    uint64_t frame_number;
+    // The ring position right after this piece.
+    uint64_t staging_end;
+    uint64_t staging_offset;
+    void *destination;
+    size_t size;
+    uint32_t request;
+    bool failed;
+} FakeUnityVulkanTransfer;
+
+typedef struct FakeUnityVulkanTransfers
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanTransfer *items;
+} FakeUnityVulkanTransfers;
+
+// A ring buffer that is created on first use. head and tail count bytes
+// since the creation, head - tail bytes are in use. Only accessed by the
+// thread that executes the render commands.
+typedef struct FakeUnityVulkanStagingBuffer
+{
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    uint8_t *mapped;
+
+    uint64_t head;
+    uint64_t tail;
+
+    // Ordered by frame number.
+    FakeUnityVulkanTransfers transfers;
+} FakeUnityVulkanStagingBuffer;
+
+// Size of the VkDeviceMemory blocks that images are sub-allocated from.
+// Has to be a power of two. Images that need more than half a block get
+// memory of their own.
+#ifndef FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE
+#  define FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE (64 * 1024 * 1024)
+#endif
+
+// Sub-allocations are rounded up to a power of two of at least 4 KiB and
+// are aligned to their size.
+#define __FAKE_UNITY_VULKAN_MIN_ALLOCATION_SHIFT 12
+#define __FAKE_UNITY_VULKAN_ALLOCATION_BUCKET_COUNT 40
+
+typedef struct FakeUnityVulkanAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    uint32_t memory_type_index;
+    // UINT32_MAX for memory of its own.
+    uint32_t block_index;
+    uint32_t bucket_index;
+} FakeUnityVulkanAllocation;
+
+// Blocks are filled linearly from head. Freed ranges go into the bucket of
+// their size and are reused before a block grows.
+typedef struct FakeUnityVulkanMemoryBlock
+{
+    VkDeviceMemory memory;
+    VkDeviceSize head;
+} FakeUnityVulkanMemoryBlock;
+
+typedef struct FakeUnityVulkanMemoryBlocks
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanMemoryBlock *items;
+} FakeUnityVulkanMemoryBlocks;
+
+typedef struct FakeUnityVulkanFreeRange
+{
+    uint32_t block_index;
+    VkDeviceSize offset;
+} FakeUnityVulkanFreeRange;
+
+typedef struct FakeUnityVulkanFreeRanges
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanFreeRange *items;
+} FakeUnityVulkanFreeRanges;
+
+typedef struct FakeUnityVulkanMemoryType
+{
+    FakeUnityVulkanMemoryBlocks blocks;
+    FakeUnityVulkanFreeRanges buckets[__FAKE_UNITY_VULKAN_ALLOCATION_BUCKET_COUNT];
+} FakeUnityVulkanMemoryType;
+
+// Textures are created on the calling thread and released on the thread
+// that executes the render commands, so all of this is behind lock.
+typedef struct FakeUnityVulkanMemoryAllocator
+{
+    volatile uint32_t lock;
+    VkPhysicalDeviceMemoryProperties properties;
+    FakeUnityVulkanMemoryType types[VK_MAX_MEMORY_TYPES];
+} FakeUnityVulkanMemoryAllocator;
 
 #define declare_function(name) PFN_##name name
 
@@ -150,6 +796,55 @@ typedef struct FakeUnityVulkanRenderer
     VkQueue graphics_queue;
     uint32_t graphics_queue_index;
 
+    // These are the same as the graphics queue if the device has no
+    // dedicated queue family for async compute or transfers.
+    VkQueue compute_queue;
+    uint32_t compute_queue_index;
+    VkQueue transfer_queue;
+    uint32_t transfer_queue_index;
+
+    // Shared with the plugins through UnityVulkanInstance.
+    VkPipelineCache pipeline_cache;
+
+    // Only accessed by the thread that executes the render commands.
+    bool recording;
+    uint64_t current_frame_number;
+    uint64_t safe_frame_number;
+    FakeUnityVulkanFrame frames[FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT];
+
+    // Transitions requested by AccessTexture and barriers requested by
+    // AccessBuffer are collected here and recorded with a single
+    // vkCmdPipelineBarrier once the plugin gets the command buffer, the event
+    // returns or the command buffer is submitted. After the command buffer
+    // was handed out to the executing event, barriers are recorded right away.
+    FakeUnityVulkanImageBarriers pending_image_barriers;
+    FakeUnityVulkanBufferBarriers pending_buffer_barriers;
+    VkPipelineStageFlags pending_src_stage_flags;
+    VkPipelineStageFlags pending_dst_stage_flags;
+    uint64_t barrier_batch;
+    bool command_buffer_exposed;
+
+    // Ordered by frame number.
+    FakeUnityVulkanDeferredTextures deferred_textures;
+
+    FakeUnityVulkanStagingBuffer staging;
+
+    FakeUnityVulkanMemoryAllocator memory;
+
+    // Set when a readback was recorded into the current command buffer, so
+    // its writes are made visible to the host before it is submitted.
+    bool pending_host_read;
+
+    // Zero if the graphics queue can not write timestamps. The period is
+    // the number of nanoseconds per tick.
+    uint32_t timestamp_valid_bits;
+    double timestamp_period;
+    const FakeUnityProfilerMarker *gpu_frame_marker;
+
+    // The cpu time the last emitted frame ended at on the gpu. The next
+    // frame starts no earlier, because the gpu runs frames in order.
+    uint64_t gpu_frame_end_timestamp;
+
     PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr;
     PFN_vkGetInstanceProcAddr loader_vkGetInstanceProcAddr;
 
@@ -158,48 +853,540 @@ typedef struct FakeUnityVulkanRenderer
     __FAKE_UNITY_VULKAN_INSTANCE_FUNCTIONS(declare_function);
 
     __FAKE_UNITY_VULKAN_DEVICE_FUNCTIONS(declare_function);
+
+    FakeUnityVulkanDeviceTable device_table;
 } FakeUnityVulkanRenderer;
 
 #undef declare_function
 
+// Pixel memory of null renderer textures is rounded up to a power of two of
+// at least 256 bytes. Freed memory is kept in a list per size and reused by
+// the next texture that needs the same size.
+#define __FAKE_UNITY_NULL_MIN_PIXELS_SHIFT 8
+#define __FAKE_UNITY_NULL_PIXELS_BUCKET_COUNT 40
+
+// Alignment of the pixel memory of null renderer textures. Has to be a
+// power of two of at least the size of a pointer.
+#ifndef FAKE_UNITY_NULL_PIXELS_ALIGNMENT
+#  define FAKE_UNITY_NULL_PIXELS_ALIGNMENT 64
+#endif
+
+// Draws nothing and keeps textures in host memory. Textures are created on
+// the calling thread and released on the thread that executes the render
+// commands, so the free lists are behind lock.
+typedef struct FakeUnityNullRenderer
+{
+    volatile uint32_t lock;
+    // The first bytes of a free block point to the next one.
+    void *free_pixels[__FAKE_UNITY_NULL_PIXELS_BUCKET_COUNT];
+} FakeUnityNullRenderer;
+
 typedef struct FakeUnityTexture
 {
+    // The handle that currently owns this slot.
+    uint32_t handle;
+
     int32_t width;
     int32_t height;
-
+    // Only 3D textures have a depth other than 1.
+    int32_t depth;
+    uint32_t layer_count;
+    uint32_t mip_count;
+    VkImageViewType view_type;
+
+    // The native texture pointer of a texture points to image, like
+    // Texture.GetNativeTexturePtr does in the engine on vulkan.
+    VkImage image;
+    VkFormat format;
     VkImageView vk_image_view;
+
+    // The FakeUnity_TextureFormat the texture was created with.
+    int32_t texture_format;
+
+    // Only set for textures that fake_unity created the image or pixels of,
+    // which are destroyed together with the texture.
+    bool owns_image;
+    FakeUnityVulkanAllocation allocation;
+
+    // The host memory of a null renderer texture. Mip levels follow each
+    // other, the layers of a mip level are next to each other.
+    void *pixels;
+    uint32_t pixels_bucket_index;
+
+    // How the image was last accessed. This is tracked for the whole image,
+    // not per subresource, and only touched by the thread that executes the
+    // render commands.
+    VkImageLayout layout;
+    VkPipelineStageFlags stage_flags;
+    VkAccessFlags access_flags;
+
+    // Equal to the barrier_batch of the renderer while the barrier at
+    // barrier_index of the pending barriers belongs to this image.
+    uint64_t barrier_batch;
+    int32_t barrier_index;
 } FakeUnityTexture;
 
+// A vulkan buffer registered with fake_unity_vulkan_register_buffer. The
+// buffer itself is owned by the caller.
+typedef struct FakeUnityBuffer
+{
+    // The handle that currently owns this slot.
+    uint32_t handle;
+
+    // The native buffer pointer of a buffer points to buffer, like
+    // GraphicsBuffer.GetNativeBufferPtr does in the engine on vulkan.
+    VkBuffer buffer;
+    VkDeviceSize size;
+    VkBufferUsageFlags usage;
+
+    // How the buffer was last accessed, only touched by the thread that
+    // executes the render commands.
+    VkPipelineStageFlags stage_flags;
+    VkAccessFlags access_flags;
+
+    // Equal to the barrier_batch of the renderer while the barrier at
+    // barrier_index of the pending barriers belongs to this buffer.
+    uint64_t barrier_batch;
+    int32_t barrier_index;
+} FakeUnityBuffer;
+
+// Number of bits of a handle that hold the slot index, the remaining upper
+// bits hold the generation. Handles stay 32 bit wide because texture
+// handles double as UnityTextureID. More index bits allow more live
+// handles, but leave fewer bits for the generation. Free slots are reused
+// in the order they were freed, so a stale handle only matches again once
+// its slot went through every generation, with every other free slot
+// reused in between each time.
+#ifndef FAKE_UNITY_HANDLE_INDEX_BITS
+#  define FAKE_UNITY_HANDLE_INDEX_BITS 20
+#endif
+
+// Number of slots that are allocated at once when a pool grows.
+#ifndef FAKE_UNITY_HANDLE_POOL_PAGE_SIZE
+#  define FAKE_UNITY_HANDLE_POOL_PAGE_SIZE 1024
+#endif
+
+#define FAKE_UNITY_HANDLE_POOL_MAX_PAGE_COUNT ((1u << FAKE_UNITY_HANDLE_INDEX_BITS) / FAKE_UNITY_HANDLE_POOL_PAGE_SIZE)
+
+// Every page is entered twice into the block table, which is kept at most
+// half full.
+#define FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE (4 * FAKE_UNITY_HANDLE_POOL_MAX_PAGE_COUNT)
+
+// The items of a page follow right after it. The links of the free list
+// carry a tag in their upper 32 bits, like its head and tail.
+typedef struct FakeUnityHandlePoolPage
+{
+    volatile uint32_t generations[FAKE_UNITY_HANDLE_POOL_PAGE_SIZE];
+    volatile uint64_t next_free_indices[FAKE_UNITY_HANDLE_POOL_PAGE_SIZE];
+} FakeUnityHandlePoolPage;
+
+// Maps an aligned block of memory that the items of a page overlap to the
+// index of the page. key is the block address shifted by block_shift plus
+// one, zero marks an empty entry.
+typedef struct FakeUnityHandlePoolBlock
+{
+    volatile uint64_t key;
+    uint32_t page_index;
+} FakeUnityHandlePoolBlock;
+
+// Hands out handles with a generation in the upper and a slot index in the
+// lower FAKE_UNITY_HANDLE_INDEX_BITS bits, and stores an item of item_size
+// bytes for every slot. Slots live in pages that are never moved, so item
+// pointers stay valid while the pool grows. Allocation and release are
+// lock-free, only adding a page takes grow_lock, so handles can be created
+// and destroyed from any thread.
+//
+// Free slots are kept in a lock-free queue (Michael and Scott), which
+// always holds one of them as its dummy node, so at most
+// 2^FAKE_UNITY_HANDLE_INDEX_BITS - 1 handles are alive at once. The head,
+// the tail and the links carry a tag in their upper 32 bits that changes on
+// every update to avoid ABA.
+//
+// Blocks are a power of two at least as large as the items of a page, so
+// the items of a page overlap at most two blocks and a pointer into them is
+// found in constant time. Entries are only added under grow_lock.
+typedef struct FakeUnityHandlePool
+{
+    volatile uint64_t free_head;
+    volatile uint64_t free_tail;
+    uint32_t item_size;
+    uint32_t block_shift;
+
+    volatile uint32_t grow_lock;
+    volatile uint32_t page_count;
+    FakeUnityHandlePoolPage *volatile pages[FAKE_UNITY_HANDLE_POOL_MAX_PAGE_COUNT];
+    FakeUnityHandlePoolBlock blocks[FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE];
+} FakeUnityHandlePool;
+
+#define FAKE_UNITY_GPU_REQUEST_DONE     0x1
+#define FAKE_UNITY_GPU_REQUEST_ERROR    0x2
+#define FAKE_UNITY_GPU_REQUEST_RELEASED 0x4
+
+// The slot of a request is given back once it is both done and released.
+typedef struct FakeUnityGPURequest
+{
+    volatile uint32_t flags;
+} FakeUnityGPURequest;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+typedef HANDLE FakeUnityThreadHandle;
+typedef CRITICAL_SECTION FakeUnityMutex;
+typedef CONDITION_VARIABLE FakeUnityCondition;
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+typedef pthread_t FakeUnityThreadHandle;
+typedef pthread_mutex_t FakeUnityMutex;
+typedef pthread_cond_t FakeUnityCondition;
+#endif
+
+// Number of commands that can be queued for the render thread before the
+// issuing thread has to wait. Has to be a power of two.
+#ifndef FAKE_UNITY_RENDER_QUEUE_SIZE
+#  define FAKE_UNITY_RENDER_QUEUE_SIZE 4096
+#endif
+
+typedef enum FakeUnityRenderCommandType
+{
+    FakeUnityRenderCommandType_PluginEvent,
+    FakeUnityRenderCommandType_PluginEventAndData,
+    FakeUnityRenderCommandType_BeginFrame,
+    FakeUnityRenderCommandType_EndFrame,
+    FakeUnityRenderCommandType_DestroyTextures,
+    FakeUnityRenderCommandType_UploadTexture,
+    FakeUnityRenderCommandType_ReadbackTexture,
+    FakeUnityRenderCommandType_CompleteTransfers,
+    FakeUnityRenderCommandType_Quit,
+} FakeUnityRenderCommandType;
+
+typedef struct FakeUnityRenderCommand
+{
+    FakeUnityRenderCommandType type;
+    int32_t event_id;
+    UnityRenderingEvent event;
+    UnityRenderingEventAndData event_and_data;
+    void *data;
+
+    // The slot indices of the textures retired by a texture destruction,
+    // owned by the command.
+    int32_t texture_count;
+    uint32_t *texture_indices;
+
+    // A pixel transfer of size bytes between data and a mip level of a
+    // texture. request is zero or completed once the transfer is done.
+    uint32_t texture_handle;
+    uint32_t mip_level;
+    size_t size;
+    uint32_t request;
+
+    // Submit the recorded commands before executing this one.
+    bool flush;
+} FakeUnityRenderCommand;
+
+// The commands are passed through a single producer single consumer ring
+// buffer. Issuing threads are serialized by producer_lock. write_index is
+// only written by the producer, read_index is only written by the render
+// thread after a command was executed. The mutex and conditions are only
+// used when the render thread runs out of work or somebody waits for it.
+typedef struct FakeUnityRenderThread
+{
+    volatile uint32_t running;
+    volatile uint32_t producer_lock;
+
+    volatile uint32_t write_index;
+    volatile uint32_t read_index;
+    FakeUnityRenderCommand *commands;
+
+    volatile uint32_t sleeping;
+    volatile uint32_t waiter_count;
+
+    FakeUnityThreadHandle handle;
+    FakeUnityMutex mutex;
+    FakeUnityCondition wake_condition;
+    FakeUnityCondition idle_condition;
+} FakeUnityRenderThread;
+
+// Plugin event ids have to be in [0, FAKE_UNITY_MAX_EVENT_ID_COUNT).
+// ReserveEventIDRange hands out ranges starting at
+// FAKE_UNITY_FIRST_RESERVED_EVENT_ID, so they don't collide with the small
+// hardcoded ids a lot of plugins use.
+#ifndef FAKE_UNITY_MAX_EVENT_ID_COUNT
+#  define FAKE_UNITY_MAX_EVENT_ID_COUNT 65536
+#endif
+
+#define FAKE_UNITY_FIRST_RESERVED_EVENT_ID 1024
+#define FAKE_UNITY_EVENT_PAGE_SIZE         256
+
+typedef struct FakeUnityPluginEvent
+{
+    // config is only valid once configured is set.
+    volatile uint32_t configured;
+    volatile uint32_t plugin_handle;
+    UnityVulkanPluginEventConfig config;
+
+    // The marker the gpu timings of the event are emitted with, created on
+    // first use by the thread that executes the render commands.
+    const FakeUnityProfilerMarker *gpu_marker;
+} FakeUnityPluginEvent;
+
+typedef struct FakeUnityEventIDRange
+{
+    uint32_t first;
+    uint32_t count;
+    uint32_t plugin_handle;
+} FakeUnityEventIDRange;
+
+typedef struct FakeUnityEventIDRanges
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityEventIDRange *items;
+} FakeUnityEventIDRanges;
+
+// Maps event ids to their owning plugin and configuration. Pages are
+// allocated on first use and never freed before the context is destroyed,
+// so the render thread can look events up without taking a lock.
+typedef struct FakeUnityPluginEvents
+{
+    // Protects the reservations below.
+    volatile uint32_t lock;
+
+    // Ids after the ones reserved so far, relative to
+    // FAKE_UNITY_FIRST_RESERVED_EVENT_ID.
+    uint32_t next_reserved_id;
+    // The ranges reserved while a plugin was loading, which are given back
+    // to free_ranges when it is unloaded or reloaded. Free ranges are
+    // reused before new ids are taken.
+    FakeUnityEventIDRanges reserved_ranges;
+    FakeUnityEventIDRanges free_ranges;
+
+    FakeUnityPluginEvent *volatile pages[FAKE_UNITY_MAX_EVENT_ID_COUNT / FAKE_UNITY_EVENT_PAGE_SIZE];
+} FakeUnityPluginEvents;
+
+// A function that InterceptVulkanAPI installed, together with the plugin
+// that was loading or executing when it was installed.
+typedef struct FakeUnityVulkanInterceptHook
+{
+    PFN_vkVoidFunction function;
+    uint32_t plugin_handle;
+} FakeUnityVulkanInterceptHook;
+
+typedef struct FakeUnityVulkanInterceptHooks
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanInterceptHook *items;
+} FakeUnityVulkanInterceptHooks;
+
+// The chain of hooks of a vulkan function, from the first one that was
+// installed to the latest one, which is the one that gets called. Every
+// hook calls the function that was installed before it, so removing a hook
+// also removes the hooks that were installed after it.
+typedef struct FakeUnityVulkanIntercept
+{
+    uint64_t name_hash;
+    char *name;
+    FakeUnityVulkanInterceptHooks hooks;
+} FakeUnityVulkanIntercept;
+
+// Outlives the renderer, so hooks installed in UnityPluginLoad survive
+// creating the renderer again. The end of every chain is the function the
+// vulkan loader exports, which stays valid because the loader is kept open
+// through loader_handle.
+//
+// Open addressing hash table with linear probing over the hash of the
+// function names, whose capacity is doubled once it is half full. Entries
+// are never removed, a chain without hooks stays in the table.
+typedef struct FakeUnityVulkanIntercepts
+{
+    uint32_t count;
+    uint32_t capacity;
+    FakeUnityVulkanIntercept *items;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    HMODULE loader_handle;
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    void *loader_handle;
+#endif
+} FakeUnityVulkanIntercepts;
+
+// Number of plugins every thread can count vulkan calls for while tracing.
+// Calls of further plugins are not counted.
+#ifndef FAKE_UNITY_VULKAN_TRACE_MAX_PLUGIN_COUNT
+#  define FAKE_UNITY_VULKAN_TRACE_MAX_PLUGIN_COUNT 64
+#endif
+
+// Number of devices the traced functions are remembered for separately.
+// Functions looked up from further devices are not traced.
+#ifndef FAKE_UNITY_VULKAN_TRACE_MAX_DEVICE_COUNT
+#  define FAKE_UNITY_VULKAN_TRACE_MAX_DEVICE_COUNT 16
+#endif
+
+// Number of call sites every thread remembers the plugin of.
+#define __FAKE_UNITY_VULKAN_TRACE_CALLER_CACHE_SIZE 16
+
+// The vulkan functions that are counted while tracing. Every one of them
+// needs a wrapper with its signature, so this is a fixed list of the calls
+// that usually dominate the cost of a plugin. Unlike the other function
+// lists the items are not separated, so the list also works for enums.
+#define __FAKE_UNITY_VULKAN_TRACE_FUNCTIONS(__name__) \
+    __name__(vkQueueSubmit)                           \
+    __name__(vkCmdPipelineBarrier)                    \
+    __name__(vkCmdDispatch)                           \
+    __name__(vkCmdDraw)                               \
+    __name__(vkCmdDrawIndexed)                        \
+    __name__(vkAllocateDescriptorSets)                \
+    __name__(vkUpdateDescriptorSets)                  \
+    __name__(vkAllocateMemory)                        \
+    __name__(vkFreeMemory)                            \
+    __name__(vkCreateBuffer)                          \
+    __name__(vkCreateImage)
+
+typedef enum FakeUnityVulkanTraceFunction
+{
+#define trace_function_enum(name) FakeUnityVulkanTraceFunction_##name,
+    __FAKE_UNITY_VULKAN_TRACE_FUNCTIONS(trace_function_enum)
+#undef trace_function_enum
+
+    FakeUnityVulkanTraceFunction_Count
+} FakeUnityVulkanTraceFunction;
+
+typedef struct FakeUnityVulkanTracePlugin
+{
+    volatile uint32_t plugin_handle;
+    volatile uint64_t counts[FakeUnityVulkanTraceFunction_Count];
+    volatile uint64_t times[FakeUnityVulkanTraceFunction_Count];
+} FakeUnityVulkanTracePlugin;
+
+// Calls are counted per thread, so threads never contend on the counters.
+// Only the owning thread adds plugins, the others read up to plugin_count.
+typedef struct FakeUnityVulkanTraceThread
+{
+    struct FakeUnityVulkanTraceThread *next;
+    const void *key;
+
+    volatile uint32_t plugin_count;
+    FakeUnityVulkanTracePlugin plugins[FAKE_UNITY_VULKAN_TRACE_MAX_PLUGIN_COUNT];
+
+    // Only accessed by the owning thread.
+    uint32_t last_plugin_index;
+
+    // The plugins that code at recently seen return addresses belongs to,
+    // valid while caller_version matches the module version of the trace.
+    uint32_t caller_version;
+    const void *callers[__FAKE_UNITY_VULKAN_TRACE_CALLER_CACHE_SIZE];
+    uint32_t caller_plugins[__FAKE_UNITY_VULKAN_TRACE_CALLER_CACHE_SIZE];
+} FakeUnityVulkanTraceThread;
+
+typedef struct FakeUnityVulkanTraceModule
+{
+    const void *base;
+    uint32_t plugin_handle;
+} FakeUnityVulkanTraceModule;
+
+typedef struct FakeUnityVulkanTraceModules
+{
+    int32_t count;
+    int32_t allocated;
+    FakeUnityVulkanTraceModule *items;
+} FakeUnityVulkanTraceModules;
+
+typedef struct FakeUnityVulkanTrace
+{
+    volatile uint32_t enabled;
+
+    FakeUnityVulkanTraceThread *volatile threads;
+
+    // The libraries of the loaded plugins. The version changes with every
+    // load and unload, which invalidates the caller caches of the threads.
+    volatile uint32_t modules_lock;
+    volatile uint32_t modules_version;
+    FakeUnityVulkanTraceModules modules;
+} FakeUnityVulkanTrace;
+
+// The functions the wrappers call for the devices with a given dispatch
+// key, which every dispatchable handle of a device starts with.
+typedef struct FakeUnityVulkanTraceDevice
+{
+    const void *volatile key;
+    PFN_vkVoidFunction volatile functions[FakeUnityVulkanTraceFunction_Count];
+} FakeUnityVulkanTraceDevice;
+
+// What the wrappers call. This is shared by all contexts, because a
+// wrapper can be called on any thread and does not know the context that
+// handed it out.
+typedef struct FakeUnityVulkanTraceTargets
+{
+    // Taken while a device record is taken or released.
+    volatile uint32_t lock;
+    FakeUnityVulkanTraceDevice devices[FAKE_UNITY_VULKAN_TRACE_MAX_DEVICE_COUNT];
+
+    // Used for handles of devices a function was not looked up from,
+    // taken from the last lookup from an instance.
+    PFN_vkVoidFunction volatile functions[FakeUnityVulkanTraceFunction_Count];
+
+    PFN_vkGetInstanceProcAddr volatile vkGetInstanceProcAddr;
+    PFN_vkGetDeviceProcAddr volatile vkGetDeviceProcAddr;
+} FakeUnityVulkanTraceTargets;
+
+typedef struct FakeUnityVulkanCallStats
+{
+    // Number of calls and the time spent in them in nanoseconds.
+    uint64_t count;
+    uint64_t total_time;
+} FakeUnityVulkanCallStats;
+
 typedef struct FakeUnityState
 {
     UnityGfxRenderer renderer_type;
+    // renderer_type is kUnityGfxRendererNull both for the null renderer and
+    // when there is no renderer at all.
+    bool has_renderer;
 
     FakeUnityInterfaces interfaces;
     FakeUnityGraphicsDeviceEventCallbacks graphics_device_event_callbacks;
 
-    FakeUnityNativePlugin *plugins;
-    uint16_t *free_plugin_indices;
-    uint16_t *plugin_generations;
-    int32_t free_plugin_count;
-    int32_t max_plugin_count;
+    // Items are FakeUnityNativePlugin.
+    FakeUnityHandlePool plugin_pool;
+
+    // Items are FakeUnityTexture.
+    FakeUnityHandlePool texture_pool;
 
-    FakeUnityTexture *textures;
-    uint16_t *free_texture_indices;
-    uint16_t *texture_generations;
-    int32_t free_texture_count;
-    int32_t max_texture_count;
+    // Items are FakeUnityGPURequest.
+    FakeUnityHandlePool request_pool;
+
+    // Items are FakeUnityBuffer.
+    FakeUnityHandlePool buffer_pool;
 
     UnityVulkanInitCallback unity_vulkan_init_callback;
     void *unity_vulkan_init_userdata;
 
+    FakeUnityVulkanIntercepts vulkan_intercepts;
+    FakeUnityVulkanTrace vulkan_trace;
+
+    char *vulkan_pipeline_cache_path;
+
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+    // The inotify instance that watches the directories of hot reloadable
+    // plugins, -1 until the first one is loaded.
+    int hot_reload_fd;
+#endif
+
     IUnityInterfaces unity_interfaces;
     IUnityProfiler unity_profiler;
     IUnityGraphics unity_graphics;
     IUnityGraphicsVulkan unity_graphics_vulkan;
 
+    FakeUnityProfiler profiler;
+
+    // Links the contexts created with fake_unity_context_create.
+    struct FakeUnityState *next_context;
+
+    FakeUnityRenderThread render_thread;
+    FakeUnityPluginEvents plugin_events;
+
     union FakeUnityRenderer
     {
         FakeUnityVulkanRenderer vulkan;
+        FakeUnityNullRenderer null;
     } renderer;
 } FakeUnityState;
 
@@ -208,24 +1395,129 @@ typedef struct FakeUnityState
 // So FakeUnity_TextureFormat_BGRA32 != TextureFormat.BGRA32
 typedef enum FakeUnity_TextureFormat
 {
-    FakeUnity_TextureFormat_Alpha8   = 0,
-    FakeUnity_TextureFormat_ARGB4444 = 1,
-    FakeUnity_TextureFormat_RGB24    = 2,
-    FakeUnity_TextureFormat_RGBA32   = 3,
-    FakeUnity_TextureFormat_ARGB32   = 4,
-    FakeUnity_TextureFormat_RGB565   = 5,
-
-    // TODO: all the rest
+    FakeUnity_TextureFormat_Alpha8             = 0,
+    FakeUnity_TextureFormat_ARGB4444           = 1,
+    FakeUnity_TextureFormat_RGB24              = 2,
+    FakeUnity_TextureFormat_RGBA32             = 3,
+    FakeUnity_TextureFormat_ARGB32             = 4,
+    FakeUnity_TextureFormat_RGB565             = 5,
+    FakeUnity_TextureFormat_R16                = 6,
+    FakeUnity_TextureFormat_DXT1               = 7,
+    FakeUnity_TextureFormat_DXT5               = 8,
+    FakeUnity_TextureFormat_RGBA4444           = 9,
+    FakeUnity_TextureFormat_BGRA32             = 10,
+    FakeUnity_TextureFormat_RHalf              = 11,
+    FakeUnity_TextureFormat_RGHalf             = 12,
+    FakeUnity_TextureFormat_RGBAHalf           = 13,
+    FakeUnity_TextureFormat_RFloat             = 14,
+    FakeUnity_TextureFormat_RGFloat            = 15,
+    FakeUnity_TextureFormat_RGBAFloat          = 16,
+    FakeUnity_TextureFormat_YUY2               = 17,
+    FakeUnity_TextureFormat_RGB9e5Float        = 18,
+    FakeUnity_TextureFormat_BC4                = 19,
+    FakeUnity_TextureFormat_BC5                = 20,
+    FakeUnity_TextureFormat_BC6H               = 21,
+    FakeUnity_TextureFormat_BC7                = 22,
+    FakeUnity_TextureFormat_DXT1Crunched       = 23,
+    FakeUnity_TextureFormat_DXT5Crunched       = 24,
+    FakeUnity_TextureFormat_PVRTC_RGB2         = 25,
+    FakeUnity_TextureFormat_PVRTC_RGBA2        = 26,
+    FakeUnity_TextureFormat_PVRTC_RGB4         = 27,
+    FakeUnity_TextureFormat_PVRTC_RGBA4        = 28,
+    FakeUnity_TextureFormat_ETC_RGB4           = 29,
+    FakeUnity_TextureFormat_EAC_R              = 30,
+    FakeUnity_TextureFormat_EAC_R_SIGNED       = 31,
+    FakeUnity_TextureFormat_EAC_RG             = 32,
+    FakeUnity_TextureFormat_EAC_RG_SIGNED      = 33,
+    FakeUnity_TextureFormat_ETC2_RGB           = 34,
+    FakeUnity_TextureFormat_ETC2_RGBA1         = 35,
+    FakeUnity_TextureFormat_ETC2_RGBA8         = 36,
+    FakeUnity_TextureFormat_ASTC_4x4           = 37,
+    FakeUnity_TextureFormat_ASTC_5x5           = 38,
+    FakeUnity_TextureFormat_ASTC_6x6           = 39,
+    FakeUnity_TextureFormat_ASTC_8x8           = 40,
+    FakeUnity_TextureFormat_ASTC_10x10         = 41,
+    FakeUnity_TextureFormat_ASTC_12x12         = 42,
+    FakeUnity_TextureFormat_RG16               = 43,
+    FakeUnity_TextureFormat_R8                 = 44,
+    FakeUnity_TextureFormat_ETC_RGB4Crunched   = 45,
+    FakeUnity_TextureFormat_ETC2_RGBA8Crunched = 46,
+    FakeUnity_TextureFormat_ASTC_HDR_4x4       = 47,
+    FakeUnity_TextureFormat_ASTC_HDR_5x5       = 48,
+    FakeUnity_TextureFormat_ASTC_HDR_6x6       = 49,
+    FakeUnity_TextureFormat_ASTC_HDR_8x8       = 50,
+    FakeUnity_TextureFormat_ASTC_HDR_10x10     = 51,
+    FakeUnity_TextureFormat_ASTC_HDR_12x12     = 52,
+    FakeUnity_TextureFormat_RG32               = 53,
+    FakeUnity_TextureFormat_RGB48              = 54,
+    FakeUnity_TextureFormat_RGBA64             = 55,
+    FakeUnity_TextureFormat_R8_SIGNED          = 56,
+    FakeUnity_TextureFormat_RG16_SIGNED        = 57,
+    FakeUnity_TextureFormat_RGB24_SIGNED       = 58,
+    FakeUnity_TextureFormat_RGBA32_SIGNED      = 59,
+    FakeUnity_TextureFormat_R16_SIGNED         = 60,
+    FakeUnity_TextureFormat_RG32_SIGNED        = 61,
+    FakeUnity_TextureFormat_RGB48_SIGNED       = 62,
+    FakeUnity_TextureFormat_RGBA64_SIGNED      = 63,
+
+    FakeUnity_TextureFormat_Count
 } FakeUnity_TextureFormat;
 
 typedef uint32_t FakeUnity_Texture2D;
 
+typedef uint32_t FakeUnity_GraphicsBuffer;
+
+// All texture handles come from the same pool, so fake_unity_Texture2D_Destroy
+// and fake_unity_Texture2D_GetNativeTexturePtr accept any of them.
+typedef uint32_t FakeUnity_Texture2DArray;
+typedef uint32_t FakeUnity_Texture3D;
+typedef uint32_t FakeUnity_Cubemap;
+
+typedef uint32_t FakeUnity_AsyncGPURequest;
+
+// A context is a completely independent instance of the simulated engine.
+// It is only ever handed out as a pointer, its contents are private.
+typedef struct FakeUnityContext FakeUnityContext;
+
 // This function initializes the fake_unity library and preallocates space
-// for the native plugins. max_plugin_count determines how many plugins can
-// be loaded at the same time, so this is best set to the upper bound of the
-// expected number of plugins. Returns true on success.
+// for max_plugin_count native plugins and max_texture_count textures. Both
+// grow on demand up to 2^FAKE_UNITY_HANDLE_INDEX_BITS, so these only avoid
+// growing later. Returns true on success.
+// Once initialized, plugins can be loaded and textures can be created and
+// destroyed from any thread.
 FAKE_UNITY_DEF bool fake_unity_initialize(int32_t max_plugin_count, int32_t max_texture_count);
 
+// Tears down the default context: stops the render thread, destroys the
+// renderer like fake_unity_destroy_renderer, calls UnityPluginUnload of
+// every loaded plugin and unloads it, and frees everything else.
+// fake_unity_initialize can be called again afterwards.
+FAKE_UNITY_DEF void fake_unity_shutdown(void);
+
+// Creates an additional context with its own interfaces, plugins, textures,
+// renderer and profiler. The parameters have the same meaning as for
+// fake_unity_initialize. Returns NULL on error.
+FAKE_UNITY_DEF FakeUnityContext *fake_unity_context_create(int32_t max_plugin_count, int32_t max_texture_count);
+
+// Tears down and frees a context created with fake_unity_context_create,
+// like fake_unity_shutdown does for the default context.
+FAKE_UNITY_DEF void fake_unity_context_destroy(FakeUnityContext *context);
+
+// Makes context the current context of the calling thread. All fake_unity
+// functions called on this thread operate on the current context, and so do
+// all calls that plugins make into the unity interfaces from this thread.
+// Passing NULL selects the default context, which is the one set up by
+// fake_unity_initialize. The render thread of a context is bound to it.
+// Worker threads that a plugin starts on its own can't be bound by the
+// harness, they use the default context like every thread that never made a
+// context current. Plugins that call the unity interfaces from their own
+// threads therefore have to be loaded into the default context. If a context
+// is destroyed while it is current on another thread, that thread falls back
+// to the default context.
+FAKE_UNITY_DEF void fake_unity_context_make_current(FakeUnityContext *context);
+
+// Returns the current context of the calling thread.
+FAKE_UNITY_DEF FakeUnityContext *fake_unity_context_get_current(void);
+
 // Loads a native plugin from a given filename and calls UnityPluginLoad if
 // available. Returns a non zero plugin handle on success and zero on error.
 FAKE_UNITY_DEF uint32_t fake_unity_load_native_plugin(const char *filename);
@@ -233,879 +1525,8754 @@ FAKE_UNITY_DEF uint32_t fake_unity_load_native_plugin(const char *filename);
 // Retrieves the pointer to a function from the native plugin.
 FAKE_UNITY_DEF void *fake_unity_native_plugin_get_proc_address(uint32_t plugin_handle, const char *proc_name);
 
+// Calls UnityPluginUnload, unloads the library and frees the slot of a
+// plugin, so the handle becomes stale. Waits for the render thread first,
+// because commands issued before may still call into the plugin. Like in
+// the engine, the plugin has to unregister its callbacks in
+// UnityPluginUnload. The event id ranges it reserved are given back, its
+// events lose their configuration, and its vulkan hooks and traced calls
+// are dropped. The same happens when a plugin is reloaded.
+FAKE_UNITY_DEF void fake_unity_unload_native_plugin(uint32_t plugin_handle);
+
+// Like fake_unity_load_native_plugin, but the library is loaded from a copy
+// next to filename, so filename can be rebuilt while the plugin is loaded.
+// Rebuilds are picked up by fake_unity_reload_native_plugins.
+FAKE_UNITY_DEF uint32_t fake_unity_load_native_plugin_hot_reloadable(const char *filename);
+
+// Reloads every hot reloadable plugin whose library was rewritten since it
+// was loaded. The new library is loaded from a fresh copy, then the old one
+// gets UnityPluginUnload and is unloaded, and the new one gets
+// UnityPluginLoad. Plugin handles stay the same, but pointers returned by
+// fake_unity_native_plugin_get_proc_address have to be fetched again. If
+// the new library can not be loaded, the old one stays. Changes are watched
+// with inotify on linux and android and by modification time elsewhere.
+// Call this between frames, e.g. before fake_unity_begin_frame. Returns the
+// number of reloaded plugins.
+FAKE_UNITY_DEF int32_t fake_unity_reload_native_plugins(void);
+
 // Initializes the rendering subsystem with vulkan. device_index selects the
-// physical vulkan device to use. If device_index is negative a default
-// device is used. Returns true on success.
+// physical vulkan device to use. If device_index is negative the device
+// with a graphics queue that scores best is used, preferring discrete over
+// integrated over virtual over cpu devices. Returns true on success.
 // It should be called after fake_unity_load_native_plugin so the native
 // plugin can hook into the vulkan instance and device creation.
 FAKE_UNITY_DEF bool fake_unity_create_vulkan_renderer(int32_t device_index);
 
+// Initializes the rendering subsystem without a gpu, like the engine does
+// in batch mode with -nographics. IUnityGraphics::GetRenderer returns
+// kUnityGfxRendererNull and the vulkan interface has nothing to offer, but
+// device events are sent, plugin events are executed and textures work.
+// Their pixels live in host memory, so uploads and readbacks are plain
+// copies. This is meant for tests that only need the plugin interfaces and
+// should not pay for loading vulkan. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_create_null_renderer(void);
+
+// Sends kUnityGfxDeviceEventShutdown, submits the frame that is being
+// recorded and waits for the gpu. Then destroys all textures, the vulkan
+// device and instance and unloads the vulkan loader, or frees the pixel
+// memory of the null renderer. Outstanding transfers
+// are completed first. Afterwards a renderer can be created again.
+FAKE_UNITY_DEF void fake_unity_destroy_renderer(void);
+
+// Cycles the device like the engine does when it recovers from a reset:
+// sends kUnityGfxDeviceEventBeforeReset, submits the frame that is being
+// recorded, waits until the gpu is idle and completes everything that was
+// waiting for it, then sends kUnityGfxDeviceEventAfterReset. The device and
+// all textures stay valid.
+FAKE_UNITY_DEF void fake_unity_reset_renderer(void);
+
+typedef enum FakeUnityVulkanQueueType
+{
+    FakeUnityVulkanQueueType_Graphics = 0,
+    FakeUnityVulkanQueueType_Compute  = 1,
+    FakeUnityVulkanQueueType_Transfer = 2,
+} FakeUnityVulkanQueueType;
+
+// Returns the queue of the given type and stores its family index in
+// queue_family_index if that is not NULL. The compute and transfer queues
+// are the graphics queue if the device has no dedicated queue family for
+// them. Returns VK_NULL_HANDLE if there is no vulkan renderer.
+FAKE_UNITY_DEF VkQueue fake_unity_vulkan_get_queue(FakeUnityVulkanQueueType type, uint32_t *queue_family_index);
+
+// Sets the file the vulkan pipeline cache is loaded from when the renderer is
+// created and saved to by fake_unity_vulkan_save_pipeline_cache and when the
+// renderer is destroyed. A file that was written for another device or
+// driver is ignored. Pass NULL to not persist the pipeline cache, which is
+// the default.
+FAKE_UNITY_DEF void fake_unity_vulkan_set_pipeline_cache_path(const char *path);
+
+// Writes the contents of the vulkan pipeline cache to the file set with
+// fake_unity_vulkan_set_pipeline_cache_path. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_vulkan_save_pipeline_cache(void);
+
 // Returns the address of a vulkan instance procedure. Is only expected to be
 // called after a successful call to fake_unit_create_vulkan_renderer.
-// Returns non-NULL on success.
+// Functions that were intercepted with InterceptVulkanAPI return the latest
+// hook. Returns non-NULL on success.
 FAKE_UNITY_DEF PFN_vkVoidFunction fake_unity_vulkan_get_instance_proc_address(const char *proc_name);
 
 // Returns the address of a vulkan device procedure. Is only expected to be
 // called after a successful call to fake_unit_create_vulkan_renderer.
-// Returns non-NULL on success.
+// Functions that were intercepted with InterceptVulkanAPI return the latest
+// hook. Functions of the device table are found with a hash lookup and
+// returned from it, others are looked up with vkGetDeviceProcAddr. Returns
+// non-NULL on success.
 FAKE_UNITY_DEF PFN_vkVoidFunction fake_unity_vulkan_get_device_proc_address(const char *proc_name);
 
+// Makes a buffer that was created with the device of the vulkan renderer
+// known to the plugins, which access it with AccessBuffer through the
+// pointer returned by fake_unity_GraphicsBuffer_GetNativeBufferPtr. The
+// buffer stays owned by the caller and has to outlive its registration,
+// which ends with the renderer at the latest. Returns zero on error.
+FAKE_UNITY_DEF FakeUnity_GraphicsBuffer fake_unity_vulkan_register_buffer(VkBuffer buffer, VkDeviceSize size, VkBufferUsageFlags usage);
+
+// Ends the registration of a buffer. Plugin events that access the buffer
+// must have been executed, see fake_unity_render_thread_sync.
+FAKE_UNITY_DEF void fake_unity_vulkan_unregister_buffer(FakeUnity_GraphicsBuffer buffer);
+
+// This implements the C# scripting api function GraphicsBuffer.GetNativeBufferPtr.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/GraphicsBuffer.GetNativeBufferPtr.html.
+// Returns NULL for stale handles.
+FAKE_UNITY_DEF void *fake_unity_GraphicsBuffer_GetNativeBufferPtr(FakeUnity_GraphicsBuffer buffer);
+
+// Returns the dispatch table of the vulkan device, so the harness can call
+// any device level function without looking it up by name and without
+// going through the trampolines of the vulkan loader. Hooks installed with
+// InterceptVulkanAPI are in the table as well. The table stays valid until
+// the renderer is destroyed. Returns NULL without a vulkan renderer.
+FAKE_UNITY_DEF const FakeUnityVulkanDeviceTable *fake_unity_vulkan_get_device_table(void);
+
+// Enables or disables counting the vulkan calls of plugins. While enabled,
+// the vkGetInstanceProcAddr that plugins get from InterceptInitialization
+// and IUnityGraphicsVulkan::Instance hands out wrappers for the functions
+// in __FAKE_UNITY_VULKAN_TRACE_FUNCTIONS, which count every call and the
+// time spent in it. Plugins usually look their functions up once, so
+// enable this before creating the renderer. A call is attributed to the
+// plugin whose UnityPluginLoad, UnityPluginUnload, device event callback
+// or plugin event runs on the calling thread. Other calls, like those on
+// threads of a plugin or in events with ids nobody reserved, count for
+// the plugin whose library made the call, or for plugin handle zero if it
+// was made from outside any plugin. Disabled by default.
+FAKE_UNITY_DEF void fake_unity_vulkan_trace_set_enabled(bool enabled);
+
+// Sums up the calls a plugin made to a traced vulkan function on all
+// threads since it was loaded or last reloaded. Returns false if the
+// function is not traced.
+FAKE_UNITY_DEF bool fake_unity_vulkan_trace_get_stats(uint32_t plugin_handle, const char *function_name, FakeUnityVulkanCallStats *stats);
+
+// Resets the counts of all plugins and functions to zero.
+FAKE_UNITY_DEF void fake_unity_vulkan_trace_reset(void);
+
+// Creates a texture that owns its image, like a texture created by the
+// engine. The image has a single mip level, uses the sRGB variant of the
+// format if there is one and is sub-allocated from large memory blocks.
+// With the null renderer the pixels are pooled host memory instead, which
+// also works for formats without a vulkan format like YUY2. Its contents
+// are undefined until they are set. Returns zero on error.
+FAKE_UNITY_DEF FakeUnity_Texture2D fake_unity_create_texture(int32_t width, int32_t height, FakeUnity_TextureFormat format);
+
 // This implements the C# scripting api function Texture2D.CreateExternalTexture.
 // See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Texture2D.CreateExternalTexture.html.
+// With the null renderer native_texture points to host memory that holds
+// the pixels of every mip level and layer, and has to outlive the texture.
 FAKE_UNITY_DEF FakeUnity_Texture2D fake_unity_Texture2D_CreateExternalTexture(int32_t width, int32_t height, FakeUnity_TextureFormat format, bool mip_chain, bool linear, void *native_texture);
 
+// This implements the C# scripting api function Texture2DArray.CreateExternalTexture.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Texture2DArray.CreateExternalTexture.html.
+FAKE_UNITY_DEF FakeUnity_Texture2DArray fake_unity_Texture2DArray_CreateExternalTexture(int32_t width, int32_t height, int32_t depth, FakeUnity_TextureFormat format, bool mip_chain, bool linear, void *native_texture);
+
+// This implements the C# scripting api function Texture3D.CreateExternalTexture.
+// There is no linear parameter, 3D textures always use the linear format.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Texture3D.CreateExternalTexture.html.
+FAKE_UNITY_DEF FakeUnity_Texture3D fake_unity_Texture3D_CreateExternalTexture(int32_t width, int32_t height, int32_t depth, FakeUnity_TextureFormat format, bool mip_chain, void *native_texture);
+
+// This implements the C# scripting api function Cubemap.CreateExternalTexture.
+// The image has to have 6 array layers. Cubemaps use the sRGB format.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Cubemap.CreateExternalTexture.html.
+FAKE_UNITY_DEF FakeUnity_Cubemap fake_unity_Cubemap_CreateExternalTexture(int32_t width, FakeUnity_TextureFormat format, bool mip_chain, void *native_texture);
+
+// Creates count textures of the same size and format in one call.
+// native_textures holds a VkImage pointer, or pixel memory with the null
+// renderer, for every texture. On success the
+// handles are written to textures. Either all or none of the textures are
+// created. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_Texture2D_CreateExternalTextures(int32_t count, int32_t width, int32_t height, FakeUnity_TextureFormat format, bool mip_chain, bool linear, void *const *native_textures, FakeUnity_Texture2D *textures);
+
+// The handle is stale as soon as this returns, also for plugin events that
+// were issued before and not executed yet. The image view and the slot of
+// the texture are released in order with the plugin events on the render
+// thread, once the gpu finished every frame that could have used it.
 FAKE_UNITY_DEF void fake_unity_Texture2D_Destroy(FakeUnity_Texture2D texture_handle);
 
+// Destroys count textures with a single render command.
+FAKE_UNITY_DEF void fake_unity_Texture2D_DestroyTextures(int32_t count, const FakeUnity_Texture2D *textures);
+
+// Pixel data is laid out like in Texture2D.SetPixelData: rows of pixels or
+// compressed blocks without padding, bottom row first, followed by the
+// other array layers, cube faces or depth slices of the mip level. Transfers
+// are staged in a ring buffer and recorded into the command buffer of the
+// current frame in order with the plugin events. Outside of a frame they
+// are submitted on their own. Afterwards the texture is in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+
+// Copies size bytes of data to mip_level of texture. data can be reused
+// once this returns. Returns false if size does not match the mip level.
+FAKE_UNITY_DEF bool fake_unity_Texture2D_SetPixelData(FakeUnity_Texture2D texture, uint32_t mip_level, const void *data, size_t size);
+
+// Like fake_unity_Texture2D_SetPixelData, but data has to stay valid until
+// the returned request is done. Returns zero on error.
+FAKE_UNITY_DEF FakeUnity_AsyncGPURequest fake_unity_Texture2D_SetPixelDataAsync(FakeUnity_Texture2D texture, uint32_t mip_level, const void *data, size_t size);
+
+// Copies mip_level of texture to data and waits for it. Returns false if
+// size does not match the mip level.
+FAKE_UNITY_DEF bool fake_unity_Texture2D_GetPixelData(FakeUnity_Texture2D texture, uint32_t mip_level, void *data, size_t size);
+
+// This implements the C# scripting api function AsyncGPUReadback.Request for
+// textures, with the destination passed up front. data has to stay valid
+// until the returned request is done. Returns zero on error.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Rendering.AsyncGPUReadback.Request.html.
+FAKE_UNITY_DEF FakeUnity_AsyncGPURequest fake_unity_AsyncGPUReadback_Request(FakeUnity_Texture2D texture, uint32_t mip_level, void *data, size_t size);
+
+// Requests are completed when a later frame begins and the gpu finished the
+// frame of the transfer, or when they are waited for. Released requests
+// count as done.
+FAKE_UNITY_DEF bool fake_unity_AsyncGPURequest_IsDone(FakeUnity_AsyncGPURequest request);
+
+// Returns true if the transfer of a done request failed.
+FAKE_UNITY_DEF bool fake_unity_AsyncGPURequest_HasError(FakeUnity_AsyncGPURequest request);
+
+// Waits until the request is done. If the transfer was recorded in the
+// current frame, that frame is submitted early and a new one is started.
+FAKE_UNITY_DEF void fake_unity_AsyncGPURequest_WaitForCompletion(FakeUnity_AsyncGPURequest request);
+
+// Every request has to be released, also before it is done.
+FAKE_UNITY_DEF void fake_unity_AsyncGPURequest_Release(FakeUnity_AsyncGPURequest request);
+
+// This implements the C# scripting api function Texture.GetNativeTexturePtr.
+// On vulkan this is a pointer to the VkImage, which is what plugins pass to
+// AccessTexture. External textures are expected to be in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL when they are created. With the
+// null renderer this is the pixel memory of the texture. Returns NULL for
+// stale handles.
+FAKE_UNITY_DEF void *fake_unity_Texture2D_GetNativeTexturePtr(FakeUnity_Texture2D texture_handle);
+
+// Starts a dedicated render thread like the one of the engine. Plugin events
+// issued afterwards are queued and executed asynchronously on that thread.
+// Without a render thread they are executed right away on the issuing
+// thread. On posix systems this requires linking with pthread.
+// Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_render_thread_start(void);
+
+// Executes all queued plugin events and stops the render thread.
+FAKE_UNITY_DEF void fake_unity_render_thread_stop(void);
+
+// Waits until the render thread has executed all plugin events issued so
+// far. This is the equivalent of a flush of the engine.
+FAKE_UNITY_DEF void fake_unity_render_thread_sync(void);
+
+// Starts recording a new frame. The command buffer that is handed out by
+// CommandRecordingState cycles through FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT
+// frames. Waits for the gpu if the oldest frame is still in flight. Like
+// plugin events, this is executed on the render thread if one is running.
+FAKE_UNITY_DEF void fake_unity_begin_frame(void);
+
+// Submits the command buffers of the current frame. While a trace is being
+// written, this also moves the buffered profiler events into the trace, so
+// it has to be called on the same thread as the trace functions.
+FAKE_UNITY_DEF void fake_unity_end_frame(void);
+
+// Returns the handle of the plugin that reserved or configured event_id
+// while it was loaded, or zero if there is none.
+FAKE_UNITY_DEF uint32_t fake_unity_plugin_event_get_owner(int event_id);
+
+// This implements the C# scripting api function GL.IssuePluginEvent.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/GL.IssuePluginEvent.html.
+FAKE_UNITY_DEF void fake_unity_issue_plugin_event(UnityRenderingEvent func, int event_id);
+
+// This implements the C# scripting api function CommandBuffer.IssuePluginEventAndData.
+// See https://docs.unity3d.com/6000.0/Documentation/ScriptReference/Rendering.CommandBuffer.IssuePluginEventAndData.html.
+FAKE_UNITY_DEF void fake_unity_issue_plugin_event_and_data(UnityRenderingEventAndData func, int event_id, void *data);
+
+// Enables or disables the capturing of profiler events. This is what the
+// IsEnabled function of IUnityProfiler reports back to the plugins. While
+// enabled, the vulkan renderer also times every frame and every plugin
+// event on the gpu with timestamp queries. The timings are read back a few
+// frames later, when the gpu is known to be done, and are emitted on a
+// thread called "GPU" with the markers "GPU Frame" and "GPU Plugin Event
+// <event id>". Gpu and cpu clocks are not calibrated against each other, so
+// the events of a frame are placed relative to its first submission, or to
+// the end of the previous frame if that is later. Transfers recorded
+// outside of a frame are not timed. The profiler is disabled by default.
+FAKE_UNITY_DEF void fake_unity_profiler_set_enabled(bool enabled);
+
+// Selects what the profiler does with emitted events while it is enabled.
+// mode is a combination of FakeUnityProfilerMode flags. The default is
+// FakeUnityProfilerMode_Events.
+FAKE_UNITY_DEF void fake_unity_profiler_set_mode(uint32_t mode);
+
+// Fills stats with the aggregated timings of the marker called name. The
+// percentiles are upper bounds of the histogram bucket they fall into.
+// Requires FakeUnityProfilerMode_Statistics. Returns false if there is no
+// marker with that name.
+FAKE_UNITY_DEF bool fake_unity_profiler_get_marker_stats(const char *name, FakeUnityProfilerMarkerStats *stats);
+
+// Returns the duration in nanoseconds below which the given fraction (0 to 1)
+// of the samples of the marker called name fall. Returns 0 if there is no
+// marker with that name or no samples.
+FAKE_UNITY_DEF uint64_t fake_unity_profiler_get_marker_percentile(const char *name, double percentile);
+
+// Resets the statistics of all markers.
+FAKE_UNITY_DEF void fake_unity_profiler_reset_marker_stats(void);
+
+// Calls callback for every buffered profiler event in the order they were
+// emitted per thread and releases them from the thread buffers afterwards.
+// Must not be called from within callback. Returns the number of events.
+FAKE_UNITY_DEF int64_t fake_unity_profiler_consume_events(FakeUnityProfilerEventCallback callback, void *userdata);
+
+// Returns the number of events that were dropped, because a thread buffer
+// was full.
+FAKE_UNITY_DEF int64_t fake_unity_profiler_get_dropped_event_count(void);
+
+// Unpacks the data item at index of a captured event. data->ptr points into
+// the event itself. Returns false if index is out of bounds.
+FAKE_UNITY_DEF bool fake_unity_profiler_event_get_data(const FakeUnityProfilerEvent *event, int32_t index, UnityProfilerMarkerData *data);
+
+// Starts streaming captured profiler events to a chrome trace event json file
+// at path, which can be opened with chrome://tracing or ui.perfetto.dev.
+// Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_profiler_begin_trace(const char *path);
+
+// Consumes all buffered profiler events and appends them to the trace file.
+// The events are written in fixed size chunks, so this can be called
+// periodically for long running captures. fake_unity_end_frame drains the
+// events too, but only this writes out the last partial chunk. Dropped events
+// are reported on stderr. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_profiler_flush_trace(void);
+
+// Flushes the remaining events, writes the thread names and closes the trace
+// file. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_profiler_end_trace(void);
+
+// Writes all buffered profiler events to a chrome trace event json file at
+// path. This is the same as calling begin, flush and end. Returns true on success.
+FAKE_UNITY_DEF bool fake_unity_profiler_write_trace(const char *path);
+
 #endif // __FAKE_UNITY_INCLUDE__
 
 #if defined(FAKE_UNITY_IMPLEMENTATION)
 
-static FakeUnityState __fake_unity_state;
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
 
 #if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
 #  include <dlfcn.h>
+#  include <sched.h>
+#  include <time.h>
+#  include <unistd.h>
 #endif
 
-static inline const char *
-__fake_unity_vk_physical_device_type_to_string(VkPhysicalDeviceType type)
-{
-    const char *str = "<unknown-vk-physical-device-type>";
-
-#  define NAME(name) case name: str = #name; break
+// glibc only declares dladdr with _GNU_SOURCE, which C++ compilers define.
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_MACOS || (FAKE_UNITY_PLATFORM_LINUX && defined(_GNU_SOURCE))
+#  define __FAKE_UNITY_HAS_DLADDR 1
+#else
+#  define __FAKE_UNITY_HAS_DLADDR 0
+#endif
 
-    switch (type)
-    {
-        NAME(VK_PHYSICAL_DEVICE_TYPE_OTHER);
-        NAME(VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU);
-        NAME(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
-        NAME(VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU);
-        NAME(VK_PHYSICAL_DEVICE_TYPE_CPU);
-        default: break;
-    }
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+#  include <sys/inotify.h>
+#else
+#  include <sys/stat.h>
+#endif
 
-#  undef NAME
+#if FAKE_UNITY_PLATFORM_WINDOWS
+#  include <malloc.h>
+#endif
 
-    return str;
-}
+#if defined(__cplusplus) && (__cplusplus >= 201103L)
+#  define __FAKE_UNITY_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#  define __FAKE_UNITY_THREAD_LOCAL __declspec(thread)
+#else
+#  define __FAKE_UNITY_THREAD_LOCAL __thread
+#endif
 
-static inline VkFormat
-__fake_unity_get_vk_format(FakeUnity_TextureFormat format, bool linear)
-{
-    switch (format)
-    {
-        // case FakeUnity_TextureFormat_Alpha8:
-        // case FakeUnity_TextureFormat_ARGB4444:
-        // case FakeUnity_TextureFormat_RGB24:
-        case FakeUnity_TextureFormat_RGBA32:   return linear ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB;
-        // case FakeUnity_TextureFormat_ARGB32:
-        // case FakeUnity_TextureFormat_RGB565:
-    }
+// The address a function returns to, which lies in the code of its caller.
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#  define __FAKE_UNITY_RETURN_ADDRESS() _ReturnAddress()
+#else
+#  define __FAKE_UNITY_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
 
-    return VK_FORMAT_UNDEFINED;
-}
+static FakeUnityState __fake_unity_default_state;
+static __FAKE_UNITY_THREAD_LOCAL FakeUnityState *__fake_unity_current_state;
 
-#define ARRAY_ENSURE_SPACE(array, item_type)                                                      \
-    do {                                                                                          \
-        if ((array)->allocated == 0)                                                              \
-        {                                                                                         \
-            (array)->count = 0;                                                                   \
-            (array)->allocated = 16;                                                              \
-            (array)->items = (item_type *) malloc(sizeof(*(array)->items) * (array)->allocated);  \
-        }                                                                                         \
-        if ((array)->count == (array)->allocated)                                                 \
-        {                                                                                         \
-            (array)->allocated *= 2;                                                              \
-            (array)->items = (item_type *) realloc((array)->items,                                \
-                                                   sizeof(*(array)->items) * (array)->allocated); \
-        }                                                                                         \
-    } while (0)
+#if defined(_MSC_VER)
 
-static IUnityInterface *
-IUnityInterfaces_GetInterfaceSplit(unsigned long long guid_high, unsigned long long guid_low)
+static inline uint32_t
+__fake_unity_atomic_load_u32(volatile uint32_t *ptr)
 {
-    for (int32_t i = 0; i < __fake_unity_state.interfaces.count; i += 1)
-    {
-        FakeUnityInterface *item = __fake_unity_state.interfaces.items + i;
-
-        if ((item->guid_high == guid_high) && (item->guid_low == guid_low))
-        {
-            return item->ptr;
-        }
-    }
-
-    return 0;
+    return (uint32_t) InterlockedOr((volatile LONG *) ptr, 0);
 }
 
-static void
-IUnityInterfaces_RegisterInterfaceSplit(unsigned long long guid_high, unsigned long long guid_low, IUnityInterface *ptr)
+static inline uint64_t
+__fake_unity_atomic_load_u64(volatile uint64_t *ptr)
 {
-    ARRAY_ENSURE_SPACE(&__fake_unity_state.interfaces, FakeUnityInterface);
-
-    FakeUnityInterface *item = __fake_unity_state.interfaces.items + __fake_unity_state.interfaces.count;
-    __fake_unity_state.interfaces.count += 1;
-
-    item->guid_high = guid_high;
-    item->guid_low  = guid_low;
-    item->ptr       = ptr;
+    return (uint64_t) InterlockedOr64((volatile LONG64 *) ptr, 0);
 }
 
-static IUnityInterface *
-IUnityInterfaces_GetInterface(UnityInterfaceGUID guid)
+static inline void *
+__fake_unity_atomic_load_ptr(void *volatile *ptr)
 {
-#ifndef __cplusplus
-    fprintf(stderr, "[fake_unity] warning: your program is not compiled as a c++ program,\n"
-                    "             but it looks like the native unity plugin you are loading is.\n"
-                    "             Due to calling conventions being incompatible, calling GetInterface\n"
-                    "             may not work. Please compile your program as a c++ program or\n"
-                    "             make the native unity plugin call GetInterfaceSplit.\n");
-#endif
-
-    return IUnityInterfaces_GetInterfaceSplit(guid.m_GUIDHigh, guid.m_GUIDLow);
+    return InterlockedCompareExchangePointer(ptr, 0, 0);
 }
 
-static void
-IUnityInterfaces_RegisterInterface(UnityInterfaceGUID guid, IUnityInterface *ptr)
+static inline void
+__fake_unity_atomic_store_u32(volatile uint32_t *ptr, uint32_t value)
 {
-#ifndef __cplusplus
-    fprintf(stderr, "[fake_unity] warning: your program is not compiled as a c++ program,\n"
-                    "             but it looks like the native unity plugin you are loading is.\n"
-                    "             Due to calling conventions being incompatible, calling RegisterInterface\n"
-                    "             may not work. Please compile your program as a c++ program or\n"
-                    "             make the native unity plugin call RegisterInterfaceSplit.\n");
-#endif
-
-    return IUnityInterfaces_RegisterInterfaceSplit(guid.m_GUIDHigh, guid.m_GUIDLow, ptr);
+    InterlockedExchange((volatile LONG *) ptr, (LONG) value);
 }
 
-static void
-IUnityProfiler_EmitEvent(const UnityProfilerMarkerDesc* markerDesc, UnityProfilerMarkerEventType eventType, uint16_t eventDataCount, const UnityProfilerMarkerData* eventData)
+static inline void
+__fake_unity_atomic_store_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: EmitEvent\n");
+    InterlockedExchange64((volatile LONG64 *) ptr, (LONG64) value);
 }
 
-static int
-IUnityProfiler_IsEnabled()
+static inline void
+__fake_unity_atomic_store_ptr(void *volatile *ptr, void *value)
 {
-    fprintf(stderr, "[fake_unity] TODO: IsEnabled\n");
-    return 0;
+    InterlockedExchangePointer(ptr, value);
 }
 
-static int
-IUnityProfiler_IsAvailable()
+// Returns the value before the addition.
+static inline uint32_t
+__fake_unity_atomic_add_u32(volatile uint32_t *ptr, uint32_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: IsAvailable\n");
-    return 0;
+    return (uint32_t) InterlockedExchangeAdd((volatile LONG *) ptr, (LONG) value);
 }
 
-static int
-IUnityProfiler_CreateMarker(const UnityProfilerMarkerDesc** desc, const char* name, UnityProfilerCategoryId category, UnityProfilerMarkerFlags flags, int eventDataCount)
+// Returns the value before the addition.
+static inline uint64_t
+__fake_unity_atomic_add_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: CreateMarker\n");
-    return 0;
+    return (uint64_t) InterlockedExchangeAdd64((volatile LONG64 *) ptr, (LONG64) value);
 }
 
-static int
-IUnityProfiler_SetMarkerMetadataName(const UnityProfilerMarkerDesc* desc, int index, const char* metadataName, UnityProfilerMarkerDataType metadataType, UnityProfilerMarkerDataUnit metadataUnit)
+static inline bool
+__fake_unity_atomic_cas_u32(volatile uint32_t *ptr, uint32_t expected, uint32_t desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: SetMarkerMetadataName\n");
-    return 0;
+    return (uint32_t) InterlockedCompareExchange((volatile LONG *) ptr, (LONG) desired, (LONG) expected) == expected;
 }
 
-static int
-IUnityProfiler_RegisterThread(UnityProfilerThreadId* threadId, const char* groupName, const char* name)
+static inline bool
+__fake_unity_atomic_cas_u64(volatile uint64_t *ptr, uint64_t expected, uint64_t desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: RegisterThread\n");
-    return 0;
+    return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) ptr, (LONG64) desired, (LONG64) expected) == expected;
 }
 
-static int
-IUnityProfiler_UnregisterThread(UnityProfilerThreadId threadId)
+static inline bool
+__fake_unity_atomic_cas_ptr(void *volatile *ptr, void *expected, void *desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: UnregisterThread\n");
-    return 0;
+    return InterlockedCompareExchangePointer(ptr, desired, expected) == expected;
 }
 
-static UnityGfxRenderer
-IUnityGraphics_GetRenderer()
+static inline void
+__fake_unity_atomic_fence(void)
 {
-    return __fake_unity_state.renderer_type;
+    MemoryBarrier();
 }
 
-static void
-IUnityGraphics_RegisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+static inline void
+__fake_unity_thread_yield(void)
 {
-    ARRAY_ENSURE_SPACE(&__fake_unity_state.graphics_device_event_callbacks, IUnityGraphicsDeviceEventCallback);
-
-    __fake_unity_state.graphics_device_event_callbacks.items[__fake_unity_state.graphics_device_event_callbacks.count] = callback;
-    __fake_unity_state.graphics_device_event_callbacks.count += 1;
+    SwitchToThread();
 }
 
-static void
-IUnityGraphics_UnregisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+#else
+
+static inline uint32_t
+__fake_unity_atomic_load_u32(volatile uint32_t *ptr)
 {
-    for (int32_t i = 0; i < __fake_unity_state.graphics_device_event_callbacks.count; i += 1)
-    {
-        if (__fake_unity_state.graphics_device_event_callbacks.items[i] == callback)
-        {
-            __fake_unity_state.graphics_device_event_callbacks.count -= 1;
-            __fake_unity_state.graphics_device_event_callbacks.items[i] =
-                __fake_unity_state.graphics_device_event_callbacks.items[__fake_unity_state.graphics_device_event_callbacks.count];
-        }
-    }
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
 }
 
-static int
-IUnityGraphics_ReserveEventIDRange(int count)
+static inline uint64_t
+__fake_unity_atomic_load_u64(volatile uint64_t *ptr)
 {
-    fprintf(stderr, "[fake_unity] TODO: ReserveEventIDRange\n");
-    // TODO:
-    return 0;
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
 }
 
-static bool
-UnityGraphicsVulkan_InterceptInitialization(UnityVulkanInitCallback func, void *userdata)
+static inline void *
+__fake_unity_atomic_load_ptr(void *volatile *ptr)
 {
-    __fake_unity_state.unity_vulkan_init_callback = func;
-    __fake_unity_state.unity_vulkan_init_userdata = userdata;
-    return true;
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
 }
 
-static PFN_vkVoidFunction
-UnityGraphicsVulkan_InterceptVulkanAPI(const char *name, PFN_vkVoidFunction func)
+static inline void
+__fake_unity_atomic_store_u32(volatile uint32_t *ptr, uint32_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: InterceptVulkanAPI\n");
-    return 0;
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
 }
 
-static void
-UnityGraphicsVulkan_ConfigureEvent(int event_id, const UnityVulkanPluginEventConfig *plugin_event_config)
+static inline void
+__fake_unity_atomic_store_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: ConfigureEvent\n");
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
 }
 
-static UnityVulkanInstance
-UnityGraphicsVulkan_Instance()
+static inline void
+__fake_unity_atomic_store_ptr(void *volatile *ptr, void *value)
 {
-    UnityVulkanInstance vulkan_instance;
-
-    vulkan_instance.pipelineCache = VK_NULL_HANDLE;
-    vulkan_instance.instance = __fake_unity_state.renderer.vulkan.instance;
-    vulkan_instance.physicalDevice = __fake_unity_state.renderer.vulkan.physical_device;
-    vulkan_instance.device = __fake_unity_state.renderer.vulkan.device;
-    vulkan_instance.graphicsQueue = __fake_unity_state.renderer.vulkan.graphics_queue;
-    vulkan_instance.getInstanceProcAddr = __fake_unity_state.renderer.vulkan.loader_vkGetInstanceProcAddr;
-    vulkan_instance.queueFamilyIndex = __fake_unity_state.renderer.vulkan.graphics_queue_index;
-
-    return vulkan_instance;
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
 }
 
-static bool
-UnityGraphicsVulkan_CommandRecordingState(UnityVulkanRecordingState *command_recording_state, UnityVulkanGraphicsQueueAccess queue_access)
+// Returns the value before the addition.
+static inline uint32_t
+__fake_unity_atomic_add_u32(volatile uint32_t *ptr, uint32_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: CommandRecordingState\n");
-    return false;
+    return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
 }
 
-static bool
-UnityGraphicsVulkan_AccessTexture(void* native_texture, const VkImageSubresource *sub_resource, VkImageLayout layout,
-                                  VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
-                                  UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+// Returns the value before the addition.
+static inline uint64_t
+__fake_unity_atomic_add_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessTexture\n");
-    return false;
+    return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
 }
 
-static bool
-UnityGraphicsVulkan_AccessRenderBufferTexture(UnityRenderBuffer native_render_buffer, const VkImageSubresource *sub_resource, VkImageLayout layout,
-                                              VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
-                                              UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+static inline bool
+__fake_unity_atomic_cas_u32(volatile uint32_t *ptr, uint32_t expected, uint32_t desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessRenderBufferTexture\n");
-    return false;
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
 }
 
-static bool
-UnityGraphicsVulkan_AccessRenderBufferResolveTexture(UnityRenderBuffer native_render_buffer, const VkImageSubresource *sub_resource, VkImageLayout layout,
-                                                     VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
-                                                     UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+static inline bool
+__fake_unity_atomic_cas_u64(volatile uint64_t *ptr, uint64_t expected, uint64_t desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessRenderBufferResolveTexture\n");
-    return false;
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
 }
 
-static bool
-UnityGraphicsVulkan_AccessBuffer(void* native_buffer, VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
-                                 UnityVulkanResourceAccessMode access_mode, UnityVulkanBuffer *buffer)
+static inline bool
+__fake_unity_atomic_cas_ptr(void *volatile *ptr, void *expected, void *desired)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessBuffer\n");
-    return false;
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
 }
 
-static void
-UnityGraphicsVulkan_EnsureOutsideRenderPass()
+static inline void
+__fake_unity_atomic_fence(void)
 {
-    fprintf(stderr, "[fake_unity] TODO: EnsureOutsideRenderPass\n");
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
-static void
-UnityGraphicsVulkan_EnsureInsideRenderPass()
+static inline void
+__fake_unity_thread_yield(void)
 {
-    fprintf(stderr, "[fake_unity] TODO: EnsureInsideRenderPass\n");
+    sched_yield();
 }
 
-static void
-UnityGraphicsVulkan_AccessQueue(UnityRenderingEventAndData func, int event_id, void* userdata, bool flush)
+#endif
+
+// Returns the index of the most significant set bit. value must not be zero.
+static inline uint32_t
+__fake_unity_find_last_set_u64(uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessQueue\n");
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (uint32_t) index;
+#else
+    return 63 - (uint32_t) __builtin_clzll(value);
+#endif
 }
 
-static bool
-UnityGraphicsVulkan_ConfigureSwapchain(const UnityVulkanSwapchainConfiguration *swapchain_config)
+static inline void
+__fake_unity_atomic_min_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: ConfigureSwapchain\n");
-    return false;
+    uint64_t current = __fake_unity_atomic_load_u64(ptr);
+
+    while ((value < current) && !__fake_unity_atomic_cas_u64(ptr, current, value))
+    {
+        current = __fake_unity_atomic_load_u64(ptr);
+    }
 }
 
-static bool
-UnityGraphicsVulkan_AccessTextureByID(UnityTextureID texture_id, const VkImageSubresource *sub_resource, VkImageLayout layout,
-                                      VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
-                                      UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+static inline void
+__fake_unity_atomic_max_u64(volatile uint64_t *ptr, uint64_t value)
 {
-    fprintf(stderr, "[fake_unity] TODO: AccessTextureByID\n");
-    return false;
+    uint64_t current = __fake_unity_atomic_load_u64(ptr);
+
+    while ((value > current) && !__fake_unity_atomic_cas_u64(ptr, current, value))
+    {
+        current = __fake_unity_atomic_load_u64(ptr);
+    }
 }
 
-FAKE_UNITY_DEF bool
-fake_unity_initialize(int32_t max_plugin_count, int32_t max_texture_count)
+static inline void
+__fake_unity_spin_lock(volatile uint32_t *lock)
 {
-    __fake_unity_state.renderer_type = kUnityGfxRendererNull;
+    while (!__fake_unity_atomic_cas_u32(lock, 0, 1))
+    {
+        __fake_unity_thread_yield();
+    }
+}
 
-    __fake_unity_state.unity_interfaces.GetInterface           = IUnityInterfaces_GetInterface;
-    __fake_unity_state.unity_interfaces.RegisterInterface      = IUnityInterfaces_RegisterInterface;
-    __fake_unity_state.unity_interfaces.GetInterfaceSplit      = IUnityInterfaces_GetInterfaceSplit;
-    __fake_unity_state.unity_interfaces.RegisterInterfaceSplit = IUnityInterfaces_RegisterInterfaceSplit;
+static inline void
+__fake_unity_spin_unlock(volatile uint32_t *lock)
+{
+    __fake_unity_atomic_store_u32(lock, 0);
+}
 
-    __fake_unity_state.unity_profiler.EmitEvent             = IUnityProfiler_EmitEvent;
-    __fake_unity_state.unity_profiler.IsEnabled             = IUnityProfiler_IsEnabled;
-    __fake_unity_state.unity_profiler.IsAvailable           = IUnityProfiler_IsAvailable;
-    __fake_unity_state.unity_profiler.CreateMarker          = IUnityProfiler_CreateMarker;
-    __fake_unity_state.unity_profiler.SetMarkerMetadataName = IUnityProfiler_SetMarkerMetadataName;
-    __fake_unity_state.unity_profiler.RegisterThread        = IUnityProfiler_RegisterThread;
-    __fake_unity_state.unity_profiler.UnregisterThread      = IUnityProfiler_UnregisterThread;
+// The contexts created with fake_unity_context_create. Every thread remembers
+// the profiler id of its current context, which is never reused, and how many
+// contexts were destroyed when it checked the context the last time. Only if
+// a context was destroyed since then, the current context is looked up again.
+static volatile uint32_t __fake_unity_context_lock;
+static FakeUnityState *__fake_unity_contexts;
+static volatile uint32_t __fake_unity_destroyed_context_count;
 
-    __fake_unity_state.unity_graphics.GetRenderer                   = IUnityGraphics_GetRenderer;
-    __fake_unity_state.unity_graphics.RegisterDeviceEventCallback   = IUnityGraphics_RegisterDeviceEventCallback;
-    __fake_unity_state.unity_graphics.UnregisterDeviceEventCallback = IUnityGraphics_UnregisterDeviceEventCallback;
-    __fake_unity_state.unity_graphics.ReserveEventIDRange           = IUnityGraphics_ReserveEventIDRange;
+static __FAKE_UNITY_THREAD_LOCAL uint64_t __fake_unity_current_state_id;
+static __FAKE_UNITY_THREAD_LOCAL uint32_t __fake_unity_current_state_destroyed_count;
 
-    __fake_unity_state.unity_graphics_vulkan.InterceptInitialization          = UnityGraphicsVulkan_InterceptInitialization;
-    __fake_unity_state.unity_graphics_vulkan.InterceptVulkanAPI               = UnityGraphicsVulkan_InterceptVulkanAPI;
-    __fake_unity_state.unity_graphics_vulkan.ConfigureEvent                   = UnityGraphicsVulkan_ConfigureEvent;
-    __fake_unity_state.unity_graphics_vulkan.Instance                         = UnityGraphicsVulkan_Instance;
-    __fake_unity_state.unity_graphics_vulkan.CommandRecordingState            = UnityGraphicsVulkan_CommandRecordingState;
-    __fake_unity_state.unity_graphics_vulkan.AccessTexture                    = UnityGraphicsVulkan_AccessTexture;
-    __fake_unity_state.unity_graphics_vulkan.AccessRenderBufferTexture        = UnityGraphicsVulkan_AccessRenderBufferTexture;
-    __fake_unity_state.unity_graphics_vulkan.AccessRenderBufferResolveTexture = UnityGraphicsVulkan_AccessRenderBufferResolveTexture;
-    __fake_unity_state.unity_graphics_vulkan.AccessBuffer                     = UnityGraphicsVulkan_AccessBuffer;
-    __fake_unity_state.unity_graphics_vulkan.EnsureOutsideRenderPass          = UnityGraphicsVulkan_EnsureOutsideRenderPass;
-    __fake_unity_state.unity_graphics_vulkan.EnsureInsideRenderPass           = UnityGraphicsVulkan_EnsureInsideRenderPass;
-    __fake_unity_state.unity_graphics_vulkan.AccessQueue                      = UnityGraphicsVulkan_AccessQueue;
-    __fake_unity_state.unity_graphics_vulkan.ConfigureSwapchain               = UnityGraphicsVulkan_ConfigureSwapchain;
-    __fake_unity_state.unity_graphics_vulkan.AccessTextureByID                = UnityGraphicsVulkan_AccessTextureByID;
+static void
+__fake_unity_set_current_state(FakeUnityState *state)
+{
+    __fake_unity_current_state = state;
+    __fake_unity_current_state_id = state ? state->profiler.id : 0;
+    __fake_unity_current_state_destroyed_count = __fake_unity_atomic_load_u32(&__fake_unity_destroyed_context_count);
+}
 
-    IUnityInterfaces_RegisterInterfaceSplit(0x2CE79ED8316A4833ULL, 0x87076B2013E1571FULL, &__fake_unity_state.unity_profiler);
-    IUnityInterfaces_RegisterInterfaceSplit(0x7CBA0A9CA4DDB544ULL, 0x8C5AD4926EB17B11ULL, &__fake_unity_state.unity_graphics);
-    IUnityInterfaces_RegisterInterfaceSplit(0x95355348d4ef4e11ULL, 0x9789313dfcffcc87ULL, &__fake_unity_state.unity_graphics_vulkan);
+static FakeUnityState *
+__fake_unity_validate_current_state(uint32_t destroyed_count)
+{
+    FakeUnityState *state = __fake_unity_current_state;
 
-    {
-        if (max_plugin_count <= 0)
-        {
-            max_plugin_count = 8;
-        }
+    __fake_unity_spin_lock(&__fake_unity_context_lock);
 
-        __fake_unity_state.plugins = (FakeUnityNativePlugin *) malloc(max_plugin_count * sizeof(FakeUnityNativePlugin));
-        __fake_unity_state.free_plugin_indices = (uint16_t *) malloc(max_plugin_count * sizeof(uint16_t));
-        __fake_unity_state.plugin_generations = (uint16_t *) malloc(max_plugin_count * sizeof(uint16_t));
+    FakeUnityState *context = __fake_unity_contexts;
 
-        __fake_unity_state.max_plugin_count = max_plugin_count;
-        __fake_unity_state.free_plugin_count = max_plugin_count;
+    while (context && ((context != state) || (context->profiler.id != __fake_unity_current_state_id)))
+    {
+        context = context->next_context;
+    }
 
-        int32_t index = max_plugin_count;
+    __fake_unity_spin_unlock(&__fake_unity_context_lock);
 
-        for (int32_t i = 0; i < max_plugin_count; i += 1)
-        {
-            __fake_unity_state.plugin_generations[i] = 1;
-            __fake_unity_state.free_plugin_indices[i] = --index;
-        }
+    if (!context)
+    {
+        fprintf(stderr, "[fake_unity] error: the current context of this thread was destroyed, using the default context instead.\n");
+        __fake_unity_current_state = 0;
+        __fake_unity_current_state_id = 0;
     }
 
-    {
-        if (max_texture_count <= 0)
-        {
-            max_texture_count = 8;
-        }
+    __fake_unity_current_state_destroyed_count = destroyed_count;
 
-        __fake_unity_state.textures = (FakeUnityTexture *) malloc(max_texture_count * sizeof(FakeUnityTexture));
-        __fake_unity_state.free_texture_indices = (uint16_t *) malloc(max_texture_count * sizeof(uint16_t));
-        __fake_unity_state.texture_generations = (uint16_t *) malloc(max_texture_count * sizeof(uint16_t));
+    return context;
+}
 
-        __fake_unity_state.max_texture_count = max_texture_count;
-        __fake_unity_state.free_texture_count = max_texture_count;
+// Everything the plugins call goes through the context that is current on
+// the calling thread. Threads that never made a context current, or whose
+// context was destroyed, use the default context.
+static inline FakeUnityState *
+__fake_unity_get_state(void)
+{
+    FakeUnityState *state = __fake_unity_current_state;
 
-        int32_t index = max_texture_count;
+    if (state)
+    {
+        uint32_t destroyed_count = __fake_unity_atomic_load_u32(&__fake_unity_destroyed_context_count);
 
-        for (int32_t i = 0; i < max_texture_count; i += 1)
+        if (destroyed_count != __fake_unity_current_state_destroyed_count)
         {
-            __fake_unity_state.texture_generations[i] = 1;
-            __fake_unity_state.free_texture_indices[i] = --index;
+            state = __fake_unity_validate_current_state(destroyed_count);
         }
     }
 
-    return true;
+    return state ? state : &__fake_unity_default_state;
 }
 
-FAKE_UNITY_DEF uint32_t
-fake_unity_load_native_plugin(const char *filename)
-{
-    uint32_t result = 0;
-
-    if (__fake_unity_state.free_plugin_count > 0)
-    {
 #if FAKE_UNITY_PLATFORM_WINDOWS
-        // TODO: use the unicode variant which requires converting utf8 to utf16
-        HMODULE handle = LoadLibraryA(filename);
 
-        if (!handle)
-        {
-            fprintf(stderr, "[fake_unity] error: could not load native plugin '%s'\n", filename);
-            return 0;
-        }
+static inline void __fake_unity_mutex_initialize(FakeUnityMutex *mutex) { InitializeCriticalSection(mutex); }
+static inline void __fake_unity_mutex_destroy(FakeUnityMutex *mutex)    { DeleteCriticalSection(mutex); }
+static inline void __fake_unity_mutex_lock(FakeUnityMutex *mutex)       { EnterCriticalSection(mutex); }
+static inline void __fake_unity_mutex_unlock(FakeUnityMutex *mutex)     { LeaveCriticalSection(mutex); }
+
+static inline void __fake_unity_condition_initialize(FakeUnityCondition *condition) { InitializeConditionVariable(condition); }
+static inline void __fake_unity_condition_destroy(FakeUnityCondition *condition)    { (void) condition; }
+static inline void __fake_unity_condition_wake_all(FakeUnityCondition *condition)   { WakeAllConditionVariable(condition); }
+
+static inline void
+__fake_unity_condition_wait(FakeUnityCondition *condition, FakeUnityMutex *mutex)
+{
+    SleepConditionVariableCS(condition, mutex, INFINITE);
+}
+
 #elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
-        void *handle = dlopen(filename, RTLD_NOW);
 
-        if (!handle)
-        {
-            fprintf(stderr, "[fake_unity] error: could not load native plugin '%s' -> %s\n", filename, dlerror());
-            return 0;
-        }
+static inline void __fake_unity_mutex_initialize(FakeUnityMutex *mutex) { pthread_mutex_init(mutex, 0); }
+static inline void __fake_unity_mutex_destroy(FakeUnityMutex *mutex)    { pthread_mutex_destroy(mutex); }
+static inline void __fake_unity_mutex_lock(FakeUnityMutex *mutex)       { pthread_mutex_lock(mutex); }
+static inline void __fake_unity_mutex_unlock(FakeUnityMutex *mutex)     { pthread_mutex_unlock(mutex); }
+
+static inline void __fake_unity_condition_initialize(FakeUnityCondition *condition) { pthread_cond_init(condition, 0); }
+static inline void __fake_unity_condition_destroy(FakeUnityCondition *condition)    { pthread_cond_destroy(condition); }
+static inline void __fake_unity_condition_wake_all(FakeUnityCondition *condition)   { pthread_cond_broadcast(condition); }
+
+static inline void
+__fake_unity_condition_wait(FakeUnityCondition *condition, FakeUnityMutex *mutex)
+{
+    pthread_cond_wait(condition, mutex);
+}
+
 #endif
 
-        uint16_t index = __fake_unity_state.free_plugin_indices[--__fake_unity_state.free_plugin_count];
-        uint16_t generation = __fake_unity_state.plugin_generations[index];
+// Returns a monotonic timestamp in nanoseconds.
+static inline uint64_t
+__fake_unity_get_timestamp(void)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
 
-        result = ((uint32_t) generation << 16) | (uint32_t) index;
+    if (!frequency.QuadPart)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
 
-        FakeUnityNativePlugin *plugin = __fake_unity_state.plugins + index;
+    QueryPerformanceCounter(&counter);
 
-        plugin->handle = handle;
+    uint64_t seconds = (uint64_t) counter.QuadPart / (uint64_t) frequency.QuadPart;
+    uint64_t rest    = (uint64_t) counter.QuadPart % (uint64_t) frequency.QuadPart;
 
-#if FAKE_UNITY_PLATFORM_WINDOWS
-        plugin->UnityPluginLoad   = (PFN_UnityPluginLoad)   GetProcAddress(plugin->handle, "UnityPluginLoad");
-        plugin->UnityPluginUnload = (PFN_UnityPluginUnload) GetProcAddress(plugin->handle, "UnityPluginUnload");
+    return (seconds * 1000000000ull) + ((rest * 1000000000ull) / (uint64_t) frequency.QuadPart);
 #elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
-        plugin->UnityPluginLoad   = (PFN_UnityPluginLoad)   dlsym(plugin->handle, "UnityPluginLoad");
-        plugin->UnityPluginUnload = (PFN_UnityPluginUnload) dlsym(plugin->handle, "UnityPluginUnload");
-#endif
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-        if (plugin->UnityPluginLoad)
-        {
-            plugin->UnityPluginLoad(&__fake_unity_state.unity_interfaces);
-        }
-    }
+    return ((uint64_t) now.tv_sec * 1000000000ull) + (uint64_t) now.tv_nsec;
+#endif
+}
 
+static inline char *
+__fake_unity_copy_string(const char *str)
+{
+    size_t length = strlen(str);
+    char *result = (char *) malloc(length + 1);
+    memcpy(result, str, length + 1);
     return result;
 }
 
-FAKE_UNITY_DEF void *
-fake_unity_native_plugin_get_proc_address(uint32_t plugin_handle, const char *proc_name)
+static inline const char *
+__fake_unity_vk_physical_device_type_to_string(VkPhysicalDeviceType type)
 {
-    void *result = 0;
+    const char *str = "<unknown-vk-physical-device-type>";
 
-    uint16_t index = (uint16_t) (plugin_handle & 0xFFFF);
-    uint16_t generation = (uint16_t) ((plugin_handle >> 16) & 0xFFFF);
+#  define NAME(name) case name: str = #name; break
 
-    if (__fake_unity_state.plugin_generations[index] == generation)
+    switch (type)
     {
-        FakeUnityNativePlugin *plugin = __fake_unity_state.plugins + index;
-
-#if FAKE_UNITY_PLATFORM_WINDOWS
-        result = GetProcAddress(plugin->handle, proc_name);
-#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
-        result = dlsym(plugin->handle, proc_name);
-#endif
+        NAME(VK_PHYSICAL_DEVICE_TYPE_OTHER);
+        NAME(VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU);
+        NAME(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
+        NAME(VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU);
+        NAME(VK_PHYSICAL_DEVICE_TYPE_CPU);
+        default: break;
     }
 
-    return result;
+#  undef NAME
+
+    return str;
 }
 
-FAKE_UNITY_DEF bool
-fake_unity_create_vulkan_renderer(int32_t device_index)
+// Maps the channels of a format to the channels of the unity texture
+// format, for example ARGB32 is stored as R8G8B8A8 with alpha in the red
+// channel. Formats without alpha read 1, like they do in the engine.
+#define __FAKE_UNITY_SWIZZLE(r, g, b, a) { VK_COMPONENT_SWIZZLE_##r, VK_COMPONENT_SWIZZLE_##g, VK_COMPONENT_SWIZZLE_##b, VK_COMPONENT_SWIZZLE_##a }
+
+#define __FAKE_UNITY_SWIZZLE_IDENTITY __FAKE_UNITY_SWIZZLE(IDENTITY, IDENTITY, IDENTITY, IDENTITY)
+#define __FAKE_UNITY_SWIZZLE_ARGB     __FAKE_UNITY_SWIZZLE(G, B, A, R)
+#define __FAKE_UNITY_SWIZZLE_RGB      __FAKE_UNITY_SWIZZLE(IDENTITY, IDENTITY, IDENTITY, ONE)
+#define __FAKE_UNITY_SWIZZLE_RG       __FAKE_UNITY_SWIZZLE(IDENTITY, IDENTITY, ZERO, ONE)
+#define __FAKE_UNITY_SWIZZLE_R        __FAKE_UNITY_SWIZZLE(IDENTITY, ZERO, ZERO, ONE)
+#define __FAKE_UNITY_SWIZZLE_ALPHA    __FAKE_UNITY_SWIZZLE(ZERO, ZERO, ZERO, R)
+
+typedef struct FakeUnityTextureFormatInfo
+{
+    VkFormat linear_format;
+    VkFormat srgb_format;
+
+    // Compressed formats are stored in blocks of block_width x block_height
+    // pixels, every other format has 1 x 1 blocks.
+    uint32_t block_size;
+    uint32_t block_width;
+    uint32_t block_height;
+
+    VkComponentMapping components;
+} FakeUnityTextureFormatInfo;
+
+// Indexed by FakeUnity_TextureFormat. The crunched formats are decompressed
+// to their block compressed format before they are uploaded, so they share
+// its vulkan format. YUY2 has no vulkan format that can be used without a
+// sampler conversion, so only the null renderer, which just needs the size
+// of its blocks, can create textures with it.
+static const FakeUnityTextureFormatInfo __fake_unity_texture_formats[] =
 {
-    if (__fake_unity_state.renderer_type != kUnityGfxRendererNull)
+    /* Alpha8             */ { VK_FORMAT_R8_UNORM,                    VK_FORMAT_R8_UNORM,                    1,  1,  1, __FAKE_UNITY_SWIZZLE_ALPHA },
+    /* ARGB4444           */ { VK_FORMAT_R4G4B4A4_UNORM_PACK16,       VK_FORMAT_R4G4B4A4_UNORM_PACK16,       2,  1,  1, __FAKE_UNITY_SWIZZLE_ARGB },
+    /* RGB24              */ { VK_FORMAT_R8G8B8_UNORM,                VK_FORMAT_R8G8B8_SRGB,                 3,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* RGBA32             */ { VK_FORMAT_R8G8B8A8_UNORM,              VK_FORMAT_R8G8B8A8_SRGB,               4,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ARGB32             */ { VK_FORMAT_R8G8B8A8_UNORM,              VK_FORMAT_R8G8B8A8_SRGB,               4,  1,  1, __FAKE_UNITY_SWIZZLE_ARGB },
+    /* RGB565             */ { VK_FORMAT_R5G6B5_UNORM_PACK16,         VK_FORMAT_R5G6B5_UNORM_PACK16,         2,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* R16                */ { VK_FORMAT_R16_UNORM,                   VK_FORMAT_R16_UNORM,                   2,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* DXT1               */ { VK_FORMAT_BC1_RGB_UNORM_BLOCK,         VK_FORMAT_BC1_RGB_SRGB_BLOCK,          8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* DXT5               */ { VK_FORMAT_BC3_UNORM_BLOCK,             VK_FORMAT_BC3_SRGB_BLOCK,             16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RGBA4444           */ { VK_FORMAT_R4G4B4A4_UNORM_PACK16,       VK_FORMAT_R4G4B4A4_UNORM_PACK16,       2,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* BGRA32             */ { VK_FORMAT_B8G8R8A8_UNORM,              VK_FORMAT_B8G8R8A8_SRGB,               4,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RHalf              */ { VK_FORMAT_R16_SFLOAT,                  VK_FORMAT_R16_SFLOAT,                  2,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* RGHalf             */ { VK_FORMAT_R16G16_SFLOAT,               VK_FORMAT_R16G16_SFLOAT,               4,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* RGBAHalf           */ { VK_FORMAT_R16G16B16A16_SFLOAT,         VK_FORMAT_R16G16B16A16_SFLOAT,         8,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RFloat             */ { VK_FORMAT_R32_SFLOAT,                  VK_FORMAT_R32_SFLOAT,                  4,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* RGFloat            */ { VK_FORMAT_R32G32_SFLOAT,               VK_FORMAT_R32G32_SFLOAT,               8,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* RGBAFloat          */ { VK_FORMAT_R32G32B32A32_SFLOAT,         VK_FORMAT_R32G32B32A32_SFLOAT,        16,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* YUY2               */ { VK_FORMAT_UNDEFINED,                   VK_FORMAT_UNDEFINED,                   4,  2,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RGB9e5Float        */ { VK_FORMAT_E5B9G9R9_UFLOAT_PACK32,      VK_FORMAT_E5B9G9R9_UFLOAT_PACK32,      4,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* BC4                */ { VK_FORMAT_BC4_UNORM_BLOCK,             VK_FORMAT_BC4_UNORM_BLOCK,             8,  4,  4, __FAKE_UNITY_SWIZZLE_R },
+    /* BC5                */ { VK_FORMAT_BC5_UNORM_BLOCK,             VK_FORMAT_BC5_UNORM_BLOCK,            16,  4,  4, __FAKE_UNITY_SWIZZLE_RG },
+    /* BC6H               */ { VK_FORMAT_BC6H_UFLOAT_BLOCK,           VK_FORMAT_BC6H_UFLOAT_BLOCK,          16,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* BC7                */ { VK_FORMAT_BC7_UNORM_BLOCK,             VK_FORMAT_BC7_SRGB_BLOCK,             16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* DXT1Crunched       */ { VK_FORMAT_BC1_RGB_UNORM_BLOCK,         VK_FORMAT_BC1_RGB_SRGB_BLOCK,          8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* DXT5Crunched       */ { VK_FORMAT_BC3_UNORM_BLOCK,             VK_FORMAT_BC3_SRGB_BLOCK,             16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* PVRTC_RGB2         */ { VK_FORMAT_PVRTC1_2BPP_UNORM_BLOCK_IMG, VK_FORMAT_PVRTC1_2BPP_SRGB_BLOCK_IMG,  8,  8,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* PVRTC_RGBA2        */ { VK_FORMAT_PVRTC1_2BPP_UNORM_BLOCK_IMG, VK_FORMAT_PVRTC1_2BPP_SRGB_BLOCK_IMG,  8,  8,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* PVRTC_RGB4         */ { VK_FORMAT_PVRTC1_4BPP_UNORM_BLOCK_IMG, VK_FORMAT_PVRTC1_4BPP_SRGB_BLOCK_IMG,  8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* PVRTC_RGBA4        */ { VK_FORMAT_PVRTC1_4BPP_UNORM_BLOCK_IMG, VK_FORMAT_PVRTC1_4BPP_SRGB_BLOCK_IMG,  8,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ETC_RGB4           */ { VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK,     VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK,      8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* EAC_R              */ { VK_FORMAT_EAC_R11_UNORM_BLOCK,         VK_FORMAT_EAC_R11_UNORM_BLOCK,         8,  4,  4, __FAKE_UNITY_SWIZZLE_R },
+    /* EAC_R_SIGNED       */ { VK_FORMAT_EAC_R11_SNORM_BLOCK,         VK_FORMAT_EAC_R11_SNORM_BLOCK,         8,  4,  4, __FAKE_UNITY_SWIZZLE_R },
+    /* EAC_RG             */ { VK_FORMAT_EAC_R11G11_UNORM_BLOCK,      VK_FORMAT_EAC_R11G11_UNORM_BLOCK,     16,  4,  4, __FAKE_UNITY_SWIZZLE_RG },
+    /* EAC_RG_SIGNED      */ { VK_FORMAT_EAC_R11G11_SNORM_BLOCK,      VK_FORMAT_EAC_R11G11_SNORM_BLOCK,     16,  4,  4, __FAKE_UNITY_SWIZZLE_RG },
+    /* ETC2_RGB           */ { VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK,     VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK,      8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* ETC2_RGBA1         */ { VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK,   VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK,    8,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ETC2_RGBA8         */ { VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK,   VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK,   16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_4x4           */ { VK_FORMAT_ASTC_4x4_UNORM_BLOCK,        VK_FORMAT_ASTC_4x4_SRGB_BLOCK,        16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_5x5           */ { VK_FORMAT_ASTC_5x5_UNORM_BLOCK,        VK_FORMAT_ASTC_5x5_SRGB_BLOCK,        16,  5,  5, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_6x6           */ { VK_FORMAT_ASTC_6x6_UNORM_BLOCK,        VK_FORMAT_ASTC_6x6_SRGB_BLOCK,        16,  6,  6, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_8x8           */ { VK_FORMAT_ASTC_8x8_UNORM_BLOCK,        VK_FORMAT_ASTC_8x8_SRGB_BLOCK,        16,  8,  8, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_10x10         */ { VK_FORMAT_ASTC_10x10_UNORM_BLOCK,      VK_FORMAT_ASTC_10x10_SRGB_BLOCK,      16, 10, 10, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_12x12         */ { VK_FORMAT_ASTC_12x12_UNORM_BLOCK,      VK_FORMAT_ASTC_12x12_SRGB_BLOCK,      16, 12, 12, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RG16               */ { VK_FORMAT_R8G8_UNORM,                  VK_FORMAT_R8G8_UNORM,                  2,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* R8                 */ { VK_FORMAT_R8_UNORM,                    VK_FORMAT_R8_UNORM,                    1,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* ETC_RGB4Crunched   */ { VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK,     VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK,      8,  4,  4, __FAKE_UNITY_SWIZZLE_RGB },
+    /* ETC2_RGBA8Crunched */ { VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK,   VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK,   16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_4x4       */ { VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK,       VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK,      16,  4,  4, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_5x5       */ { VK_FORMAT_ASTC_5x5_SFLOAT_BLOCK,       VK_FORMAT_ASTC_5x5_SFLOAT_BLOCK,      16,  5,  5, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_6x6       */ { VK_FORMAT_ASTC_6x6_SFLOAT_BLOCK,       VK_FORMAT_ASTC_6x6_SFLOAT_BLOCK,      16,  6,  6, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_8x8       */ { VK_FORMAT_ASTC_8x8_SFLOAT_BLOCK,       VK_FORMAT_ASTC_8x8_SFLOAT_BLOCK,      16,  8,  8, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_10x10     */ { VK_FORMAT_ASTC_10x10_SFLOAT_BLOCK,     VK_FORMAT_ASTC_10x10_SFLOAT_BLOCK,    16, 10, 10, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* ASTC_HDR_12x12     */ { VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK,     VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK,    16, 12, 12, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* RG32               */ { VK_FORMAT_R16G16_UNORM,                VK_FORMAT_R16G16_UNORM,                4,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* RGB48              */ { VK_FORMAT_R16G16B16_UNORM,             VK_FORMAT_R16G16B16_UNORM,             6,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* RGBA64             */ { VK_FORMAT_R16G16B16A16_UNORM,          VK_FORMAT_R16G16B16A16_UNORM,          8,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* R8_SIGNED          */ { VK_FORMAT_R8_SNORM,                    VK_FORMAT_R8_SNORM,                    1,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* RG16_SIGNED        */ { VK_FORMAT_R8G8_SNORM,                  VK_FORMAT_R8G8_SNORM,                  2,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* RGB24_SIGNED       */ { VK_FORMAT_R8G8B8_SNORM,                VK_FORMAT_R8G8B8_SNORM,                3,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* RGBA32_SIGNED      */ { VK_FORMAT_R8G8B8A8_SNORM,              VK_FORMAT_R8G8B8A8_SNORM,              4,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+    /* R16_SIGNED         */ { VK_FORMAT_R16_SNORM,                   VK_FORMAT_R16_SNORM,                   2,  1,  1, __FAKE_UNITY_SWIZZLE_R },
+    /* RG32_SIGNED        */ { VK_FORMAT_R16G16_SNORM,                VK_FORMAT_R16G16_SNORM,                4,  1,  1, __FAKE_UNITY_SWIZZLE_RG },
+    /* RGB48_SIGNED       */ { VK_FORMAT_R16G16B16_SNORM,             VK_FORMAT_R16G16B16_SNORM,             6,  1,  1, __FAKE_UNITY_SWIZZLE_RGB },
+    /* RGBA64_SIGNED      */ { VK_FORMAT_R16G16B16A16_SNORM,          VK_FORMAT_R16G16B16A16_SNORM,          8,  1,  1, __FAKE_UNITY_SWIZZLE_IDENTITY },
+};
+
+static_assert((sizeof(__fake_unity_texture_formats) / sizeof(__fake_unity_texture_formats[0])) == FakeUnity_TextureFormat_Count,
+              "every texture format needs an entry in __fake_unity_texture_formats");
+
+// Returns NULL for values that are not a FakeUnity_TextureFormat.
+static inline const FakeUnityTextureFormatInfo *
+__fake_unity_get_texture_format_info(FakeUnity_TextureFormat format)
+{
+    if ((uint32_t) format >= (uint32_t) FakeUnity_TextureFormat_Count)
     {
-        return false;
+        return NULL;
     }
 
-    FakeUnityVulkanRenderer *renderer = &__fake_unity_state.renderer.vulkan;
+    return __fake_unity_texture_formats + format;
+}
 
-    if (renderer->loader_handle)
+static inline VkFormat
+__fake_unity_get_vk_format(FakeUnity_TextureFormat format, bool linear)
+{
+    const FakeUnityTextureFormatInfo *info = __fake_unity_get_texture_format_info(format);
+
+    if (!info)
+    {
+        return VK_FORMAT_UNDEFINED;
+    }
+
+    return linear ? info->linear_format : info->srgb_format;
+}
+
+// Returns the number of bytes of a single mip level with the given size.
+static inline uint64_t
+__fake_unity_get_texture_data_size(const FakeUnityTextureFormatInfo *info, uint32_t width, uint32_t height)
+{
+    uint64_t block_count_x = (width + info->block_width - 1) / info->block_width;
+    uint64_t block_count_y = (height + info->block_height - 1) / info->block_height;
+
+    return block_count_x * block_count_y * info->block_size;
+}
+
+#define ARRAY_ENSURE_SPACE(array, item_type)                                                      \
+    do {                                                                                          \
+        if ((array)->allocated == 0)                                                              \
+        {                                                                                         \
+            (array)->count = 0;                                                                   \
+            (array)->allocated = 16;                                                              \
+            (array)->items = (item_type *) malloc(sizeof(*(array)->items) * (array)->allocated);  \
+        }                                                                                         \
+        if ((array)->count == (array)->allocated)                                                 \
+        {                                                                                         \
+            (array)->allocated *= 2;                                                              \
+            (array)->items = (item_type *) realloc((array)->items,                                \
+                                                   sizeof(*(array)->items) * (array)->allocated); \
+        }                                                                                         \
+    } while (0)
+
+#define __FAKE_UNITY_HANDLE_POOL_EMPTY 0xFFFFFFFF
+
+#define __FAKE_UNITY_HANDLE_INDEX_MASK ((1u << FAKE_UNITY_HANDLE_INDEX_BITS) - 1)
+#define __FAKE_UNITY_HANDLE_MAX_GENERATION ((uint32_t) (0xFFFFFFFFu >> FAKE_UNITY_HANDLE_INDEX_BITS))
+
+static inline FakeUnityHandlePoolPage *
+__fake_unity_handle_pool_get_page(FakeUnityHandlePool *pool, uint32_t index)
+{
+    return (FakeUnityHandlePoolPage *) __fake_unity_atomic_load_ptr((void *volatile *) (pool->pages + (index / FAKE_UNITY_HANDLE_POOL_PAGE_SIZE)));
+}
+
+// Returns the item of a slot. The slot has to be in a page that exists.
+static inline void *
+__fake_unity_handle_pool_get_item(FakeUnityHandlePool *pool, uint32_t index)
+{
+    FakeUnityHandlePoolPage *page = __fake_unity_handle_pool_get_page(pool, index);
+    return (char *) (page + 1) + ((index % FAKE_UNITY_HANDLE_POOL_PAGE_SIZE) * pool->item_size);
+}
+
+static inline volatile uint64_t *
+__fake_unity_handle_pool_get_link(FakeUnityHandlePool *pool, uint32_t index)
+{
+    return __fake_unity_handle_pool_get_page(pool, index)->next_free_indices + (index % FAKE_UNITY_HANDLE_POOL_PAGE_SIZE);
+}
+
+// Returns the tagged value that replaces value to point to index.
+static inline uint64_t
+__fake_unity_handle_pool_retag(uint64_t value, uint32_t index)
+{
+    return (((value >> 32) + 1) << 32) | index;
+}
+
+// Appends the slots first to last to the free list, in this order. None of
+// them can be in the free list already.
+static void
+__fake_unity_handle_pool_push_range(FakeUnityHandlePool *pool, uint32_t first, uint32_t last)
+{
+    for (uint32_t index = first; index <= last; index += 1)
+    {
+        volatile uint64_t *link = __fake_unity_handle_pool_get_link(pool, index);
+        uint32_t next = (index == last) ? __FAKE_UNITY_HANDLE_POOL_EMPTY : (index + 1);
+
+        __fake_unity_atomic_store_u64(link, __fake_unity_handle_pool_retag(__fake_unity_atomic_load_u64(link), next));
+    }
+
+    for (;;)
+    {
+        uint64_t tail = __fake_unity_atomic_load_u64(&pool->free_tail);
+        volatile uint64_t *tail_link = __fake_unity_handle_pool_get_link(pool, (uint32_t) tail);
+        uint64_t next = __fake_unity_atomic_load_u64(tail_link);
+
+        if (tail != __fake_unity_atomic_load_u64(&pool->free_tail))
+        {
+            continue;
+        }
+
+        if ((uint32_t) next == __FAKE_UNITY_HANDLE_POOL_EMPTY)
+        {
+            if (__fake_unity_atomic_cas_u64(tail_link, next, __fake_unity_handle_pool_retag(next, first)))
+            {
+                // If this fails, another thread already moved the tail on.
+                __fake_unity_atomic_cas_u64(&pool->free_tail, tail, __fake_unity_handle_pool_retag(tail, last));
+                break;
+            }
+        }
+        else
+        {
+            // The tail lags behind, help moving it on.
+            __fake_unity_atomic_cas_u64(&pool->free_tail, tail, __fake_unity_handle_pool_retag(tail, (uint32_t) next));
+        }
+    }
+}
+
+static inline void
+__fake_unity_handle_pool_push(FakeUnityHandlePool *pool, uint32_t index)
+{
+    __fake_unity_handle_pool_push_range(pool, index, index);
+}
+
+static inline uint32_t
+__fake_unity_handle_pool_hash_block(uint64_t key)
+{
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) % FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE;
+}
+
+// Has to be called with grow_lock held. The page index is written before
+// the key, so readers that see the key also see the index.
+static void
+__fake_unity_handle_pool_add_block(FakeUnityHandlePool *pool, uint64_t key, uint32_t page_index)
+{
+    uint32_t slot = __fake_unity_handle_pool_hash_block(key);
+
+    while (__fake_unity_atomic_load_u64(&pool->blocks[slot].key) != 0)
+    {
+        slot = (slot + 1) % FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE;
+    }
+
+    pool->blocks[slot].page_index = page_index;
+    __fake_unity_atomic_store_u64(&pool->blocks[slot].key, key);
+}
+
+// Adds a page of free slots unless another thread added one since
+// page_count was read. Returns false if the pool is at its maximum size or
+// the page could not be allocated.
+static bool
+__fake_unity_handle_pool_grow(FakeUnityHandlePool *pool, uint32_t page_count)
+{
+    bool result = true;
+
+    __fake_unity_spin_lock(&pool->grow_lock);
+
+    if (__fake_unity_atomic_load_u32(&pool->page_count) == page_count)
+    {
+        if (page_count == FAKE_UNITY_HANDLE_POOL_MAX_PAGE_COUNT)
+        {
+            result = false;
+        }
+        else
+        {
+            size_t items_size = (size_t) FAKE_UNITY_HANDLE_POOL_PAGE_SIZE * pool->item_size;
+
+            FakeUnityHandlePoolPage *page = (FakeUnityHandlePoolPage *)
+                calloc(1, sizeof(FakeUnityHandlePoolPage) + items_size);
+
+            if (!page)
+            {
+                fprintf(stderr, "[fake_unity] error: could not grow a handle pool, out of memory.\n");
+                result = false;
+            }
+            else
+            {
+                uint32_t first = page_count * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+                for (uint32_t i = 0; i < FAKE_UNITY_HANDLE_POOL_PAGE_SIZE; i += 1)
+                {
+                    page->generations[i] = 1;
+                    page->next_free_indices[i] = __FAKE_UNITY_HANDLE_POOL_EMPTY;
+                }
+
+                uintptr_t items = (uintptr_t) (page + 1);
+                uint64_t first_key = ((uint64_t) items >> pool->block_shift) + 1;
+                uint64_t last_key = ((uint64_t) (items + items_size - 1) >> pool->block_shift) + 1;
+
+                __fake_unity_atomic_store_ptr((void *volatile *) (pool->pages + page_count), page);
+
+                __fake_unity_handle_pool_add_block(pool, first_key, page_count);
+
+                if (last_key != first_key)
+                {
+                    __fake_unity_handle_pool_add_block(pool, last_key, page_count);
+                }
+
+                __fake_unity_atomic_store_u32(&pool->page_count, page_count + 1);
+
+                if (page_count == 0)
+                {
+                    // The first slot becomes the dummy node. The head is
+                    // stored last, so a thread that sees it also sees the tail.
+                    __fake_unity_atomic_store_u64(&pool->free_tail, first);
+                    __fake_unity_atomic_store_u64(&pool->free_head, first);
+
+                    first += 1;
+                }
+
+                __fake_unity_handle_pool_push_range(pool, first, (page_count + 1) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE - 1);
+            }
+        }
+    }
+
+    __fake_unity_spin_unlock(&pool->grow_lock);
+
+    return result;
+}
+
+static void
+__fake_unity_handle_pool_initialize(FakeUnityHandlePool *pool, uint32_t item_size, int32_t capacity)
+{
+    pool->free_head = __FAKE_UNITY_HANDLE_POOL_EMPTY;
+    pool->free_tail = __FAKE_UNITY_HANDLE_POOL_EMPTY;
+    pool->item_size = (item_size + 15) & ~15u;
+    pool->grow_lock = 0;
+    pool->page_count = 0;
+
+    pool->block_shift = 0;
+
+    while (((uint64_t) 1 << pool->block_shift) < ((uint64_t) FAKE_UNITY_HANDLE_POOL_PAGE_SIZE * pool->item_size))
+    {
+        pool->block_shift += 1;
+    }
+
+    for (uint32_t i = 0; i < FAKE_UNITY_HANDLE_POOL_MAX_PAGE_COUNT; i += 1)
+    {
+        pool->pages[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE; i += 1)
+    {
+        pool->blocks[i].key = 0;
+        pool->blocks[i].page_index = 0;
+    }
+
+    while ((int64_t) pool->page_count * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE < capacity)
+    {
+        if (!__fake_unity_handle_pool_grow(pool, pool->page_count))
+        {
+            break;
+        }
+    }
+}
+
+static void
+__fake_unity_handle_pool_free(FakeUnityHandlePool *pool)
+{
+    for (uint32_t i = 0; i < pool->page_count; i += 1)
+    {
+        free(pool->pages[i]);
+    }
+}
+
+// Returns a new handle or zero if the pool has reached its maximum size or
+// is out of memory. out_index receives the slot index of the handle.
+static uint32_t
+__fake_unity_handle_pool_allocate(FakeUnityHandlePool *pool, uint32_t *out_index)
+{
+    for (;;)
+    {
+        // Read before the head, so a page added after an empty head was seen
+        // is never missed.
+        uint32_t page_count = __fake_unity_atomic_load_u32(&pool->page_count);
+
+        uint64_t head = __fake_unity_atomic_load_u64(&pool->free_head);
+        uint64_t tail = __fake_unity_atomic_load_u64(&pool->free_tail);
+        uint32_t index = (uint32_t) head;
+
+        uint64_t next = (index != __FAKE_UNITY_HANDLE_POOL_EMPTY) ?
+                        __fake_unity_atomic_load_u64(__fake_unity_handle_pool_get_link(pool, index)) : __FAKE_UNITY_HANDLE_POOL_EMPTY;
+
+        // If another thread took this slot meanwhile, next may be stale.
+        if (head != __fake_unity_atomic_load_u64(&pool->free_head))
+        {
+            continue;
+        }
+
+        if (index == (uint32_t) tail)
+        {
+            // Only the dummy node is left, or the tail lags behind.
+            if ((uint32_t) next == __FAKE_UNITY_HANDLE_POOL_EMPTY)
+            {
+                if (!__fake_unity_handle_pool_grow(pool, page_count))
+                {
+                    return 0;
+                }
+            }
+            else
+            {
+                __fake_unity_atomic_cas_u64(&pool->free_tail, tail, __fake_unity_handle_pool_retag(tail, (uint32_t) next));
+            }
+
+            continue;
+        }
+
+        // The next slot becomes the new dummy node and the old one is handed
+        // out. The tag of the head changed if another thread got there first.
+        if (__fake_unity_atomic_cas_u64(&pool->free_head, head, __fake_unity_handle_pool_retag(head, (uint32_t) next)))
+        {
+            FakeUnityHandlePoolPage *page = __fake_unity_handle_pool_get_page(pool, index);
+            uint32_t generation = __fake_unity_atomic_load_u32(page->generations + (index % FAKE_UNITY_HANDLE_POOL_PAGE_SIZE));
+
+            *out_index = index;
+
+            return (generation << FAKE_UNITY_HANDLE_INDEX_BITS) | index;
+        }
+    }
+}
+
+// Returns the slot index of handle or -1 if the handle is stale.
+static inline int32_t
+__fake_unity_handle_pool_get_index(FakeUnityHandlePool *pool, uint32_t handle)
+{
+    uint32_t index = handle & __FAKE_UNITY_HANDLE_INDEX_MASK;
+    uint32_t generation = handle >> FAKE_UNITY_HANDLE_INDEX_BITS;
+
+    if (generation == 0)
+    {
+        return -1;
+    }
+
+    FakeUnityHandlePoolPage *page = __fake_unity_handle_pool_get_page(pool, index);
+
+    if (!page || (__fake_unity_atomic_load_u32(page->generations + (index % FAKE_UNITY_HANDLE_POOL_PAGE_SIZE)) != generation))
+    {
+        return -1;
+    }
+
+    return (int32_t) index;
+}
+
+// Invalidates handle by bumping the generation of its slot. Only one of
+// several threads retiring the same handle succeeds. The slot has to be
+// given back with __fake_unity_handle_pool_push afterwards. Returns the slot
+// index or -1 if the handle is stale.
+static int32_t
+__fake_unity_handle_pool_retire(FakeUnityHandlePool *pool, uint32_t handle)
+{
+    int32_t index = __fake_unity_handle_pool_get_index(pool, handle);
+
+    if (index < 0)
+    {
+        return -1;
+    }
+
+    uint32_t generation = handle >> FAKE_UNITY_HANDLE_INDEX_BITS;
+    uint32_t next_generation = (generation == __FAKE_UNITY_HANDLE_MAX_GENERATION) ? 1 : (generation + 1);
+
+    FakeUnityHandlePoolPage *page = __fake_unity_handle_pool_get_page(pool, (uint32_t) index);
+
+    if (!__fake_unity_atomic_cas_u32(page->generations + (index % FAKE_UNITY_HANDLE_POOL_PAGE_SIZE), generation, next_generation))
+    {
+        return -1;
+    }
+
+    return index;
+}
+
+// Maps a pointer to a member of an item, as handed out to plugins, back to
+// the slot index by looking up the page it points into in the block table.
+// member_offset is the offset of that member in the item. Returns -1 for
+// pointers that are not ours and for slots whose item handle is stale.
+static int32_t
+__fake_unity_handle_pool_get_index_from_pointer(FakeUnityHandlePool *pool, const void *pointer, size_t member_offset)
+{
+    uintptr_t address = (uintptr_t) pointer - member_offset;
+    uint64_t key = ((uint64_t) address >> pool->block_shift) + 1;
+    uint32_t slot = __fake_unity_handle_pool_hash_block(key);
+
+    for (;;)
+    {
+        uint64_t block_key = __fake_unity_atomic_load_u64(&pool->blocks[slot].key);
+
+        if (block_key == 0)
+        {
+            return -1;
+        }
+
+        if (block_key == key)
+        {
+            // A block can be shared by the end of one page and the start of
+            // another, so the address still has to be within the page.
+            uint32_t page_index = pool->blocks[slot].page_index;
+            uintptr_t first = (uintptr_t) (__fake_unity_handle_pool_get_page(pool, page_index * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE) + 1);
+            uintptr_t offset = address - first;
+
+            if ((address >= first) && (offset < ((uintptr_t) FAKE_UNITY_HANDLE_POOL_PAGE_SIZE * pool->item_size)))
+            {
+                if ((offset % pool->item_size) != 0)
+                {
+                    return -1;
+                }
+
+                uint32_t index = (page_index * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE) + (uint32_t) (offset / pool->item_size);
+
+                // Every item starts with the handle that owns its slot.
+                uint32_t handle = *(const uint32_t *) __fake_unity_handle_pool_get_item(pool, index);
+
+                if (__fake_unity_handle_pool_get_index(pool, handle) != (int32_t) index)
+                {
+                    return -1;
+                }
+
+                return (int32_t) index;
+            }
+        }
+
+        slot = (slot + 1) % FAKE_UNITY_HANDLE_POOL_BLOCK_TABLE_SIZE;
+    }
+}
+
+static inline FakeUnityNativePlugin *
+__fake_unity_get_plugin(FakeUnityState *state, uint32_t index)
+{
+    return (FakeUnityNativePlugin *) __fake_unity_handle_pool_get_item(&state->plugin_pool, index);
+}
+
+static inline FakeUnityTexture *
+__fake_unity_get_texture(FakeUnityState *state, uint32_t index)
+{
+    return (FakeUnityTexture *) __fake_unity_handle_pool_get_item(&state->texture_pool, index);
+}
+
+// Returns the size of the pixel data of a whole mip level, or zero if the
+// texture has no such mip level.
+static uint64_t
+__fake_unity_get_texture_mip_data_size(FakeUnityTexture *texture, uint32_t mip_level)
+{
+    const FakeUnityTextureFormatInfo *format_info = __fake_unity_get_texture_format_info((FakeUnity_TextureFormat) texture->texture_format);
+
+    if (!format_info || (mip_level >= texture->mip_count))
+    {
+        return 0;
+    }
+
+    uint32_t width = ((uint32_t) texture->width >> mip_level) ? ((uint32_t) texture->width >> mip_level) : 1;
+    uint32_t height = ((uint32_t) texture->height >> mip_level) ? ((uint32_t) texture->height >> mip_level) : 1;
+    uint32_t depth = ((uint32_t) texture->depth >> mip_level) ? ((uint32_t) texture->depth >> mip_level) : 1;
+
+    return __fake_unity_get_texture_data_size(format_info, width, height) * depth * texture->layer_count;
+}
+
+// Returns where a mip level starts in the pixels of a null renderer texture.
+// With mip_level equal to the mip count this is the size of all pixels.
+static uint64_t
+__fake_unity_get_texture_mip_offset(FakeUnityTexture *texture, uint32_t mip_level)
+{
+    uint64_t offset = 0;
+
+    for (uint32_t i = 0; i < mip_level; i += 1)
+    {
+        offset += __fake_unity_get_texture_mip_data_size(texture, i);
+    }
+
+    return offset;
+}
+
+// Returns a new request that is neither done nor released.
+static uint32_t
+__fake_unity_gpu_request_create(FakeUnityState *state)
+{
+    uint32_t index;
+    uint32_t handle = __fake_unity_handle_pool_allocate(&state->request_pool, &index);
+
+    if (handle)
+    {
+        FakeUnityGPURequest *request = (FakeUnityGPURequest *) __fake_unity_handle_pool_get_item(&state->request_pool, index);
+        __fake_unity_atomic_store_u32(&request->flags, 0);
+    }
+
+    return handle;
+}
+
+// Adds flags to a request. The handle may already be released, so only its
+// slot is used. Whoever completes the pair of DONE and RELEASED gives the
+// slot back to the pool.
+static void
+__fake_unity_gpu_request_set_flags(FakeUnityState *state, uint32_t handle, uint32_t flags)
+{
+    uint32_t index = handle & __FAKE_UNITY_HANDLE_INDEX_MASK;
+    FakeUnityGPURequest *request = (FakeUnityGPURequest *) __fake_unity_handle_pool_get_item(&state->request_pool, index);
+
+    const uint32_t finished = FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_RELEASED;
+
+    for (;;)
+    {
+        uint32_t old_flags = __fake_unity_atomic_load_u32(&request->flags);
+        uint32_t new_flags = old_flags | flags;
+
+        if (__fake_unity_atomic_cas_u32(&request->flags, old_flags, new_flags))
+        {
+            if (((old_flags & finished) != finished) && ((new_flags & finished) == finished))
+            {
+                __fake_unity_handle_pool_push(&state->request_pool, index);
+            }
+
+            break;
+        }
+    }
+}
+
+static inline uint64_t
+__fake_unity_hash_guid(unsigned long long guid_high, unsigned long long guid_low)
+{
+    uint64_t hash = (uint64_t) guid_high ^ ((uint64_t) guid_low * 0x9E3779B97F4A7C15ull);
+
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+
+    return hash;
+}
+
+static inline uint64_t
+__fake_unity_hash_string(const char *string)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (; *string; string += 1)
+    {
+        hash ^= (uint8_t) *string;
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+// Returns the slot for the guid or the empty slot where it would be inserted.
+static inline FakeUnityInterface *
+__fake_unity_interface_table_find(FakeUnityInterfaceTable *table, unsigned long long guid_high, unsigned long long guid_low)
+{
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = (uint32_t) __fake_unity_hash_guid(guid_high, guid_low) & mask;
+
+    for (;;)
+    {
+        FakeUnityInterface *item = table->items + index;
+
+        if (!__fake_unity_atomic_load_u32(&item->used) ||
+            ((item->guid_high == guid_high) && (item->guid_low == guid_low)))
+        {
+            return item;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+static FakeUnityInterfaceTable *
+__fake_unity_interface_table_create(uint32_t capacity)
+{
+    FakeUnityInterfaceTable *table = (FakeUnityInterfaceTable *) malloc(sizeof(FakeUnityInterfaceTable));
+
+    table->retired  = 0;
+    table->count    = 0;
+    table->capacity = capacity;
+    table->items    = (FakeUnityInterface *) calloc(capacity, sizeof(FakeUnityInterface));
+
+    return table;
+}
+
+static IUnityInterface *
+IUnityInterfaces_GetInterfaceSplit(unsigned long long guid_high, unsigned long long guid_low)
+{
+    FakeUnityInterfaceTable *table = (FakeUnityInterfaceTable *) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_get_state()->interfaces.table);
+
+    if (!table)
+    {
+        return 0;
+    }
+
+    FakeUnityInterface *item = __fake_unity_interface_table_find(table, guid_high, guid_low);
+
+    // The slot may have been empty and filled with a different guid
+    // in the meantime.
+    if (!__fake_unity_atomic_load_u32(&item->used) ||
+        (item->guid_high != guid_high) || (item->guid_low != guid_low))
+    {
+        return 0;
+    }
+
+    return (IUnityInterface *) __fake_unity_atomic_load_ptr((void *volatile *) &item->ptr);
+}
+
+static void
+__fake_unity_register_interface(FakeUnityState *state, unsigned long long guid_high, unsigned long long guid_low, IUnityInterface *ptr)
+{
+    FakeUnityInterfaces *interfaces = &state->interfaces;
+
+    __fake_unity_spin_lock(&interfaces->lock);
+
+    FakeUnityInterfaceTable *table = interfaces->table;
+
+    if (!table)
+    {
+        table = __fake_unity_interface_table_create(32);
+        __fake_unity_atomic_store_ptr((void *volatile *) &interfaces->table, table);
+    }
+
+    FakeUnityInterface *item = __fake_unity_interface_table_find(table, guid_high, guid_low);
+
+    if (item->used)
+    {
+        __fake_unity_atomic_store_ptr((void *volatile *) &item->ptr, ptr);
+    }
+    else
+    {
+        if (((table->count + 1) * 2) > table->capacity)
+        {
+            FakeUnityInterfaceTable *new_table = __fake_unity_interface_table_create(table->capacity * 2);
+
+            for (uint32_t i = 0; i < table->capacity; i += 1)
+            {
+                FakeUnityInterface *old_item = table->items + i;
+
+                if (old_item->used)
+                {
+                    FakeUnityInterface *new_item = __fake_unity_interface_table_find(new_table, old_item->guid_high, old_item->guid_low);
+
+                    new_item->guid_high = old_item->guid_high;
+                    new_item->guid_low  = old_item->guid_low;
+                    new_item->ptr       = old_item->ptr;
+                    new_item->used      = 1;
+                }
+            }
+
+            new_table->count   = table->count;
+            new_table->retired = table;
+
+            table = new_table;
+
+            __fake_unity_atomic_store_ptr((void *volatile *) &interfaces->table, table);
+
+            item = __fake_unity_interface_table_find(table, guid_high, guid_low);
+        }
+
+        item->guid_high = guid_high;
+        item->guid_low  = guid_low;
+        item->ptr       = ptr;
+
+        __fake_unity_atomic_store_u32(&item->used, 1);
+
+        table->count += 1;
+    }
+
+    __fake_unity_spin_unlock(&interfaces->lock);
+}
+
+static void
+IUnityInterfaces_RegisterInterfaceSplit(unsigned long long guid_high, unsigned long long guid_low, IUnityInterface *ptr)
+{
+    __fake_unity_register_interface(__fake_unity_get_state(), guid_high, guid_low, ptr);
+}
+
+static IUnityInterface *
+IUnityInterfaces_GetInterface(UnityInterfaceGUID guid)
+{
+#ifndef __cplusplus
+    fprintf(stderr, "[fake_unity] warning: your program is not compiled as a c++ program,\n"
+                    "             but it looks like the native unity plugin you are loading is.\n"
+                    "             Due to calling conventions being incompatible, calling GetInterface\n"
+                    "             may not work. Please compile your program as a c++ program or\n"
+                    "             make the native unity plugin call GetInterfaceSplit.\n");
+#endif
+
+    return IUnityInterfaces_GetInterfaceSplit(guid.m_GUIDHigh, guid.m_GUIDLow);
+}
+
+static void
+IUnityInterfaces_RegisterInterface(UnityInterfaceGUID guid, IUnityInterface *ptr)
+{
+#ifndef __cplusplus
+    fprintf(stderr, "[fake_unity] warning: your program is not compiled as a c++ program,\n"
+                    "             but it looks like the native unity plugin you are loading is.\n"
+                    "             Due to calling conventions being incompatible, calling RegisterInterface\n"
+                    "             may not work. Please compile your program as a c++ program or\n"
+                    "             make the native unity plugin call RegisterInterfaceSplit.\n");
+#endif
+
+    return IUnityInterfaces_RegisterInterfaceSplit(guid.m_GUIDHigh, guid.m_GUIDLow, ptr);
+}
+
+static volatile uint64_t __fake_unity_next_profiler_id;
+
+// The address of __fake_unity_thread_key is unique for every running thread.
+// The last looked up thread buffer is cached together with the id of the
+// profiler it belongs to, ids are never reused.
+static __FAKE_UNITY_THREAD_LOCAL char __fake_unity_thread_key;
+static __FAKE_UNITY_THREAD_LOCAL const char *__fake_unity_thread_name;
+static __FAKE_UNITY_THREAD_LOCAL uint64_t __fake_unity_profiler_cached_id;
+static __FAKE_UNITY_THREAD_LOCAL FakeUnityProfilerThread *__fake_unity_profiler_cached_thread;
+
+// Allocates a thread and publishes it to the consumers. The event buffer is
+// only allocated by the first event that is captured, so threads don't pay
+// for it in statistics only mode. The thread is called "Thread <id>" if name
+// is NULL.
+static FakeUnityProfilerThread *
+__fake_unity_profiler_add_thread(FakeUnityProfiler *profiler, const void *key, const char *name)
+{
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) calloc(1, sizeof(FakeUnityProfilerThread));
+    thread->key = key;
+    thread->id = __fake_unity_atomic_add_u64(&profiler->thread_count, 1) + 1;
+
+    if (name)
+    {
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+    }
+    else
+    {
+        snprintf(thread->name, sizeof(thread->name), "Thread %llu", (unsigned long long) thread->id);
+    }
+
+    FakeUnityProfilerThread *head;
+
+    do
+    {
+        head = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &profiler->threads);
+        thread->next = head;
+    } while (!__fake_unity_atomic_cas_ptr((void *volatile *) &profiler->threads, head, thread));
+
+    return thread;
+}
+
+static FakeUnityProfilerThread *
+__fake_unity_profiler_get_current_thread(FakeUnityProfiler *profiler)
+{
+    if ((__fake_unity_profiler_cached_id == profiler->id) && !__fake_unity_profiler_cached_thread->retired)
+    {
+        return __fake_unity_profiler_cached_thread;
+    }
+
+    const void *key = &__fake_unity_thread_key;
+
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &profiler->threads);
+
+    while (thread && ((thread->key != key) || thread->retired))
+    {
+        thread = thread->next;
+    }
+
+    if (!thread)
+    {
+        // Together with the event buffer this is the only allocation on the
+        // event path and it only happens on the first event of a thread.
+        thread = __fake_unity_profiler_add_thread(profiler, key, __fake_unity_thread_name);
+    }
+
+    __fake_unity_profiler_cached_id = profiler->id;
+    __fake_unity_profiler_cached_thread = thread;
+
+    return thread;
+}
+
+static inline uint32_t
+__fake_unity_profiler_get_histogram_bucket(uint64_t value)
+{
+    const uint64_t sub_bucket_count = 1 << FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS;
+
+    if (value < sub_bucket_count)
+    {
+        return (uint32_t) value;
+    }
+
+    uint32_t exponent = __fake_unity_find_last_set_u64(value);
+    uint32_t sub_bucket = (uint32_t) (value >> (exponent - FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS)) & (sub_bucket_count - 1);
+
+    return ((exponent - FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS + 1) << FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS) + sub_bucket;
+}
+
+// Returns the largest value that is sorted into bucket.
+static inline uint64_t
+__fake_unity_profiler_get_histogram_bucket_limit(uint32_t bucket)
+{
+    const uint64_t sub_bucket_count = 1 << FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS;
+
+    if (bucket < sub_bucket_count)
+    {
+        return bucket;
+    }
+
+    uint32_t exponent = (bucket >> FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS) + FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = bucket & (sub_bucket_count - 1);
+    uint32_t shift = exponent - FAKE_UNITY_PROFILER_HISTOGRAM_SUB_BUCKET_BITS;
+
+    return (((sub_bucket_count + sub_bucket + 1) << shift) - 1);
+}
+
+static void
+__fake_unity_profiler_update_stats(FakeUnityProfilerThread *thread, const FakeUnityProfilerMarker *marker,
+                                   UnityProfilerMarkerEventType type, uint64_t timestamp)
+{
+    if (type == kUnityProfilerMarkerEventTypeBegin)
+    {
+        if (thread->stack_depth < FAKE_UNITY_PROFILER_MAX_STACK_DEPTH)
+        {
+            thread->stack_markers[thread->stack_depth] = marker;
+            thread->stack_timestamps[thread->stack_depth] = timestamp;
+        }
+
+        thread->stack_depth += 1;
+    }
+    else if ((type == kUnityProfilerMarkerEventTypeEnd) && (thread->stack_depth > 0))
+    {
+        thread->stack_depth -= 1;
+
+        if ((thread->stack_depth >= FAKE_UNITY_PROFILER_MAX_STACK_DEPTH) ||
+            (thread->stack_markers[thread->stack_depth] != marker))
+        {
+            return;
+        }
+
+        // The statistics are only ever modified through atomics.
+        FakeUnityProfilerMarker *stats = (FakeUnityProfilerMarker *) marker;
+
+        uint64_t duration = timestamp - thread->stack_timestamps[thread->stack_depth];
+
+        __fake_unity_atomic_add_u64(&stats->sample_count, 1);
+        __fake_unity_atomic_add_u64(&stats->total_time, duration);
+        __fake_unity_atomic_min_u64(&stats->min_time, duration);
+        __fake_unity_atomic_max_u64(&stats->max_time, duration);
+        __fake_unity_atomic_add_u64(stats->histogram + __fake_unity_profiler_get_histogram_bucket(duration), 1);
+    }
+}
+
+// Only the thread that owns the buffer of thread may call this.
+static void
+__fake_unity_profiler_emit_event(FakeUnityProfiler *profiler, FakeUnityProfilerThread *thread, const UnityProfilerMarkerDesc *markerDesc,
+                                 UnityProfilerMarkerEventType eventType, uint64_t timestamp, uint16_t eventDataCount,
+                                 const UnityProfilerMarkerData *eventData)
+{
+    uint32_t mode = __fake_unity_atomic_load_u32(&profiler->mode);
+
+    if (mode & FakeUnityProfilerMode_Statistics)
+    {
+        __fake_unity_profiler_update_stats(thread, (const FakeUnityProfilerMarker *) markerDesc, eventType, timestamp);
+    }
+
+    if (!(mode & FakeUnityProfilerMode_Events))
+    {
+        return;
+    }
+
+    if (!thread->events)
+    {
+        // Published to the consumer by the store of write_index below.
+        thread->events = (FakeUnityProfilerEvent *) malloc(FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE * sizeof(FakeUnityProfilerEvent));
+
+        if (!thread->events)
+        {
+            __fake_unity_atomic_add_u32(&thread->dropped_count, 1);
+            return;
+        }
+    }
+
+    uint32_t write_index = thread->write_index;
+    uint32_t read_index = __fake_unity_atomic_load_u32(&thread->read_index);
+
+    if ((write_index - read_index) >= FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE)
+    {
+        __fake_unity_atomic_add_u32(&thread->dropped_count, 1);
+        return;
+    }
+
+    FakeUnityProfilerEvent *event = thread->events + (write_index & (FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE - 1));
+
+    event->timestamp  = timestamp;
+    event->marker     = (const FakeUnityProfilerMarker *) markerDesc;
+    event->type       = eventType;
+    event->data_count = 0;
+
+    uint32_t offset = 0;
+
+    for (uint16_t i = 0; (i < eventDataCount) && (event->data_count < FAKE_UNITY_PROFILER_MAX_EVENT_DATA); i += 1)
+    {
+        const UnityProfilerMarkerData *data = eventData + i;
+
+        if (offset >= FAKE_UNITY_PROFILER_EVENT_PAYLOAD_SIZE)
+        {
+            break;
+        }
+
+        uint32_t size = data->ptr ? data->size : 0;
+
+        uint8_t *dst = (uint8_t *) event->payload + offset;
+
+        if (size > (FAKE_UNITY_PROFILER_EVENT_PAYLOAD_SIZE - offset))
+        {
+            size = FAKE_UNITY_PROFILER_EVENT_PAYLOAD_SIZE - offset;
+
+            // Truncated strings lose their terminator, so cut them one
+            // character short and terminate them again.
+            if (data->type == kUnityProfilerMarkerDataTypeString)
+            {
+                memcpy(dst, data->ptr, size - 1);
+                dst[size - 1] = 0;
+            }
+            else if (data->type == kUnityProfilerMarkerDataTypeString16)
+            {
+                size &= ~1u;
+                memcpy(dst, data->ptr, size - 2);
+                dst[size - 2] = 0;
+                dst[size - 1] = 0;
+            }
+            else
+            {
+                memcpy(dst, data->ptr, size);
+            }
+        }
+        else
+        {
+            memcpy(dst, data->ptr, size);
+        }
+
+        event->data_types[event->data_count] = data->type;
+        event->data_sizes[event->data_count] = (uint8_t) size;
+
+        event->data_count += 1;
+        offset += (size + 7) & ~7u;
+    }
+
+    __fake_unity_atomic_store_u32(&thread->write_index, write_index + 1);
+}
+
+static void
+IUnityProfiler_EmitEvent(const UnityProfilerMarkerDesc* markerDesc, UnityProfilerMarkerEventType eventType, uint16_t eventDataCount, const UnityProfilerMarkerData* eventData)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
+
+    if (!__fake_unity_atomic_load_u32(&profiler->enabled) || !markerDesc)
+    {
+        return;
+    }
+
+    uint64_t timestamp = __fake_unity_get_timestamp();
+
+    FakeUnityProfilerThread *thread = __fake_unity_profiler_get_current_thread(profiler);
+
+    __fake_unity_profiler_emit_event(profiler, thread, markerDesc, eventType, timestamp, eventDataCount, eventData);
+}
+
+static int
+IUnityProfiler_IsEnabled()
+{
+    return __fake_unity_atomic_load_u32(&__fake_unity_get_state()->profiler.enabled) ? 1 : 0;
+}
+
+static int
+IUnityProfiler_IsAvailable()
+{
+    return 1;
+}
+
+static int
+IUnityProfiler_CreateMarker(const UnityProfilerMarkerDesc** desc, const char* name, UnityProfilerCategoryId category, UnityProfilerMarkerFlags flags, int eventDataCount)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
+
+    if (!desc || !name)
+    {
+        return -1;
+    }
+
+    __fake_unity_spin_lock(&profiler->marker_lock);
+
+    FakeUnityProfilerMarker *marker = profiler->markers;
+
+    while (marker && strcmp(marker->name, name))
+    {
+        marker = marker->next;
+    }
+
+    if (!marker)
+    {
+        if (eventDataCount < 0)
+        {
+            eventDataCount = 0;
+        }
+
+        marker = (FakeUnityProfilerMarker *) calloc(1, sizeof(FakeUnityProfilerMarker));
+
+        marker->name = __fake_unity_copy_string(name);
+        marker->metadata_count = eventDataCount;
+        marker->metadata = (FakeUnityProfilerMarkerMetadata *) calloc(eventDataCount + 1, sizeof(FakeUnityProfilerMarkerMetadata));
+
+        marker->desc.callback     = 0;
+        marker->desc.id           = (UnityProfilerMarkerId) profiler->marker_count;
+        marker->desc.flags        = flags;
+        marker->desc.categoryId   = category;
+        marker->desc.name         = marker->name;
+        marker->desc.metaDataDesc = marker->metadata;
+
+        marker->min_time = UINT64_MAX;
+
+        profiler->marker_count += 1;
+
+        marker->next = profiler->markers;
+        __fake_unity_atomic_store_ptr((void *volatile *) &profiler->markers, marker);
+    }
+
+    __fake_unity_spin_unlock(&profiler->marker_lock);
+
+    *desc = &marker->desc;
+
+    return 0;
+}
+
+static int
+IUnityProfiler_SetMarkerMetadataName(const UnityProfilerMarkerDesc* desc, int index, const char* metadataName, UnityProfilerMarkerDataType metadataType, UnityProfilerMarkerDataUnit metadataUnit)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
+    FakeUnityProfilerMarker *marker = (FakeUnityProfilerMarker *) desc;
+
+    if (!marker || !metadataName || (index < 0) || (index >= marker->metadata_count))
+    {
+        return -1;
+    }
+
+    FakeUnityProfilerMarkerMetadata *metadata = marker->metadata + index;
+
+    // The trace writer reads the names without taking the lock, so a name is
+    // only ever published once and stays alive until shutdown.
+    int result = 0;
+
+    __fake_unity_spin_lock(&profiler->marker_lock);
+
+    if (!metadata->name)
+    {
+        metadata->type = metadataType;
+        metadata->unit = metadataUnit;
+        __fake_unity_atomic_store_ptr((void *volatile *) &metadata->name, __fake_unity_copy_string(metadataName));
+    }
+    else if (strcmp(metadata->name, metadataName))
+    {
+        fprintf(stderr, "[fake_unity] error: metadata %d of marker '%s' is already named '%s'.\n",
+                index, marker->name, metadata->name);
+        result = -1;
+    }
+
+    __fake_unity_spin_unlock(&profiler->marker_lock);
+
+    return result;
+}
+
+static int
+IUnityProfiler_RegisterThread(UnityProfilerThreadId* threadId, const char* groupName, const char* name)
+{
+    FakeUnityProfilerThread *thread = __fake_unity_profiler_get_current_thread(&__fake_unity_get_state()->profiler);
+
+    snprintf(thread->group_name, sizeof(thread->group_name), "%s", groupName ? groupName : "");
+    snprintf(thread->name, sizeof(thread->name), "%s", name ? name : "");
+
+    if (threadId)
+    {
+        *threadId = thread->id;
+    }
+
+    return 0;
+}
+
+// Like in unity this has to be called on the thread that was registered. The
+// events that are still buffered can be consumed afterwards, the buffer is
+// freed by the consumer once it is empty. If the thread emits events again it
+// gets a new thread buffer.
+static int
+IUnityProfiler_UnregisterThread(UnityProfilerThreadId threadId)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
+
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &profiler->threads);
+
+    while (thread && ((thread->id != threadId) || thread->retired))
+    {
+        thread = thread->next;
+    }
+
+    if (!thread || (thread == profiler->gpu_thread))
+    {
+        return -1;
+    }
+
+    __fake_unity_spin_lock(&profiler->consumer_lock);
+
+    __fake_unity_atomic_store_u32(&thread->retired, 1);
+
+    if (thread->read_index == thread->write_index)
+    {
+        free(thread->events);
+        thread->events = NULL;
+    }
+
+    __fake_unity_spin_unlock(&profiler->consumer_lock);
+
+    return 0;
+}
+
+#define __FAKE_UNITY_PROFILER_TRACE_CHUNK_SIZE (64 * 1024)
+
+typedef struct FakeUnityProfilerTrace
+{
+    FILE *file;
+    bool failed;
+    bool has_events;
+
+    // Number of dropped events that were already reported.
+    int64_t dropped_count;
+
+    uint32_t used;
+    char buffer[__FAKE_UNITY_PROFILER_TRACE_CHUNK_SIZE];
+} FakeUnityProfilerTrace;
+
+static void
+__fake_unity_trace_flush(FakeUnityProfilerTrace *trace)
+{
+    if (trace->used > 0)
+    {
+        if (fwrite(trace->buffer, 1, trace->used, trace->file) != trace->used)
+        {
+            trace->failed = true;
+        }
+
+        trace->used = 0;
+    }
+}
+
+static void
+__fake_unity_trace_write(FakeUnityProfilerTrace *trace, const char *data, size_t size)
+{
+    if ((trace->used + size) > sizeof(trace->buffer))
+    {
+        __fake_unity_trace_flush(trace);
+
+        if (size > sizeof(trace->buffer))
+        {
+            if (fwrite(data, 1, size, trace->file) != size)
+            {
+                trace->failed = true;
+            }
+
+            return;
+        }
+    }
+
+    memcpy(trace->buffer + trace->used, data, size);
+    trace->used += (uint32_t) size;
+}
+
+#define __fake_unity_trace_write_literal(trace, str) __fake_unity_trace_write(trace, str, sizeof(str) - 1)
+
+static void
+__fake_unity_trace_write_format(FakeUnityProfilerTrace *trace, const char *format, ...)
+{
+    char str[256];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(str, sizeof(str), format, args);
+    va_end(args);
+
+    if (length > 0)
+    {
+        __fake_unity_trace_write(trace, str, ((size_t) length < sizeof(str)) ? (size_t) length : (sizeof(str) - 1));
+    }
+}
+
+static void
+__fake_unity_trace_write_char(FakeUnityProfilerTrace *trace, uint32_t c)
+{
+    if ((c == '"') || (c == '\\'))
+    {
+        char str[2] = { '\\', (char) c };
+        __fake_unity_trace_write(trace, str, 2);
+    }
+    else if ((c < 0x20) || (c > 0x7E))
+    {
+        __fake_unity_trace_write_format(trace, "\\u%04x", c & 0xFFFF);
+    }
+    else
+    {
+        char str = (char) c;
+        __fake_unity_trace_write(trace, &str, 1);
+    }
+}
+
+// Writes a quoted json string. Stops at size bytes or at the first null byte.
+static void
+__fake_unity_trace_write_string(FakeUnityProfilerTrace *trace, const char *str, size_t size)
+{
+    __fake_unity_trace_write_literal(trace, "\"");
+
+    for (size_t i = 0; (i < size) && str[i]; i += 1)
+    {
+        uint8_t c = (uint8_t) str[i];
+
+        // Bytes of utf8 sequences are copied through as is.
+        if (c >= 0x80)
+        {
+            __fake_unity_trace_write(trace, str + i, 1);
+        }
+        else
+        {
+            __fake_unity_trace_write_char(trace, c);
+        }
+    }
+
+    __fake_unity_trace_write_literal(trace, "\"");
+}
+
+static void
+__fake_unity_trace_write_data(FakeUnityProfilerTrace *trace, const UnityProfilerMarkerData *data)
+{
+    union
+    {
+        int32_t i32;
+        uint32_t u32;
+        int64_t i64;
+        uint64_t u64;
+        float f32;
+        double f64;
+    } value;
+
+    memset(&value, 0, sizeof(value));
+    memcpy(&value, data->ptr, (data->size < sizeof(value)) ? data->size : sizeof(value));
+
+    switch (data->type)
+    {
+        case kUnityProfilerMarkerDataTypeInstanceId:
+        case kUnityProfilerMarkerDataTypeInt32:
+        {
+            __fake_unity_trace_write_format(trace, "%d", value.i32);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeUInt32:
+        {
+            __fake_unity_trace_write_format(trace, "%u", value.u32);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeInt64:
+        {
+            __fake_unity_trace_write_format(trace, "%lld", (long long) value.i64);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeUInt64:
+        case kUnityProfilerMarkerDataTypeGfxResourceId:
+        {
+            __fake_unity_trace_write_format(trace, "%llu", (unsigned long long) value.u64);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeFloat:
+        {
+            __fake_unity_trace_write_format(trace, "%.9g", (double) value.f32);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeDouble:
+        {
+            __fake_unity_trace_write_format(trace, "%.17g", value.f64);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeString:
+        {
+            __fake_unity_trace_write_string(trace, (const char *) data->ptr, data->size);
+        } break;
+
+        case kUnityProfilerMarkerDataTypeString16:
+        {
+            const uint8_t *ptr = (const uint8_t *) data->ptr;
+
+            __fake_unity_trace_write_literal(trace, "\"");
+
+            for (uint32_t i = 0; (i + 1) < data->size; i += 2)
+            {
+                uint16_t c;
+                memcpy(&c, ptr + i, 2);
+
+                if (!c)
+                {
+                    break;
+                }
+
+                __fake_unity_trace_write_char(trace, c);
+            }
+
+            __fake_unity_trace_write_literal(trace, "\"");
+        } break;
+
+        default:
+        {
+            const uint8_t *ptr = (const uint8_t *) data->ptr;
+
+            __fake_unity_trace_write_literal(trace, "\"");
+
+            for (uint32_t i = 0; i < data->size; i += 1)
+            {
+                __fake_unity_trace_write_format(trace, "%02x", ptr[i]);
+            }
+
+            __fake_unity_trace_write_literal(trace, "\"");
+        } break;
+    }
+}
+
+static void
+__fake_unity_trace_write_event(const FakeUnityProfilerThread *thread, const FakeUnityProfilerEvent *event, void *userdata)
+{
+    FakeUnityProfilerTrace *trace = (FakeUnityProfilerTrace *) userdata;
+    const FakeUnityProfilerMarker *marker = event->marker;
+
+    const char *phase = "i";
+
+    switch (event->type)
+    {
+        case kUnityProfilerMarkerEventTypeBegin: phase = "B"; break;
+        case kUnityProfilerMarkerEventTypeEnd:   phase = "E"; break;
+    }
+
+    if (trace->has_events)
+    {
+        __fake_unity_trace_write_literal(trace, ",\n");
+    }
+
+    trace->has_events = true;
+
+    __fake_unity_trace_write_literal(trace, "{\"name\":");
+    __fake_unity_trace_write_string(trace, marker->name, (size_t) -1);
+    __fake_unity_trace_write_format(trace, ",\"cat\":\"%u\",\"ph\":\"%s\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%llu",
+                                    (uint32_t) marker->desc.categoryId, phase,
+                                    (unsigned long long) (event->timestamp / 1000), (unsigned long long) (event->timestamp % 1000),
+                                    (unsigned long long) thread->id);
+
+    if (*phase == 'i')
+    {
+        __fake_unity_trace_write_literal(trace, ",\"s\":\"t\"");
+    }
+
+    if (event->data_count > 0)
+    {
+        __fake_unity_trace_write_literal(trace, ",\"args\":{");
+
+        for (int32_t i = 0; i < event->data_count; i += 1)
+        {
+            UnityProfilerMarkerData data;
+            fake_unity_profiler_event_get_data(event, i, &data);
+
+            if (i > 0)
+            {
+                __fake_unity_trace_write_literal(trace, ",");
+            }
+
+            const char *name = (i < marker->metadata_count) ?
+                               (const char *) __fake_unity_atomic_load_ptr((void *volatile *) &marker->metadata[i].name) : 0;
+
+            if (name)
+            {
+                __fake_unity_trace_write_string(trace, name, (size_t) -1);
+            }
+            else
+            {
+                __fake_unity_trace_write_format(trace, "\"arg%d\"", i);
+            }
+
+            __fake_unity_trace_write_literal(trace, ":");
+            __fake_unity_trace_write_data(trace, &data);
+        }
+
+        __fake_unity_trace_write_literal(trace, "}");
+    }
+
+    __fake_unity_trace_write_literal(trace, "}");
+}
+
+// Moves the buffered events into the trace and reports events that were
+// dropped since the last drain, because they are missing from the trace.
+static void
+__fake_unity_trace_drain(FakeUnityProfilerTrace *trace)
+{
+    fake_unity_profiler_consume_events(__fake_unity_trace_write_event, trace);
+
+    int64_t dropped_count = fake_unity_profiler_get_dropped_event_count();
+
+    if (dropped_count > trace->dropped_count)
+    {
+        fprintf(stderr, "[fake_unity] error: %lld profiler events were dropped from the trace, because a thread buffer was full.\n"
+                        "             flush the trace more often or increase FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE.\n",
+                (long long) (dropped_count - trace->dropped_count));
+
+        trace->dropped_count = dropped_count;
+    }
+}
+
+static UnityGfxRenderer
+IUnityGraphics_GetRenderer()
+{
+    return __fake_unity_get_state()->renderer_type;
+}
+
+// Handle of the plugin whose UnityPluginLoad or device event callback runs on
+// this thread. Event ids reserved and configured meanwhile belong to it.
+static __FAKE_UNITY_THREAD_LOCAL uint32_t __fake_unity_loading_plugin;
+
+// Handle of the plugin whose code runs on this thread, which traced vulkan
+// calls are attributed to.
+static __FAKE_UNITY_THREAD_LOCAL uint32_t __fake_unity_active_plugin;
+
+static void
+IUnityGraphics_RegisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+{
+    FakeUnityGraphicsDeviceEventCallbacks *callbacks = &__fake_unity_get_state()->graphics_device_event_callbacks;
+
+    __fake_unity_spin_lock(&callbacks->lock);
+
+    ARRAY_ENSURE_SPACE(callbacks, FakeUnityGraphicsDeviceEventCallback);
+
+    callbacks->items[callbacks->count].callback      = callback;
+    callbacks->items[callbacks->count].plugin_handle = __fake_unity_active_plugin;
+    callbacks->count += 1;
+
+    __fake_unity_spin_unlock(&callbacks->lock);
+}
+
+static void
+IUnityGraphics_UnregisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+{
+    FakeUnityGraphicsDeviceEventCallbacks *callbacks = &__fake_unity_get_state()->graphics_device_event_callbacks;
+
+    __fake_unity_spin_lock(&callbacks->lock);
+
+    for (int32_t i = 0; i < callbacks->count; i += 1)
+    {
+        if (callbacks->items[i].callback == callback)
+        {
+            callbacks->count -= 1;
+            callbacks->items[i] = callbacks->items[callbacks->count];
+            i -= 1;
+        }
+    }
+
+    __fake_unity_spin_unlock(&callbacks->lock);
+}
+
+// The callbacks are copied before they are called, so they are free to
+// register or unregister callbacks themselves.
+static void
+__fake_unity_send_device_event(FakeUnityState *state, UnityGfxDeviceEventType event_type)
+{
+    FakeUnityGraphicsDeviceEventCallbacks *callbacks = &state->graphics_device_event_callbacks;
+
+    __fake_unity_spin_lock(&callbacks->lock);
+
+    int32_t count = callbacks->count;
+    FakeUnityGraphicsDeviceEventCallback *items = 0;
+
+    if (count > 0)
+    {
+        items = (FakeUnityGraphicsDeviceEventCallback *) malloc(count * sizeof(FakeUnityGraphicsDeviceEventCallback));
+
+        if (!items)
+        {
+            count = 0;
+        }
+        else
+        {
+            memcpy(items, callbacks->items, count * sizeof(FakeUnityGraphicsDeviceEventCallback));
+        }
+    }
+
+    __fake_unity_spin_unlock(&callbacks->lock);
+
+    uint32_t loading_plugin = __fake_unity_loading_plugin;
+    uint32_t active_plugin = __fake_unity_active_plugin;
+
+    for (int32_t i = 0; i < count; i += 1)
+    {
+        __fake_unity_loading_plugin = items[i].plugin_handle;
+        __fake_unity_active_plugin = items[i].plugin_handle;
+        items[i].callback(event_type);
+    }
+
+    __fake_unity_loading_plugin = loading_plugin;
+    __fake_unity_active_plugin = active_plugin;
+
+    free(items);
+}
+
+// Plugins are supposed to unregister their callbacks in UnityPluginUnload,
+// the ones that are left would call into unloaded code.
+static void
+__fake_unity_remove_device_event_callbacks(FakeUnityState *state, uint32_t plugin_handle)
+{
+    FakeUnityGraphicsDeviceEventCallbacks *callbacks = &state->graphics_device_event_callbacks;
+
+    __fake_unity_spin_lock(&callbacks->lock);
+
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < callbacks->count; i += 1)
+    {
+        if (callbacks->items[i].plugin_handle == plugin_handle)
+        {
+            fprintf(stderr, "[fake_unity] error: a device event callback of plugin %u is removed, because the plugin\n"
+                            "             is unloaded without unregistering it.\n", plugin_handle);
+        }
+        else
+        {
+            callbacks->items[count] = callbacks->items[i];
+            count += 1;
+        }
+    }
+
+    callbacks->count = count;
+
+    __fake_unity_spin_unlock(&callbacks->lock);
+}
+
+// Returns NULL if event_id is out of range, if its page can't be allocated
+// or, unless create is set, if its page was never allocated.
+static FakeUnityPluginEvent *
+__fake_unity_get_plugin_event(FakeUnityPluginEvents *events, int event_id, bool create)
+{
+    if ((event_id < 0) || (event_id >= FAKE_UNITY_MAX_EVENT_ID_COUNT))
+    {
+        return 0;
+    }
+
+    uint32_t page_index = (uint32_t) event_id / FAKE_UNITY_EVENT_PAGE_SIZE;
+
+    FakeUnityPluginEvent *page = (FakeUnityPluginEvent *) __fake_unity_atomic_load_ptr((void *volatile *) (events->pages + page_index));
+
+    if (!page)
+    {
+        if (!create)
+        {
+            return 0;
+        }
+
+        page = (FakeUnityPluginEvent *) calloc(FAKE_UNITY_EVENT_PAGE_SIZE, sizeof(FakeUnityPluginEvent));
+
+        if (!page)
+        {
+            fprintf(stderr, "[fake_unity] error: could not allocate the plugin events %u to %u.\n",
+                    page_index * FAKE_UNITY_EVENT_PAGE_SIZE, (page_index + 1) * FAKE_UNITY_EVENT_PAGE_SIZE - 1);
+            return 0;
+        }
+
+        if (!__fake_unity_atomic_cas_ptr((void *volatile *) (events->pages + page_index), 0, page))
+        {
+            free(page);
+            page = (FakeUnityPluginEvent *) __fake_unity_atomic_load_ptr((void *volatile *) (events->pages + page_index));
+        }
+    }
+
+    return page + ((uint32_t) event_id % FAKE_UNITY_EVENT_PAGE_SIZE);
+}
+
+static int
+IUnityGraphics_ReserveEventIDRange(int count)
+{
+    FakeUnityPluginEvents *events = &__fake_unity_get_state()->plugin_events;
+
+    if (count <= 0)
+    {
+        return -1;
+    }
+
+    __fake_unity_spin_lock(&events->lock);
+
+    // The first free range that is large enough is used, so a reloaded
+    // plugin usually gets its old ids back.
+    FakeUnityEventIDRanges *free_ranges = &events->free_ranges;
+    uint32_t first = 0;
+
+    for (int32_t i = 0; i < free_ranges->count; i += 1)
+    {
+        FakeUnityEventIDRange *range = free_ranges->items + i;
+
+        if (range->count >= (uint32_t) count)
+        {
+            first = range->first;
+            range->first += (uint32_t) count;
+            range->count -= (uint32_t) count;
+
+            if (range->count == 0)
+            {
+                free_ranges->count -= 1;
+                *range = free_ranges->items[free_ranges->count];
+            }
+
+            break;
+        }
+    }
+
+    if (first == 0)
+    {
+        // The range is only taken if it fits, so a failed reservation
+        // doesn't use up ids and the end of the range can't overflow.
+        if ((uint32_t) count > (FAKE_UNITY_MAX_EVENT_ID_COUNT - FAKE_UNITY_FIRST_RESERVED_EVENT_ID - events->next_reserved_id))
+        {
+            __fake_unity_spin_unlock(&events->lock);
+            fprintf(stderr, "[fake_unity] error: ReserveEventIDRange(%d) exceeds FAKE_UNITY_MAX_EVENT_ID_COUNT.\n", count);
+            return -1;
+        }
+
+        first = FAKE_UNITY_FIRST_RESERVED_EVENT_ID + events->next_reserved_id;
+        events->next_reserved_id += (uint32_t) count;
+    }
+
+    if (__fake_unity_loading_plugin)
+    {
+        FakeUnityEventIDRanges *reserved_ranges = &events->reserved_ranges;
+
+        ARRAY_ENSURE_SPACE(reserved_ranges, FakeUnityEventIDRange);
+
+        reserved_ranges->items[reserved_ranges->count].first = first;
+        reserved_ranges->items[reserved_ranges->count].count = (uint32_t) count;
+        reserved_ranges->items[reserved_ranges->count].plugin_handle = __fake_unity_loading_plugin;
+        reserved_ranges->count += 1;
+    }
+
+    __fake_unity_spin_unlock(&events->lock);
+
+    if (__fake_unity_loading_plugin)
+    {
+        for (int32_t i = 0; i < count; i += 1)
+        {
+            FakeUnityPluginEvent *event = __fake_unity_get_plugin_event(events, (int) first + i, true);
+
+            if (event)
+            {
+                __fake_unity_atomic_store_u32(&event->plugin_handle, __fake_unity_loading_plugin);
+            }
+        }
+    }
+
+    return (int) first;
+}
+
+// Gives the ranges a plugin reserved back and forgets which events it owns
+// and how it configured them. The plugin must not have events in flight.
+static void
+__fake_unity_plugin_events_release(FakeUnityPluginEvents *events, uint32_t plugin_handle)
+{
+    __fake_unity_spin_lock(&events->lock);
+
+    FakeUnityEventIDRanges *reserved_ranges = &events->reserved_ranges;
+    FakeUnityEventIDRanges *free_ranges = &events->free_ranges;
+
+    for (int32_t i = 0; i < reserved_ranges->count;)
+    {
+        FakeUnityEventIDRange range = reserved_ranges->items[i];
+
+        if (range.plugin_handle != plugin_handle)
+        {
+            i += 1;
+            continue;
+        }
+
+        reserved_ranges->count -= 1;
+        reserved_ranges->items[i] = reserved_ranges->items[reserved_ranges->count];
+
+        // Merged with the free ranges right before and after it, so the
+        // free list doesn't fragment over several reloads.
+        for (int32_t j = 0; j < free_ranges->count;)
+        {
+            FakeUnityEventIDRange *free_range = free_ranges->items + j;
+
+            if ((free_range->first + free_range->count == range.first) || (range.first + range.count == free_range->first))
+            {
+                range.first = (free_range->first < range.first) ? free_range->first : range.first;
+                range.count += free_range->count;
+
+                free_ranges->count -= 1;
+                *free_range = free_ranges->items[free_ranges->count];
+            }
+            else
+            {
+                j += 1;
+            }
+        }
+
+        ARRAY_ENSURE_SPACE(free_ranges, FakeUnityEventIDRange);
+
+        free_ranges->items[free_ranges->count] = range;
+        free_ranges->count += 1;
+    }
+
+    __fake_unity_spin_unlock(&events->lock);
+
+    for (uint32_t page_index = 0; page_index < (FAKE_UNITY_MAX_EVENT_ID_COUNT / FAKE_UNITY_EVENT_PAGE_SIZE); page_index += 1)
+    {
+        FakeUnityPluginEvent *page = (FakeUnityPluginEvent *) __fake_unity_atomic_load_ptr((void *volatile *) (events->pages + page_index));
+
+        if (!page)
+        {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < FAKE_UNITY_EVENT_PAGE_SIZE; i += 1)
+        {
+            if (__fake_unity_atomic_load_u32(&page[i].plugin_handle) == plugin_handle)
+            {
+                __fake_unity_atomic_store_u32(&page[i].configured, 0);
+                __fake_unity_atomic_store_u32(&page[i].plugin_handle, 0);
+            }
+        }
+    }
+}
+
+static bool
+__fake_unity_vulkan_create_frames(FakeUnityVulkanRenderer *renderer)
+{
+    VkCommandPoolCreateInfo command_pool_create_info;
+    command_pool_create_info.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_create_info.pNext            = 0;
+    command_pool_create_info.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    command_pool_create_info.queueFamilyIndex = renderer->graphics_queue_index;
+
+    VkFenceCreateInfo fence_create_info;
+    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_create_info.pNext = 0;
+    fence_create_info.flags = 0;
+
+    VkQueryPoolCreateInfo query_pool_create_info;
+    query_pool_create_info.sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.pNext              = 0;
+    query_pool_create_info.flags              = 0;
+    query_pool_create_info.queryType          = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_create_info.queryCount         = FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES;
+    query_pool_create_info.pipelineStatistics = 0;
+
+    for (int32_t i = 0; i < FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT; i += 1)
+    {
+        FakeUnityVulkanFrame *frame = renderer->frames + i;
+
+        if ((renderer->vkCreateCommandPool(renderer->device, &command_pool_create_info, 0, &frame->command_pool) != VK_SUCCESS) ||
+            (renderer->vkCreateFence(renderer->device, &fence_create_info, 0, &frame->fence) != VK_SUCCESS))
+        {
+            fprintf(stderr, "[fake_unity] error: could not create the frame command pools.\n");
+            return false;
+        }
+
+        // Without a query pool the frame is just not timed.
+        if (renderer->timestamp_valid_bits &&
+            (renderer->vkCreateQueryPool(renderer->device, &query_pool_create_info, 0, &frame->query_pool) != VK_SUCCESS))
+        {
+            fprintf(stderr, "[fake_unity] error: could not create a timestamp query pool.\n");
+            frame->query_pool = VK_NULL_HANDLE;
+        }
+    }
+
+    renderer->recording = false;
+    renderer->current_frame_number = 1;
+    renderer->safe_frame_number = 0;
+    renderer->barrier_batch = 1;
+    renderer->command_buffer_exposed = false;
+
+    return true;
+}
+
+// Begins the next command buffer of the current frame.
+static bool
+__fake_unity_vulkan_begin_command_buffer(FakeUnityVulkanRenderer *renderer, FakeUnityVulkanFrame *frame)
+{
+    if (frame->command_buffer_index == frame->command_buffers.count)
+    {
+        VkCommandBufferAllocateInfo command_buffer_allocate_info;
+        command_buffer_allocate_info.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.pNext              = 0;
+        command_buffer_allocate_info.commandPool        = frame->command_pool;
+        command_buffer_allocate_info.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        command_buffer_allocate_info.commandBufferCount = 1;
+
+        VkCommandBuffer command_buffer;
+
+        if (renderer->vkAllocateCommandBuffers(renderer->device, &command_buffer_allocate_info, &command_buffer) != VK_SUCCESS)
+        {
+            fprintf(stderr, "[fake_unity] error: vkAllocateCommandBuffers failed.\n");
+            return false;
+        }
+
+        ARRAY_ENSURE_SPACE(&frame->command_buffers, VkCommandBuffer);
+
+        frame->command_buffers.items[frame->command_buffers.count] = command_buffer;
+        frame->command_buffers.count += 1;
+    }
+
+    VkCommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext            = 0;
+    command_buffer_begin_info.flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    command_buffer_begin_info.pInheritanceInfo = 0;
+
+    if (renderer->vkBeginCommandBuffer(frame->command_buffers.items[frame->command_buffer_index], &command_buffer_begin_info) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkBeginCommandBuffer failed.\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Records all pending image and buffer barriers with a single vkCmdPipelineBarrier.
+static void
+__fake_unity_vulkan_record_pending_barriers(FakeUnityVulkanRenderer *renderer, VkCommandBuffer command_buffer)
+{
+    FakeUnityVulkanImageBarriers *barriers = &renderer->pending_image_barriers;
+    FakeUnityVulkanBufferBarriers *buffer_barriers = &renderer->pending_buffer_barriers;
+
+    if ((barriers->count == 0) && (buffer_barriers->count == 0))
+    {
+        return;
+    }
+
+    VkPipelineStageFlags src_stage_flags = renderer->pending_src_stage_flags;
+    VkPipelineStageFlags dst_stage_flags = renderer->pending_dst_stage_flags;
+
+    if (!src_stage_flags)
+    {
+        src_stage_flags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+
+    if (!dst_stage_flags)
+    {
+        dst_stage_flags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
+
+    renderer->vkCmdPipelineBarrier(command_buffer, src_stage_flags, dst_stage_flags, 0, 0, 0,
+                                   (uint32_t) buffer_barriers->count, buffer_barriers->items,
+                                   (uint32_t) barriers->count, barriers->items);
+
+    barriers->count = 0;
+    buffer_barriers->count = 0;
+    renderer->pending_src_stage_flags = 0;
+    renderer->pending_dst_stage_flags = 0;
+    renderer->barrier_batch += 1;
+}
+
+// Ends and submits the current command buffer. The fence is only passed
+// with the last submission of a frame.
+static bool
+__fake_unity_vulkan_submit_command_buffer(FakeUnityVulkanRenderer *renderer, FakeUnityVulkanFrame *frame, VkFence fence)
+{
+    VkCommandBuffer command_buffer = frame->command_buffers.items[frame->command_buffer_index];
+
+    __fake_unity_vulkan_record_pending_barriers(renderer, command_buffer);
+
+    if (renderer->pending_host_read)
+    {
+        VkMemoryBarrier memory_barrier;
+        memory_barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memory_barrier.pNext         = 0;
+        memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        renderer->vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                                       1, &memory_barrier, 0, 0, 0, 0);
+
+        renderer->pending_host_read = false;
+    }
+
+    // The end of the frame, after everything else it recorded.
+    if (frame->query_count && (fence != VK_NULL_HANDLE))
+    {
+        renderer->vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->query_pool, 1);
+    }
+
+    if (frame->command_buffer_index == 0)
+    {
+        frame->submit_timestamp = __fake_unity_get_timestamp();
+    }
+
+    frame->command_buffer_index += 1;
+
+    if (renderer->vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkEndCommandBuffer failed.\n");
+        return false;
+    }
+
+    VkSubmitInfo submit_info;
+    submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext                = 0;
+    submit_info.waitSemaphoreCount   = 0;
+    submit_info.pWaitSemaphores      = 0;
+    submit_info.pWaitDstStageMask    = 0;
+    submit_info.commandBufferCount   = 1;
+    submit_info.pCommandBuffers      = &command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores    = 0;
+
+    if (renderer->vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, fence) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkQueueSubmit failed.\n");
+        return false;
+    }
+
+    return true;
+}
+
+static inline FakeUnityVulkanFrame *
+__fake_unity_vulkan_get_current_frame(FakeUnityVulkanRenderer *renderer)
+{
+    return renderer->frames + (renderer->current_frame_number % FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT);
+}
+
+// Advances safe_frame_number past every frame whose fence is signaled.
+static void
+__fake_unity_vulkan_update_safe_frame_number(FakeUnityVulkanRenderer *renderer)
+{
+    for (uint64_t frame_number = renderer->safe_frame_number + 1; frame_number < renderer->current_frame_number; frame_number += 1)
+    {
+        FakeUnityVulkanFrame *frame = renderer->frames + (frame_number % FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT);
+
+        // A frame that wasn't submitted only becomes safe through a blocking wait.
+        if (!frame->submitted || (renderer->vkGetFenceStatus(renderer->device, frame->fence) != VK_SUCCESS))
+        {
+            break;
+        }
+
+        renderer->safe_frame_number = frame_number;
+    }
+}
+
+// Only the thread that executes the render commands emits gpu timings, so
+// the address of a global identifies the gpu thread in every context.
+static const char __fake_unity_gpu_thread_key = 0;
+
+static const FakeUnityProfilerMarker *
+__fake_unity_vulkan_get_event_gpu_marker(FakeUnityState *state, int event_id)
+{
+    FakeUnityPluginEvent *event = __fake_unity_get_plugin_event(&state->plugin_events, event_id, true);
+
+    if (event && event->gpu_marker)
+    {
+        return event->gpu_marker;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "GPU Plugin Event %d", event_id);
+
+    const UnityProfilerMarkerDesc *marker;
+    IUnityProfiler_CreateMarker(&marker, name, kUnityProfilerCategoryRender, kUnityProfilerMarkerFlagDefault, 0);
+
+    if (event)
+    {
+        event->gpu_marker = (const FakeUnityProfilerMarker *) marker;
+    }
+
+    return (const FakeUnityProfilerMarker *) marker;
+}
+
+// Emits the timings of a frame the gpu finished on the gpu thread of the
+// profiler.
+static void
+__fake_unity_vulkan_emit_frame_timestamps(FakeUnityState *state, FakeUnityVulkanFrame *frame)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    FakeUnityProfiler *profiler = &state->profiler;
+
+    if (!__fake_unity_atomic_load_u32(&profiler->enabled))
+    {
+        return;
+    }
+
+    uint64_t timestamps[FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES];
+
+    if (renderer->vkGetQueryPoolResults(renderer->device, frame->query_pool, 0, frame->query_count, frame->query_count * sizeof(uint64_t),
+                                        timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+        return;
+    }
+
+    if (!profiler->gpu_thread)
+    {
+        profiler->gpu_thread = __fake_unity_profiler_add_thread(profiler, &__fake_unity_gpu_thread_key, "GPU");
+    }
+
+    if (!renderer->gpu_frame_marker)
+    {
+        const UnityProfilerMarkerDesc *marker;
+        IUnityProfiler_CreateMarker(&marker, "GPU Frame", kUnityProfilerCategoryRender, kUnityProfilerMarkerFlagDefault, 0);
+        renderer->gpu_frame_marker = (const FakeUnityProfilerMarker *) marker;
+    }
+
+    uint64_t mask = (renderer->timestamp_valid_bits < 64) ? ((1ull << renderer->timestamp_valid_bits) - 1) : UINT64_MAX;
+
+    // A frame that was submitted while the previous one was still running
+    // starts when that one ended.
+    uint64_t anchor = frame->submit_timestamp;
+
+    if (anchor < renderer->gpu_frame_end_timestamp)
+    {
+        anchor = renderer->gpu_frame_end_timestamp;
+    }
+
+#define to_cpu_timestamp(query) \
+    (anchor + (uint64_t) ((double) ((timestamps[query] - timestamps[0]) & mask) * renderer->timestamp_period))
+
+    __fake_unity_profiler_emit_event(profiler, profiler->gpu_thread, &renderer->gpu_frame_marker->desc,
+                                     kUnityProfilerMarkerEventTypeBegin, to_cpu_timestamp(0), 0, 0);
+
+    for (int32_t i = 0; i < frame->timestamp_scopes.count; i += 1)
+    {
+        FakeUnityVulkanTimestampScope *scope = frame->timestamp_scopes.items + i;
+        const FakeUnityProfilerMarker *marker = __fake_unity_vulkan_get_event_gpu_marker(state, scope->event_id);
+
+        __fake_unity_profiler_emit_event(profiler, profiler->gpu_thread, &marker->desc,
+                                         kUnityProfilerMarkerEventTypeBegin, to_cpu_timestamp(scope->query), 0, 0);
+        __fake_unity_profiler_emit_event(profiler, profiler->gpu_thread, &marker->desc,
+                                         kUnityProfilerMarkerEventTypeEnd, to_cpu_timestamp(scope->query + 1), 0, 0);
+    }
+
+    renderer->gpu_frame_end_timestamp = to_cpu_timestamp(1);
+
+    __fake_unity_profiler_emit_event(profiler, profiler->gpu_thread, &renderer->gpu_frame_marker->desc,
+                                     kUnityProfilerMarkerEventTypeEnd, renderer->gpu_frame_end_timestamp, 0, 0);
+
+#undef to_cpu_timestamp
+}
+
+// Emits the timings of every timed frame up to safe_frame_number, oldest
+// first. Their fences are signaled, so reading the queries never waits.
+static void
+__fake_unity_vulkan_resolve_timestamps(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    uint64_t frame_number = 1;
+
+    if (renderer->safe_frame_number > FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT)
+    {
+        frame_number = renderer->safe_frame_number - FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT + 1;
+    }
+
+    for (; frame_number <= renderer->safe_frame_number; frame_number += 1)
+    {
+        FakeUnityVulkanFrame *frame = renderer->frames + (frame_number % FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT);
+
+        if ((frame->frame_number == frame_number) && frame->query_count)
+        {
+            __fake_unity_vulkan_emit_frame_timestamps(state, frame);
+
+            frame->query_count = 0;
+            frame->timestamp_scopes.count = 0;
+        }
+    }
+}
+
+// Writes the timestamp before a plugin event into the current command
+// buffer and returns the query of the timestamp after it, or zero if the
+// event is not timed.
+static uint32_t
+__fake_unity_vulkan_begin_event_timestamp(FakeUnityVulkanRenderer *renderer, int event_id)
+{
+    if (!renderer->recording)
+    {
+        return 0;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    if (!frame->query_count || ((frame->query_count + 2) > FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES))
+    {
+        return 0;
+    }
+
+    uint32_t query = frame->query_count;
+
+    renderer->vkCmdWriteTimestamp(frame->command_buffers.items[frame->command_buffer_index], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                  frame->query_pool, query);
+
+    FakeUnityVulkanTimestampScopes *scopes = &frame->timestamp_scopes;
+
+    ARRAY_ENSURE_SPACE(scopes, FakeUnityVulkanTimestampScope);
+
+    scopes->items[scopes->count].event_id = event_id;
+    scopes->items[scopes->count].query = query;
+    scopes->count += 1;
+
+    frame->query_count += 2;
+
+    return query + 1;
+}
+
+static void
+__fake_unity_vulkan_end_event_timestamp(FakeUnityVulkanRenderer *renderer, uint32_t query)
+{
+    if (!query || !renderer->recording)
+    {
+        return;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    renderer->vkCmdWriteTimestamp(frame->command_buffers.items[frame->command_buffer_index], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                  frame->query_pool, query);
+}
+
+// Waits until the gpu finished the submitted frame in the slot frame. If it
+// was never submitted, its fence is never signaled, so this waits for
+// everything that was submitted before instead.
+static void
+__fake_unity_vulkan_wait_for_fence(FakeUnityVulkanRenderer *renderer, FakeUnityVulkanFrame *frame)
+{
+    if (frame->submitted)
+    {
+        renderer->vkWaitForFences(renderer->device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+    }
+    else
+    {
+        renderer->vkDeviceWaitIdle(renderer->device);
+    }
+}
+
+// Stops recording and moves on to the next frame. If the last command
+// buffer of the frame wasn't submitted, an empty batch signals the fence
+// instead, once the command buffers the frame flushed before are done.
+static void
+__fake_unity_vulkan_finish_frame(FakeUnityVulkanRenderer *renderer, FakeUnityVulkanFrame *frame, bool submitted)
+{
+    if (!submitted)
+    {
+        // The timestamps of the frame are never written.
+        frame->query_count = 0;
+        frame->timestamp_scopes.count = 0;
+
+        submitted = (renderer->vkQueueSubmit(renderer->graphics_queue, 0, 0, frame->fence) == VK_SUCCESS);
+
+        if (!submitted)
+        {
+            fprintf(stderr, "[fake_unity] error: frame %llu could not be submitted.\n", (unsigned long long) frame->frame_number);
+        }
+    }
+
+    frame->submitted = submitted;
+
+    renderer->recording = false;
+    renderer->current_frame_number += 1;
+}
+
+// Frames that are only begun to record a transfer outside of a frame are
+// not timed, so timed is false for them.
+static void
+__fake_unity_vulkan_begin_frame(FakeUnityState *state, bool timed)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    if (renderer->recording)
+    {
+        return;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    if (frame->frame_number)
+    {
+        if (frame->frame_number > renderer->safe_frame_number)
+        {
+            __fake_unity_vulkan_wait_for_fence(renderer, frame);
+            renderer->safe_frame_number = frame->frame_number;
+        }
+
+        renderer->vkResetFences(renderer->device, 1, &frame->fence);
+    }
+
+    __fake_unity_vulkan_update_safe_frame_number(renderer);
+    __fake_unity_vulkan_resolve_timestamps(state);
+
+    renderer->vkResetCommandPool(renderer->device, frame->command_pool, 0);
+
+    frame->frame_number = renderer->current_frame_number;
+    frame->command_buffer_index = 0;
+    frame->query_count = 0;
+    frame->timestamp_scopes.count = 0;
+
+    renderer->recording = __fake_unity_vulkan_begin_command_buffer(renderer, frame);
+
+    if (timed && renderer->recording && frame->query_pool && __fake_unity_atomic_load_u32(&state->profiler.enabled))
+    {
+        VkCommandBuffer command_buffer = frame->command_buffers.items[0];
+
+        renderer->vkCmdResetQueryPool(command_buffer, frame->query_pool, 0, FAKE_UNITY_VULKAN_MAX_TIMESTAMP_QUERIES);
+        renderer->vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->query_pool, 0);
+
+        frame->query_count = 2;
+    }
+}
+
+static void
+__fake_unity_vulkan_end_frame(FakeUnityVulkanRenderer *renderer)
+{
+    if (!renderer->recording)
+    {
+        return;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    __fake_unity_vulkan_finish_frame(renderer, frame, __fake_unity_vulkan_submit_command_buffer(renderer, frame, frame->fence));
+}
+
+// Submits what was recorded so far and continues the frame in a new
+// command buffer.
+static void
+__fake_unity_vulkan_flush(FakeUnityVulkanRenderer *renderer)
+{
+    if (!renderer->recording)
+    {
+        return;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    // If recording can't continue, the frame ends here.
+    if (!__fake_unity_vulkan_submit_command_buffer(renderer, frame, VK_NULL_HANDLE) ||
+        !__fake_unity_vulkan_begin_command_buffer(renderer, frame))
+    {
+        __fake_unity_vulkan_finish_frame(renderer, frame, false);
+    }
+}
+
+// Returns a memory type allowed by type_bits that has the required flags,
+// preferring one that has the preferred flags as well, or UINT32_MAX.
+static uint32_t
+__fake_unity_vulkan_find_memory_type(FakeUnityVulkanRenderer *renderer, uint32_t type_bits,
+                                     VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags)
+{
+    const VkPhysicalDeviceMemoryProperties *properties = &renderer->memory.properties;
+
+    uint32_t memory_type_index = UINT32_MAX;
+
+    for (uint32_t i = 0; i < properties->memoryTypeCount; i += 1)
+    {
+        VkMemoryPropertyFlags flags = properties->memoryTypes[i].propertyFlags;
+
+        if (!(type_bits & (1u << i)) || ((flags & required_flags) != required_flags))
+        {
+            continue;
+        }
+
+        if ((flags & preferred_flags) == preferred_flags)
+        {
+            return i;
+        }
+
+        if (memory_type_index == UINT32_MAX)
+        {
+            memory_type_index = i;
+        }
+    }
+
+    return memory_type_index;
+}
+
+static inline uint32_t
+__fake_unity_vulkan_get_bucket_index(VkDeviceSize size)
+{
+    uint32_t shift = __FAKE_UNITY_VULKAN_MIN_ALLOCATION_SHIFT;
+
+    while (((VkDeviceSize) 1 << shift) < size)
+    {
+        shift += 1;
+    }
+
+    return shift - __FAKE_UNITY_VULKAN_MIN_ALLOCATION_SHIFT;
+}
+
+static inline void
+__fake_unity_vulkan_push_free_range(FakeUnityVulkanMemoryType *memory_type, uint32_t bucket_index, uint32_t block_index, VkDeviceSize offset)
+{
+    FakeUnityVulkanFreeRanges *bucket = memory_type->buckets + bucket_index;
+
+    ARRAY_ENSURE_SPACE(bucket, FakeUnityVulkanFreeRange);
+
+    bucket->items[bucket->count].block_index = block_index;
+    bucket->items[bucket->count].offset = offset;
+    bucket->count += 1;
+}
+
+// Takes size bytes aligned to size from the end of a block. The padding in
+// front of it is handed to the buckets. Returns false if no block has space.
+static bool
+__fake_unity_vulkan_allocate_from_blocks(FakeUnityVulkanMemoryType *memory_type, VkDeviceSize size, FakeUnityVulkanAllocation *allocation)
+{
+    for (int32_t i = 0; i < memory_type->blocks.count; i += 1)
+    {
+        FakeUnityVulkanMemoryBlock *block = memory_type->blocks.items + i;
+
+        VkDeviceSize offset = (block->head + size - 1) & ~(size - 1);
+
+        if ((offset + size) > FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE)
+        {
+            continue;
+        }
+
+        // Splits the padding into the largest ranges that are aligned to
+        // their size. head is always a multiple of the smallest size.
+        while (block->head < offset)
+        {
+            VkDeviceSize range_size = block->head & (~block->head + 1);
+
+            while ((block->head + range_size) > offset)
+            {
+                range_size >>= 1;
+            }
+
+            __fake_unity_vulkan_push_free_range(memory_type, __fake_unity_vulkan_get_bucket_index(range_size), (uint32_t) i, block->head);
+            block->head += range_size;
+        }
+
+        block->head = offset + size;
+
+        allocation->memory = block->memory;
+        allocation->offset = offset;
+        allocation->block_index = (uint32_t) i;
+
+        return true;
+    }
+
+    return false;
+}
+
+// Sub-allocates memory for requirements, preferring device local memory.
+static bool
+__fake_unity_vulkan_allocate_memory(FakeUnityVulkanRenderer *renderer, const VkMemoryRequirements *requirements, FakeUnityVulkanAllocation *allocation)
+{
+    FakeUnityVulkanMemoryAllocator *allocator = &renderer->memory;
+
+    uint32_t memory_type_index = __fake_unity_vulkan_find_memory_type(renderer, requirements->memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (memory_type_index == UINT32_MAX)
+    {
+        fprintf(stderr, "[fake_unity] error: there is no memory type for memory type bits 0x%x.\n", requirements->memoryTypeBits);
+        return false;
+    }
+
+    uint32_t bucket_index = __fake_unity_vulkan_get_bucket_index((requirements->size > requirements->alignment) ? requirements->size : requirements->alignment);
+    VkDeviceSize size = (VkDeviceSize) 1 << (bucket_index + __FAKE_UNITY_VULKAN_MIN_ALLOCATION_SHIFT);
+
+    allocation->memory_type_index = memory_type_index;
+    allocation->bucket_index = bucket_index;
+
+    VkMemoryAllocateInfo memory_allocate_info;
+    memory_allocate_info.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_allocate_info.pNext           = 0;
+    memory_allocate_info.allocationSize  = FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE;
+    memory_allocate_info.memoryTypeIndex = memory_type_index;
+
+    if (size > (FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE / 2))
+    {
+        memory_allocate_info.allocationSize = requirements->size;
+
+        if (renderer->vkAllocateMemory(renderer->device, &memory_allocate_info, NULL, &allocation->memory) != VK_SUCCESS)
+        {
+            fprintf(stderr, "[fake_unity] error: could not allocate %llu bytes of device memory.\n", (unsigned long long) requirements->size);
+            return false;
+        }
+
+        allocation->offset = 0;
+        allocation->block_index = UINT32_MAX;
+
+        return true;
+    }
+
+    bool result = true;
+
+    __fake_unity_spin_lock(&allocator->lock);
+
+    FakeUnityVulkanMemoryType *memory_type = allocator->types + memory_type_index;
+    FakeUnityVulkanFreeRanges *bucket = memory_type->buckets + bucket_index;
+
+    if (bucket->count > 0)
+    {
+        bucket->count -= 1;
+
+        allocation->block_index = bucket->items[bucket->count].block_index;
+        allocation->offset = bucket->items[bucket->count].offset;
+        allocation->memory = memory_type->blocks.items[allocation->block_index].memory;
+    }
+    else if (!__fake_unity_vulkan_allocate_from_blocks(memory_type, size, allocation))
+    {
+        FakeUnityVulkanMemoryBlock block;
+        block.head = 0;
+
+        if (renderer->vkAllocateMemory(renderer->device, &memory_allocate_info, NULL, &block.memory) == VK_SUCCESS)
+        {
+            FakeUnityVulkanMemoryBlocks *blocks = &memory_type->blocks;
+
+            ARRAY_ENSURE_SPACE(blocks, FakeUnityVulkanMemoryBlock);
+
+            blocks->items[blocks->count] = block;
+            blocks->count += 1;
+
+            result = __fake_unity_vulkan_allocate_from_blocks(memory_type, size, allocation);
+        }
+        else
+        {
+            fprintf(stderr, "[fake_unity] error: could not allocate a memory block of %u bytes.\n", FAKE_UNITY_VULKAN_MEMORY_BLOCK_SIZE);
+            result = false;
+        }
+    }
+
+    __fake_unity_spin_unlock(&allocator->lock);
+
+    return result;
+}
+
+static void
+__fake_unity_vulkan_free_memory(FakeUnityVulkanRenderer *renderer, const FakeUnityVulkanAllocation *allocation)
+{
+    if (allocation->block_index == UINT32_MAX)
+    {
+        renderer->vkFreeMemory(renderer->device, allocation->memory, NULL);
+        return;
+    }
+
+    FakeUnityVulkanMemoryAllocator *allocator = &renderer->memory;
+
+    __fake_unity_spin_lock(&allocator->lock);
+
+    __fake_unity_vulkan_push_free_range(allocator->types + allocation->memory_type_index, allocation->bucket_index,
+                                        allocation->block_index, allocation->offset);
+
+    __fake_unity_spin_unlock(&allocator->lock);
+}
+
+static void *
+__fake_unity_aligned_alloc(size_t size, size_t alignment)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    return _aligned_malloc(size, alignment);
+#else
+    void *memory;
+
+    if (posix_memalign(&memory, alignment, size) != 0)
+    {
+        return 0;
+    }
+
+    return memory;
+#endif
+}
+
+static void
+__fake_unity_aligned_free(void *memory)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+static void *
+__fake_unity_null_allocate_pixels(FakeUnityNullRenderer *renderer, uint64_t size, uint32_t *out_bucket_index)
+{
+    uint32_t shift = __FAKE_UNITY_NULL_MIN_PIXELS_SHIFT;
+
+    while (((uint64_t) 1 << shift) < size)
+    {
+        shift += 1;
+    }
+
+    uint32_t bucket_index = shift - __FAKE_UNITY_NULL_MIN_PIXELS_SHIFT;
+
+    if (bucket_index >= __FAKE_UNITY_NULL_PIXELS_BUCKET_COUNT)
+    {
+        return 0;
+    }
+
+    __fake_unity_spin_lock(&renderer->lock);
+
+    void *pixels = renderer->free_pixels[bucket_index];
+
+    if (pixels)
+    {
+        renderer->free_pixels[bucket_index] = *(void **) pixels;
+    }
+
+    __fake_unity_spin_unlock(&renderer->lock);
+
+    if (!pixels)
+    {
+        pixels = __fake_unity_aligned_alloc((size_t) 1 << shift, FAKE_UNITY_NULL_PIXELS_ALIGNMENT);
+    }
+
+    *out_bucket_index = bucket_index;
+
+    return pixels;
+}
+
+static void
+__fake_unity_null_free_pixels(FakeUnityNullRenderer *renderer, void *pixels, uint32_t bucket_index)
+{
+    __fake_unity_spin_lock(&renderer->lock);
+
+    *(void **) pixels = renderer->free_pixels[bucket_index];
+    renderer->free_pixels[bucket_index] = pixels;
+
+    __fake_unity_spin_unlock(&renderer->lock);
+}
+
+// Gives the slot of a retired texture back to the pool.
+static void
+__fake_unity_texture_release(FakeUnityState *state, uint32_t index)
+{
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+        FakeUnityTexture *texture = __fake_unity_get_texture(state, index);
+
+        renderer->vkDestroyImageView(renderer->device, texture->vk_image_view, NULL);
+
+        if (texture->owns_image)
+        {
+            renderer->vkDestroyImage(renderer->device, texture->image, NULL);
+            __fake_unity_vulkan_free_memory(renderer, &texture->allocation);
+        }
+    }
+    else
+    {
+        FakeUnityTexture *texture = __fake_unity_get_texture(state, index);
+
+        if (texture->owns_image)
+        {
+            __fake_unity_null_free_pixels(&state->renderer.null, texture->pixels, texture->pixels_bucket_index);
+        }
+    }
+
+    __fake_unity_handle_pool_push(&state->texture_pool, index);
+}
+
+// Releases the destroyed textures of every frame the gpu has finished.
+static void
+__fake_unity_vulkan_release_deferred_textures(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    FakeUnityVulkanDeferredTextures *deferred_textures = &renderer->deferred_textures;
+
+    int32_t released_count = 0;
+
+    while ((released_count < deferred_textures->count) &&
+           (deferred_textures->items[released_count].frame_number <= renderer->safe_frame_number))
+    {
+        __fake_unity_texture_release(state, deferred_textures->items[released_count].index);
+        released_count += 1;
+    }
+
+    if (released_count > 0)
+    {
+        deferred_textures->count -= released_count;
+        memmove(deferred_textures->items, deferred_textures->items + released_count,
+                deferred_textures->count * sizeof(*deferred_textures->items));
+    }
+}
+
+// Releases the slots of retired textures once no frame in flight can use
+// them anymore.
+static void
+__fake_unity_release_textures(FakeUnityState *state, int32_t count, const uint32_t *indices)
+{
+    for (int32_t i = 0; i < count; i += 1)
+    {
+        uint32_t index = indices[i];
+
+        if (state->renderer_type == kUnityGfxRendererVulkan)
+        {
+            FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+            // The frame that is being recorded or the last submitted one.
+            uint64_t frame_number = renderer->recording ? renderer->current_frame_number : (renderer->current_frame_number - 1);
+
+            if (frame_number > renderer->safe_frame_number)
+            {
+                FakeUnityVulkanDeferredTextures *deferred_textures = &renderer->deferred_textures;
+
+                ARRAY_ENSURE_SPACE(deferred_textures, FakeUnityVulkanDeferredTexture);
+
+                deferred_textures->items[deferred_textures->count].frame_number = frame_number;
+                deferred_textures->items[deferred_textures->count].index = index;
+                deferred_textures->count += 1;
+
+                continue;
+            }
+        }
+
+        __fake_unity_texture_release(state, index);
+    }
+}
+
+static bool
+__fake_unity_vulkan_access_texture(FakeUnityState *state, FakeUnityTexture *texture, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                   VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                   UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image);
+
+static bool
+__fake_unity_vulkan_create_staging_buffer(FakeUnityVulkanRenderer *renderer)
+{
+    FakeUnityVulkanStagingBuffer *staging = &renderer->staging;
+
+    if (staging->buffer)
+    {
+        return true;
+    }
+
+    VkBufferCreateInfo buffer_create_info;
+    buffer_create_info.sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.pNext                 = 0;
+    buffer_create_info.flags                 = 0;
+    buffer_create_info.size                  = FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE;
+    buffer_create_info.usage                 = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_create_info.sharingMode           = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_create_info.queueFamilyIndexCount = 0;
+    buffer_create_info.pQueueFamilyIndices   = 0;
+
+    if (renderer->vkCreateBuffer(renderer->device, &buffer_create_info, NULL, &staging->buffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkCreateBuffer failed for the staging buffer.\n");
+        staging->buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    renderer->vkGetBufferMemoryRequirements(renderer->device, staging->buffer, &memory_requirements);
+
+    // Readbacks are copied out of the buffer by the cpu, which is a lot
+    // faster from cached memory.
+    uint32_t memory_type_index = __fake_unity_vulkan_find_memory_type(renderer, memory_requirements.memoryTypeBits,
+                                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                                                      VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+    if (memory_type_index == UINT32_MAX)
+    {
+        fprintf(stderr, "[fake_unity] error: there is no host visible and coherent memory type for the staging buffer.\n");
+        renderer->vkDestroyBuffer(renderer->device, staging->buffer, NULL);
+        staging->buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkMemoryAllocateInfo memory_allocate_info;
+    memory_allocate_info.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_allocate_info.pNext           = 0;
+    memory_allocate_info.allocationSize  = memory_requirements.size;
+    memory_allocate_info.memoryTypeIndex = memory_type_index;
+
+    void *mapped = 0;
+
+    if ((renderer->vkAllocateMemory(renderer->device, &memory_allocate_info, NULL, &staging->memory) != VK_SUCCESS) ||
+        (renderer->vkBindBufferMemory(renderer->device, staging->buffer, staging->memory, 0) != VK_SUCCESS) ||
+        (renderer->vkMapMemory(renderer->device, staging->memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS))
+    {
+        fprintf(stderr, "[fake_unity] error: could not allocate %u bytes for the staging buffer.\n", FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE);
+        renderer->vkDestroyBuffer(renderer->device, staging->buffer, NULL);
+        renderer->vkFreeMemory(renderer->device, staging->memory, NULL);
+        staging->buffer = VK_NULL_HANDLE;
+        staging->memory = VK_NULL_HANDLE;
+        return false;
+    }
+
+    staging->mapped = (uint8_t *) mapped;
+    staging->head = 0;
+    staging->tail = 0;
+
+    return true;
+}
+
+// Gives back the staging memory of every transfer the gpu has finished and
+// copies the readbacks to their destination.
+static void
+__fake_unity_vulkan_retire_transfers(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    FakeUnityVulkanStagingBuffer *staging = &renderer->staging;
+    FakeUnityVulkanTransfers *transfers = &staging->transfers;
+
+    int32_t retired_count = 0;
+
+    while ((retired_count < transfers->count) &&
+           (transfers->items[retired_count].frame_number <= renderer->safe_frame_number))
+    {
+        FakeUnityVulkanTransfer *transfer = transfers->items + retired_count;
+
+        if (transfer->destination)
+        {
+            memcpy(transfer->destination, staging->mapped + transfer->staging_offset, transfer->size);
+        }
+
+        staging->tail = transfer->staging_end;
+
+        if (transfer->request)
+        {
+            __fake_unity_gpu_request_set_flags(state, transfer->request,
+                                               FAKE_UNITY_GPU_REQUEST_DONE | (transfer->failed ? FAKE_UNITY_GPU_REQUEST_ERROR : 0));
+        }
+
+        retired_count += 1;
+    }
+
+    if (retired_count > 0)
+    {
+        transfers->count -= retired_count;
+        memmove(transfers->items, transfers->items + retired_count,
+                transfers->count * sizeof(*transfers->items));
+    }
+}
+
+// Blocks until the gpu finished frame_number. The frame that is being
+// recorded is submitted first and recording continues in the next frame.
+static void
+__fake_unity_vulkan_wait_for_frame(FakeUnityState *state, uint64_t frame_number)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    if (frame_number <= renderer->safe_frame_number)
+    {
+        return;
+    }
+
+    if (renderer->recording && (frame_number == renderer->current_frame_number))
+    {
+        // The next frame continues the current one, standalone transfers
+        // stay untimed.
+        bool timed = __fake_unity_vulkan_get_current_frame(renderer)->query_count != 0;
+
+        __fake_unity_vulkan_end_frame(renderer);
+        __fake_unity_vulkan_begin_frame(state, timed);
+        __fake_unity_vulkan_release_deferred_textures(state);
+    }
+
+    if (frame_number >= renderer->current_frame_number)
+    {
+        // Never submitted, nothing to wait for.
+        return;
+    }
+
+    FakeUnityVulkanFrame *frame = renderer->frames + (frame_number % FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT);
+
+    if (frame_number > renderer->safe_frame_number)
+    {
+        __fake_unity_vulkan_wait_for_fence(renderer, frame);
+        renderer->safe_frame_number = frame_number;
+    }
+}
+
+// Reserves size bytes of the staging buffer at a multiple of alignment.
+// Waits for the oldest transfers while the ring buffer is full. Returns
+// false if the space can not be freed.
+static bool
+__fake_unity_vulkan_staging_allocate(FakeUnityState *state, uint64_t size, uint64_t alignment, uint64_t *out_offset)
+{
+    FakeUnityVulkanStagingBuffer *staging = &state->renderer.vulkan.staging;
+
+    const uint64_t capacity = FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE;
+
+    if (size > capacity)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        uint64_t offset = staging->head % capacity;
+        uint64_t padding = (alignment - (offset % alignment)) % alignment;
+
+        // Pieces are never split at the end of the buffer.
+        if ((offset + padding + size) > capacity)
+        {
+            padding = capacity - offset;
+        }
+
+        uint64_t start = staging->head + padding;
+
+        if ((start + size - staging->tail) <= capacity)
+        {
+            staging->head = start + size;
+            *out_offset = start % capacity;
+            return true;
+        }
+
+        if (staging->transfers.count == 0)
+        {
+            return false;
+        }
+
+        __fake_unity_vulkan_wait_for_frame(state, staging->transfers.items[0].frame_number);
+        __fake_unity_vulkan_retire_transfers(state);
+
+        if (staging->transfers.count && (staging->transfers.items[0].frame_number > state->renderer.vulkan.safe_frame_number))
+        {
+            return false;
+        }
+    }
+}
+
+// Copies the pixel data of a command between its host memory and a mip
+// level of the texture through the staging buffer. Every piece is at most a
+// quarter of the buffer, so a transfer larger than the buffer waits for its
+// own earlier pieces. Uploads are done once their data is in the staging
+// buffer, readbacks once the gpu finished the frame with their last piece.
+static void
+__fake_unity_vulkan_transfer_texture(FakeUnityState *state, const FakeUnityRenderCommand *command)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    FakeUnityVulkanStagingBuffer *staging = &renderer->staging;
+    FakeUnityVulkanTransfers *transfers = &staging->transfers;
+
+    bool upload = (command->type == FakeUnityRenderCommandType_UploadTexture);
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->texture_pool, command->texture_handle);
+
+    if ((index < 0) || !__fake_unity_vulkan_create_staging_buffer(renderer))
+    {
+        __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_ERROR);
+        return;
+    }
+
+    FakeUnityTexture *texture = __fake_unity_get_texture(state, (uint32_t) index);
+    const FakeUnityTextureFormatInfo *format_info = __fake_unity_get_texture_format_info((FakeUnity_TextureFormat) texture->texture_format);
+
+    uint32_t mip_level = command->mip_level;
+    uint32_t width = ((uint32_t) texture->width >> mip_level) ? ((uint32_t) texture->width >> mip_level) : 1;
+    uint32_t height = ((uint32_t) texture->height >> mip_level) ? ((uint32_t) texture->height >> mip_level) : 1;
+    uint32_t depth = ((uint32_t) texture->depth >> mip_level) ? ((uint32_t) texture->depth >> mip_level) : 1;
+
+    uint64_t block_row_size = ((width + format_info->block_width - 1) / format_info->block_width) * format_info->block_size;
+    uint32_t block_row_count = (height + format_info->block_height - 1) / format_info->block_height;
+
+    uint64_t max_piece_size = FAKE_UNITY_VULKAN_STAGING_BUFFER_SIZE / 4;
+
+    if (block_row_size > max_piece_size)
+    {
+        fprintf(stderr, "[fake_unity] error: a row of %u pixels does not fit into the staging buffer.\n", width);
+        __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_ERROR);
+        return;
+    }
+
+    uint32_t rows_per_piece = (uint32_t) (max_piece_size / block_row_size);
+
+    if (rows_per_piece > block_row_count)
+    {
+        rows_per_piece = block_row_count;
+    }
+
+    // Buffer offsets of copies have to be a multiple of the texel block
+    // size and of 4.
+    uint64_t alignment = format_info->block_size;
+
+    while (alignment % 4)
+    {
+        alignment += format_info->block_size;
+    }
+
+    bool standalone = !renderer->recording;
+
+    if (standalone)
+    {
+        __fake_unity_vulkan_begin_frame(state, false);
+        __fake_unity_vulkan_release_deferred_textures(state);
+        __fake_unity_vulkan_retire_transfers(state);
+    }
+
+    // Without other mip levels an upload overwrites the whole image, so the
+    // old contents do not have to be preserved.
+    UnityVulkanResourceAccessMode access_mode = (upload && (texture->mip_count == 1)) ? kUnityVulkanResourceAccess_Recreate
+                                                                                    : kUnityVulkanResourceAccess_PipelineBarrier;
+
+    if (!__fake_unity_vulkan_access_texture(state, texture, NULL,
+                                            upload ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                            upload ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_TRANSFER_READ_BIT,
+                                            access_mode, NULL))
+    {
+        __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_ERROR);
+        return;
+    }
+
+    // 3D textures have a single layer with depth slices, everything else
+    // has layers with a single slice.
+    bool volume = (texture->view_type == VK_IMAGE_VIEW_TYPE_3D);
+    uint32_t slice_count = volume ? depth : texture->layer_count;
+
+    uint8_t *data = (uint8_t *) command->data;
+    uint64_t data_offset = 0;
+    uint64_t last_frame_number = 0;
+    bool failed = false;
+
+    for (uint32_t slice = 0; (slice < slice_count) && !failed; slice += 1)
+    {
+        for (uint32_t row = 0; row < block_row_count; row += rows_per_piece)
+        {
+            uint32_t row_count = ((block_row_count - row) < rows_per_piece) ? (block_row_count - row) : rows_per_piece;
+            uint64_t size = row_count * block_row_size;
+            uint64_t staging_offset;
+
+            // May submit the frame, so the command buffer is looked up after.
+            if (!__fake_unity_vulkan_staging_allocate(state, size, alignment, &staging_offset) || !renderer->recording)
+            {
+                fprintf(stderr, "[fake_unity] error: could not allocate %llu bytes of staging memory.\n", (unsigned long long) size);
+                failed = true;
+                break;
+            }
+
+            if (upload)
+            {
+                memcpy(staging->mapped + staging_offset, data + data_offset, size);
+            }
+
+            uint32_t y = row * format_info->block_height;
+
+            VkBufferImageCopy region;
+            region.bufferOffset      = staging_offset;
+            region.bufferRowLength   = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource  = { VK_IMAGE_ASPECT_COLOR_BIT, mip_level, volume ? 0 : slice, 1 };
+            region.imageOffset       = { 0, (int32_t) y, volume ? (int32_t) slice : 0 };
+            region.imageExtent       = { width, ((height - y) < (row_count * format_info->block_height)) ? (height - y) : (row_count * format_info->block_height), 1 };
+
+            FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+            VkCommandBuffer command_buffer = frame->command_buffers.items[frame->command_buffer_index];
+
+            __fake_unity_vulkan_record_pending_barriers(renderer, command_buffer);
+
+            if (upload)
+            {
+                renderer->vkCmdCopyBufferToImage(command_buffer, staging->buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            }
+            else
+            {
+                renderer->vkCmdCopyImageToBuffer(command_buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging->buffer, 1, &region);
+                renderer->pending_host_read = true;
+            }
+
+            ARRAY_ENSURE_SPACE(transfers, FakeUnityVulkanTransfer);
+
+            FakeUnityVulkanTransfer *transfer = transfers->items + transfers->count;
+            transfer->frame_number   = renderer->current_frame_number;
+            transfer->staging_end    = staging->head;
+            transfer->staging_offset = staging_offset;
+            transfer->destination    = upload ? NULL : (data + data_offset);
+            transfer->size           = upload ? 0 : (size_t) size;
+            transfer->request        = 0;
+            transfer->failed         = false;
+
+            transfers->count += 1;
+
+            data_offset += size;
+            last_frame_number = renderer->current_frame_number;
+        }
+    }
+
+    if (renderer->recording)
+    {
+        __fake_unity_vulkan_access_texture(state, texture, NULL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                           kUnityVulkanResourceAccess_PipelineBarrier, NULL);
+    }
+
+    // Nothing is retired after the last piece was added, so it is still the
+    // last transfer unless it was retired while the next piece waited for
+    // staging memory and failed.
+    if (!upload && (last_frame_number > renderer->safe_frame_number))
+    {
+        transfers->items[transfers->count - 1].request = command->request;
+        transfers->items[transfers->count - 1].failed = failed;
+    }
+    else
+    {
+        __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | (failed ? FAKE_UNITY_GPU_REQUEST_ERROR : 0));
+    }
+
+    if (standalone)
+    {
+        __fake_unity_vulkan_end_frame(renderer);
+    }
+}
+
+// Waits for every transfer that was recorded so far.
+static void
+__fake_unity_vulkan_complete_transfers(FakeUnityState *state)
+{
+    FakeUnityVulkanTransfers *transfers = &state->renderer.vulkan.staging.transfers;
+
+    if (transfers->count > 0)
+    {
+        __fake_unity_vulkan_wait_for_frame(state, transfers->items[transfers->count - 1].frame_number);
+    }
+
+    __fake_unity_vulkan_retire_transfers(state);
+}
+
+// Submits the frame that is being recorded, waits until the gpu is idle and
+// finishes everything that was waiting for it.
+static void
+__fake_unity_vulkan_wait_idle(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    __fake_unity_vulkan_end_frame(renderer);
+
+    renderer->vkDeviceWaitIdle(renderer->device);
+    renderer->safe_frame_number = renderer->current_frame_number - 1;
+
+    __fake_unity_vulkan_resolve_timestamps(state);
+
+    __fake_unity_vulkan_release_deferred_textures(state);
+    __fake_unity_vulkan_retire_transfers(state);
+}
+
+static volatile uint32_t __fake_unity_pipeline_cache_save_count;
+
+// Writes the pipeline cache to vulkan_pipeline_cache_path, if one is set.
+static bool
+__fake_unity_vulkan_save_pipeline_cache(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    const char *path = state->vulkan_pipeline_cache_path;
+
+    if (!path || !renderer->pipeline_cache)
+    {
+        return false;
+    }
+
+    size_t size = 0;
+
+    if (renderer->vkGetPipelineCacheData(renderer->device, renderer->pipeline_cache, &size, 0) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    void *data = malloc(size);
+
+    if (!data)
+    {
+        return false;
+    }
+
+    if (renderer->vkGetPipelineCacheData(renderer->device, renderer->pipeline_cache, &size, data) != VK_SUCCESS)
+    {
+        free(data);
+        return false;
+    }
+
+    // Write to a temporary file first, so concurrent runs never load a
+    // partially written cache. The name is unique per process and save, so
+    // concurrent saves never write to the same temporary file.
+    uint32_t number = __fake_unity_atomic_add_u32(&__fake_unity_pipeline_cache_save_count, 1);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    unsigned long process_id = (unsigned long) GetCurrentProcessId();
+#else
+    unsigned long process_id = (unsigned long) getpid();
+#endif
+
+    size_t temp_path_size = strlen(path) + 48;
+    char *temp_path = (char *) malloc(temp_path_size);
+
+    if (!temp_path)
+    {
+        free(data);
+        return false;
+    }
+
+    snprintf(temp_path, temp_path_size, "%s.%lu.%u.tmp", path, process_id, number);
+
+    bool result = false;
+    FILE *file = fopen(temp_path, "wb");
+
+    if (file)
+    {
+        result = (fwrite(data, 1, size, file) == size);
+        result = (fclose(file) == 0) && result;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        result = result && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+        result = result && (rename(temp_path, path) == 0);
+#endif
+
+        if (!result)
+        {
+            remove(temp_path);
+        }
+    }
+
+    if (!result)
+    {
+        fprintf(stderr, "[fake_unity] error: could not write pipeline cache '%s'\n", path);
+    }
+
+    free(temp_path);
+    free(data);
+
+    return result;
+}
+
+// Retires and releases every live texture. Nothing may use them anymore.
+static void
+__fake_unity_release_all_textures(FakeUnityState *state)
+{
+    FakeUnityHandlePool *texture_pool = &state->texture_pool;
+    uint32_t texture_count = __fake_unity_atomic_load_u32(&texture_pool->page_count) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+    for (uint32_t index = 0; index < texture_count; index += 1)
+    {
+        if (__fake_unity_handle_pool_retire(texture_pool, __fake_unity_get_texture(state, index)->handle) >= 0)
+        {
+            __fake_unity_texture_release(state, index);
+        }
+    }
+}
+
+static void __fake_unity_vulkan_trace_release_device(VkDevice device);
+
+// Destroys every vulkan object of the renderer and the textures, leaving
+// the renderer zeroed so it can be created again.
+static void
+__fake_unity_vulkan_destroy_renderer(FakeUnityState *state)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    VkDevice device = renderer->device;
+
+    __fake_unity_vulkan_wait_idle(state);
+    __fake_unity_release_all_textures(state);
+
+    // Registered buffers belong to the caller, only their handles go away.
+    FakeUnityHandlePool *buffer_pool = &state->buffer_pool;
+    uint32_t buffer_count = __fake_unity_atomic_load_u32(&buffer_pool->page_count) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+    for (uint32_t index = 0; index < buffer_count; index += 1)
+    {
+        if (__fake_unity_handle_pool_retire(buffer_pool, *(uint32_t *) __fake_unity_handle_pool_get_item(buffer_pool, index)) >= 0)
+        {
+            __fake_unity_handle_pool_push(buffer_pool, index);
+        }
+    }
+
+    FakeUnityVulkanStagingBuffer *staging = &renderer->staging;
+
+    if (staging->buffer)
+    {
+        renderer->vkDestroyBuffer(device, staging->buffer, NULL);
+        renderer->vkFreeMemory(device, staging->memory, NULL);
+    }
+
+    free(staging->transfers.items);
+
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i += 1)
+    {
+        FakeUnityVulkanMemoryType *memory_type = renderer->memory.types + i;
+
+        for (int32_t j = 0; j < memory_type->blocks.count; j += 1)
+        {
+            renderer->vkFreeMemory(device, memory_type->blocks.items[j].memory, NULL);
+        }
+
+        free(memory_type->blocks.items);
+
+        for (uint32_t j = 0; j < __FAKE_UNITY_VULKAN_ALLOCATION_BUCKET_COUNT; j += 1)
+        {
+            free(memory_type->buckets[j].items);
+        }
+    }
+
+    for (int32_t i = 0; i < FAKE_UNITY_VULKAN_FRAMES_IN_FLIGHT; i += 1)
+    {
+        FakeUnityVulkanFrame *frame = renderer->frames + i;
+
+        // Also frees the command buffers of the frame.
+        renderer->vkDestroyCommandPool(device, frame->command_pool, NULL);
+        renderer->vkDestroyFence(device, frame->fence, NULL);
+
+        if (frame->query_pool)
+        {
+            renderer->vkDestroyQueryPool(device, frame->query_pool, NULL);
+        }
+
+        free(frame->command_buffers.items);
+        free(frame->timestamp_scopes.items);
+    }
+
+    free(renderer->pending_image_barriers.items);
+    free(renderer->pending_buffer_barriers.items);
+    free(renderer->deferred_textures.items);
+
+    // Like the engine, the pipeline cache is written back when the device
+    // goes away.
+    __fake_unity_vulkan_save_pipeline_cache(state);
+
+    renderer->vkDestroyPipelineCache(device, renderer->pipeline_cache, NULL);
+
+    // Another device can get the same dispatch key later on.
+    __fake_unity_vulkan_trace_release_device(device);
+
+    renderer->vkDestroyDevice(device, NULL);
+    renderer->vkDestroyInstance(renderer->instance, NULL);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    FreeLibrary(renderer->loader_handle);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    dlclose(renderer->loader_handle);
+#endif
+
+    memset(renderer, 0, sizeof(*renderer));
+}
+
+// Releases the textures and frees the pooled pixel memory.
+static void
+__fake_unity_null_destroy_renderer(FakeUnityState *state)
+{
+    FakeUnityNullRenderer *renderer = &state->renderer.null;
+
+    __fake_unity_release_all_textures(state);
+
+    for (uint32_t i = 0; i < __FAKE_UNITY_NULL_PIXELS_BUCKET_COUNT; i += 1)
+    {
+        void *pixels = renderer->free_pixels[i];
+
+        while (pixels)
+        {
+            void *next = *(void **) pixels;
+            __fake_unity_aligned_free(pixels);
+            pixels = next;
+        }
+    }
+
+    memset(renderer, 0, sizeof(*renderer));
+}
+
+// The pixels are in host memory, so a transfer is done right away.
+static void
+__fake_unity_null_transfer_texture(FakeUnityState *state, const FakeUnityRenderCommand *command)
+{
+    int32_t index = __fake_unity_handle_pool_get_index(&state->texture_pool, command->texture_handle);
+
+    if (index < 0)
+    {
+        __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_ERROR);
+        return;
+    }
+
+    FakeUnityTexture *texture = __fake_unity_get_texture(state, (uint32_t) index);
+    uint8_t *pixels = (uint8_t *) texture->pixels + __fake_unity_get_texture_mip_offset(texture, command->mip_level);
+
+    if (command->type == FakeUnityRenderCommandType_UploadTexture)
+    {
+        memcpy(pixels, command->data, command->size);
+    }
+    else
+    {
+        memcpy(command->data, pixels, command->size);
+    }
+
+    __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE);
+}
+
+// Set on the render thread to the context it belongs to.
+static __FAKE_UNITY_THREAD_LOCAL FakeUnityState *__fake_unity_render_thread_state;
+
+static inline bool
+__fake_unity_render_thread_is_running(FakeUnityRenderThread *render_thread)
+{
+    return __fake_unity_atomic_load_u32(&render_thread->running) != 0;
+}
+
+// Used for events that were never configured.
+static const UnityVulkanPluginEventConfig __fake_unity_default_plugin_event_config =
+{
+    kUnityVulkanRenderPass_DontCare,
+    kUnityVulkanGraphicsQueueAccess_DontCare,
+    kUnityVulkanEventConfigFlag_EnsurePreviousFrameSubmission,
+};
+
+// The configuration of the plugin event that is executing on this thread.
+static __FAKE_UNITY_THREAD_LOCAL const UnityVulkanPluginEventConfig *__fake_unity_current_plugin_event_config;
+
+static void
+__fake_unity_plugin_event_execute(FakeUnityState *state, const FakeUnityRenderCommand *command)
+{
+    const UnityVulkanPluginEventConfig *config = &__fake_unity_default_plugin_event_config;
+
+    FakeUnityPluginEvent *event = __fake_unity_get_plugin_event(&state->plugin_events, command->event_id, false);
+
+    if (event && __fake_unity_atomic_load_u32(&event->configured))
+    {
+        config = &event->config;
+    }
+
+    if ((state->renderer_type == kUnityGfxRendererVulkan) &&
+        (command->flush || (config->flags & kUnityVulkanEventConfigFlag_FlushCommandBuffers)))
+    {
+        __fake_unity_vulkan_flush(&state->renderer.vulkan);
+    }
+
+    uint32_t end_query = 0;
+
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        end_query = __fake_unity_vulkan_begin_event_timestamp(&state->renderer.vulkan, command->event_id);
+
+        // Work the plugin submits to the queue itself has to come after the
+        // timestamp.
+        if (end_query && (command->flush || (config->graphicsQueueAccess == kUnityVulkanGraphicsQueueAccess_Allow)))
+        {
+            __fake_unity_vulkan_flush(&state->renderer.vulkan);
+        }
+    }
+
+    // Without a render thread events can run inside UnityPluginLoad.
+    uint32_t active_plugin = __fake_unity_active_plugin;
+
+    __fake_unity_current_plugin_event_config = config;
+    __fake_unity_active_plugin = event ? __fake_unity_atomic_load_u32(&event->plugin_handle) : 0;
+
+    if (command->type == FakeUnityRenderCommandType_PluginEvent)
+    {
+        command->event(command->event_id);
+    }
+    else
+    {
+        command->event_and_data(command->event_id, command->data);
+    }
+
+    __fake_unity_current_plugin_event_config = 0;
+    __fake_unity_active_plugin = active_plugin;
+
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+        // Transitions a plugin requested without recording anything still
+        // have to happen before the work that follows the event.
+        if (renderer->recording)
+        {
+            FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+            __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+        }
+
+        __fake_unity_vulkan_end_event_timestamp(renderer, end_query);
+
+        renderer->command_buffer_exposed = false;
+    }
+}
+
+static void
+__fake_unity_render_command_execute(FakeUnityState *state, const FakeUnityRenderCommand *command)
+{
+    switch (command->type)
+    {
+        case FakeUnityRenderCommandType_PluginEvent:
+        case FakeUnityRenderCommandType_PluginEventAndData:
+            __fake_unity_plugin_event_execute(state, command);
+            break;
+
+        case FakeUnityRenderCommandType_BeginFrame:
+            if (state->renderer_type == kUnityGfxRendererVulkan)
+            {
+                __fake_unity_vulkan_begin_frame(state, true);
+                __fake_unity_vulkan_release_deferred_textures(state);
+                __fake_unity_vulkan_retire_transfers(state);
+            }
+            break;
+
+        case FakeUnityRenderCommandType_EndFrame:
+            if (state->renderer_type == kUnityGfxRendererVulkan)
+            {
+                __fake_unity_vulkan_end_frame(&state->renderer.vulkan);
+            }
+            break;
+
+        case FakeUnityRenderCommandType_DestroyTextures:
+            __fake_unity_release_textures(state, command->texture_count, command->texture_indices);
+            free(command->texture_indices);
+            break;
+
+        case FakeUnityRenderCommandType_UploadTexture:
+        case FakeUnityRenderCommandType_ReadbackTexture:
+            if (state->renderer_type == kUnityGfxRendererVulkan)
+            {
+                __fake_unity_vulkan_transfer_texture(state, command);
+            }
+            else if (state->has_renderer)
+            {
+                __fake_unity_null_transfer_texture(state, command);
+            }
+            else
+            {
+                __fake_unity_gpu_request_set_flags(state, command->request, FAKE_UNITY_GPU_REQUEST_DONE | FAKE_UNITY_GPU_REQUEST_ERROR);
+            }
+            break;
+
+        case FakeUnityRenderCommandType_CompleteTransfers:
+            if (state->renderer_type == kUnityGfxRendererVulkan)
+            {
+                __fake_unity_vulkan_complete_transfers(state);
+            }
+            break;
+
+        case FakeUnityRenderCommandType_Quit:
+            break;
+    }
+}
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+static DWORD WINAPI
+__fake_unity_render_thread_main(LPVOID parameter)
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+static void *
+__fake_unity_render_thread_main(void *parameter)
+#endif
+{
+    FakeUnityState *state = (FakeUnityState *) parameter;
+    FakeUnityRenderThread *render_thread = &state->render_thread;
+
+    __fake_unity_set_current_state((state == &__fake_unity_default_state) ? 0 : state);
+    __fake_unity_render_thread_state = state;
+    __fake_unity_thread_name = "Render Thread";
+
+    uint32_t read_index = render_thread->read_index;
+
+    for (;;)
+    {
+        if (read_index == __fake_unity_atomic_load_u32(&render_thread->write_index))
+        {
+            // The fence pairs with the one in __fake_unity_render_thread_push. Either
+            // the producer sees sleeping or we see the new write_index.
+            __fake_unity_mutex_lock(&render_thread->mutex);
+            __fake_unity_atomic_store_u32(&render_thread->sleeping, 1);
+            __fake_unity_atomic_fence();
+
+            if (read_index == __fake_unity_atomic_load_u32(&render_thread->write_index))
+            {
+                __fake_unity_condition_wait(&render_thread->wake_condition, &render_thread->mutex);
+            }
+
+            __fake_unity_atomic_store_u32(&render_thread->sleeping, 0);
+            __fake_unity_mutex_unlock(&render_thread->mutex);
+            continue;
+        }
+
+        FakeUnityRenderCommand command = render_thread->commands[read_index & (FAKE_UNITY_RENDER_QUEUE_SIZE - 1)];
+
+        __fake_unity_render_command_execute(state, &command);
+
+        read_index += 1;
+        __fake_unity_atomic_store_u32(&render_thread->read_index, read_index);
+        __fake_unity_atomic_fence();
+
+        if (__fake_unity_atomic_load_u32(&render_thread->waiter_count))
+        {
+            __fake_unity_mutex_lock(&render_thread->mutex);
+            __fake_unity_condition_wake_all(&render_thread->idle_condition);
+            __fake_unity_mutex_unlock(&render_thread->mutex);
+        }
+
+        if (command.type == FakeUnityRenderCommandType_Quit)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Returns the index after the pushed command.
+static uint32_t
+__fake_unity_render_thread_push(FakeUnityRenderThread *render_thread, const FakeUnityRenderCommand *command)
+{
+    __fake_unity_spin_lock(&render_thread->producer_lock);
+
+    uint32_t write_index = render_thread->write_index;
+
+    while ((write_index - __fake_unity_atomic_load_u32(&render_thread->read_index)) >= FAKE_UNITY_RENDER_QUEUE_SIZE)
+    {
+        __fake_unity_thread_yield();
+    }
+
+    render_thread->commands[write_index & (FAKE_UNITY_RENDER_QUEUE_SIZE - 1)] = *command;
+
+    write_index += 1;
+    __fake_unity_atomic_store_u32(&render_thread->write_index, write_index);
+
+    __fake_unity_spin_unlock(&render_thread->producer_lock);
+
+    __fake_unity_atomic_fence();
+
+    if (__fake_unity_atomic_load_u32(&render_thread->sleeping))
+    {
+        __fake_unity_mutex_lock(&render_thread->mutex);
+        __fake_unity_condition_wake_all(&render_thread->wake_condition);
+        __fake_unity_mutex_unlock(&render_thread->mutex);
+    }
+
+    return write_index;
+}
+
+// Waits until the render thread has executed every command before index.
+static void
+__fake_unity_render_thread_wait(FakeUnityRenderThread *render_thread, uint32_t index)
+{
+    if ((int32_t) (index - __fake_unity_atomic_load_u32(&render_thread->read_index)) <= 0)
+    {
+        return;
+    }
+
+    __fake_unity_mutex_lock(&render_thread->mutex);
+    __fake_unity_atomic_add_u32(&render_thread->waiter_count, 1);
+    __fake_unity_atomic_fence();
+
+    while ((int32_t) (index - __fake_unity_atomic_load_u32(&render_thread->read_index)) > 0)
+    {
+        __fake_unity_condition_wait(&render_thread->idle_condition, &render_thread->mutex);
+    }
+
+    __fake_unity_atomic_add_u32(&render_thread->waiter_count, (uint32_t) -1);
+    __fake_unity_mutex_unlock(&render_thread->mutex);
+}
+
+// Queues the command if the render thread is running and executes it
+// right away otherwise. Commands issued on the render thread itself are
+// also executed right away, because they are already in order.
+static void
+__fake_unity_render_thread_issue(FakeUnityState *state, const FakeUnityRenderCommand *command, bool flush)
+{
+    FakeUnityRenderThread *render_thread = &state->render_thread;
+
+    if (!__fake_unity_render_thread_is_running(render_thread) || (__fake_unity_render_thread_state == state))
+    {
+        __fake_unity_render_command_execute(state, command);
+        return;
+    }
+
+    uint32_t index = __fake_unity_render_thread_push(render_thread, command);
+
+    if (flush)
+    {
+        __fake_unity_render_thread_wait(render_thread, index);
+    }
+}
+
+// Waits until the render thread executed every command issued so far.
+static void
+__fake_unity_render_thread_sync(FakeUnityState *state)
+{
+    FakeUnityRenderThread *render_thread = &state->render_thread;
+
+    if (__fake_unity_render_thread_is_running(render_thread) && (__fake_unity_render_thread_state != state))
+    {
+        __fake_unity_render_thread_wait(render_thread, __fake_unity_atomic_load_u32(&render_thread->write_index));
+    }
+}
+
+static bool
+__fake_unity_render_thread_start(FakeUnityState *state)
+{
+    FakeUnityRenderThread *render_thread = &state->render_thread;
+
+    if (__fake_unity_render_thread_is_running(render_thread))
+    {
+        return false;
+    }
+
+    render_thread->commands = (FakeUnityRenderCommand *) malloc(FAKE_UNITY_RENDER_QUEUE_SIZE * sizeof(FakeUnityRenderCommand));
+
+    if (!render_thread->commands)
+    {
+        fprintf(stderr, "[fake_unity] error: could not allocate the command queue of the render thread.\n");
+        return false;
+    }
+
+    render_thread->write_index = 0;
+    render_thread->read_index = 0;
+    render_thread->sleeping = 0;
+    render_thread->waiter_count = 0;
+
+    __fake_unity_mutex_initialize(&render_thread->mutex);
+    __fake_unity_condition_initialize(&render_thread->wake_condition);
+    __fake_unity_condition_initialize(&render_thread->idle_condition);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    render_thread->handle = CreateThread(0, 0, __fake_unity_render_thread_main, state, 0, 0);
+    bool started = (render_thread->handle != 0);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    bool started = (pthread_create(&render_thread->handle, 0, __fake_unity_render_thread_main, state) == 0);
+#endif
+
+    if (!started)
+    {
+        fprintf(stderr, "[fake_unity] error: could not start the render thread.\n");
+
+        __fake_unity_condition_destroy(&render_thread->idle_condition);
+        __fake_unity_condition_destroy(&render_thread->wake_condition);
+        __fake_unity_mutex_destroy(&render_thread->mutex);
+
+        free(render_thread->commands);
+        render_thread->commands = 0;
+
+        return false;
+    }
+
+    __fake_unity_atomic_store_u32(&render_thread->running, 1);
+
+    return true;
+}
+
+static void
+__fake_unity_render_thread_stop(FakeUnityState *state)
+{
+    FakeUnityRenderThread *render_thread = &state->render_thread;
+
+    if (!__fake_unity_render_thread_is_running(render_thread) || (__fake_unity_render_thread_state == state))
+    {
+        return;
+    }
+
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = FakeUnityRenderCommandType_Quit;
+
+    __fake_unity_render_thread_push(render_thread, &command);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    WaitForSingleObject(render_thread->handle, INFINITE);
+    CloseHandle(render_thread->handle);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    pthread_join(render_thread->handle, 0);
+#endif
+
+    __fake_unity_atomic_store_u32(&render_thread->running, 0);
+
+    __fake_unity_condition_destroy(&render_thread->idle_condition);
+    __fake_unity_condition_destroy(&render_thread->wake_condition);
+    __fake_unity_mutex_destroy(&render_thread->mutex);
+
+    free(render_thread->commands);
+    render_thread->commands = 0;
+}
+
+static bool
+UnityGraphicsVulkan_InterceptInitialization(UnityVulkanInitCallback func, void *userdata)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    state->unity_vulkan_init_callback = func;
+    state->unity_vulkan_init_userdata = userdata;
+    return true;
+}
+
+// Returns where the renderer keeps the pointer to a vulkan function it
+// calls, or NULL if it does not use the function.
+static PFN_vkVoidFunction *
+__fake_unity_vulkan_find_function(FakeUnityVulkanRenderer *renderer, const char *name)
+{
+#define find_function(function_name)                            \
+    if (strcmp(name, #function_name) == 0)                      \
+    {                                                           \
+        return (PFN_vkVoidFunction *) &renderer->function_name; \
+    }
+
+    __FAKE_UNITY_VULKAN_GLOBAL_FUNCTIONS(find_function);
+    __FAKE_UNITY_VULKAN_INSTANCE_FUNCTIONS(find_function);
+    __FAKE_UNITY_VULKAN_DEVICE_FUNCTIONS(find_function);
+
+#undef find_function
+
+    return 0;
+}
+
+typedef struct FakeUnityVulkanDeviceTableEntry
+{
+    const char *name;
+    uint32_t offset;
+} FakeUnityVulkanDeviceTableEntry;
+
+// Has to be a power of two and stay at most half full.
+#define __FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE 512
+
+static_assert((2 * (sizeof(FakeUnityVulkanDeviceTable) / sizeof(PFN_vkVoidFunction))) <= __FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE,
+              "__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE is too small for the device table");
+
+// Open addressing hash table with linear probing over the hashes of the
+// names of the device table functions, a NULL name marks an empty slot.
+// Built once from __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS on first use
+// and shared by all contexts.
+static FakeUnityVulkanDeviceTableEntry __fake_unity_vulkan_device_table_hash[__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE];
+static volatile uint32_t __fake_unity_vulkan_device_table_hash_lock;
+static volatile uint32_t __fake_unity_vulkan_device_table_hash_built;
+
+static void
+__fake_unity_vulkan_device_table_hash_add(const char *name, uint32_t offset)
+{
+    uint32_t slot = (uint32_t) __fake_unity_hash_string(name) & (__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE - 1);
+
+    while (__fake_unity_vulkan_device_table_hash[slot].name)
+    {
+        slot = (slot + 1) & (__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE - 1);
+    }
+
+    __fake_unity_vulkan_device_table_hash[slot].name = name;
+    __fake_unity_vulkan_device_table_hash[slot].offset = offset;
+}
+
+// Returns the offset of name in FakeUnityVulkanDeviceTable or -1 if the
+// device table has no such function.
+static int32_t
+__fake_unity_vulkan_get_device_table_offset(const char *name)
+{
+    if (!__fake_unity_atomic_load_u32(&__fake_unity_vulkan_device_table_hash_built))
+    {
+        __fake_unity_spin_lock(&__fake_unity_vulkan_device_table_hash_lock);
+
+        if (!__fake_unity_vulkan_device_table_hash_built)
+        {
+#define add_function(function_name) \
+            __fake_unity_vulkan_device_table_hash_add(#function_name, (uint32_t) offsetof(FakeUnityVulkanDeviceTable, function_name))
+
+            __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS(add_function)
+
+#undef add_function
+
+            __fake_unity_atomic_store_u32(&__fake_unity_vulkan_device_table_hash_built, 1);
+        }
+
+        __fake_unity_spin_unlock(&__fake_unity_vulkan_device_table_hash_lock);
+    }
+
+    uint32_t slot = (uint32_t) __fake_unity_hash_string(name) & (__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE - 1);
+
+    while (__fake_unity_vulkan_device_table_hash[slot].name)
+    {
+        if (strcmp(__fake_unity_vulkan_device_table_hash[slot].name, name) == 0)
+        {
+            return (int32_t) __fake_unity_vulkan_device_table_hash[slot].offset;
+        }
+
+        slot = (slot + 1) & (__FAKE_UNITY_VULKAN_DEVICE_TABLE_HASH_SIZE - 1);
+    }
+
+    return -1;
+}
+
+static PFN_vkVoidFunction *
+__fake_unity_vulkan_find_device_table_function(FakeUnityVulkanDeviceTable *device_table, const char *name)
+{
+    int32_t offset = __fake_unity_vulkan_get_device_table_offset(name);
+    return (offset >= 0) ? (PFN_vkVoidFunction *) ((char *) device_table + offset) : 0;
+}
+
+// Points the function of the renderer and the device table entry of name to
+// function, where they were loaded already.
+static void
+__fake_unity_vulkan_install_intercept(FakeUnityVulkanRenderer *renderer, const char *name, PFN_vkVoidFunction function)
+{
+    PFN_vkVoidFunction *renderer_function = __fake_unity_vulkan_find_function(renderer, name);
+    PFN_vkVoidFunction *device_table_function = __fake_unity_vulkan_find_device_table_function(&renderer->device_table, name);
+
+    if (renderer_function && *renderer_function)
+    {
+        *renderer_function = function;
+    }
+
+    if (device_table_function && *device_table_function)
+    {
+        *device_table_function = function;
+    }
+}
+
+// Returns the slot of name or the empty slot where it would be inserted.
+// The table must have been allocated.
+static FakeUnityVulkanIntercept *
+__fake_unity_vulkan_intercept_table_find(FakeUnityVulkanIntercepts *intercepts, const char *name, uint64_t name_hash)
+{
+    uint32_t mask = intercepts->capacity - 1;
+    uint32_t index = (uint32_t) name_hash & mask;
+
+    for (;;)
+    {
+        FakeUnityVulkanIntercept *intercept = intercepts->items + index;
+
+        if (!intercept->name || ((intercept->name_hash == name_hash) && (strcmp(intercept->name, name) == 0)))
+        {
+            return intercept;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Returns NULL if nothing intercepts name.
+static FakeUnityVulkanIntercept *
+__fake_unity_vulkan_find_intercept(FakeUnityState *state, const char *name)
+{
+    FakeUnityVulkanIntercepts *intercepts = &state->vulkan_intercepts;
+
+    if (!intercepts->items || !name)
+    {
+        return 0;
+    }
+
+    FakeUnityVulkanIntercept *intercept = __fake_unity_vulkan_intercept_table_find(intercepts, name, __fake_unity_hash_string(name));
+
+    if (!intercept->name || (intercept->hooks.count == 0))
+    {
+        return 0;
+    }
+
+    return intercept;
+}
+
+// Returns the entry of name, adding an empty one if there is none. Returns
+// NULL if out of memory.
+static FakeUnityVulkanIntercept *
+__fake_unity_vulkan_add_intercept(FakeUnityState *state, const char *name)
+{
+    FakeUnityVulkanIntercepts *intercepts = &state->vulkan_intercepts;
+
+    if ((intercepts->count + 1) * 2 > intercepts->capacity)
+    {
+        uint32_t capacity = intercepts->capacity ? (intercepts->capacity * 2) : 64;
+        FakeUnityVulkanIntercept *items = (FakeUnityVulkanIntercept *) calloc(capacity, sizeof(FakeUnityVulkanIntercept));
+
+        if (!items)
+        {
+            return 0;
+        }
+
+        FakeUnityVulkanIntercepts grown = *intercepts;
+        grown.capacity = capacity;
+        grown.items = items;
+
+        for (uint32_t i = 0; i < intercepts->capacity; i += 1)
+        {
+            FakeUnityVulkanIntercept *intercept = intercepts->items + i;
+
+            if (intercept->name)
+            {
+                *__fake_unity_vulkan_intercept_table_find(&grown, intercept->name, intercept->name_hash) = *intercept;
+            }
+        }
+
+        free(intercepts->items);
+        *intercepts = grown;
+    }
+
+    uint64_t name_hash = __fake_unity_hash_string(name);
+    FakeUnityVulkanIntercept *intercept = __fake_unity_vulkan_intercept_table_find(intercepts, name, name_hash);
+
+    if (!intercept->name)
+    {
+        intercept->name_hash = name_hash;
+        intercept->name = __fake_unity_copy_string(name);
+        intercepts->count += 1;
+    }
+
+    return intercept;
+}
+
+static inline PFN_vkVoidFunction
+__fake_unity_vulkan_get_intercept_head(const FakeUnityVulkanIntercept *intercept)
+{
+    return intercept->hooks.items[intercept->hooks.count - 1].function;
+}
+
+// Points the functions of the renderer that were loaded so far to the
+// installed hooks. This is where hooks are resolved by name, so the renderer
+// calls them through its function pointers like any other function.
+static void
+__fake_unity_vulkan_apply_intercepts(FakeUnityState *state)
+{
+    FakeUnityVulkanIntercepts *intercepts = &state->vulkan_intercepts;
+
+    for (uint32_t i = 0; i < intercepts->capacity; i += 1)
+    {
+        FakeUnityVulkanIntercept *intercept = intercepts->items + i;
+
+        if (intercept->name && (intercept->hooks.count > 0))
+        {
+            __fake_unity_vulkan_install_intercept(&state->renderer.vulkan, intercept->name, __fake_unity_vulkan_get_intercept_head(intercept));
+        }
+    }
+}
+
+// Drops the hooks a plugin installed, together with the hooks that were
+// installed after them and call into them, and points the functions of the
+// renderer to what is left of every chain. Called before the library of the
+// plugin is unloaded or replaced.
+static void
+__fake_unity_vulkan_remove_intercepts(FakeUnityState *state, uint32_t plugin_handle)
+{
+    FakeUnityVulkanIntercepts *intercepts = &state->vulkan_intercepts;
+
+    for (uint32_t i = 0; i < intercepts->capacity; i += 1)
+    {
+        FakeUnityVulkanIntercept *intercept = intercepts->items + i;
+        FakeUnityVulkanInterceptHooks *hooks = &intercept->hooks;
+
+        if (!intercept->name)
+        {
+            continue;
+        }
+
+        int32_t first = 0;
+
+        while ((first < hooks->count) && (hooks->items[first].plugin_handle != plugin_handle))
+        {
+            first += 1;
+        }
+
+        if (first == hooks->count)
+        {
+            continue;
+        }
+
+        for (int32_t j = first; j < hooks->count; j += 1)
+        {
+            if (hooks->items[j].plugin_handle != plugin_handle)
+            {
+                fprintf(stderr, "[fake_unity] error: the hook of plugin %u for '%s' is removed, because it calls a plugin\n"
+                                "             that is unloaded.\n", hooks->items[j].plugin_handle, intercept->name);
+            }
+        }
+
+        hooks->count = first;
+
+        if (state->renderer_type == kUnityGfxRendererVulkan)
+        {
+            FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+            PFN_vkVoidFunction function;
+
+            if (hooks->count > 0)
+            {
+                function = __fake_unity_vulkan_get_intercept_head(intercept);
+            }
+            else
+            {
+                // Resolved again like the renderer loaded it.
+                function = renderer->device ? renderer->vkGetDeviceProcAddr(renderer->device, intercept->name) : 0;
+
+                if (!function)
+                {
+                    function = renderer->vkGetInstanceProcAddr(renderer->instance, intercept->name);
+                }
+            }
+
+            __fake_unity_vulkan_install_intercept(renderer, intercept->name, function);
+        }
+    }
+}
+
+// Returns the function that is called when nothing intercepts name.
+static PFN_vkVoidFunction
+__fake_unity_vulkan_get_original_function(FakeUnityState *state, const char *name)
+{
+    FakeUnityVulkanIntercepts *intercepts = &state->vulkan_intercepts;
+    PFN_vkVoidFunction result = 0;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    if (!intercepts->loader_handle)
+    {
+        intercepts->loader_handle = LoadLibraryA("vulkan-1.dll");
+    }
+
+    if (intercepts->loader_handle)
+    {
+        result = (PFN_vkVoidFunction) GetProcAddress(intercepts->loader_handle, name);
+    }
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    if (!intercepts->loader_handle)
+    {
+        intercepts->loader_handle = dlopen("libvulkan.so.1", RTLD_NOW);
+    }
+
+    if (intercepts->loader_handle)
+    {
+        result = (PFN_vkVoidFunction) dlsym(intercepts->loader_handle, name);
+    }
+#endif
+
+    // The loader only exports core and window system functions.
+    if (!result && (state->renderer_type == kUnityGfxRendererVulkan))
+    {
+        FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+        result = renderer->vkGetDeviceProcAddr(renderer->device, name);
+
+        if (!result)
+        {
+            result = renderer->vkGetInstanceProcAddr(renderer->instance, name);
+        }
+    }
+
+    return result;
+}
+
+// Like in the engine this can be called at any time, usually from
+// UnityPluginLoad. Installing a hook while the render thread executes
+// commands is a race. Returns the function that was installed before, which
+// the hook is expected to call. The hook belongs to the plugin that is
+// loading or executing and is removed when that plugin is unloaded or
+// reloaded.
+static PFN_vkVoidFunction
+UnityGraphicsVulkan_InterceptVulkanAPI(const char *name, PFN_vkVoidFunction func)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (!name || !func)
+    {
+        return 0;
+    }
+
+    FakeUnityVulkanIntercept *intercept = __fake_unity_vulkan_find_intercept(state, name);
+    PFN_vkVoidFunction previous;
+
+    if (intercept)
+    {
+        previous = __fake_unity_vulkan_get_intercept_head(intercept);
+    }
+    else
+    {
+        previous = __fake_unity_vulkan_get_original_function(state, name);
+
+        if (!previous)
+        {
+            fprintf(stderr, "[fake_unity] error: InterceptVulkanAPI could not find vulkan function '%s'.\n", name);
+            return 0;
+        }
+
+        intercept = __fake_unity_vulkan_add_intercept(state, name);
+
+        if (!intercept)
+        {
+            return 0;
+        }
+    }
+
+    FakeUnityVulkanInterceptHooks *hooks = &intercept->hooks;
+
+    ARRAY_ENSURE_SPACE(hooks, FakeUnityVulkanInterceptHook);
+
+    hooks->items[hooks->count].function = func;
+    hooks->items[hooks->count].plugin_handle = __fake_unity_active_plugin;
+    hooks->count += 1;
+
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        __fake_unity_vulkan_install_intercept(&state->renderer.vulkan, name, func);
+    }
+
+    return previous;
+}
+
+// Plugins are expected to configure their events before issuing them.
+// Reconfiguring an event while it is executed on the render thread is a race.
+static void
+UnityGraphicsVulkan_ConfigureEvent(int event_id, const UnityVulkanPluginEventConfig *plugin_event_config)
+{
+    if (!plugin_event_config)
+    {
+        fprintf(stderr, "[fake_unity] error: ConfigureEvent(%d) needs a plugin event config.\n", event_id);
+        return;
+    }
+
+    if ((event_id < 0) || (event_id >= FAKE_UNITY_MAX_EVENT_ID_COUNT))
+    {
+        fprintf(stderr, "[fake_unity] error: ConfigureEvent(%d) is out of range.\n", event_id);
+        return;
+    }
+
+    FakeUnityPluginEvent *event = __fake_unity_get_plugin_event(&__fake_unity_get_state()->plugin_events, event_id, true);
+
+    if (!event)
+    {
+        return;
+    }
+
+    if (__fake_unity_loading_plugin)
+    {
+        __fake_unity_atomic_cas_u32(&event->plugin_handle, 0, __fake_unity_loading_plugin);
+    }
+
+    event->config = *plugin_event_config;
+    __fake_unity_atomic_store_u32(&event->configured, 1);
+}
+
+// Cached like __fake_unity_profiler_cached_thread, with the profiler id
+// identifying the context.
+static __FAKE_UNITY_THREAD_LOCAL uint64_t __fake_unity_vulkan_trace_cached_id;
+static __FAKE_UNITY_THREAD_LOCAL FakeUnityVulkanTraceThread *__fake_unity_vulkan_trace_cached_thread;
+
+// Returns NULL if the record of a new thread can't be allocated.
+static FakeUnityVulkanTraceThread *
+__fake_unity_vulkan_trace_get_current_thread(FakeUnityState *state)
+{
+    if (__fake_unity_vulkan_trace_cached_id == state->profiler.id)
+    {
+        return __fake_unity_vulkan_trace_cached_thread;
+    }
+
+    FakeUnityVulkanTrace *trace = &state->vulkan_trace;
+    const void *key = &__fake_unity_thread_key;
+
+    FakeUnityVulkanTraceThread *thread = (FakeUnityVulkanTraceThread *) __fake_unity_atomic_load_ptr((void *volatile *) &trace->threads);
+
+    while (thread && (thread->key != key))
+    {
+        thread = thread->next;
+    }
+
+    if (!thread)
+    {
+        thread = (FakeUnityVulkanTraceThread *) calloc(1, sizeof(FakeUnityVulkanTraceThread));
+
+        if (!thread)
+        {
+            return 0;
+        }
+
+        thread->key = key;
+
+        FakeUnityVulkanTraceThread *head;
+
+        do
+        {
+            head = (FakeUnityVulkanTraceThread *) __fake_unity_atomic_load_ptr((void *volatile *) &trace->threads);
+            thread->next = head;
+        } while (!__fake_unity_atomic_cas_ptr((void *volatile *) &trace->threads, head, thread));
+    }
+
+    __fake_unity_vulkan_trace_cached_id = state->profiler.id;
+    __fake_unity_vulkan_trace_cached_thread = thread;
+
+    return thread;
+}
+
+// Marks a record whose plugin was unloaded. No plugin handle reaches it,
+// the plugin pool would need 2^20 slots first.
+#define __FAKE_UNITY_VULKAN_TRACE_UNUSED_PLUGIN 0xFFFFFFFFu
+
+// Returns NULL if the thread has no space left for another plugin.
+static FakeUnityVulkanTracePlugin *
+__fake_unity_vulkan_trace_get_plugin(FakeUnityVulkanTraceThread *thread, uint32_t plugin_handle)
+{
+    uint32_t plugin_count = thread->plugin_count;
+
+    if ((thread->last_plugin_index < plugin_count) &&
+        (thread->plugins[thread->last_plugin_index].plugin_handle == plugin_handle))
+    {
+        return thread->plugins + thread->last_plugin_index;
+    }
+
+    uint32_t index = 0;
+
+    while ((index < plugin_count) && (thread->plugins[index].plugin_handle != plugin_handle))
+    {
+        index += 1;
+    }
+
+    if (index == plugin_count)
+    {
+        // Records of unloaded plugins are reused first. Their counts were
+        // reset before they were released.
+        index = 0;
+
+        while ((index < plugin_count) && (__fake_unity_atomic_load_u32(&thread->plugins[index].plugin_handle) != __FAKE_UNITY_VULKAN_TRACE_UNUSED_PLUGIN))
+        {
+            index += 1;
+        }
+
+        if (index < plugin_count)
+        {
+            __fake_unity_atomic_store_u32(&thread->plugins[index].plugin_handle, plugin_handle);
+        }
+        else if (plugin_count == FAKE_UNITY_VULKAN_TRACE_MAX_PLUGIN_COUNT)
+        {
+            return 0;
+        }
+        else
+        {
+            // The record is published to other threads by the count.
+            thread->plugins[index].plugin_handle = plugin_handle;
+            __fake_unity_atomic_store_u32(&thread->plugin_count, plugin_count + 1);
+        }
+    }
+
+    thread->last_plugin_index = index;
+
+    return thread->plugins + index;
+}
+
+// Resets the counts of an unloaded plugin and releases its records, so a
+// reloaded plugin starts from zero and the records can be reused.
+static void
+__fake_unity_vulkan_trace_release_plugin(FakeUnityVulkanTrace *trace, uint32_t plugin_handle)
+{
+    FakeUnityVulkanTraceThread *thread = (FakeUnityVulkanTraceThread *) __fake_unity_atomic_load_ptr((void *volatile *) &trace->threads);
+
+    while (thread)
+    {
+        uint32_t plugin_count = __fake_unity_atomic_load_u32(&thread->plugin_count);
+
+        for (uint32_t i = 0; i < plugin_count; i += 1)
+        {
+            FakeUnityVulkanTracePlugin *plugin = thread->plugins + i;
+
+            if (__fake_unity_atomic_load_u32(&plugin->plugin_handle) == plugin_handle)
+            {
+                for (int32_t j = 0; j < FakeUnityVulkanTraceFunction_Count; j += 1)
+                {
+                    __fake_unity_atomic_store_u64(&plugin->counts[j], 0);
+                    __fake_unity_atomic_store_u64(&plugin->times[j], 0);
+                }
+
+                __fake_unity_atomic_store_u32(&plugin->plugin_handle, __FAKE_UNITY_VULKAN_TRACE_UNUSED_PLUGIN);
+            }
+        }
+
+        thread = thread->next;
+    }
+}
+
+// Returns the base address of the library that contains the code at
+// address, NULL if it is not known.
+static const void *
+__fake_unity_get_module_base(const void *address)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    HMODULE module;
+
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                           (LPCSTR) address, &module))
+    {
+        return (const void *) module;
+    }
+#elif __FAKE_UNITY_HAS_DLADDR
+    Dl_info info;
+
+    if (dladdr(address, &info))
+    {
+        return info.dli_fbase;
+    }
+#else
+    (void) address;
+#endif
+
+    return 0;
+}
+
+static void
+__fake_unity_vulkan_trace_add_module(FakeUnityVulkanTrace *trace, const void *base, uint32_t plugin_handle)
+{
+    if (!base)
+    {
+        return;
+    }
+
+    __fake_unity_spin_lock(&trace->modules_lock);
+
+    FakeUnityVulkanTraceModules *modules = &trace->modules;
+
+    ARRAY_ENSURE_SPACE(modules, FakeUnityVulkanTraceModule);
+
+    modules->items[modules->count].base = base;
+    modules->items[modules->count].plugin_handle = plugin_handle;
+    modules->count += 1;
+
+    __fake_unity_atomic_add_u32(&trace->modules_version, 1);
+
+    __fake_unity_spin_unlock(&trace->modules_lock);
+}
+
+static void
+__fake_unity_vulkan_trace_remove_module(FakeUnityVulkanTrace *trace, uint32_t plugin_handle)
+{
+    __fake_unity_spin_lock(&trace->modules_lock);
+
+    FakeUnityVulkanTraceModules *modules = &trace->modules;
+
+    for (int32_t i = 0; i < modules->count; i += 1)
+    {
+        if (modules->items[i].plugin_handle == plugin_handle)
+        {
+            modules->count -= 1;
+            modules->items[i] = modules->items[modules->count];
+            i -= 1;
+        }
+    }
+
+    __fake_unity_atomic_add_u32(&trace->modules_version, 1);
+
+    __fake_unity_spin_unlock(&trace->modules_lock);
+}
+
+// Returns the plugin whose library made a call that returns to address,
+// zero if the caller is not in any plugin. Finding the library is slow,
+// so every thread remembers the result for a few call sites.
+static uint32_t
+__fake_unity_vulkan_trace_find_caller(FakeUnityVulkanTrace *trace, FakeUnityVulkanTraceThread *thread, const void *address)
+{
+    uint32_t version = __fake_unity_atomic_load_u32(&trace->modules_version);
+
+    if (thread->caller_version != version)
+    {
+        memset(thread->callers, 0, sizeof(thread->callers));
+        thread->caller_version = version;
+    }
+
+    uintptr_t bits = (uintptr_t) address;
+    uint32_t slot = (uint32_t) (bits ^ (bits >> 8)) & (__FAKE_UNITY_VULKAN_TRACE_CALLER_CACHE_SIZE - 1);
+
+    if (thread->callers[slot] == address)
+    {
+        return thread->caller_plugins[slot];
+    }
+
+    const void *base = __fake_unity_get_module_base(address);
+    uint32_t plugin_handle = 0;
+
+    if (base)
+    {
+        __fake_unity_spin_lock(&trace->modules_lock);
+
+        for (int32_t i = 0; i < trace->modules.count; i += 1)
+        {
+            if (trace->modules.items[i].base == base)
+            {
+                plugin_handle = trace->modules.items[i].plugin_handle;
+                break;
+            }
+        }
+
+        __fake_unity_spin_unlock(&trace->modules_lock);
+    }
+
+    thread->callers[slot] = address;
+    thread->caller_plugins[slot] = plugin_handle;
+
+    return plugin_handle;
+}
+
+static void
+__fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction function, uint64_t start, const void *return_address)
+{
+    uint64_t duration = __fake_unity_get_timestamp() - start;
+
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (!__fake_unity_atomic_load_u32(&state->vulkan_trace.enabled))
+    {
+        return;
+    }
+
+    FakeUnityVulkanTraceThread *thread = __fake_unity_vulkan_trace_get_current_thread(state);
+
+    if (!thread)
+    {
+        return;
+    }
+
+    uint32_t plugin_handle = __fake_unity_active_plugin;
+
+    if (!plugin_handle)
+    {
+        plugin_handle = __fake_unity_vulkan_trace_find_caller(&state->vulkan_trace, thread, return_address);
+    }
+
+    FakeUnityVulkanTracePlugin *plugin = __fake_unity_vulkan_trace_get_plugin(thread, plugin_handle);
+
+    if (plugin)
+    {
+        __fake_unity_atomic_add_u64(&plugin->counts[function], 1);
+        __fake_unity_atomic_add_u64(&plugin->times[function], duration);
+    }
+}
+
+static FakeUnityVulkanTraceTargets __fake_unity_vulkan_trace_targets;
+
+// Every dispatchable handle starts with the dispatch table of the loader,
+// which is the same for all handles of a device.
+static inline const void *
+__fake_unity_vulkan_get_dispatch_key(const void *handle)
+{
+    return handle ? *(const void *const *) handle : 0;
+}
+
+// The key of a record whose device was destroyed, which can be taken again.
+#define __FAKE_UNITY_VULKAN_TRACE_RELEASED_KEY ((const void *) (uintptr_t) 1)
+
+// Returns the device record for a dispatch key. Unless create is set, or if
+// all records are taken, returns NULL for keys without one. Records are
+// only taken under the lock, so a key never gets two of them.
+static FakeUnityVulkanTraceDevice *
+__fake_unity_vulkan_trace_get_device(const void *key, bool create)
+{
+    if (!key)
+    {
+        return 0;
+    }
+
+    FakeUnityVulkanTraceTargets *targets = &__fake_unity_vulkan_trace_targets;
+    FakeUnityVulkanTraceDevice *result = 0;
+    FakeUnityVulkanTraceDevice *free_device = 0;
+
+    if (create)
+    {
+        __fake_unity_spin_lock(&targets->lock);
+    }
+
+    for (int32_t i = 0; i < FAKE_UNITY_VULKAN_TRACE_MAX_DEVICE_COUNT; i += 1)
+    {
+        FakeUnityVulkanTraceDevice *device = targets->devices + i;
+        const void *device_key = __fake_unity_atomic_load_ptr((void *volatile *) &device->key);
+
+        if (device_key == key)
+        {
+            result = device;
+            break;
+        }
+
+        if ((device_key == __FAKE_UNITY_VULKAN_TRACE_RELEASED_KEY) || !device_key)
+        {
+            if (!free_device)
+            {
+                free_device = device;
+            }
+
+            // Records are taken in order, so the key is not in the rest.
+            if (!device_key)
+            {
+                break;
+            }
+        }
+    }
+
+    if (create)
+    {
+        if (!result && free_device)
+        {
+            __fake_unity_atomic_store_ptr((void *volatile *) &free_device->key, (void *) key);
+            result = free_device;
+        }
+
+        __fake_unity_spin_unlock(&targets->lock);
+    }
+
+    return result;
+}
+
+// Clears the record of a device that is destroyed, so wrappers called for
+// a later device with the same dispatch key don't call its functions.
+static void
+__fake_unity_vulkan_trace_release_device(VkDevice device)
+{
+    FakeUnityVulkanTraceTargets *targets = &__fake_unity_vulkan_trace_targets;
+
+    __fake_unity_spin_lock(&targets->lock);
+
+    FakeUnityVulkanTraceDevice *record = __fake_unity_vulkan_trace_get_device(__fake_unity_vulkan_get_dispatch_key(device), false);
+
+    if (record)
+    {
+        for (int32_t i = 0; i < FakeUnityVulkanTraceFunction_Count; i += 1)
+        {
+            __fake_unity_atomic_store_ptr((void *volatile *) &record->functions[i], 0);
+        }
+
+        __fake_unity_atomic_store_ptr((void *volatile *) &record->key, (void *) __FAKE_UNITY_VULKAN_TRACE_RELEASED_KEY);
+    }
+
+    __fake_unity_spin_unlock(&targets->lock);
+}
+
+// Returns the function a wrapper calls for a handle, NULL if it was never
+// looked up.
+static PFN_vkVoidFunction
+__fake_unity_vulkan_trace_get_target(const void *handle, FakeUnityVulkanTraceFunction function)
+{
+    FakeUnityVulkanTraceDevice *device = __fake_unity_vulkan_trace_get_device(__fake_unity_vulkan_get_dispatch_key(handle), false);
+
+    if (device)
+    {
+        void *result = __fake_unity_atomic_load_ptr((void *volatile *) &device->functions[function]);
+
+        if (result)
+        {
+            return (PFN_vkVoidFunction) result;
+        }
+    }
+
+    return (PFN_vkVoidFunction) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_vulkan_trace_targets.functions[function]);
+}
+
+// Remembers what a wrapper calls. Returns false if the device has no
+// record left, in which case the function can't be wrapped.
+static bool
+__fake_unity_vulkan_trace_set_target(VkDevice device, FakeUnityVulkanTraceFunction function, PFN_vkVoidFunction target)
+{
+    void *volatile *slot = (void *volatile *) &__fake_unity_vulkan_trace_targets.functions[function];
+
+    if (device)
+    {
+        FakeUnityVulkanTraceDevice *record = __fake_unity_vulkan_trace_get_device(__fake_unity_vulkan_get_dispatch_key(device), true);
+
+        if (!record)
+        {
+            return false;
+        }
+
+        slot = (void *volatile *) &record->functions[function];
+    }
+
+    __fake_unity_atomic_store_ptr(slot, (void *) target);
+
+    return true;
+}
+
+#define __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(name, handle) \
+    ((PFN_##name) __fake_unity_vulkan_trace_get_target((const void *) (handle), FakeUnityVulkanTraceFunction_##name))
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+__fake_unity_vulkan_trace_vkQueueSubmit(VkQueue queue, uint32_t submit_count, const VkSubmitInfo *submits, VkFence fence)
+{
+    PFN_vkQueueSubmit function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkQueueSubmit, queue);
+
+    if (!function)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    VkResult result = function(queue, submit_count, submits, fence);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkQueueSubmit, start, __FAKE_UNITY_RETURN_ADDRESS());
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkCmdPipelineBarrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage_mask,
+                                               VkPipelineStageFlags dst_stage_mask, VkDependencyFlags dependency_flags,
+                                               uint32_t memory_barrier_count, const VkMemoryBarrier *memory_barriers,
+                                               uint32_t buffer_memory_barrier_count, const VkBufferMemoryBarrier *buffer_memory_barriers,
+                                               uint32_t image_memory_barrier_count, const VkImageMemoryBarrier *image_memory_barriers)
+{
+    PFN_vkCmdPipelineBarrier function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCmdPipelineBarrier, command_buffer);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(command_buffer, src_stage_mask, dst_stage_mask, dependency_flags,
+             memory_barrier_count, memory_barriers,
+             buffer_memory_barrier_count, buffer_memory_barriers,
+             image_memory_barrier_count, image_memory_barriers);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCmdPipelineBarrier, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkCmdDispatch(VkCommandBuffer command_buffer, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
+{
+    PFN_vkCmdDispatch function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCmdDispatch, command_buffer);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(command_buffer, group_count_x, group_count_y, group_count_z);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCmdDispatch, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkCmdDraw(VkCommandBuffer command_buffer, uint32_t vertex_count, uint32_t instance_count,
+                                    uint32_t first_vertex, uint32_t first_instance)
+{
+    PFN_vkCmdDraw function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCmdDraw, command_buffer);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(command_buffer, vertex_count, instance_count, first_vertex, first_instance);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCmdDraw, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkCmdDrawIndexed(VkCommandBuffer command_buffer, uint32_t index_count, uint32_t instance_count,
+                                           uint32_t first_index, int32_t vertex_offset, uint32_t first_instance)
+{
+    PFN_vkCmdDrawIndexed function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCmdDrawIndexed, command_buffer);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(command_buffer, index_count, instance_count, first_index, vertex_offset, first_instance);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCmdDrawIndexed, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+__fake_unity_vulkan_trace_vkAllocateDescriptorSets(VkDevice device, const VkDescriptorSetAllocateInfo *allocate_info, VkDescriptorSet *descriptor_sets)
+{
+    PFN_vkAllocateDescriptorSets function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkAllocateDescriptorSets, device);
+
+    if (!function)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    VkResult result = function(device, allocate_info, descriptor_sets);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkAllocateDescriptorSets, start, __FAKE_UNITY_RETURN_ADDRESS());
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkUpdateDescriptorSets(VkDevice device, uint32_t descriptor_write_count, const VkWriteDescriptorSet *descriptor_writes,
+                                                 uint32_t descriptor_copy_count, const VkCopyDescriptorSet *descriptor_copies)
+{
+    PFN_vkUpdateDescriptorSets function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkUpdateDescriptorSets, device);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(device, descriptor_write_count, descriptor_writes, descriptor_copy_count, descriptor_copies);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkUpdateDescriptorSets, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+__fake_unity_vulkan_trace_vkAllocateMemory(VkDevice device, const VkMemoryAllocateInfo *allocate_info,
+                                           const VkAllocationCallbacks *allocator, VkDeviceMemory *memory)
+{
+    PFN_vkAllocateMemory function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkAllocateMemory, device);
+
+    if (!function)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    VkResult result = function(device, allocate_info, allocator, memory);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkAllocateMemory, start, __FAKE_UNITY_RETURN_ADDRESS());
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+__fake_unity_vulkan_trace_vkFreeMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks *allocator)
+{
+    PFN_vkFreeMemory function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkFreeMemory, device);
+
+    if (!function)
+    {
+        return;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    function(device, memory, allocator);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkFreeMemory, start, __FAKE_UNITY_RETURN_ADDRESS());
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+__fake_unity_vulkan_trace_vkCreateBuffer(VkDevice device, const VkBufferCreateInfo *create_info,
+                                         const VkAllocationCallbacks *allocator, VkBuffer *buffer)
+{
+    PFN_vkCreateBuffer function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCreateBuffer, device);
+
+    if (!function)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    VkResult result = function(device, create_info, allocator, buffer);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCreateBuffer, start, __FAKE_UNITY_RETURN_ADDRESS());
+    return result;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+__fake_unity_vulkan_trace_vkCreateImage(VkDevice device, const VkImageCreateInfo *create_info,
+                                        const VkAllocationCallbacks *allocator, VkImage *image)
+{
+    PFN_vkCreateImage function = __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION(vkCreateImage, device);
+
+    if (!function)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint64_t start = __fake_unity_get_timestamp();
+    VkResult result = function(device, create_info, allocator, image);
+    __fake_unity_vulkan_trace_record(FakeUnityVulkanTraceFunction_vkCreateImage, start, __FAKE_UNITY_RETURN_ADDRESS());
+    return result;
+}
+
+#undef __FAKE_UNITY_VULKAN_TRACE_GET_FUNCTION
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL __fake_unity_vulkan_trace_vkGetInstanceProcAddr(VkInstance instance, const char *name);
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL __fake_unity_vulkan_trace_vkGetDeviceProcAddr(VkDevice device, const char *name);
+
+// Returns the wrapper of a traced function and remembers the function it
+// has to call. Functions looked up from a device are only called for the
+// handles of that device, those looked up from the instance for all
+// others. Other functions, and those of devices beyond
+// FAKE_UNITY_VULKAN_TRACE_MAX_DEVICE_COUNT, are returned as they are.
+static PFN_vkVoidFunction
+__fake_unity_vulkan_trace_wrap(VkDevice device, const char *name, PFN_vkVoidFunction function)
+{
+    if (!function)
+    {
+        return 0;
+    }
+
+#define wrap_function(function_name)                                                                                              \
+    if (strcmp(name, #function_name) == 0)                                                                                        \
+    {                                                                                                                             \
+        if (!__fake_unity_vulkan_trace_set_target(device, FakeUnityVulkanTraceFunction_##function_name, function))               \
+        {                                                                                                                         \
+            return function;                                                                                                      \
+        }                                                                                                                         \
+        return (PFN_vkVoidFunction) __fake_unity_vulkan_trace_##function_name;                                                    \
+    }
+
+    __FAKE_UNITY_VULKAN_TRACE_FUNCTIONS(wrap_function)
+
+#undef wrap_function
+
+    if (strcmp(name, "vkGetDeviceProcAddr") == 0)
+    {
+        __fake_unity_atomic_store_ptr((void *volatile *) &__fake_unity_vulkan_trace_targets.vkGetDeviceProcAddr, (void *) function);
+        return (PFN_vkVoidFunction) __fake_unity_vulkan_trace_vkGetDeviceProcAddr;
+    }
+
+    if (strcmp(name, "vkGetInstanceProcAddr") == 0)
+    {
+        return (PFN_vkVoidFunction) __fake_unity_vulkan_trace_vkGetInstanceProcAddr;
+    }
+
+    return function;
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+__fake_unity_vulkan_trace_vkGetInstanceProcAddr(VkInstance instance, const char *name)
+{
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr =
+        (PFN_vkGetInstanceProcAddr) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_vulkan_trace_targets.vkGetInstanceProcAddr);
+
+    return __fake_unity_vulkan_trace_wrap(0, name, get_instance_proc_addr(instance, name));
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+__fake_unity_vulkan_trace_vkGetDeviceProcAddr(VkDevice device, const char *name)
+{
+    PFN_vkGetDeviceProcAddr get_device_proc_addr =
+        (PFN_vkGetDeviceProcAddr) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_vulkan_trace_targets.vkGetDeviceProcAddr);
+
+    if (!get_device_proc_addr)
+    {
+        return 0;
+    }
+
+    return __fake_unity_vulkan_trace_wrap(device, name, get_device_proc_addr(device, name));
+}
+
+// Returns the vkGetInstanceProcAddr that is handed to plugins instead of
+// the one of the loader.
+static PFN_vkGetInstanceProcAddr
+__fake_unity_vulkan_get_plugin_instance_proc_addr(FakeUnityState *state, PFN_vkGetInstanceProcAddr get_instance_proc_addr)
+{
+    if (!get_instance_proc_addr || !__fake_unity_atomic_load_u32(&state->vulkan_trace.enabled))
+    {
+        return get_instance_proc_addr;
+    }
+
+    __fake_unity_atomic_store_ptr((void *volatile *) &__fake_unity_vulkan_trace_targets.vkGetInstanceProcAddr, (void *) get_instance_proc_addr);
+
+    return __fake_unity_vulkan_trace_vkGetInstanceProcAddr;
+}
+
+// Returns a zeroed instance without a vulkan renderer, whose state would
+// otherwise be read from the null renderer that shares its memory.
+static UnityVulkanInstance
+UnityGraphicsVulkan_Instance()
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    UnityVulkanInstance vulkan_instance;
+    memset(&vulkan_instance, 0, sizeof(vulkan_instance));
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return vulkan_instance;
+    }
+
+    vulkan_instance.pipelineCache = state->renderer.vulkan.pipeline_cache;
+    vulkan_instance.instance = state->renderer.vulkan.instance;
+    vulkan_instance.physicalDevice = state->renderer.vulkan.physical_device;
+    vulkan_instance.device = state->renderer.vulkan.device;
+    vulkan_instance.graphicsQueue = state->renderer.vulkan.graphics_queue;
+    vulkan_instance.getInstanceProcAddr = state->renderer.vulkan.loader_vkGetInstanceProcAddr;
+    vulkan_instance.queueFamilyIndex = state->renderer.vulkan.graphics_queue_index;
+    vulkan_instance.getInstanceProcAddr = __fake_unity_vulkan_get_plugin_instance_proc_addr(state, vulkan_instance.getInstanceProcAddr);
+
+    return vulkan_instance;
+}
+
+// Like the engine this only succeeds between fake_unity_begin_frame and
+// fake_unity_end_frame, and queue access has to be allowed by the
+// configuration of the executing event. There is never an active render
+// pass.
+static bool
+UnityGraphicsVulkan_CommandRecordingState(UnityVulkanRecordingState *command_recording_state, UnityVulkanGraphicsQueueAccess queue_access)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return false;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    if (!renderer->recording)
+    {
+        return false;
+    }
+
+    if ((queue_access == kUnityVulkanGraphicsQueueAccess_Allow) &&
+        (!__fake_unity_current_plugin_event_config ||
+         (__fake_unity_current_plugin_event_config->graphicsQueueAccess != kUnityVulkanGraphicsQueueAccess_Allow)))
+    {
+        return false;
+    }
+
+    FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+
+    __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+
+    renderer->command_buffer_exposed = true;
+
+    memset(command_recording_state, 0, sizeof(*command_recording_state));
+
+    command_recording_state->commandBuffer      = frame->command_buffers.items[frame->command_buffer_index];
+    command_recording_state->commandBufferLevel = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_recording_state->renderPass         = VK_NULL_HANDLE;
+    command_recording_state->framebuffer        = VK_NULL_HANDLE;
+    command_recording_state->subPassIndex       = -1;
+    command_recording_state->currentFrameNumber = renderer->current_frame_number;
+    command_recording_state->safeFrameNumber    = renderer->safe_frame_number;
+
+    return true;
+}
+
+// Only writes have to be made available by a barrier. Reads in the same
+// layout do not need a barrier between them.
+#define __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS                                             \
+    (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |                    \
+     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |          \
+     VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT)
+
+// Maps a pointer returned by fake_unity_Texture2D_GetNativeTexturePtr back to
+// its texture. Returns NULL for pointers that are not ours and for textures
+// that were destroyed.
+static FakeUnityTexture *
+__fake_unity_get_texture_from_native_pointer(FakeUnityState *state, void *native_texture)
+{
+    int32_t index = __fake_unity_handle_pool_get_index_from_pointer(&state->texture_pool, native_texture, offsetof(FakeUnityTexture, image));
+    return (index >= 0) ? __fake_unity_get_texture(state, (uint32_t) index) : NULL;
+}
+
+static bool
+__fake_unity_vulkan_access_texture(FakeUnityState *state, FakeUnityTexture *texture, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                   VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                   UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+{
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    VkImageAspectFlags aspect = sub_resource ? (VkImageAspectFlags) sub_resource->aspectMask : (VkImageAspectFlags) VK_IMAGE_ASPECT_COLOR_BIT;
+
+    if (access_mode != kUnityVulkanResourceAccess_ObserveOnly)
+    {
+        if (!renderer->recording)
+        {
+            return false;
+        }
+
+        // With Recreate the plugin overwrites the whole image, so the old
+        // contents can be discarded by the transition.
+        bool discard = (access_mode == kUnityVulkanResourceAccess_Recreate);
+
+        bool read_after_read = !discard && (layout == texture->layout) &&
+                               !(texture->access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS) &&
+                               !(access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS);
+
+        bool pending = (texture->barrier_batch == renderer->barrier_batch);
+
+        if (read_after_read)
+        {
+            // A later write has to wait for this read as well. If the image
+            // still waits for its transition, the read has to wait for it.
+            if (pending)
+            {
+                renderer->pending_image_barriers.items[texture->barrier_index].dstAccessMask |= access_flags;
+                renderer->pending_dst_stage_flags |= pipeline_stage_flags;
+            }
+
+            texture->stage_flags |= pipeline_stage_flags;
+            texture->access_flags |= access_flags;
+        }
+        else
+        {
+            // Barriers of the same vkCmdPipelineBarrier are not ordered
+            // against each other, so a second transition of an image
+            // starts a new batch.
+            if (pending)
+            {
+                FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+                __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+            }
+
+            FakeUnityVulkanImageBarriers *barriers = &renderer->pending_image_barriers;
+
+            ARRAY_ENSURE_SPACE(barriers, VkImageMemoryBarrier);
+
+            VkImageMemoryBarrier *barrier = barriers->items + barriers->count;
+            barrier->sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier->pNext               = 0;
+            barrier->srcAccessMask       = texture->access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS;
+            barrier->dstAccessMask       = access_flags;
+            barrier->oldLayout           = discard ? VK_IMAGE_LAYOUT_UNDEFINED : texture->layout;
+            barrier->newLayout           = layout;
+            barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->image               = texture->image;
+            barrier->subresourceRange    = { aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+            renderer->pending_src_stage_flags |= texture->stage_flags;
+            renderer->pending_dst_stage_flags |= pipeline_stage_flags;
+
+            texture->barrier_batch = renderer->barrier_batch;
+            texture->barrier_index = barriers->count;
+
+            barriers->count += 1;
+
+            texture->layout = layout;
+            texture->stage_flags = pipeline_stage_flags;
+            texture->access_flags = access_flags;
+
+            if (renderer->command_buffer_exposed)
+            {
+                FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+                __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+            }
+        }
+    }
+
+    if (image)
+    {
+        // The memory of external textures is owned by the plugin and unknown.
+        memset(image, 0, sizeof(*image));
+
+        image->image     = texture->image;
+        image->layout    = texture->layout;
+        image->aspect    = aspect;
+        image->usage     = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        image->format    = texture->format;
+        image->extent    = { (uint32_t) texture->width, (uint32_t) texture->height, (uint32_t) texture->depth };
+        image->tiling    = VK_IMAGE_TILING_OPTIMAL;
+        image->type      = (texture->view_type == VK_IMAGE_VIEW_TYPE_3D) ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+        image->samples   = VK_SAMPLE_COUNT_1_BIT;
+        image->layers    = (int) texture->layer_count;
+        image->mipCount  = (int) texture->mip_count;
+    }
+
+    return true;
+}
+
+// native_texture has to be a pointer returned by
+// fake_unity_Texture2D_GetNativeTexturePtr. With PipelineBarrier the image
+// is transitioned to layout, the barrier is batched with the other pending
+// ones until the plugin asks for the command buffer. Like the engine this
+// only works while a frame is being recorded. The layout and the last access
+// are tracked for the whole image: sub_resource only selects the aspect and
+// every barrier covers all mip levels and array layers, so a plugin can't
+// keep different subresources of one image in different layouts.
+static bool
+UnityGraphicsVulkan_AccessTexture(void* native_texture, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                  VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                  UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return false;
+    }
+
+    FakeUnityTexture *texture = __fake_unity_get_texture_from_native_pointer(state, native_texture);
+
+    if (!texture)
+    {
+        return false;
+    }
+
+    return __fake_unity_vulkan_access_texture(state, texture, sub_resource, layout, pipeline_stage_flags,
+                                              access_flags, access_mode, image);
+}
+
+static bool
+UnityGraphicsVulkan_AccessRenderBufferTexture(UnityRenderBuffer native_render_buffer, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                              VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                              UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+{
+    fprintf(stderr, "[fake_unity] TODO: AccessRenderBufferTexture\n");
+    return false;
+}
+
+static bool
+UnityGraphicsVulkan_AccessRenderBufferResolveTexture(UnityRenderBuffer native_render_buffer, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                                     VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                                     UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+{
+    fprintf(stderr, "[fake_unity] TODO: AccessRenderBufferResolveTexture\n");
+    return false;
+}
+
+// native_buffer has to be a pointer returned by
+// fake_unity_GraphicsBuffer_GetNativeBufferPtr. With PipelineBarrier a
+// buffer barrier from the last access is batched with the pending image
+// barriers, unless both accesses only read. The memory of registered
+// buffers is owned by the caller and unknown.
+static bool
+UnityGraphicsVulkan_AccessBuffer(void* native_buffer, VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                 UnityVulkanResourceAccessMode access_mode, UnityVulkanBuffer *out_buffer)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return false;
+    }
+
+    int32_t index = __fake_unity_handle_pool_get_index_from_pointer(&state->buffer_pool, native_buffer, offsetof(FakeUnityBuffer, buffer));
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+    FakeUnityBuffer *buffer = (FakeUnityBuffer *) __fake_unity_handle_pool_get_item(&state->buffer_pool, (uint32_t) index);
+
+    if (access_mode != kUnityVulkanResourceAccess_ObserveOnly)
+    {
+        if (!renderer->recording)
+        {
+            return false;
+        }
+
+        bool read_after_read = !(buffer->access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS) &&
+                               !(access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS);
+
+        bool pending = (buffer->barrier_batch == renderer->barrier_batch);
+
+        if (read_after_read)
+        {
+            if (pending)
+            {
+                renderer->pending_buffer_barriers.items[buffer->barrier_index].dstAccessMask |= access_flags;
+                renderer->pending_dst_stage_flags |= pipeline_stage_flags;
+            }
+
+            buffer->stage_flags |= pipeline_stage_flags;
+            buffer->access_flags |= access_flags;
+        }
+        else
+        {
+            if (pending)
+            {
+                FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+                __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+            }
+
+            FakeUnityVulkanBufferBarriers *barriers = &renderer->pending_buffer_barriers;
+
+            ARRAY_ENSURE_SPACE(barriers, VkBufferMemoryBarrier);
+
+            VkBufferMemoryBarrier *barrier = barriers->items + barriers->count;
+            barrier->sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier->pNext               = 0;
+            barrier->srcAccessMask       = buffer->access_flags & __FAKE_UNITY_VULKAN_WRITE_ACCESS_FLAGS;
+            barrier->dstAccessMask       = access_flags;
+            barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->buffer              = buffer->buffer;
+            barrier->offset              = 0;
+            barrier->size                = VK_WHOLE_SIZE;
+
+            renderer->pending_src_stage_flags |= buffer->stage_flags;
+            renderer->pending_dst_stage_flags |= pipeline_stage_flags;
+
+            buffer->barrier_batch = renderer->barrier_batch;
+            buffer->barrier_index = barriers->count;
+
+            barriers->count += 1;
+
+            buffer->stage_flags = pipeline_stage_flags;
+            buffer->access_flags = access_flags;
+
+            if (renderer->command_buffer_exposed)
+            {
+                FakeUnityVulkanFrame *frame = __fake_unity_vulkan_get_current_frame(renderer);
+                __fake_unity_vulkan_record_pending_barriers(renderer, frame->command_buffers.items[frame->command_buffer_index]);
+            }
+        }
+    }
+
+    if (out_buffer)
+    {
+        memset(out_buffer, 0, sizeof(*out_buffer));
+
+        out_buffer->buffer      = buffer->buffer;
+        out_buffer->sizeInBytes = (size_t) buffer->size;
+        out_buffer->usage       = buffer->usage;
+    }
+
+    return true;
+}
+
+static void
+UnityGraphicsVulkan_EnsureOutsideRenderPass()
+{
+    fprintf(stderr, "[fake_unity] TODO: EnsureOutsideRenderPass\n");
+}
+
+static void
+UnityGraphicsVulkan_EnsureInsideRenderPass()
+{
+    fprintf(stderr, "[fake_unity] TODO: EnsureInsideRenderPass\n");
+}
+
+// There is no separate graphics queue thread, the callback is executed in
+// order with the plugin events on the render thread. With flush set the
+// commands recorded so far are submitted first, and a calling thread other
+// than the render thread waits until the callback was executed.
+static void
+UnityGraphicsVulkan_AccessQueue(UnityRenderingEventAndData func, int event_id, void* userdata, bool flush)
+{
+    FakeUnityRenderCommand command;
+    command.type           = FakeUnityRenderCommandType_PluginEventAndData;
+    command.event_id       = event_id;
+    command.event          = 0;
+    command.event_and_data = func;
+    command.data           = userdata;
+    command.flush          = flush;
+
+    __fake_unity_render_thread_issue(__fake_unity_get_state(), &command, flush);
+}
+
+static bool
+UnityGraphicsVulkan_ConfigureSwapchain(const UnityVulkanSwapchainConfiguration *swapchain_config)
+{
+    fprintf(stderr, "[fake_unity] TODO: ConfigureSwapchain\n");
+    return false;
+}
+
+// The texture id of a texture is its FakeUnity_Texture2D handle.
+static bool
+UnityGraphicsVulkan_AccessTextureByID(UnityTextureID texture_id, const VkImageSubresource *sub_resource, VkImageLayout layout,
+                                      VkPipelineStageFlags pipeline_stage_flags, VkAccessFlags access_flags,
+                                      UnityVulkanResourceAccessMode access_mode, UnityVulkanImage *image)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return false;
+    }
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->texture_pool, texture_id);
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+    return __fake_unity_vulkan_access_texture(state, __fake_unity_get_texture(state, (uint32_t) index), sub_resource, layout, pipeline_stage_flags,
+                                              access_flags, access_mode, image);
+}
+
+static bool
+__fake_unity_state_initialize(FakeUnityState *state, int32_t max_plugin_count, int32_t max_texture_count)
+{
+    if (max_plugin_count <= 0)
+    {
+        max_plugin_count = 8;
+    }
+
+    if (max_texture_count <= 0)
+    {
+        max_texture_count = 8;
+    }
+
+    if ((max_plugin_count > 0x10000) || (max_texture_count > 0x10000))
+    {
+        fprintf(stderr, "[fake_unity] error: at most 65536 plugins and textures are supported.\n");
+        return false;
+    }
+
+    state->renderer_type = kUnityGfxRendererNull;
+
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+    state->hot_reload_fd = -1;
+#endif
+
+    state->profiler.id   = __fake_unity_atomic_add_u64(&__fake_unity_next_profiler_id, 1) + 1;
+    state->profiler.mode = FakeUnityProfilerMode_Events;
+
+    state->unity_interfaces.GetInterface           = IUnityInterfaces_GetInterface;
+    state->unity_interfaces.RegisterInterface      = IUnityInterfaces_RegisterInterface;
+    state->unity_interfaces.GetInterfaceSplit      = IUnityInterfaces_GetInterfaceSplit;
+    state->unity_interfaces.RegisterInterfaceSplit = IUnityInterfaces_RegisterInterfaceSplit;
+
+    state->unity_profiler.EmitEvent             = IUnityProfiler_EmitEvent;
+    state->unity_profiler.IsEnabled             = IUnityProfiler_IsEnabled;
+    state->unity_profiler.IsAvailable           = IUnityProfiler_IsAvailable;
+    state->unity_profiler.CreateMarker          = IUnityProfiler_CreateMarker;
+    state->unity_profiler.SetMarkerMetadataName = IUnityProfiler_SetMarkerMetadataName;
+    state->unity_profiler.RegisterThread        = IUnityProfiler_RegisterThread;
+    state->unity_profiler.UnregisterThread      = IUnityProfiler_UnregisterThread;
+
+    state->unity_graphics.GetRenderer                   = IUnityGraphics_GetRenderer;
+    state->unity_graphics.RegisterDeviceEventCallback   = IUnityGraphics_RegisterDeviceEventCallback;
+    state->unity_graphics.UnregisterDeviceEventCallback = IUnityGraphics_UnregisterDeviceEventCallback;
+    state->unity_graphics.ReserveEventIDRange           = IUnityGraphics_ReserveEventIDRange;
+
+    state->unity_graphics_vulkan.InterceptInitialization          = UnityGraphicsVulkan_InterceptInitialization;
+    state->unity_graphics_vulkan.InterceptVulkanAPI               = UnityGraphicsVulkan_InterceptVulkanAPI;
+    state->unity_graphics_vulkan.ConfigureEvent                   = UnityGraphicsVulkan_ConfigureEvent;
+    state->unity_graphics_vulkan.Instance                         = UnityGraphicsVulkan_Instance;
+    state->unity_graphics_vulkan.CommandRecordingState            = UnityGraphicsVulkan_CommandRecordingState;
+    state->unity_graphics_vulkan.AccessTexture                    = UnityGraphicsVulkan_AccessTexture;
+    state->unity_graphics_vulkan.AccessRenderBufferTexture        = UnityGraphicsVulkan_AccessRenderBufferTexture;
+    state->unity_graphics_vulkan.AccessRenderBufferResolveTexture = UnityGraphicsVulkan_AccessRenderBufferResolveTexture;
+    state->unity_graphics_vulkan.AccessBuffer                     = UnityGraphicsVulkan_AccessBuffer;
+    state->unity_graphics_vulkan.EnsureOutsideRenderPass          = UnityGraphicsVulkan_EnsureOutsideRenderPass;
+    state->unity_graphics_vulkan.EnsureInsideRenderPass           = UnityGraphicsVulkan_EnsureInsideRenderPass;
+    state->unity_graphics_vulkan.AccessQueue                      = UnityGraphicsVulkan_AccessQueue;
+    state->unity_graphics_vulkan.ConfigureSwapchain               = UnityGraphicsVulkan_ConfigureSwapchain;
+    state->unity_graphics_vulkan.AccessTextureByID                = UnityGraphicsVulkan_AccessTextureByID;
+
+    __fake_unity_register_interface(state, 0x2CE79ED8316A4833ULL, 0x87076B2013E1571FULL, &state->unity_profiler);
+    __fake_unity_register_interface(state, 0x7CBA0A9CA4DDB544ULL, 0x8C5AD4926EB17B11ULL, &state->unity_graphics);
+    __fake_unity_register_interface(state, 0x95355348d4ef4e11ULL, 0x9789313dfcffcc87ULL, &state->unity_graphics_vulkan);
+
+    __fake_unity_handle_pool_initialize(&state->plugin_pool, sizeof(FakeUnityNativePlugin), max_plugin_count);
+    __fake_unity_handle_pool_initialize(&state->texture_pool, sizeof(FakeUnityTexture), max_texture_count);
+    __fake_unity_handle_pool_initialize(&state->request_pool, sizeof(FakeUnityGPURequest), 0);
+    __fake_unity_handle_pool_initialize(&state->buffer_pool, sizeof(FakeUnityBuffer), 0);
+
+    return true;
+}
+
+// The render thread has to be idle or stopped.
+static void
+__fake_unity_destroy_renderer(FakeUnityState *state)
+{
+    if (!state->has_renderer)
+    {
+        return;
+    }
+
+    // Plugins still see the renderer while they handle the event.
+    __fake_unity_send_device_event(state, kUnityGfxDeviceEventShutdown);
+
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        __fake_unity_vulkan_destroy_renderer(state);
+    }
+    else
+    {
+        __fake_unity_null_destroy_renderer(state);
+    }
+
+    state->renderer_type = kUnityGfxRendererNull;
+    state->has_renderer = false;
+}
+
+// Loads the library of a plugin and looks up its entry points.
+static bool
+__fake_unity_native_plugin_open(FakeUnityNativePlugin *plugin, const char *filename)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    // TODO: use the unicode variant which requires converting utf8 to utf16
+    HMODULE handle = LoadLibraryA(filename);
+
+    if (!handle)
+    {
+        fprintf(stderr, "[fake_unity] error: could not load native plugin '%s'\n", filename);
+        return false;
+    }
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    void *handle = dlopen(filename, RTLD_NOW);
+
+    if (!handle)
+    {
+        fprintf(stderr, "[fake_unity] error: could not load native plugin '%s' -> %s\n", filename, dlerror());
+        return false;
+    }
+#endif
+
+    plugin->handle = handle;
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    plugin->UnityPluginLoad   = (PFN_UnityPluginLoad)   GetProcAddress(plugin->handle, "UnityPluginLoad");
+    plugin->UnityPluginUnload = (PFN_UnityPluginUnload) GetProcAddress(plugin->handle, "UnityPluginUnload");
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    plugin->UnityPluginLoad   = (PFN_UnityPluginLoad)   dlsym(plugin->handle, "UnityPluginLoad");
+    plugin->UnityPluginUnload = (PFN_UnityPluginUnload) dlsym(plugin->handle, "UnityPluginUnload");
+#endif
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    plugin->module_base = (const void *) plugin->handle;
+#else
+    plugin->module_base = 0;
+
+    if (plugin->UnityPluginLoad || plugin->UnityPluginUnload)
+    {
+        plugin->module_base = __fake_unity_get_module_base(plugin->UnityPluginLoad ? (const void *) plugin->UnityPluginLoad
+                                                                                   : (const void *) plugin->UnityPluginUnload);
+    }
+#endif
+
+    return true;
+}
+
+// Unloads the library of a plugin and deletes its shadow copy.
+static void
+__fake_unity_native_plugin_close(FakeUnityNativePlugin *plugin)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    FreeLibrary(plugin->handle);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    dlclose(plugin->handle);
+#endif
+
+    if (plugin->shadow_path)
+    {
+        remove(plugin->shadow_path);
+        free(plugin->shadow_path);
+        plugin->shadow_path = 0;
+    }
+}
+
+static void
+__fake_unity_native_plugin_call_load(FakeUnityState *state, FakeUnityNativePlugin *plugin)
+{
+    __fake_unity_vulkan_trace_add_module(&state->vulkan_trace, plugin->module_base, plugin->plugin_handle);
+
+    if (plugin->UnityPluginLoad)
+    {
+        __fake_unity_loading_plugin = plugin->plugin_handle;
+        __fake_unity_active_plugin = plugin->plugin_handle;
+        plugin->UnityPluginLoad(&state->unity_interfaces);
+        __fake_unity_loading_plugin = 0;
+        __fake_unity_active_plugin = 0;
+    }
+}
+
+// Calls UnityPluginUnload and drops what the plugin left behind that would
+// call into its library once it is unloaded or replaced.
+static void
+__fake_unity_native_plugin_call_unload(FakeUnityState *state, FakeUnityNativePlugin *plugin)
+{
+    if (plugin->UnityPluginUnload)
+    {
+        __fake_unity_active_plugin = plugin->plugin_handle;
+        plugin->UnityPluginUnload();
+        __fake_unity_active_plugin = 0;
+    }
+
+    __fake_unity_remove_device_event_callbacks(state, plugin->plugin_handle);
+    __fake_unity_vulkan_remove_intercepts(state, plugin->plugin_handle);
+    __fake_unity_plugin_events_release(&state->plugin_events, plugin->plugin_handle);
+    __fake_unity_vulkan_trace_remove_module(&state->vulkan_trace, plugin->plugin_handle);
+    __fake_unity_vulkan_trace_release_plugin(&state->vulkan_trace, plugin->plugin_handle);
+}
+
+// Calls UnityPluginUnload and unloads the library of a plugin whose handle
+// was retired.
+static void
+__fake_unity_native_plugin_unload(FakeUnityState *state, uint32_t index)
+{
+    FakeUnityNativePlugin *plugin = __fake_unity_get_plugin(state, index);
+
+    __fake_unity_native_plugin_call_unload(state, plugin);
+    __fake_unity_native_plugin_close(plugin);
+
+    free(plugin->path);
+    plugin->path = 0;
+
+    __fake_unity_handle_pool_push(&state->plugin_pool, index);
+}
+
+static volatile uint32_t __fake_unity_shadow_copy_count;
+
+// Copies a library to a new file next to it and returns the name of the
+// copy. The name is unique per load, because most loaders return the
+// already loaded image when a path is opened again.
+static char *
+__fake_unity_make_shadow_copy(const char *path)
+{
+    uint32_t number = __fake_unity_atomic_add_u32(&__fake_unity_shadow_copy_count, 1);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    unsigned long process_id = (unsigned long) GetCurrentProcessId();
+#else
+    unsigned long process_id = (unsigned long) getpid();
+#endif
+
+    size_t shadow_path_size = strlen(path) + 48;
+    char *shadow_path = (char *) malloc(shadow_path_size);
+    snprintf(shadow_path, shadow_path_size, "%s.%lu.%u.hot", path, process_id, number);
+
+    FILE *source = fopen(path, "rb");
+
+    if (!source)
+    {
+        fprintf(stderr, "[fake_unity] error: could not open native plugin '%s'\n", path);
+        free(shadow_path);
+        return 0;
+    }
+
+    FILE *destination = fopen(shadow_path, "wb");
+
+    if (!destination)
+    {
+        fprintf(stderr, "[fake_unity] error: could not create '%s'\n", shadow_path);
+        fclose(source);
+        free(shadow_path);
+        return 0;
+    }
+
+    bool success = true;
+    char buffer[16 * 1024];
+    size_t size;
+
+    while ((size = fread(buffer, 1, sizeof(buffer), source)) > 0)
+    {
+        if (fwrite(buffer, 1, size, destination) != size)
+        {
+            success = false;
+            break;
+        }
+    }
+
+    success = !ferror(source) && success;
+    fclose(source);
+    success = (fclose(destination) == 0) && success;
+
+    if (!success)
+    {
+        fprintf(stderr, "[fake_unity] error: could not copy native plugin '%s' to '%s'\n", path, shadow_path);
+        remove(shadow_path);
+        free(shadow_path);
+        return 0;
+    }
+
+    return shadow_path;
+}
+
+static const char *
+__fake_unity_get_file_name(const char *path)
+{
+    const char *file_name = path;
+
+    for (const char *at = path; *at; at += 1)
+    {
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        if ((*at == '/') || (*at == '\\'))
+#else
+        if (*at == '/')
+#endif
+        {
+            file_name = at + 1;
+        }
+    }
+
+    return file_name;
+}
+
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+
+// Watches the directory instead of the library itself, because builds
+// usually replace the file, which would silently end a watch on it.
+static bool
+__fake_unity_native_plugin_watch(FakeUnityState *state, FakeUnityNativePlugin *plugin)
+{
+    if (state->hot_reload_fd < 0)
+    {
+        state->hot_reload_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (state->hot_reload_fd < 0)
+        {
+            fprintf(stderr, "[fake_unity] error: could not create inotify instance\n");
+            return false;
+        }
+    }
+
+    const char *file_name = __fake_unity_get_file_name(plugin->path);
+    size_t directory_length = (size_t) (file_name - plugin->path);
+
+    char *directory;
+
+    if (directory_length == 0)
+    {
+        directory = __fake_unity_copy_string(".");
+    }
+    else
+    {
+        // Keeps the slash of the root directory.
+        directory_length = (directory_length > 1) ? (directory_length - 1) : directory_length;
+        directory = (char *) malloc(directory_length + 1);
+        memcpy(directory, plugin->path, directory_length);
+        directory[directory_length] = 0;
+    }
+
+    plugin->watch_descriptor = inotify_add_watch(state->hot_reload_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    if (plugin->watch_descriptor < 0)
+    {
+        fprintf(stderr, "[fake_unity] error: could not watch directory '%s'\n", directory);
+    }
+
+    free(directory);
+
+    return plugin->watch_descriptor >= 0;
+}
+
+// Marks the plugins whose library was written or moved in since the last
+// call. Several plugins in one directory share the same watch descriptor.
+static void
+__fake_unity_poll_native_plugin_changes(FakeUnityState *state)
+{
+    if (state->hot_reload_fd < 0)
+    {
+        return;
+    }
+
+    union
+    {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    FakeUnityHandlePool *plugin_pool = &state->plugin_pool;
+    uint32_t plugin_count = __fake_unity_atomic_load_u32(&plugin_pool->page_count) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+    for (;;)
+    {
+        // Fails with EAGAIN once all events are read.
+        ssize_t size = read(state->hot_reload_fd, buffer.bytes, sizeof(buffer.bytes));
+
+        if (size <= 0)
+        {
+            break;
+        }
+
+        ssize_t offset = 0;
+
+        while (offset < size)
+        {
+            const struct inotify_event *event = (const struct inotify_event *) (buffer.bytes + offset);
+
+            if (event->len > 0)
+            {
+                for (uint32_t index = 0; index < plugin_count; index += 1)
+                {
+                    FakeUnityNativePlugin *plugin = __fake_unity_get_plugin(state, index);
+
+                    if ((__fake_unity_handle_pool_get_index(plugin_pool, plugin->plugin_handle) == (int32_t) index) && plugin->path &&
+                        (plugin->watch_descriptor == event->wd) && (strcmp(__fake_unity_get_file_name(plugin->path), event->name) == 0))
+                    {
+                        plugin->changed = true;
+                    }
+                }
+            }
+
+            offset += (ssize_t) (sizeof(struct inotify_event) + event->len);
+        }
+    }
+}
+
+#else
+
+static int64_t
+__fake_unity_get_modification_time(const char *path)
+{
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    struct _stat64 info;
+
+    if (_stat64(path, &info) != 0)
+    {
+        return 0;
+    }
+
+    return (int64_t) info.st_mtime;
+#elif FAKE_UNITY_PLATFORM_MACOS
+    struct stat info;
+
+    if (stat(path, &info) != 0)
+    {
+        return 0;
+    }
+
+    return ((int64_t) info.st_mtimespec.tv_sec * 1000000000) + (int64_t) info.st_mtimespec.tv_nsec;
+#else
+    struct stat info;
+
+    if (stat(path, &info) != 0)
+    {
+        return 0;
+    }
+
+    return (int64_t) info.st_mtime;
+#endif
+}
+
+#endif
+
+// Loads the rebuilt library of a hot reloadable plugin. The new library is
+// loaded before the old one is unloaded, so a broken build keeps the old one.
+static bool
+__fake_unity_native_plugin_reload(FakeUnityState *state, FakeUnityNativePlugin *plugin)
+{
+    char *shadow_path = __fake_unity_make_shadow_copy(plugin->path);
+
+    if (!shadow_path)
+    {
+        return false;
+    }
+
+    FakeUnityNativePlugin reloaded = *plugin;
+
+    if (!__fake_unity_native_plugin_open(&reloaded, shadow_path))
+    {
+        remove(shadow_path);
+        free(shadow_path);
+        return false;
+    }
+
+    __fake_unity_native_plugin_call_unload(state, plugin);
+    __fake_unity_native_plugin_close(plugin);
+
+    reloaded.shadow_path = shadow_path;
+    *plugin = reloaded;
+
+    __fake_unity_native_plugin_call_load(state, plugin);
+
+    return true;
+}
+
+static void
+__fake_unity_state_free(FakeUnityState *state)
+{
+    __fake_unity_render_thread_stop(state);
+
+    __fake_unity_destroy_renderer(state);
+
+    FakeUnityHandlePool *plugin_pool = &state->plugin_pool;
+    uint32_t plugin_count = __fake_unity_atomic_load_u32(&plugin_pool->page_count) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+    for (uint32_t index = 0; index < plugin_count; index += 1)
+    {
+        if (__fake_unity_handle_pool_retire(plugin_pool, __fake_unity_get_plugin(state, index)->plugin_handle) >= 0)
+        {
+            __fake_unity_native_plugin_unload(state, index);
+        }
+    }
+
+    for (uint32_t i = 0; i < (FAKE_UNITY_MAX_EVENT_ID_COUNT / FAKE_UNITY_EVENT_PAGE_SIZE); i += 1)
+    {
+        free(state->plugin_events.pages[i]);
+    }
+
+    free(state->plugin_events.reserved_ranges.items);
+    free(state->plugin_events.free_ranges.items);
+
+    FakeUnityInterfaceTable *table = state->interfaces.table;
+
+    while (table)
+    {
+        FakeUnityInterfaceTable *retired = table->retired;
+        free(table->items);
+        free(table);
+        table = retired;
+    }
+
+    free(state->graphics_device_event_callbacks.items);
+    free(state->vulkan_pipeline_cache_path);
+
+    FakeUnityVulkanIntercepts *vulkan_intercepts = &state->vulkan_intercepts;
+
+    for (uint32_t i = 0; i < vulkan_intercepts->capacity; i += 1)
+    {
+        free(vulkan_intercepts->items[i].name);
+        free(vulkan_intercepts->items[i].hooks.items);
+    }
+
+    free(vulkan_intercepts->items);
+
+    if (vulkan_intercepts->loader_handle)
+    {
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        FreeLibrary(vulkan_intercepts->loader_handle);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+        dlclose(vulkan_intercepts->loader_handle);
+#endif
+    }
+
+    FakeUnityVulkanTraceThread *vulkan_trace_thread = state->vulkan_trace.threads;
+
+    while (vulkan_trace_thread)
+    {
+        FakeUnityVulkanTraceThread *next = vulkan_trace_thread->next;
+        free(vulkan_trace_thread);
+        vulkan_trace_thread = next;
+    }
+
+    free(state->vulkan_trace.modules.items);
+
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+    if (state->hot_reload_fd >= 0)
+    {
+        close(state->hot_reload_fd);
+    }
+#endif
+
+    __fake_unity_handle_pool_free(&state->plugin_pool);
+    __fake_unity_handle_pool_free(&state->texture_pool);
+    __fake_unity_handle_pool_free(&state->request_pool);
+    __fake_unity_handle_pool_free(&state->buffer_pool);
+
+    FakeUnityProfiler *profiler = &state->profiler;
+
+    if (profiler->trace)
+    {
+        __fake_unity_trace_flush(profiler->trace);
+        fclose(profiler->trace->file);
+        free(profiler->trace);
+    }
+
+    FakeUnityProfilerMarker *marker = profiler->markers;
+
+    while (marker)
+    {
+        FakeUnityProfilerMarker *next = marker->next;
+
+        for (int32_t i = 0; i < marker->metadata_count; i += 1)
+        {
+            free(marker->metadata[i].name);
+        }
+
+        free(marker->metadata);
+        free(marker->name);
+        free(marker);
+
+        marker = next;
+    }
+
+    FakeUnityProfilerThread *thread = profiler->threads;
+
+    while (thread)
+    {
+        FakeUnityProfilerThread *next = thread->next;
+
+        free(thread->events);
+        free(thread);
+
+        thread = next;
+    }
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_initialize(int32_t max_plugin_count, int32_t max_texture_count)
+{
+    return __fake_unity_state_initialize(&__fake_unity_default_state, max_plugin_count, max_texture_count);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_shutdown(void)
+{
+    __fake_unity_state_free(&__fake_unity_default_state);
+    memset(&__fake_unity_default_state, 0, sizeof(__fake_unity_default_state));
+}
+
+FAKE_UNITY_DEF FakeUnityContext *
+fake_unity_context_create(int32_t max_plugin_count, int32_t max_texture_count)
+{
+    FakeUnityState *state = (FakeUnityState *) calloc(1, sizeof(FakeUnityState));
+
+    if (!__fake_unity_state_initialize(state, max_plugin_count, max_texture_count))
+    {
+        free(state);
+        return 0;
+    }
+
+    __fake_unity_spin_lock(&__fake_unity_context_lock);
+    state->next_context = __fake_unity_contexts;
+    __fake_unity_contexts = state;
+    __fake_unity_spin_unlock(&__fake_unity_context_lock);
+
+    return (FakeUnityContext *) state;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_context_destroy(FakeUnityContext *context)
+{
+    FakeUnityState *state = (FakeUnityState *) context;
+
+    if (!state || (state == &__fake_unity_default_state))
+    {
+        return;
+    }
+
+    if (__fake_unity_current_state == state)
+    {
+        __fake_unity_set_current_state(0);
+    }
+
+    __fake_unity_state_free(state);
+
+    __fake_unity_spin_lock(&__fake_unity_context_lock);
+
+    FakeUnityState **link = &__fake_unity_contexts;
+
+    while (*link && (*link != state))
+    {
+        link = &(*link)->next_context;
+    }
+
+    if (*link)
+    {
+        *link = state->next_context;
+    }
+
+    __fake_unity_spin_unlock(&__fake_unity_context_lock);
+
+    // Other threads notice this the next time they look up their current
+    // context. The cached profiler and trace threads are keyed by the profiler
+    // id of the context, which is never reused, so they are never used again.
+    __fake_unity_atomic_add_u32(&__fake_unity_destroyed_context_count, 1);
+
+    free(state);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_context_make_current(FakeUnityContext *context)
+{
+    FakeUnityState *state = (FakeUnityState *) context;
+
+    __fake_unity_set_current_state((state == &__fake_unity_default_state) ? 0 : state);
+}
+
+FAKE_UNITY_DEF FakeUnityContext *
+fake_unity_context_get_current(void)
+{
+    return (FakeUnityContext *) __fake_unity_get_state();
+}
+
+static uint32_t
+__fake_unity_load_native_plugin(FakeUnityState *state, const char *filename, bool hot_reloadable)
+{
+    uint32_t index;
+    uint32_t result = __fake_unity_handle_pool_allocate(&state->plugin_pool, &index);
+
+    if (!result)
+    {
+        return 0;
+    }
+
+    FakeUnityNativePlugin *plugin = __fake_unity_get_plugin(state, index);
+
+    plugin->plugin_handle = result;
+    plugin->path          = 0;
+    plugin->shadow_path   = 0;
+    plugin->changed       = false;
+
+    bool success = true;
+
+    if (hot_reloadable)
+    {
+        plugin->path = __fake_unity_copy_string(filename);
+
+        // The watch starts before the copy, so a build that finishes while
+        // copying is not missed.
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+        success = __fake_unity_native_plugin_watch(state, plugin);
+#else
+        plugin->modification_time = __fake_unity_get_modification_time(filename);
+#endif
+
+        if (success)
+        {
+            plugin->shadow_path = __fake_unity_make_shadow_copy(filename);
+            success = plugin->shadow_path != 0;
+        }
+    }
+
+    if (success)
+    {
+        success = __fake_unity_native_plugin_open(plugin, plugin->shadow_path ? plugin->shadow_path : filename);
+    }
+
+    if (!success)
+    {
+        if (plugin->shadow_path)
+        {
+            remove(plugin->shadow_path);
+            free(plugin->shadow_path);
+            plugin->shadow_path = 0;
+        }
+
+        free(plugin->path);
+        plugin->path = 0;
+
+        __fake_unity_handle_pool_retire(&state->plugin_pool, result);
+        __fake_unity_handle_pool_push(&state->plugin_pool, index);
+        return 0;
+    }
+
+    __fake_unity_native_plugin_call_load(state, plugin);
+
+    return result;
+}
+
+FAKE_UNITY_DEF uint32_t
+fake_unity_load_native_plugin(const char *filename)
+{
+    return __fake_unity_load_native_plugin(__fake_unity_get_state(), filename, false);
+}
+
+FAKE_UNITY_DEF uint32_t
+fake_unity_load_native_plugin_hot_reloadable(const char *filename)
+{
+    return __fake_unity_load_native_plugin(__fake_unity_get_state(), filename, true);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_unload_native_plugin(uint32_t plugin_handle)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    __fake_unity_render_thread_sync(state);
+
+    int32_t index = __fake_unity_handle_pool_retire(&state->plugin_pool, plugin_handle);
+
+    if (index < 0)
+    {
+        return;
+    }
+
+    __fake_unity_native_plugin_unload(state, (uint32_t) index);
+}
+
+FAKE_UNITY_DEF int32_t
+fake_unity_reload_native_plugins(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+#if FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX
+    __fake_unity_poll_native_plugin_changes(state);
+#endif
+
+    FakeUnityHandlePool *plugin_pool = &state->plugin_pool;
+    uint32_t plugin_count = __fake_unity_atomic_load_u32(&plugin_pool->page_count) * FAKE_UNITY_HANDLE_POOL_PAGE_SIZE;
+
+    int32_t reload_count = 0;
+    bool synced = false;
+
+    for (uint32_t index = 0; index < plugin_count; index += 1)
+    {
+        FakeUnityNativePlugin *plugin = __fake_unity_get_plugin(state, index);
+
+        if ((__fake_unity_handle_pool_get_index(plugin_pool, plugin->plugin_handle) != (int32_t) index) || !plugin->path)
+        {
+            continue;
+        }
+
+#if !(FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX)
+        int64_t modification_time = __fake_unity_get_modification_time(plugin->path);
+
+        if (modification_time != plugin->modification_time)
+        {
+            plugin->modification_time = modification_time;
+            plugin->changed = true;
+        }
+#endif
+
+        if (!plugin->changed)
+        {
+            continue;
+        }
+
+        plugin->changed = false;
+
+        // Commands issued before may still call into the old library.
+        if (!synced)
+        {
+            __fake_unity_render_thread_sync(state);
+            synced = true;
+        }
+
+        if (__fake_unity_native_plugin_reload(state, plugin))
+        {
+            reload_count += 1;
+        }
+    }
+
+    return reload_count;
+}
+
+FAKE_UNITY_DEF void *
+fake_unity_native_plugin_get_proc_address(uint32_t plugin_handle, const char *proc_name)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    void *result = 0;
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->plugin_pool, plugin_handle);
+
+    if (index >= 0)
+    {
+        FakeUnityNativePlugin *plugin = __fake_unity_get_plugin(state, (uint32_t) index);
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+        result = GetProcAddress(plugin->handle, proc_name);
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+        result = dlsym(plugin->handle, proc_name);
+#endif
+    }
+
+    return result;
+}
+
+// Size of the header that every pipeline cache starts with, see
+// VkPipelineCacheHeaderVersionOne.
+#define __FAKE_UNITY_PIPELINE_CACHE_HEADER_SIZE 32
+
+// Returns the file contents if they start with a pipeline cache header that
+// matches the device, NULL otherwise.
+static void *
+__fake_unity_vulkan_read_pipeline_cache(const char *path, const VkPhysicalDeviceProperties *properties, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    void *data = 0;
+    long file_size = 0;
+
+    if ((fseek(file, 0, SEEK_END) == 0) && ((file_size = ftell(file)) >= __FAKE_UNITY_PIPELINE_CACHE_HEADER_SIZE) &&
+        (fseek(file, 0, SEEK_SET) == 0))
+    {
+        data = malloc((size_t) file_size);
+
+        if (fread(data, 1, (size_t) file_size, file) != (size_t) file_size)
+        {
+            free(data);
+            data = 0;
+        }
+    }
+
+    fclose(file);
+
+    if (data)
+    {
+        uint32_t header[4];
+        memcpy(header, data, sizeof(header));
+
+        if ((header[0] < __FAKE_UNITY_PIPELINE_CACHE_HEADER_SIZE) ||
+            (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) ||
+            (header[2] != properties->vendorID) || (header[3] != properties->deviceID) ||
+            memcmp((uint8_t *) data + 16, properties->pipelineCacheUUID, VK_UUID_SIZE))
+        {
+            fprintf(stderr, "[fake_unity] ignoring pipeline cache '%s', it was written for another device or driver.\n", path);
+            free(data);
+            data = 0;
+        }
+    }
+
+    *size = data ? (size_t) file_size : 0;
+
+    return data;
+}
+
+static bool
+__fake_unity_vulkan_create_pipeline_cache(FakeUnityVulkanRenderer *renderer, const char *path)
+{
+    size_t initial_data_size = 0;
+    void *initial_data = 0;
+
+    if (path)
+    {
+        VkPhysicalDeviceProperties properties;
+        renderer->vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+
+        initial_data = __fake_unity_vulkan_read_pipeline_cache(path, &properties, &initial_data_size);
+    }
+
+    VkPipelineCacheCreateInfo pipeline_cache_create_info;
+    pipeline_cache_create_info.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipeline_cache_create_info.pNext           = 0;
+    pipeline_cache_create_info.flags           = 0;
+    pipeline_cache_create_info.initialDataSize = initial_data_size;
+    pipeline_cache_create_info.pInitialData    = initial_data;
+
+    VkResult result = renderer->vkCreatePipelineCache(renderer->device, &pipeline_cache_create_info, 0, &renderer->pipeline_cache);
+
+    if ((result != VK_SUCCESS) && initial_data)
+    {
+        // Drivers are allowed to reject the data, start empty in that case.
+        pipeline_cache_create_info.initialDataSize = 0;
+        pipeline_cache_create_info.pInitialData    = 0;
+
+        result = renderer->vkCreatePipelineCache(renderer->device, &pipeline_cache_create_info, 0, &renderer->pipeline_cache);
+    }
+
+    free(initial_data);
+
+    if (result != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkCreatePipelineCache failed.\n");
+        renderer->pipeline_cache = VK_NULL_HANDLE;
+        return false;
+    }
+
+    return true;
+}
+
+static int32_t
+__fake_unity_vulkan_get_device_type_score(VkPhysicalDeviceType type)
+{
+    switch (type)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   return 4;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 3;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    return 2;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:            return 1;
+        default:                                     return 0;
+    }
+}
+
+// Finds the first graphics queue family and dedicated compute and transfer
+// families if there are any. A dedicated compute family has no graphics
+// support, a dedicated transfer family neither graphics nor compute
+// support. Returns false if the device has no graphics queue family.
+static bool
+__fake_unity_vulkan_find_queue_families(FakeUnityVulkanRenderer *renderer, VkPhysicalDevice physical_device,
+                                        uint32_t *graphics_index, uint32_t *compute_index, uint32_t *transfer_index)
+{
+    uint32_t family_count = 0;
+    renderer->vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, 0);
+
+    VkQueueFamilyProperties *families = (VkQueueFamilyProperties *) malloc(sizeof(*families) * family_count);
+    renderer->vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families);
+
+    *graphics_index = VK_QUEUE_FAMILY_IGNORED;
+    *compute_index = VK_QUEUE_FAMILY_IGNORED;
+    *transfer_index = VK_QUEUE_FAMILY_IGNORED;
+
+    for (uint32_t i = 0; i < family_count; i += 1)
+    {
+        VkQueueFlags flags = families[i].queueFlags;
+
+        if (families[i].queueCount == 0)
+        {
+            continue;
+        }
+
+        if (flags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            if (*graphics_index == VK_QUEUE_FAMILY_IGNORED)
+            {
+                *graphics_index = i;
+            }
+        }
+        else if (flags & VK_QUEUE_COMPUTE_BIT)
+        {
+            if (*compute_index == VK_QUEUE_FAMILY_IGNORED)
+            {
+                *compute_index = i;
+            }
+        }
+        else if (flags & VK_QUEUE_TRANSFER_BIT)
+        {
+            if (*transfer_index == VK_QUEUE_FAMILY_IGNORED)
+            {
+                *transfer_index = i;
+            }
+        }
+    }
+
+    free(families);
+
+    return *graphics_index != VK_QUEUE_FAMILY_IGNORED;
+}
+
+static void
+__fake_unity_vulkan_get_timestamp_properties(FakeUnityVulkanRenderer *renderer, uint32_t graphics_queue_index)
+{
+    VkPhysicalDeviceProperties properties;
+    renderer->vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+
+    uint32_t family_count = 0;
+    renderer->vkGetPhysicalDeviceQueueFamilyProperties(renderer->physical_device, &family_count, 0);
+
+    VkQueueFamilyProperties *families = (VkQueueFamilyProperties *) malloc(sizeof(*families) * family_count);
+    renderer->vkGetPhysicalDeviceQueueFamilyProperties(renderer->physical_device, &family_count, families);
+
+    renderer->timestamp_valid_bits = (graphics_queue_index < family_count) ? families[graphics_queue_index].timestampValidBits : 0;
+    renderer->timestamp_period = properties.limits.timestampPeriod;
+
+    if (renderer->timestamp_period <= 0.0)
+    {
+        renderer->timestamp_valid_bits = 0;
+    }
+
+    free(families);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_create_vulkan_renderer(int32_t device_index)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->has_renderer)
+    {
+        return false;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    if (renderer->loader_handle)
+    {
+        return false;
+    }
+
+#if FAKE_UNITY_PLATFORM_WINDOWS
+    renderer->loader_handle = LoadLibraryA("vulkan-1.dll");
+
+    if (!renderer->loader_handle)
+    {
+        fprintf(stderr, "[fake_unity] error: could not load vulkan loader\n");
+        return false;
+    }
+
+    renderer->loader_vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) GetProcAddress(renderer->loader_handle, "vkGetInstanceProcAddr");
+
+#  define CLOSE_VULKAN_LOADER(handle) \
+    FreeLibrary(handle); \
+    handle = 0
+#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
+    renderer->loader_handle = dlopen("libvulkan.so.1", RTLD_NOW);
+
+    if (!renderer->loader_handle)
+    {
+        fprintf(stderr, "[fake_unity] error: could not load vulkan loader -> %s\n", dlerror());
+        return false;
+    }
+
+    renderer->loader_vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) dlsym(renderer->loader_handle, "vkGetInstanceProcAddr");
+
+#  define CLOSE_VULKAN_LOADER(handle) \
+    dlclose(handle); \
+    handle = 0
+#endif
+
+    if (!renderer->loader_vkGetInstanceProcAddr)
+    {
+        fprintf(stderr, "[fake_unity] error: could not load vulkan function 'vkGetInstanceProcAddr'.\n");
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    renderer->vkGetInstanceProcAddr = renderer->loader_vkGetInstanceProcAddr;
+
+    PFN_vkGetInstanceProcAddr plugin_vkGetInstanceProcAddr = 0;
+
+    if (state->unity_vulkan_init_callback)
+    {
+        PFN_vkGetInstanceProcAddr get_instance_proc_addr = __fake_unity_vulkan_get_plugin_instance_proc_addr(state, renderer->loader_vkGetInstanceProcAddr);
+
+        plugin_vkGetInstanceProcAddr = state->unity_vulkan_init_callback(get_instance_proc_addr, state->unity_vulkan_init_userdata);
+
+        if (plugin_vkGetInstanceProcAddr)
+        {
+            renderer->vkGetInstanceProcAddr = plugin_vkGetInstanceProcAddr;
+        }
+    }
+
+#define load_function(name)                                                                       \
+    do                                                                                            \
+    {                                                                                             \
+        renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(VK_NULL_HANDLE, #name);     \
+        if (!renderer->name)                                                                      \
+        {                                                                                         \
+            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
+            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
+            return false;                                                                         \
+        }                                                                                         \
+    } while (0)
+
+    __FAKE_UNITY_VULKAN_GLOBAL_FUNCTIONS(load_function);
+
+#undef load_function
+
+    __fake_unity_vulkan_apply_intercepts(state);
+
+    uint32_t vulkan_instance_version = VK_API_VERSION_1_0;
+    renderer->vkEnumerateInstanceVersion(&vulkan_instance_version);
+
+    fprintf(stderr, "[fake_unity] loaded vulkan library with instance version %u.%u.%u\n",
+                    VK_API_VERSION_MAJOR(vulkan_instance_version),
+                    VK_API_VERSION_MINOR(vulkan_instance_version),
+                    VK_API_VERSION_PATCH(vulkan_instance_version));
+
+    VkApplicationInfo application_info;
+    application_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    application_info.pNext              = 0;
+    application_info.pApplicationName   = "application";
+    application_info.applicationVersion = 1;
+    application_info.pEngineName        = "Unity";
+    application_info.engineVersion      = 1;
+    application_info.apiVersion         = VK_API_VERSION_1_0;
+
+    VkInstanceCreateInfo instance_create_info;
+    instance_create_info.sType                   = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instance_create_info.pNext                   = 0;
+    instance_create_info.flags                   = 0;
+    instance_create_info.pApplicationInfo        = &application_info;
+    instance_create_info.enabledLayerCount       = 0;
+    instance_create_info.ppEnabledLayerNames     = 0;
+    instance_create_info.enabledExtensionCount   = 0;
+    instance_create_info.ppEnabledExtensionNames = 0;
+
+    VkInstance instance;
+
+    if (renderer->vkCreateInstance(&instance_create_info, 0, &instance) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkCreateInstance failed.\n");
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    renderer->instance = instance;
+
+#define load_function(name)                                                                       \
+    do                                                                                            \
+    {                                                                                             \
+        renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(instance, #name);           \
+        if (!renderer->name)                                                                      \
+        {                                                                                         \
+            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
+            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
+            return false;                                                                         \
+        }                                                                                         \
+    } while (0)
+
+    __FAKE_UNITY_VULKAN_INSTANCE_FUNCTIONS(load_function);
+
+#undef load_function
+
+    __fake_unity_vulkan_apply_intercepts(state);
+
+    uint32_t physical_device_count = 0;
+
+    if (renderer->vkEnumeratePhysicalDevices(instance, &physical_device_count, 0) != VK_SUCCESS)
+    {
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    VkPhysicalDevice *physical_devices = (VkPhysicalDevice *) malloc(sizeof(*physical_devices) * physical_device_count);
+
+    if (renderer->vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices) != VK_SUCCESS)
+    {
+        free(physical_devices);
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    fprintf(stderr, "[fake_unity] %u physical devices:\n", physical_device_count);
+
+    int32_t best_device_index = -1;
+    int32_t best_device_score = -1;
+
+    for (uint32_t i = 0; i < physical_device_count; i += 1)
+    {
+        VkPhysicalDeviceProperties properties;
+        renderer->vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+
+        fprintf(stderr, "[fake_unity] [%u] %s (type = %s) (api version = %u.%u.%u)\n",
+                        i, properties.deviceName, __fake_unity_vk_physical_device_type_to_string(properties.deviceType),
+                        VK_API_VERSION_MAJOR(properties.apiVersion), VK_API_VERSION_MINOR(properties.apiVersion), VK_API_VERSION_PATCH(properties.apiVersion));
+
+        uint32_t graphics_index, compute_index, transfer_index;
+
+        if (__fake_unity_vulkan_find_queue_families(renderer, physical_devices[i], &graphics_index, &compute_index, &transfer_index))
+        {
+            int32_t score = __fake_unity_vulkan_get_device_type_score(properties.deviceType);
+
+            if (score > best_device_score)
+            {
+                best_device_index = (int32_t) i;
+                best_device_score = score;
+            }
+        }
+    }
+
+    if (device_index < 0)
+    {
+        device_index = best_device_index;
+
+        if (device_index < 0)
+        {
+            fprintf(stderr, "[fake_unity] error: no physical device with a graphics queue.\n");
+            free(physical_devices);
+            CLOSE_VULKAN_LOADER(renderer->loader_handle);
+            return false;
+        }
+    }
+
+    if (device_index >= (int32_t) physical_device_count)
+    {
+        fprintf(stderr, "[fake_unity] error: device_index = %d is out of bounds [0, %u).\n", device_index, physical_device_count);
+        free(physical_devices);
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    VkPhysicalDevice physical_device = physical_devices[device_index];
+
+    free(physical_devices);
+
+    uint32_t graphics_queue_index, compute_queue_index, transfer_queue_index;
+
+    if (!__fake_unity_vulkan_find_queue_families(renderer, physical_device, &graphics_queue_index, &compute_queue_index, &transfer_queue_index))
+    {
+        fprintf(stderr, "[fake_unity] error: device at index %d has no graphics queue.\n", device_index);
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    fprintf(stderr, "[fake_unity] selected device at index %d\n", device_index);
+
+    renderer->physical_device = physical_device;
+
+    renderer->vkGetPhysicalDeviceMemoryProperties(physical_device, &renderer->memory.properties);
+
+    __fake_unity_vulkan_get_timestamp_properties(renderer, graphics_queue_index);
+
+    float queue_priority = 1.0f;
+
+    uint32_t queue_create_info_count = 0;
+    VkDeviceQueueCreateInfo queue_create_infos[3];
+
+    uint32_t queue_family_indices[3] = { graphics_queue_index, compute_queue_index, transfer_queue_index };
+
+    for (uint32_t i = 0; i < 3; i += 1)
+    {
+        if (queue_family_indices[i] == VK_QUEUE_FAMILY_IGNORED)
+        {
+            continue;
+        }
+
+        VkDeviceQueueCreateInfo *queue_create_info = queue_create_infos + queue_create_info_count;
+        queue_create_info->sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_create_info->pNext            = 0;
+        queue_create_info->flags            = 0;
+        queue_create_info->queueFamilyIndex = queue_family_indices[i];
+        queue_create_info->queueCount       = 1;
+        queue_create_info->pQueuePriorities = &queue_priority;
+
+        queue_create_info_count += 1;
+    }
+
+    VkDeviceCreateInfo device_create_info;
+    device_create_info.sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_create_info.pNext                   = 0;
+    device_create_info.flags                   = 0;
+    device_create_info.queueCreateInfoCount    = queue_create_info_count;
+    device_create_info.pQueueCreateInfos       = queue_create_infos;
+    device_create_info.enabledLayerCount       = 0;
+    device_create_info.ppEnabledLayerNames     = 0;
+    device_create_info.enabledExtensionCount   = 0;
+    device_create_info.ppEnabledExtensionNames = 0;
+    device_create_info.pEnabledFeatures        = 0;
+
+    VkDevice device;
+
+    if (renderer->vkCreateDevice(physical_device, &device_create_info, 0, &device) != VK_SUCCESS)
+    {
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+    renderer->device = device;
+
+#define load_function(name)                                                                       \
+    do                                                                                            \
+    {                                                                                             \
+        if (renderer->vkGetInstanceProcAddr != renderer->loader_vkGetInstanceProcAddr)            \
+        {                                                                                         \
+            renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(instance, #name);       \
+        }                                                                                         \
+        else                                                                                      \
+        {                                                                                         \
+            renderer->name = (PFN_##name) renderer->vkGetDeviceProcAddr(device, #name);           \
+        }                                                                                         \
+        if (!renderer->name)                                                                      \
+        {                                                                                         \
+            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
+            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
+            return false;                                                                         \
+        }                                                                                         \
+    } while (0)
+
+    __FAKE_UNITY_VULKAN_DEVICE_FUNCTIONS(load_function);
+
+#undef load_function
+
+    // Unlike the functions above these are optional.
+#define load_function(name)                                                                                      \
+    do                                                                                                           \
+    {                                                                                                            \
+        if (renderer->vkGetInstanceProcAddr != renderer->loader_vkGetInstanceProcAddr)                           \
+        {                                                                                                        \
+            renderer->device_table.name = (PFN_##name) renderer->vkGetInstanceProcAddr(instance, #name);        \
+        }                                                                                                        \
+        else                                                                                                     \
+        {                                                                                                        \
+            renderer->device_table.name = (PFN_##name) renderer->vkGetDeviceProcAddr(device, #name);            \
+        }                                                                                                        \
+    } while (0)
+
+    __FAKE_UNITY_VULKAN_DEVICE_TABLE_FUNCTIONS(load_function)
+
+#undef load_function
+
+    __fake_unity_vulkan_apply_intercepts(state);
+
+    VkQueue graphics_queue;
+
+    renderer->vkGetDeviceQueue(device, graphics_queue_index, 0, &graphics_queue);
+
+    renderer->graphics_queue_index = graphics_queue_index;
+    renderer->graphics_queue = graphics_queue;
+
+    renderer->compute_queue_index = graphics_queue_index;
+    renderer->compute_queue = graphics_queue;
+
+    if (compute_queue_index != VK_QUEUE_FAMILY_IGNORED)
+    {
+        renderer->vkGetDeviceQueue(device, compute_queue_index, 0, &renderer->compute_queue);
+        renderer->compute_queue_index = compute_queue_index;
+    }
+
+    renderer->transfer_queue_index = graphics_queue_index;
+    renderer->transfer_queue = graphics_queue;
+
+    if (transfer_queue_index != VK_QUEUE_FAMILY_IGNORED)
+    {
+        renderer->vkGetDeviceQueue(device, transfer_queue_index, 0, &renderer->transfer_queue);
+        renderer->transfer_queue_index = transfer_queue_index;
+    }
+
+    if (!__fake_unity_vulkan_create_frames(renderer) ||
+        !__fake_unity_vulkan_create_pipeline_cache(renderer, state->vulkan_pipeline_cache_path))
+    {
+        CLOSE_VULKAN_LOADER(renderer->loader_handle);
+        return false;
+    }
+
+#undef CLOSE_VULKAN_LOADER
+
+    state->renderer_type = kUnityGfxRendererVulkan;
+    state->has_renderer = true;
+
+    __fake_unity_send_device_event(state, kUnityGfxDeviceEventInitialize);
+
+    return true;
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_create_null_renderer(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->has_renderer)
+    {
+        return false;
+    }
+
+    state->renderer_type = kUnityGfxRendererNull;
+    state->has_renderer = true;
+
+    __fake_unity_send_device_event(state, kUnityGfxDeviceEventInitialize);
+
+    return true;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_destroy_renderer(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    __fake_unity_render_thread_sync(state);
+    __fake_unity_destroy_renderer(state);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_reset_renderer(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (!state->has_renderer)
+    {
+        return;
+    }
+
+    __fake_unity_render_thread_sync(state);
+
+    __fake_unity_send_device_event(state, kUnityGfxDeviceEventBeforeReset);
+
+    if (state->renderer_type == kUnityGfxRendererVulkan)
+    {
+        __fake_unity_vulkan_wait_idle(state);
+    }
+
+    __fake_unity_send_device_event(state, kUnityGfxDeviceEventAfterReset);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_vulkan_set_pipeline_cache_path(const char *path)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    free(state->vulkan_pipeline_cache_path);
+    state->vulkan_pipeline_cache_path = path ? __fake_unity_copy_string(path) : 0;
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_vulkan_save_pipeline_cache(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return false;
+    }
+
+    return __fake_unity_vulkan_save_pipeline_cache(state);
+}
+
+FAKE_UNITY_DEF VkQueue
+fake_unity_vulkan_get_queue(FakeUnityVulkanQueueType type, uint32_t *queue_family_index)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return VK_NULL_HANDLE;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    VkQueue queue = renderer->graphics_queue;
+    uint32_t index = renderer->graphics_queue_index;
+
+    if (type == FakeUnityVulkanQueueType_Compute)
+    {
+        queue = renderer->compute_queue;
+        index = renderer->compute_queue_index;
+    }
+    else if (type == FakeUnityVulkanQueueType_Transfer)
+    {
+        queue = renderer->transfer_queue;
+        index = renderer->transfer_queue_index;
+    }
+
+    if (queue_family_index)
+    {
+        *queue_family_index = index;
+    }
+
+    return queue;
+}
+
+FAKE_UNITY_DEF PFN_vkVoidFunction
+fake_unity_vulkan_get_instance_proc_address(const char *proc_name)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    FakeUnityVulkanIntercept *intercept = __fake_unity_vulkan_find_intercept(state, proc_name);
+
+    if (intercept && (state->renderer_type == kUnityGfxRendererVulkan))
+    {
+        return __fake_unity_vulkan_get_intercept_head(intercept);
+    }
+
+    if ((state->renderer_type == kUnityGfxRendererVulkan) &&
+        (state->renderer.vulkan.vkGetInstanceProcAddr))
+    {
+        return state->renderer.vulkan.vkGetInstanceProcAddr(state->renderer.vulkan.instance, proc_name);
+    }
+
+    return NULL;
+}
+
+FAKE_UNITY_DEF PFN_vkVoidFunction
+fake_unity_vulkan_get_device_proc_address(const char *proc_name)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    FakeUnityVulkanIntercept *intercept = __fake_unity_vulkan_find_intercept(state, proc_name);
+
+    if (intercept && (state->renderer_type == kUnityGfxRendererVulkan))
+    {
+        return __fake_unity_vulkan_get_intercept_head(intercept);
+    }
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return NULL;
+    }
+
+    // Functions in the device table were resolved when the renderer was
+    // created, only others are looked up through the driver.
+    PFN_vkVoidFunction *device_table_function = __fake_unity_vulkan_find_device_table_function(&state->renderer.vulkan.device_table, proc_name);
+
+    if (device_table_function && *device_table_function)
+    {
+        return *device_table_function;
+    }
+
+    if (state->renderer.vulkan.vkGetDeviceProcAddr)
+    {
+        return state->renderer.vulkan.vkGetDeviceProcAddr(state->renderer.vulkan.device, proc_name);
+    }
+
+    return NULL;
+}
+
+FAKE_UNITY_DEF FakeUnity_GraphicsBuffer
+fake_unity_vulkan_register_buffer(VkBuffer buffer, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if ((state->renderer_type != kUnityGfxRendererVulkan) || !buffer)
+    {
+        return 0;
+    }
+
+    uint32_t index;
+    FakeUnity_GraphicsBuffer handle = __fake_unity_handle_pool_allocate(&state->buffer_pool, &index);
+
+    if (!handle)
+    {
+        fprintf(stderr, "[fake_unity] error: too many buffers.\n");
+        return 0;
+    }
+
+    FakeUnityBuffer *item = (FakeUnityBuffer *) __fake_unity_handle_pool_get_item(&state->buffer_pool, index);
+    item->handle        = handle;
+    item->buffer        = buffer;
+    item->size          = size;
+    item->usage         = usage;
+    item->stage_flags   = 0;
+    item->access_flags  = 0;
+    item->barrier_batch = 0;
+    item->barrier_index = 0;
+
+    return handle;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_vulkan_unregister_buffer(FakeUnity_GraphicsBuffer buffer)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    int32_t index = __fake_unity_handle_pool_retire(&state->buffer_pool, buffer);
+
+    if (index >= 0)
+    {
+        __fake_unity_handle_pool_push(&state->buffer_pool, (uint32_t) index);
+    }
+}
+
+FAKE_UNITY_DEF void *
+fake_unity_GraphicsBuffer_GetNativeBufferPtr(FakeUnity_GraphicsBuffer buffer)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->buffer_pool, buffer);
+
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    return &((FakeUnityBuffer *) __fake_unity_handle_pool_get_item(&state->buffer_pool, (uint32_t) index))->buffer;
+}
+
+FAKE_UNITY_DEF const FakeUnityVulkanDeviceTable *
+fake_unity_vulkan_get_device_table(void)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return NULL;
+    }
+
+    return &state->renderer.vulkan.device_table;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_vulkan_trace_set_enabled(bool enabled)
+{
+    __fake_unity_atomic_store_u32(&__fake_unity_get_state()->vulkan_trace.enabled, enabled ? 1 : 0);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_vulkan_trace_get_stats(uint32_t plugin_handle, const char *function_name, FakeUnityVulkanCallStats *stats)
+{
+    static const char *function_names[] = {
+#define trace_function_name(name) #name,
+        __FAKE_UNITY_VULKAN_TRACE_FUNCTIONS(trace_function_name)
+#undef trace_function_name
+    };
+
+    int32_t function = 0;
+
+    while ((function < FakeUnityVulkanTraceFunction_Count) && (strcmp(function_names[function], function_name) != 0))
+    {
+        function += 1;
+    }
+
+    if (function == FakeUnityVulkanTraceFunction_Count)
+    {
+        return false;
+    }
+
+    stats->count = 0;
+    stats->total_time = 0;
+
+    FakeUnityVulkanTraceThread *thread = (FakeUnityVulkanTraceThread *) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_get_state()->vulkan_trace.threads);
+
+    while (thread)
+    {
+        uint32_t plugin_count = __fake_unity_atomic_load_u32(&thread->plugin_count);
+
+        for (uint32_t i = 0; i < plugin_count; i += 1)
+        {
+            FakeUnityVulkanTracePlugin *plugin = thread->plugins + i;
+
+            if (plugin->plugin_handle == plugin_handle)
+            {
+                stats->count += __fake_unity_atomic_load_u64(&plugin->counts[function]);
+                stats->total_time += __fake_unity_atomic_load_u64(&plugin->times[function]);
+            }
+        }
+
+        thread = thread->next;
+    }
+
+    return true;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_vulkan_trace_reset(void)
+{
+    FakeUnityVulkanTraceThread *thread = (FakeUnityVulkanTraceThread *) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_get_state()->vulkan_trace.threads);
+
+    while (thread)
+    {
+        uint32_t plugin_count = __fake_unity_atomic_load_u32(&thread->plugin_count);
+
+        for (uint32_t i = 0; i < plugin_count; i += 1)
+        {
+            for (int32_t j = 0; j < FakeUnityVulkanTraceFunction_Count; j += 1)
+            {
+                __fake_unity_atomic_store_u64(&thread->plugins[i].counts[j], 0);
+                __fake_unity_atomic_store_u64(&thread->plugins[i].times[j], 0);
+            }
+        }
+
+        thread = thread->next;
+    }
+}
+
+// Returns the number of mip levels of a full mip chain.
+static inline uint32_t
+__fake_unity_get_mip_count(int32_t width, int32_t height, int32_t depth)
+{
+    uint32_t size = (uint32_t) width;
+
+    if ((uint32_t) height > size) size = (uint32_t) height;
+    if ((uint32_t) depth > size) size = (uint32_t) depth;
+
+    uint32_t mip_count = 1;
+
+    while (size > 1)
+    {
+        size >>= 1;
+        mip_count += 1;
+    }
+
+    return mip_count;
+}
+
+// Creates a view of every mip level and layer of count external images.
+// depth is the depth of 3D textures and the layer count of arrays. Either
+// all or none of the textures are created.
+static bool
+__fake_unity_create_external_textures(FakeUnityState *state, VkImageViewType view_type, int32_t width, int32_t height, int32_t depth,
+                                      FakeUnity_TextureFormat format, bool mip_chain, bool linear,
+                                      int32_t count, void *const *native_textures, FakeUnity_Texture2D *handles)
+{
+    if (!state->has_renderer)
+    {
+        return false;
+    }
+
+    if ((width <= 0) || (height <= 0) || (depth <= 0) || (count < 0))
+    {
+        return false;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    const FakeUnityTextureFormatInfo *format_info = __fake_unity_get_texture_format_info(format);
+    VkFormat vk_format = __fake_unity_get_vk_format(format, linear);
+
+    if (!format_info || ((state->renderer_type == kUnityGfxRendererVulkan) && (vk_format == VK_FORMAT_UNDEFINED)))
+    {
+        return false;
+    }
+
+    uint32_t layer_count = 1;
+
+    if (view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY)
+    {
+        layer_count = (uint32_t) depth;
+    }
+    else if (view_type == VK_IMAGE_VIEW_TYPE_CUBE)
+    {
+        layer_count = 6;
+    }
+
+    if (view_type != VK_IMAGE_VIEW_TYPE_3D)
+    {
+        depth = 1;
+    }
+
+    uint32_t mip_count = mip_chain ? __fake_unity_get_mip_count(width, height, depth) : 1;
+
+    VkImageViewCreateInfo image_view_create_info;
+    image_view_create_info.sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_create_info.pNext            = NULL;
+    image_view_create_info.flags            = 0;
+    image_view_create_info.image            = VK_NULL_HANDLE;
+    image_view_create_info.viewType         = view_type;
+    image_view_create_info.format           = vk_format;
+    image_view_create_info.components       = format_info->components;
+    image_view_create_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_count, 0, layer_count };
+
+    int32_t created_count = 0;
+
+    for (; created_count < count; created_count += 1)
+    {
+        if (!native_textures[created_count])
+        {
+            break;
+        }
+
+        uint32_t index;
+        FakeUnity_Texture2D handle = __fake_unity_handle_pool_allocate(&state->texture_pool, &index);
+
+        if (!handle)
+        {
+            break;
+        }
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView image_view = VK_NULL_HANDLE;
+        void *pixels = 0;
+
+        if (state->renderer_type == kUnityGfxRendererVulkan)
+        {
+            image = *(VkImage *) native_textures[created_count];
+            image_view_create_info.image = image;
+
+            if (renderer->vkCreateImageView(renderer->device, &image_view_create_info, NULL, &image_view) != VK_SUCCESS)
+            {
+                __fake_unity_handle_pool_push(&state->texture_pool, index);
+                break;
+            }
+        }
+        else
+        {
+            pixels = native_textures[created_count];
+        }
+
+        FakeUnityTexture *texture = __fake_unity_get_texture(state, index);
+
+        texture->handle = handle;
+        texture->width = width;
+        texture->height = height;
+        texture->depth = depth;
+        texture->layer_count = layer_count;
+        texture->mip_count = mip_count;
+        texture->view_type = view_type;
+        texture->image = image;
+        texture->format = vk_format;
+        texture->vk_image_view = image_view;
+        texture->texture_format = format;
+        texture->owns_image = false;
+        texture->pixels = pixels;
+        texture->pixels_bucket_index = 0;
+        texture->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        texture->stage_flags = 0;
+        texture->access_flags = 0;
+        texture->barrier_batch = 0;
+        texture->barrier_index = 0;
+
+        handles[created_count] = handle;
+    }
+
+    if (created_count < count)
+    {
+        // Nothing can have used these yet, so they are released right away.
+        for (int32_t i = 0; i < created_count; i += 1)
+        {
+            int32_t index = __fake_unity_handle_pool_retire(&state->texture_pool, handles[i]);
+            __fake_unity_texture_release(state, (uint32_t) index);
+
+            handles[i] = 0;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+static FakeUnity_Texture2D
+__fake_unity_create_external_texture(FakeUnityState *state, VkImageViewType view_type, int32_t width, int32_t height, int32_t depth,
+                                     FakeUnity_TextureFormat format, bool mip_chain, bool linear, void *native_texture)
+{
+    FakeUnity_Texture2D handle = 0;
+
+    if (!__fake_unity_create_external_textures(state, view_type, width, height, depth, format, mip_chain, linear,
+                                               1, &native_texture, &handle))
+    {
+        return 0;
+    }
+
+    return handle;
+}
+
+static FakeUnity_Texture2D
+__fake_unity_null_create_texture(FakeUnityState *state, int32_t width, int32_t height, FakeUnity_TextureFormat format)
+{
+    const FakeUnityTextureFormatInfo *format_info = __fake_unity_get_texture_format_info(format);
+    uint64_t size = __fake_unity_get_texture_data_size(format_info, (uint32_t) width, (uint32_t) height);
+
+    uint32_t bucket_index;
+    void *pixels = __fake_unity_null_allocate_pixels(&state->renderer.null, size, &bucket_index);
+
+    if (!pixels)
+    {
+        fprintf(stderr, "[fake_unity] error: could not allocate the pixels of a %dx%d texture.\n", width, height);
+        return 0;
+    }
+
+    FakeUnity_Texture2D handle = __fake_unity_create_external_texture(state, VK_IMAGE_VIEW_TYPE_2D, width, height, 1, format, false, false, pixels);
+
+    if (!handle)
+    {
+        __fake_unity_null_free_pixels(&state->renderer.null, pixels, bucket_index);
+        return 0;
+    }
+
+    // Nothing else knows the handle yet.
+    FakeUnityTexture *texture = __fake_unity_get_texture(state, handle & __FAKE_UNITY_HANDLE_INDEX_MASK);
+    texture->owns_image = true;
+    texture->pixels_bucket_index = bucket_index;
+
+    return handle;
+}
+
+FAKE_UNITY_DEF FakeUnity_Texture2D
+fake_unity_create_texture(int32_t width, int32_t height, FakeUnity_TextureFormat format)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (!state->has_renderer || (width <= 0) || (height <= 0) || !__fake_unity_get_texture_format_info(format))
+    {
+        return 0;
+    }
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return __fake_unity_null_create_texture(state, width, height, format);
+    }
+
+    VkFormat vk_format = __fake_unity_get_vk_format(format, false);
+
+    if (vk_format == VK_FORMAT_UNDEFINED)
+    {
+        return 0;
+    }
+
+    FakeUnityVulkanRenderer *renderer = &state->renderer.vulkan;
+
+    VkImageCreateInfo image_create_info;
+    image_create_info.sType                 = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.pNext                 = 0;
+    image_create_info.flags                 = 0;
+    image_create_info.imageType             = VK_IMAGE_TYPE_2D;
+    image_create_info.format                = vk_format;
+    image_create_info.extent                = { (uint32_t) width, (uint32_t) height, 1 };
+    image_create_info.mipLevels             = 1;
+    image_create_info.arrayLayers           = 1;
+    image_create_info.samples               = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling                = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage                 = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_create_info.sharingMode           = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.queueFamilyIndexCount = 0;
+    image_create_info.pQueueFamilyIndices   = 0;
+    image_create_info.initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImage image;
+
+    if (renderer->vkCreateImage(renderer->device, &image_create_info, NULL, &image) != VK_SUCCESS)
+    {
+        fprintf(stderr, "[fake_unity] error: vkCreateImage failed for a %dx%d texture.\n", width, height);
+        return 0;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    renderer->vkGetImageMemoryRequirements(renderer->device, image, &memory_requirements);
+
+    FakeUnityVulkanAllocation allocation;
+
+    if (!__fake_unity_vulkan_allocate_memory(renderer, &memory_requirements, &allocation))
+    {
+        renderer->vkDestroyImage(renderer->device, image, NULL);
+        return 0;
+    }
+
+    FakeUnity_Texture2D handle = 0;
+
+    if (renderer->vkBindImageMemory(renderer->device, image, allocation.memory, allocation.offset) == VK_SUCCESS)
+    {
+        handle = __fake_unity_create_external_texture(state, VK_IMAGE_VIEW_TYPE_2D, width, height, 1, format, false, false, &image);
+    }
+
+    if (!handle)
+    {
+        renderer->vkDestroyImage(renderer->device, image, NULL);
+        __fake_unity_vulkan_free_memory(renderer, &allocation);
+        return 0;
+    }
+
+    // Nothing else knows the handle yet.
+    FakeUnityTexture *texture = __fake_unity_get_texture(state, handle & __FAKE_UNITY_HANDLE_INDEX_MASK);
+    texture->owns_image = true;
+    texture->allocation = allocation;
+    texture->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    return handle;
+}
+
+FAKE_UNITY_DEF FakeUnity_Texture2D
+fake_unity_Texture2D_CreateExternalTexture(int32_t width, int32_t height, FakeUnity_TextureFormat format,
+                                           bool mip_chain, bool linear, void *native_texture)
+{
+    return __fake_unity_create_external_texture(__fake_unity_get_state(), VK_IMAGE_VIEW_TYPE_2D, width, height, 1,
+                                                format, mip_chain, linear, native_texture);
+}
+
+FAKE_UNITY_DEF FakeUnity_Texture2DArray
+fake_unity_Texture2DArray_CreateExternalTexture(int32_t width, int32_t height, int32_t depth, FakeUnity_TextureFormat format,
+                                                bool mip_chain, bool linear, void *native_texture)
+{
+    return __fake_unity_create_external_texture(__fake_unity_get_state(), VK_IMAGE_VIEW_TYPE_2D_ARRAY, width, height, depth,
+                                                format, mip_chain, linear, native_texture);
+}
+
+FAKE_UNITY_DEF FakeUnity_Texture3D
+fake_unity_Texture3D_CreateExternalTexture(int32_t width, int32_t height, int32_t depth, FakeUnity_TextureFormat format,
+                                           bool mip_chain, void *native_texture)
+{
+    return __fake_unity_create_external_texture(__fake_unity_get_state(), VK_IMAGE_VIEW_TYPE_3D, width, height, depth,
+                                                format, mip_chain, true, native_texture);
+}
+
+FAKE_UNITY_DEF FakeUnity_Cubemap
+fake_unity_Cubemap_CreateExternalTexture(int32_t width, FakeUnity_TextureFormat format, bool mip_chain, void *native_texture)
+{
+    return __fake_unity_create_external_texture(__fake_unity_get_state(), VK_IMAGE_VIEW_TYPE_CUBE, width, width, 1,
+                                                format, mip_chain, false, native_texture);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_Texture2D_CreateExternalTextures(int32_t count, int32_t width, int32_t height, FakeUnity_TextureFormat format,
+                                            bool mip_chain, bool linear, void *const *native_textures, FakeUnity_Texture2D *textures)
+{
+    return __fake_unity_create_external_textures(__fake_unity_get_state(), VK_IMAGE_VIEW_TYPE_2D, width, height, 1,
+                                                 format, mip_chain, linear, count, native_textures, textures);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_Texture2D_Destroy(FakeUnity_Texture2D texture_handle)
+{
+    fake_unity_Texture2D_DestroyTextures(1, &texture_handle);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_Texture2D_DestroyTextures(int32_t count, const FakeUnity_Texture2D *textures)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    FakeUnityState *state = __fake_unity_get_state();
+
+    uint32_t *texture_indices = (uint32_t *) malloc(count * sizeof(uint32_t));
+
+    if (!texture_indices)
+    {
+        fprintf(stderr, "[fake_unity] error: could not destroy %d textures, out of memory.\n", count);
+        return;
+    }
+
+    // The handles are retired right away, so they are stale for the calling
+    // thread and for the commands that are issued afterwards.
+    int32_t retired_count = 0;
+
+    for (int32_t i = 0; i < count; i += 1)
+    {
+        int32_t index = __fake_unity_handle_pool_retire(&state->texture_pool, textures[i]);
+
+        if (index >= 0)
+        {
+            texture_indices[retired_count] = (uint32_t) index;
+            retired_count += 1;
+        }
+    }
+
+    if (retired_count == 0)
+    {
+        free(texture_indices);
+        return;
+    }
+
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type            = FakeUnityRenderCommandType_DestroyTextures;
+    command.texture_count   = retired_count;
+    command.texture_indices = texture_indices;
+
+    __fake_unity_render_thread_issue(state, &command, false);
+}
+
+FAKE_UNITY_DEF void *
+fake_unity_Texture2D_GetNativeTexturePtr(FakeUnity_Texture2D texture_handle)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->texture_pool, texture_handle);
+
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    FakeUnityTexture *texture = __fake_unity_get_texture(state, (uint32_t) index);
+
+    if (state->renderer_type != kUnityGfxRendererVulkan)
+    {
+        return texture->pixels;
+    }
+
+    return &texture->image;
+}
+
+// Checks the arguments of a transfer on the calling thread and issues it.
+// Returns the request of the transfer or zero.
+static FakeUnity_AsyncGPURequest
+__fake_unity_issue_texture_transfer(FakeUnityState *state, FakeUnityRenderCommandType type, FakeUnity_Texture2D texture_handle,
+                                    uint32_t mip_level, void *data, size_t size, bool wait)
+{
+    int32_t index = __fake_unity_handle_pool_get_index(&state->texture_pool, texture_handle);
+
+    if ((index < 0) || !data)
+    {
+        return 0;
+    }
+
+    uint64_t mip_data_size = __fake_unity_get_texture_mip_data_size(__fake_unity_get_texture(state, (uint32_t) index), mip_level);
+
+    if (mip_data_size == 0)
+    {
+        fprintf(stderr, "[fake_unity] error: the texture has no mip level %u.\n", mip_level);
+        return 0;
+    }
+
+    if (mip_data_size != size)
+    {
+        fprintf(stderr, "[fake_unity] error: mip level %u needs %llu bytes of pixel data, got %llu.\n",
+                mip_level, (unsigned long long) mip_data_size, (unsigned long long) size);
+        return 0;
+    }
+
+    FakeUnity_AsyncGPURequest request = __fake_unity_gpu_request_create(state);
+
+    if (!request)
+    {
+        return 0;
+    }
+
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type           = type;
+    command.data           = data;
+    command.texture_handle = texture_handle;
+    command.mip_level      = mip_level;
+    command.size           = size;
+    command.request        = request;
+
+    __fake_unity_render_thread_issue(state, &command, wait);
+
+    return request;
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_Texture2D_SetPixelData(FakeUnity_Texture2D texture, uint32_t mip_level, const void *data, size_t size)
+{
+    // The data is copied to staging memory when the command is executed, so
+    // the upload is done once the render thread got to it.
+    FakeUnity_AsyncGPURequest request = __fake_unity_issue_texture_transfer(__fake_unity_get_state(), FakeUnityRenderCommandType_UploadTexture,
+                                                                            texture, mip_level, (void *) data, size, true);
+
+    if (!request)
+    {
+        return false;
+    }
+
+    bool result = !fake_unity_AsyncGPURequest_HasError(request);
+    fake_unity_AsyncGPURequest_Release(request);
+
+    return result;
+}
+
+FAKE_UNITY_DEF FakeUnity_AsyncGPURequest
+fake_unity_Texture2D_SetPixelDataAsync(FakeUnity_Texture2D texture, uint32_t mip_level, const void *data, size_t size)
+{
+    return __fake_unity_issue_texture_transfer(__fake_unity_get_state(), FakeUnityRenderCommandType_UploadTexture,
+                                               texture, mip_level, (void *) data, size, false);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_Texture2D_GetPixelData(FakeUnity_Texture2D texture, uint32_t mip_level, void *data, size_t size)
+{
+    FakeUnity_AsyncGPURequest request = fake_unity_AsyncGPUReadback_Request(texture, mip_level, data, size);
+
+    if (!request)
+    {
+        return false;
+    }
+
+    fake_unity_AsyncGPURequest_WaitForCompletion(request);
+
+    bool result = !fake_unity_AsyncGPURequest_HasError(request);
+    fake_unity_AsyncGPURequest_Release(request);
+
+    return result;
+}
+
+FAKE_UNITY_DEF FakeUnity_AsyncGPURequest
+fake_unity_AsyncGPUReadback_Request(FakeUnity_Texture2D texture, uint32_t mip_level, void *data, size_t size)
+{
+    return __fake_unity_issue_texture_transfer(__fake_unity_get_state(), FakeUnityRenderCommandType_ReadbackTexture,
+                                               texture, mip_level, data, size, false);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_AsyncGPURequest_IsDone(FakeUnity_AsyncGPURequest request)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->request_pool, request);
+
+    if (index < 0)
+    {
+        return true;
+    }
+
+    FakeUnityGPURequest *item = (FakeUnityGPURequest *) __fake_unity_handle_pool_get_item(&state->request_pool, (uint32_t) index);
+
+    return (__fake_unity_atomic_load_u32(&item->flags) & FAKE_UNITY_GPU_REQUEST_DONE) != 0;
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_AsyncGPURequest_HasError(FakeUnity_AsyncGPURequest request)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    int32_t index = __fake_unity_handle_pool_get_index(&state->request_pool, request);
+
+    if (index < 0)
     {
         return false;
     }
 
-#if FAKE_UNITY_PLATFORM_WINDOWS
-    renderer->loader_handle = LoadLibraryA("vulkan-1.dll");
+    FakeUnityGPURequest *item = (FakeUnityGPURequest *) __fake_unity_handle_pool_get_item(&state->request_pool, (uint32_t) index);
+    uint32_t flags = __fake_unity_atomic_load_u32(&item->flags);
+
+    return (flags & FAKE_UNITY_GPU_REQUEST_DONE) && (flags & FAKE_UNITY_GPU_REQUEST_ERROR);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_AsyncGPURequest_WaitForCompletion(FakeUnity_AsyncGPURequest request)
+{
+    if (fake_unity_AsyncGPURequest_IsDone(request))
+    {
+        return;
+    }
+
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = FakeUnityRenderCommandType_CompleteTransfers;
+
+    __fake_unity_render_thread_issue(__fake_unity_get_state(), &command, true);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_AsyncGPURequest_Release(FakeUnity_AsyncGPURequest request)
+{
+    FakeUnityState *state = __fake_unity_get_state();
+
+    if (__fake_unity_handle_pool_retire(&state->request_pool, request) < 0)
+    {
+        return;
+    }
+
+    __fake_unity_gpu_request_set_flags(state, request, FAKE_UNITY_GPU_REQUEST_RELEASED);
+}
+
+FAKE_UNITY_DEF bool
+fake_unity_render_thread_start(void)
+{
+    return __fake_unity_render_thread_start(__fake_unity_get_state());
+}
+
+FAKE_UNITY_DEF void
+fake_unity_render_thread_stop(void)
+{
+    __fake_unity_render_thread_stop(__fake_unity_get_state());
+}
+
+FAKE_UNITY_DEF void
+fake_unity_render_thread_sync(void)
+{
+    __fake_unity_render_thread_sync(__fake_unity_get_state());
+}
+
+FAKE_UNITY_DEF void
+fake_unity_begin_frame(void)
+{
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = FakeUnityRenderCommandType_BeginFrame;
+
+    __fake_unity_render_thread_issue(__fake_unity_get_state(), &command, false);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_end_frame(void)
+{
+    FakeUnityRenderCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = FakeUnityRenderCommandType_EndFrame;
+
+    FakeUnityState *state = __fake_unity_get_state();
+
+    __fake_unity_render_thread_issue(state, &command, false);
+
+    if (state->profiler.trace)
+    {
+        __fake_unity_trace_drain(state->profiler.trace);
+    }
+}
+
+FAKE_UNITY_DEF uint32_t
+fake_unity_plugin_event_get_owner(int event_id)
+{
+    FakeUnityPluginEvent *event = __fake_unity_get_plugin_event(&__fake_unity_get_state()->plugin_events, event_id, false);
+    return event ? __fake_unity_atomic_load_u32(&event->plugin_handle) : 0;
+}
+
+FAKE_UNITY_DEF void
+fake_unity_issue_plugin_event(UnityRenderingEvent func, int event_id)
+{
+    FakeUnityRenderCommand command;
+    command.type           = FakeUnityRenderCommandType_PluginEvent;
+    command.event_id       = event_id;
+    command.event          = func;
+    command.event_and_data = 0;
+    command.data           = 0;
+    command.flush          = false;
+
+    __fake_unity_render_thread_issue(__fake_unity_get_state(), &command, false);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_issue_plugin_event_and_data(UnityRenderingEventAndData func, int event_id, void *data)
+{
+    FakeUnityRenderCommand command;
+    command.type           = FakeUnityRenderCommandType_PluginEventAndData;
+    command.event_id       = event_id;
+    command.event          = 0;
+    command.event_and_data = func;
+    command.data           = data;
+    command.flush          = false;
+
+    __fake_unity_render_thread_issue(__fake_unity_get_state(), &command, false);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_profiler_set_enabled(bool enabled)
+{
+    __fake_unity_atomic_store_u32(&__fake_unity_get_state()->profiler.enabled, enabled ? 1 : 0);
+}
+
+FAKE_UNITY_DEF void
+fake_unity_profiler_set_mode(uint32_t mode)
+{
+    __fake_unity_atomic_store_u32(&__fake_unity_get_state()->profiler.mode, mode);
+}
+
+static FakeUnityProfilerMarker *
+__fake_unity_profiler_find_marker(FakeUnityState *state, const char *name)
+{
+    FakeUnityProfilerMarker *marker = (FakeUnityProfilerMarker *) __fake_unity_atomic_load_ptr((void *volatile *) &state->profiler.markers);
 
-    if (!renderer->loader_handle)
+    while (marker && strcmp(marker->name, name))
     {
-        fprintf(stderr, "[fake_unity] error: could not load vulkan loader\n");
-        return false;
+        marker = marker->next;
     }
 
-    renderer->loader_vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) GetProcAddress(renderer->loader_handle, "vkGetInstanceProcAddr");
-
-#  define CLOSE_VULKAN_LOADER(handle) \
-    FreeLibrary(handle); \
-    handle = 0
-#elif FAKE_UNITY_PLATFORM_ANDROID || FAKE_UNITY_PLATFORM_LINUX || FAKE_UNITY_PLATFORM_MACOS
-    renderer->loader_handle = dlopen("libvulkan.so.1", RTLD_NOW);
+    return marker;
+}
 
-    if (!renderer->loader_handle)
+static uint64_t
+__fake_unity_profiler_get_percentile(FakeUnityProfilerMarker *marker, uint64_t sample_count, double percentile)
+{
+    if (sample_count == 0)
     {
-        fprintf(stderr, "[fake_unity] error: could not load vulkan loader -> %s\n", dlerror());
-        return false;
+        return 0;
     }
 
-    renderer->loader_vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) dlsym(renderer->loader_handle, "vkGetInstanceProcAddr");
-
-#  define CLOSE_VULKAN_LOADER(handle) \
-    dlclose(handle); \
-    handle = 0
-#endif
+    uint64_t rank = (uint64_t) (percentile * (double) sample_count + 0.5);
 
-    if (!renderer->loader_vkGetInstanceProcAddr)
+    if (rank < 1)
     {
-        fprintf(stderr, "[fake_unity] error: could not load vulkan function 'vkGetInstanceProcAddr'.\n");
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
-        return false;
+        rank = 1;
     }
 
-    renderer->vkGetInstanceProcAddr = renderer->loader_vkGetInstanceProcAddr;
-
-    PFN_vkGetInstanceProcAddr plugin_vkGetInstanceProcAddr = 0;
+    uint64_t max_time = __fake_unity_atomic_load_u64(&marker->max_time);
+    uint64_t count = 0;
 
-    if (__fake_unity_state.unity_vulkan_init_callback)
+    for (uint32_t i = 0; i < FAKE_UNITY_PROFILER_HISTOGRAM_BUCKET_COUNT; i += 1)
     {
-        plugin_vkGetInstanceProcAddr = __fake_unity_state.unity_vulkan_init_callback(renderer->loader_vkGetInstanceProcAddr,
-                                                                                     __fake_unity_state.unity_vulkan_init_userdata);
+        count += __fake_unity_atomic_load_u64(marker->histogram + i);
 
-        if (plugin_vkGetInstanceProcAddr)
+        if (count >= rank)
         {
-            renderer->vkGetInstanceProcAddr = plugin_vkGetInstanceProcAddr;
+            uint64_t limit = __fake_unity_profiler_get_histogram_bucket_limit(i);
+            return (limit < max_time) ? limit : max_time;
         }
     }
 
-#define load_function(name)                                                                       \
-    do                                                                                            \
-    {                                                                                             \
-        renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(VK_NULL_HANDLE, #name);     \
-        if (!renderer->name)                                                                      \
-        {                                                                                         \
-            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
-            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
-            return false;                                                                         \
-        }                                                                                         \
-    } while (0)
-
-    __FAKE_UNITY_VULKAN_GLOBAL_FUNCTIONS(load_function);
-
-#undef load_function
-
-    uint32_t vulkan_instance_version = VK_API_VERSION_1_0;
-    renderer->vkEnumerateInstanceVersion(&vulkan_instance_version);
-
-    fprintf(stderr, "[fake_unity] loaded vulkan library with instance version %u.%u.%u\n",
-                    VK_API_VERSION_MAJOR(vulkan_instance_version),
-                    VK_API_VERSION_MINOR(vulkan_instance_version),
-                    VK_API_VERSION_PATCH(vulkan_instance_version));
-
-    VkApplicationInfo application_info;
-    application_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    application_info.pNext              = 0;
-    application_info.pApplicationName   = "application";
-    application_info.applicationVersion = 1;
-    application_info.pEngineName        = "Unity";
-    application_info.engineVersion      = 1;
-    application_info.apiVersion         = VK_API_VERSION_1_0;
-
-    VkInstanceCreateInfo instance_create_info;
-    instance_create_info.sType                   = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instance_create_info.pNext                   = 0;
-    instance_create_info.flags                   = 0;
-    instance_create_info.pApplicationInfo        = &application_info;
-    instance_create_info.enabledLayerCount       = 0;
-    instance_create_info.ppEnabledLayerNames     = 0;
-    instance_create_info.enabledExtensionCount   = 0;
-    instance_create_info.ppEnabledExtensionNames = 0;
+    return max_time;
+}
 
-    VkInstance instance;
+FAKE_UNITY_DEF bool
+fake_unity_profiler_get_marker_stats(const char *name, FakeUnityProfilerMarkerStats *stats)
+{
+    FakeUnityProfilerMarker *marker = __fake_unity_profiler_find_marker(__fake_unity_get_state(), name);
 
-    if (renderer->vkCreateInstance(&instance_create_info, 0, &instance) != VK_SUCCESS)
+    if (!marker)
     {
-        fprintf(stderr, "[fake_unity] error: vkCreateInstance failed.\n");
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
         return false;
     }
 
-    renderer->instance = instance;
-
-#define load_function(name)                                                                       \
-    do                                                                                            \
-    {                                                                                             \
-        renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(instance, #name);           \
-        if (!renderer->name)                                                                      \
-        {                                                                                         \
-            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
-            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
-            return false;                                                                         \
-        }                                                                                         \
-    } while (0)
-
-    __FAKE_UNITY_VULKAN_INSTANCE_FUNCTIONS(load_function);
+    stats->count      = __fake_unity_atomic_load_u64(&marker->sample_count);
+    stats->total_time = __fake_unity_atomic_load_u64(&marker->total_time);
+    stats->min_time   = stats->count ? __fake_unity_atomic_load_u64(&marker->min_time) : 0;
+    stats->max_time   = __fake_unity_atomic_load_u64(&marker->max_time);
+    stats->p50_time   = __fake_unity_profiler_get_percentile(marker, stats->count, 0.5);
+    stats->p90_time   = __fake_unity_profiler_get_percentile(marker, stats->count, 0.9);
+    stats->p99_time   = __fake_unity_profiler_get_percentile(marker, stats->count, 0.99);
+    stats->p999_time  = __fake_unity_profiler_get_percentile(marker, stats->count, 0.999);
 
-#undef load_function
+    return true;
+}
 
-    uint32_t physical_device_count = 0;
+FAKE_UNITY_DEF uint64_t
+fake_unity_profiler_get_marker_percentile(const char *name, double percentile)
+{
+    FakeUnityProfilerMarker *marker = __fake_unity_profiler_find_marker(__fake_unity_get_state(), name);
 
-    if (renderer->vkEnumeratePhysicalDevices(instance, &physical_device_count, 0) != VK_SUCCESS)
+    if (!marker)
     {
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
-        return false;
+        return 0;
     }
 
-    VkPhysicalDevice *physical_devices = (VkPhysicalDevice *) malloc(sizeof(*physical_devices) * physical_device_count);
+    return __fake_unity_profiler_get_percentile(marker, __fake_unity_atomic_load_u64(&marker->sample_count), percentile);
+}
 
-    if (renderer->vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices) != VK_SUCCESS)
+FAKE_UNITY_DEF void
+fake_unity_profiler_reset_marker_stats(void)
+{
+    FakeUnityProfilerMarker *marker = (FakeUnityProfilerMarker *) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_get_state()->profiler.markers);
+
+    while (marker)
     {
-        free(physical_devices);
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
-        return false;
+        __fake_unity_atomic_store_u64(&marker->sample_count, 0);
+        __fake_unity_atomic_store_u64(&marker->total_time, 0);
+        __fake_unity_atomic_store_u64(&marker->min_time, UINT64_MAX);
+        __fake_unity_atomic_store_u64(&marker->max_time, 0);
+
+        for (uint32_t i = 0; i < FAKE_UNITY_PROFILER_HISTOGRAM_BUCKET_COUNT; i += 1)
+        {
+            __fake_unity_atomic_store_u64(marker->histogram + i, 0);
+        }
+
+        marker = marker->next;
     }
+}
 
-    fprintf(stderr, "[fake_unity] %u physical devices:\n", physical_device_count);
+FAKE_UNITY_DEF int64_t
+fake_unity_profiler_consume_events(FakeUnityProfilerEventCallback callback, void *userdata)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
 
-    for (uint32_t i = 0; i < physical_device_count; i += 1)
-    {
-        VkPhysicalDeviceProperties properties;
-        renderer->vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+    int64_t result = 0;
 
-        fprintf(stderr, "[fake_unity] [%u] %s (type = %s) (api version = %u.%u.%u)\n",
-                        i, properties.deviceName, __fake_unity_vk_physical_device_type_to_string(properties.deviceType),
-                        VK_API_VERSION_MAJOR(properties.apiVersion), VK_API_VERSION_MINOR(properties.apiVersion), VK_API_VERSION_PATCH(properties.apiVersion));
-    }
+    __fake_unity_spin_lock(&profiler->consumer_lock);
 
-    if ((device_index < 0) || (device_index >= (int32_t) physical_device_count))
-    {
-        // TODO: find best device
-        device_index = 0;
-    }
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &profiler->threads);
 
-    if ((device_index < 0) || (device_index >= (int32_t) physical_device_count))
+    while (thread)
     {
-        fprintf(stderr, "[fake_unity] error: device_index = %d is out of bounds [0, %u).\n", device_index, physical_device_count);
-        free(physical_devices);
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
-        return false;
-    }
+        uint32_t read_index = thread->read_index;
+        uint32_t write_index = __fake_unity_atomic_load_u32(&thread->write_index);
 
-    VkPhysicalDevice physical_device = physical_devices[device_index];
+        while (read_index != write_index)
+        {
+            if (callback)
+            {
+                callback(thread, thread->events + (read_index & (FAKE_UNITY_PROFILER_THREAD_BUFFER_SIZE - 1)), userdata);
+            }
 
-    free(physical_devices);
+            read_index += 1;
+            result += 1;
+        }
 
-    fprintf(stderr, "[fake_unity] selected device at index %d\n", device_index);
+        __fake_unity_atomic_store_u32(&thread->read_index, read_index);
 
-    renderer->physical_device = physical_device;
+        if (thread->retired && thread->events)
+        {
+            free(thread->events);
+            thread->events = NULL;
+        }
 
-    uint32_t graphics_queue_index = 0; // TODO: correct index
+        thread = thread->next;
+    }
 
-    float queue_priority = 1.0f;
+    __fake_unity_spin_unlock(&profiler->consumer_lock);
 
-    VkDeviceQueueCreateInfo queue_create_info;
-    queue_create_info.sType               = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.pNext               = 0;
-    queue_create_info.flags               = 0;
-    queue_create_info.queueFamilyIndex    = graphics_queue_index;
-    queue_create_info.queueCount          = 1;
-    queue_create_info.pQueuePriorities    = &queue_priority;
+    return result;
+}
 
-    VkDeviceCreateInfo device_create_info;
-    device_create_info.sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.pNext                   = 0;
-    device_create_info.flags                   = 0;
-    device_create_info.queueCreateInfoCount    = 1;
-    device_create_info.pQueueCreateInfos       = &queue_create_info;
-    device_create_info.enabledLayerCount       = 0;
-    device_create_info.ppEnabledLayerNames     = 0;
-    device_create_info.enabledExtensionCount   = 0;
-    device_create_info.ppEnabledExtensionNames = 0;
-    device_create_info.pEnabledFeatures        = 0;
+FAKE_UNITY_DEF int64_t
+fake_unity_profiler_get_dropped_event_count(void)
+{
+    int64_t result = 0;
 
-    VkDevice device;
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &__fake_unity_get_state()->profiler.threads);
 
-    if (renderer->vkCreateDevice(physical_device, &device_create_info, 0, &device) != VK_SUCCESS)
+    while (thread)
     {
-        CLOSE_VULKAN_LOADER(renderer->loader_handle);
-        return false;
+        result += __fake_unity_atomic_load_u32(&thread->dropped_count);
+        thread = thread->next;
     }
 
-    renderer->device = device;
+    return result;
+}
 
-#define load_function(name)                                                                       \
-    do                                                                                            \
-    {                                                                                             \
-        if (renderer->vkGetInstanceProcAddr != renderer->loader_vkGetInstanceProcAddr)            \
-        {                                                                                         \
-            renderer->name = (PFN_##name) renderer->vkGetInstanceProcAddr(instance, #name);       \
-        }                                                                                         \
-        else                                                                                      \
-        {                                                                                         \
-            renderer->name = (PFN_##name) renderer->vkGetDeviceProcAddr(device, #name);           \
-        }                                                                                         \
-        if (!renderer->name)                                                                      \
-        {                                                                                         \
-            fprintf(stderr, "[fake_unity] error: could not load vulkan function '" #name "'.\n"); \
-            CLOSE_VULKAN_LOADER(renderer->loader_handle);                                         \
-            return false;                                                                         \
-        }                                                                                         \
-    } while (0)
+FAKE_UNITY_DEF bool
+fake_unity_profiler_event_get_data(const FakeUnityProfilerEvent *event, int32_t index, UnityProfilerMarkerData *data)
+{
+    if ((index < 0) || (index >= event->data_count))
+    {
+        return false;
+    }
 
-    __FAKE_UNITY_VULKAN_DEVICE_FUNCTIONS(load_function);
+    uint32_t offset = 0;
 
-#undef load_function
+    for (int32_t i = 0; i < index; i += 1)
+    {
+        offset += ((uint32_t) event->data_sizes[i] + 7) & ~7u;
+    }
 
-    VkQueue graphics_queue;
+    data->type      = event->data_types[index];
+    data->reserved0 = 0;
+    data->reserved1 = 0;
+    data->size      = event->data_sizes[index];
+    data->ptr       = (const uint8_t *) event->payload + offset;
 
-    renderer->vkGetDeviceQueue(device, graphics_queue_index, 0, &graphics_queue);
+    return true;
+}
 
-    renderer->graphics_queue_index = graphics_queue_index;
-    renderer->graphics_queue = graphics_queue;
+FAKE_UNITY_DEF bool
+fake_unity_profiler_begin_trace(const char *path)
+{
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
 
-#undef CLOSE_VULKAN_LOADER
+    if (profiler->trace)
+    {
+        return false;
+    }
 
-    __fake_unity_state.renderer_type = kUnityGfxRendererVulkan;
+    FILE *file = fopen(path, "wb");
 
-    for (int32_t i = 0; i < __fake_unity_state.graphics_device_event_callbacks.count; i += 1)
+    if (!file)
     {
-        __fake_unity_state.graphics_device_event_callbacks.items[i](kUnityGfxDeviceEventInitialize);
+        fprintf(stderr, "[fake_unity] error: could not open trace file '%s'\n", path);
+        return false;
     }
 
+    FakeUnityProfilerTrace *trace = (FakeUnityProfilerTrace *) malloc(sizeof(FakeUnityProfilerTrace));
+
+    trace->file          = file;
+    trace->failed        = false;
+    trace->has_events    = false;
+    trace->dropped_count = fake_unity_profiler_get_dropped_event_count();
+    trace->used          = 0;
+
+    __fake_unity_trace_write_literal(trace, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    profiler->trace = trace;
+
     return true;
 }
 
-FAKE_UNITY_DEF PFN_vkVoidFunction
-fake_unity_vulkan_get_instance_proc_address(const char *proc_name)
+FAKE_UNITY_DEF bool
+fake_unity_profiler_flush_trace(void)
 {
-    if ((__fake_unity_state.renderer_type == kUnityGfxRendererVulkan) &&
-        (__fake_unity_state.renderer.vulkan.vkGetInstanceProcAddr))
+    FakeUnityProfilerTrace *trace = __fake_unity_get_state()->profiler.trace;
+
+    if (!trace)
     {
-        return __fake_unity_state.renderer.vulkan.vkGetInstanceProcAddr(__fake_unity_state.renderer.vulkan.instance, proc_name);
+        return false;
     }
 
-    return NULL;
+    __fake_unity_trace_drain(trace);
+    __fake_unity_trace_flush(trace);
+
+    return !trace->failed;
 }
 
-FAKE_UNITY_DEF PFN_vkVoidFunction
-fake_unity_vulkan_get_device_proc_address(const char *proc_name)
+FAKE_UNITY_DEF bool
+fake_unity_profiler_end_trace(void)
 {
-    if ((__fake_unity_state.renderer_type == kUnityGfxRendererVulkan) &&
-        (__fake_unity_state.renderer.vulkan.vkGetDeviceProcAddr))
+    FakeUnityProfiler *profiler = &__fake_unity_get_state()->profiler;
+    FakeUnityProfilerTrace *trace = profiler->trace;
+
+    if (!trace)
     {
-        return __fake_unity_state.renderer.vulkan.vkGetDeviceProcAddr(__fake_unity_state.renderer.vulkan.device, proc_name);
+        return false;
     }
 
-    return NULL;
-}
+    __fake_unity_trace_drain(trace);
 
-FAKE_UNITY_DEF FakeUnity_Texture2D
-fake_unity_Texture2D_CreateExternalTexture(int32_t width, int32_t height, FakeUnity_TextureFormat format,
-                                           bool mip_chain, bool linear, void *native_texture)
-{
-    FakeUnity_Texture2D result = 0;
+    FakeUnityProfilerThread *thread = (FakeUnityProfilerThread *) __fake_unity_atomic_load_ptr((void *volatile *) &profiler->threads);
 
-    if ((__fake_unity_state.free_texture_count > 0) &&
-        (__fake_unity_state.renderer_type == kUnityGfxRendererVulkan))
+    while (thread)
     {
-        FakeUnityVulkanRenderer *renderer = &__fake_unity_state.renderer.vulkan;
-
-        VkFormat vk_format = __fake_unity_get_vk_format(format, linear);
-
-        if (vk_format == VK_FORMAT_UNDEFINED)
+        if (trace->has_events)
         {
-            return 0;
+            __fake_unity_trace_write_literal(trace, ",\n");
         }
 
-        VkImageViewCreateInfo image_view_create_info;
-        image_view_create_info.sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        image_view_create_info.pNext            = NULL;
-        image_view_create_info.flags            = 0;
-        image_view_create_info.image            = *(VkImage *) native_texture;
-        image_view_create_info.viewType         = VK_IMAGE_VIEW_TYPE_2D;
-        image_view_create_info.format           = vk_format;
-        image_view_create_info.components       = { VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                    VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                    VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                    VK_COMPONENT_SWIZZLE_IDENTITY };
-        image_view_create_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        trace->has_events = true;
 
-        VkImageView image_view;
+        char name[sizeof(thread->group_name) + sizeof(thread->name) + 2];
 
-        if (renderer->vkCreateImageView(renderer->device, &image_view_create_info, NULL, &image_view) != VK_SUCCESS)
+        if (thread->group_name[0])
         {
-            return 0;
+            snprintf(name, sizeof(name), "%s/%s", thread->group_name, thread->name);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s", thread->name);
         }
 
-        uint16_t index = __fake_unity_state.free_texture_indices[--__fake_unity_state.free_texture_count];
-        uint16_t generation = __fake_unity_state.texture_generations[index];
+        __fake_unity_trace_write_format(trace, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":",
+                                        (unsigned long long) thread->id);
+        __fake_unity_trace_write_string(trace, name, sizeof(name));
+        __fake_unity_trace_write_literal(trace, "}}");
 
-        result = ((uint32_t) generation << 16) | (uint32_t) index;
+        thread = thread->next;
+    }
 
-        FakeUnityTexture *texture = __fake_unity_state.textures + index;
+    __fake_unity_trace_write_literal(trace, "\n]}\n");
+    __fake_unity_trace_flush(trace);
 
-        texture->width = width;
-        texture->height = height;
-        texture->vk_image_view = image_view;
+    bool result = !trace->failed;
+
+    if (fclose(trace->file) != 0)
+    {
+        result = false;
     }
 
+    free(trace);
+    profiler->trace = 0;
+
     return result;
 }
 
-FAKE_UNITY_DEF void
-fake_unity_Texture2D_Destroy(FakeUnity_Texture2D texture_handle)
+FAKE_UNITY_DEF bool
+fake_unity_profiler_write_trace(const char *path)
 {
-    uint16_t index = (uint16_t) (texture_handle & 0xFFFF);
-    uint16_t generation = (uint16_t) ((texture_handle >> 16) & 0xFFFF);
-
-    if (__fake_unity_state.texture_generations[index] == generation)
+    if (!fake_unity_profiler_begin_trace(path))
     {
-        FakeUnityTexture *texture = __fake_unity_state.textures + index;
-
-        if (__fake_unity_state.renderer_type == kUnityGfxRendererVulkan)
-        {
-            FakeUnityVulkanRenderer *renderer = &__fake_unity_state.renderer.vulkan;
-            renderer->vkDestroyImageView(renderer->device, texture->vk_image_view, NULL);
-        }
-
-        if (__fake_unity_state.texture_generations[index] == 0xFFFF)
-        {
-            __fake_unity_state.texture_generations[index] = 0;
-        }
-
-        __fake_unity_state.texture_generations[index] += 1;
-        __fake_unity_state.free_texture_indices[__fake_unity_state.free_texture_count++] = index;
+        return false;
     }
+
+    return fake_unity_profiler_end_trace();
 }
 
 #undef ARRAY_ENSURE_SPACE